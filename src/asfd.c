@@ -83,9 +83,9 @@ static int parse_readbuf_ncurses(struct asfd *asfd)
 
 static int parse_readbuf_line_buf(struct asfd *asfd)
 {
-	static char *cp=NULL;
-	static char *dp=NULL;
-	static size_t len=0;
+	static THREAD_LOCAL char *cp=NULL;
+	static THREAD_LOCAL char *dp=NULL;
+	static THREAD_LOCAL size_t len=0;
 	if(!cp)
 	{
 		// Only start from the beginning if we previously got something
@@ -832,7 +832,7 @@ int asfd_write_wrapper(struct asfd *asfd, struct iobuf *wbuf)
 
 int asfd_write_wrapper_str(struct asfd *asfd, enum cmd wcmd, const char *wsrc)
 {
-	static struct iobuf wbuf;
+	static THREAD_LOCAL struct iobuf wbuf;
 	iobuf_from_str(&wbuf, wcmd, (char *)wsrc);
 	return asfd_write_wrapper(asfd, &wbuf);
 }
@@ -81,6 +81,11 @@ struct asfd
 	int blkcnt;
 	uint64_t wrap_up;
 	uint8_t want_to_remove;
+	uint8_t sig_batch;
+	// For a champ chooser running as a thread, see champ_queue.c.
+	struct champ_queue_end *queue;
+	// For a backup using a sharded champ chooser, see champ_fanout.c.
+	struct champ_fanout *fanout;
 
 	// For the champ chooser server main socket.
 	uint8_t listening_for_new_clients;
@@ -89,7 +89,7 @@ static int async_io(struct async *as, int doread)
 	int dosomething=0;
 	struct timeval tval;
 	struct asfd *asfd;
-	static int s=0;
+	static THREAD_LOCAL int s=0;
 
 	as->now=time(NULL);
 	if(!as->last_time) as->last_time=as->now;
@@ -49,8 +49,8 @@
 // Encode a stat structure into a base64 character string.
 int attribs_encode(struct sbuf *sb)
 {
-	static char *p;
-	static struct stat *statp;
+	static THREAD_LOCAL char *p;
+	static THREAD_LOCAL struct stat *statp;
 
 	if(!sb->attr.buf)
 	{
@@ -139,10 +139,10 @@ int attribs_encode(struct sbuf *sb)
 // Decode a stat packet from base64 characters.
 void attribs_decode(struct sbuf *sb)
 {
-	static const char *p;
-	static int64_t val;
-	static struct stat *statp;
-	static int eaten;
+	static THREAD_LOCAL const char *p;
+	static THREAD_LOCAL int64_t val;
+	static THREAD_LOCAL struct stat *statp;
+	static THREAD_LOCAL int eaten;
 
 	if(!(p=sb->attr.buf)) return;
 	statp=&sb->statp;
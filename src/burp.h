@@ -165,6 +165,14 @@
 	#endif
 #endif
 
+// For statics that would otherwise be shared between the champ chooser
+// thread and the backup that runs it.
+#ifdef HAVE_PTHREAD
+	#define THREAD_LOCAL	__thread
+#else
+	#define THREAD_LOCAL
+#endif
+
 // This is the shape of the Windows VSS header structure.
 // It is size 20 on disk. Using sizeof(struct bsid) gives 24 in memory.
 struct bsid
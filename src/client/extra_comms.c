@@ -264,6 +264,37 @@ int extra_comms_client(struct async *as, struct conf **confs,
 #endif
 		set_e_rshash(confs[OPT_RSHASH], RSHASH_MD4);
 
+	if(server_supports(feat, ":chunking=gear:"))
+	{
+		set_int(confs[OPT_CHUNKING], CHUNKING_GEAR);
+		// Send choice to server.
+		if(asfd->write_str(asfd, CMD_GEN, "chunking=gear"))
+			goto end;
+	}
+	else
+		set_int(confs[OPT_CHUNKING], CHUNKING_RABIN);
+
+#ifdef HAVE_EVP_BLAKE2B512
+	if(server_supports(feat, ":strong_hash=blake2b:"))
+	{
+		set_int(confs[OPT_STRONG_HASH], STRONG_HASH_BLAKE2B);
+		// Send choice to server.
+		if(asfd->write_str(asfd, CMD_GEN, "strong_hash=blake2b"))
+			goto end;
+	}
+	else
+#endif
+		set_int(confs[OPT_STRONG_HASH], STRONG_HASH_MD5);
+
+	if(server_supports(feat, ":sig_batch:"))
+	{
+		set_int(confs[OPT_SIG_BATCH], 1);
+		if(asfd->write_str(asfd, CMD_GEN, "sig_batch"))
+			goto end;
+	}
+	else
+		set_int(confs[OPT_SIG_BATCH], 0);
+
 	if(server_supports(feat, ":failover:"))
 	{
 		if(*action==ACTION_BACKUP
@@ -11,6 +11,9 @@
 #include "../../protocol2/blist.h"
 #include "../../protocol2/rabin/rabin.h"
 #include "../../slist.h"
+#include "../../strlist.h"
+#include "blk_window.h"
+#include "hash_pool.h"
 #include "rabin_read.h"
 #include "backup_phase2.h"
 
@@ -34,11 +37,9 @@ static int add_to_file_requests(struct slist *slist, struct iobuf *rbuf)
 	return 0;
 }
 
-static int add_to_data_requests(struct blist *blist, struct iobuf *rbuf)
+static int mark_requested(struct blist *blist, uint64_t index)
 {
-	uint64_t index;
 	struct blk *blk;
-	index=base64_to_uint64(rbuf->buf);
 
 //printf("last_requested: %d\n", blist->last_requested->index);
 
@@ -56,8 +57,33 @@ static int add_to_data_requests(struct blist *blist, struct iobuf *rbuf)
 	return 0;
 }
 
+static int add_to_data_requests(struct blist *blist, struct iobuf *rbuf)
+{
+	return mark_requested(blist, base64_to_uint64(rbuf->buf));
+}
+
+static int add_ranges_to_data_requests(struct blist *blist,
+	struct iobuf *rbuf)
+{
+	int ret;
+	size_t offset=0;
+	uint64_t count=0;
+	struct blk blk;
+	struct iobuf rec;
+
+	while((ret=blk_batch_next(rbuf, &offset, &rec))>0)
+	{
+		if(blk_set_from_iobuf_data_req_range(&blk, &count, &rec))
+			return -1;
+		for(; count; count--, blk.index++)
+			if(mark_requested(blist, blk.index))
+				return -1;
+	}
+	return ret;
+}
+
 static int deal_with_read(struct iobuf *rbuf, struct slist *slist,
-	struct cntr *cntr, uint8_t *end_flags)
+	struct cntr *cntr, uint8_t *end_flags, struct blk_window *window)
 {
 	int ret=0;
 	switch(rbuf->cmd)
@@ -71,6 +97,14 @@ static int deal_with_read(struct iobuf *rbuf, struct slist *slist,
 		/* Incoming data block request. */
 		case CMD_DATA_REQ:
 			if(add_to_data_requests(slist->blist, rbuf)) goto error;
+			blk_window_response(window,
+				slist->blist->last_requested->index);
+			goto end;
+		case CMD_DATA_REQS:
+			if(add_ranges_to_data_requests(slist->blist, rbuf))
+				goto error;
+			blk_window_response(window,
+				slist->blist->last_requested->index);
 			goto end;
 
 		/* Incoming control/message stuff. */
@@ -94,7 +128,11 @@ static int deal_with_read(struct iobuf *rbuf, struct slist *slist,
 				logp("Could not find wrap up index: %016" PRIX64 "\n",
 					wrap_up);
 //				goto error;
+				goto end;
 			}
+			// A stretch of blocks that were all deduplicated gets
+			// only wrap ups, so they have to end samples too.
+			blk_window_response(window, wrap_up);
 			goto end;
 		}
 		case CMD_MESSAGE:
@@ -132,10 +170,82 @@ end:
 	return ret;
 }
 
+static uint64_t blk_mem(struct blk *blk)
+{
+	return sizeof(struct blk)+blk->length;
+}
+
+// Give any blocks that were added to the list to the hash threads, and
+// count them against the window.
+static int hash_new_blks(struct hash_pool *hp, struct blk_window *window,
+	struct blist *blist, struct blk *old_tail)
+{
+	struct blk *blk;
+	for(blk=old_tail?old_tail->next:blist->head; blk; blk=blk->next)
+	{
+		if(hash_pool_add(hp, blk))
+			return -1;
+		blk_window_add(window, blk_mem(blk));
+	}
+	return 0;
+}
+
+// Skip over the 'min:avg:max:' at the start of a chunk_size_ext or
+// chunk_size_path entry. The sizes were checked when the config was loaded.
+static const char *chunk_size_match_str(const char *str)
+{
+	int i;
+	for(i=0; i<3 && str; i++)
+		if((str=strchr(str, ':')))
+			str++;
+	return str?str:"";
+}
+
+static int path_has_prefix(const char *path, const char *prefix)
+{
+	size_t len=strlen(prefix);
+	if(!len || strncmp(path, prefix, len))
+		return 0;
+	return prefix[len-1]=='/' || path[len]=='/' || !path[len];
+}
+
+// Pick the block sizes for a file. A matching extension wins, then the
+// longest matching path, then chunk_size. NULL means use the defaults.
+static const char *get_chunk_size(struct conf **confs, const char *path)
+{
+	size_t best=0;
+	const char *ext;
+	const char *match;
+	const char *ret=NULL;
+	struct strlist *l;
+
+	if(!confs)
+		return NULL;
+	if((ext=strrchr(path, '.')) && !strchr(ext, '/'))
+	{
+		for(l=get_strlist(confs[OPT_CHUNK_SIZE_EXT]); l; l=l->next)
+			if(!strcasecmp(chunk_size_match_str(l->path), ext+1))
+				return l->path;
+	}
+	for(l=get_strlist(confs[OPT_CHUNK_SIZE_PATH]); l; l=l->next)
+	{
+		match=chunk_size_match_str(l->path);
+		if(strlen(match)>best && path_has_prefix(path, match))
+		{
+			best=strlen(match);
+			ret=l->path;
+		}
+	}
+	if(ret)
+		return ret;
+	return get_string(confs[OPT_CHUNK_SIZE]);
+}
+
 static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
-	struct slist *slist)
+	struct slist *slist, struct hash_pool *hp, struct blk_window *window)
 {
 	int just_opened=0;
+	struct blk *old_tail;
 	struct sbuf *sb=slist->last_requested;
 	if(!sb) return 0;
 
@@ -159,14 +269,22 @@ static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 			default:
 				return -1;
 		}
+		if(blks_generate_set_blk_sizes(
+			get_chunk_size(confs, sb->path.buf)))
+				return -1;
 		just_opened=1;
 	}
 
+	old_tail=slist->blist->tail;
 	switch(blks_generate(sb, slist->blist, just_opened))
 	{
 		case 0: // All OK.
+			if(hash_new_blks(hp, window, slist->blist, old_tail))
+				return -1;
 			break;
 		case 1: // File ended.
+			if(hash_new_blks(hp, window, slist->blist, old_tail))
+				return -1;
 			if(rabin_close_file(sb, asfd))
 			{
 				logp("Failed to close file %s\n",
@@ -182,7 +300,7 @@ static int add_to_blks_list(struct asfd *asfd, struct conf **confs,
 	return 0;
 }
 
-static void free_stuff(struct slist *slist)
+static void free_stuff(struct slist *slist, struct blk_window *window)
 {
 	struct blk *blk;
 	struct blist *blist=slist->blist;
@@ -202,13 +320,15 @@ static void free_stuff(struct slist *slist)
 			sbuf_free(&sb);
 		}
 		blk=blk->next;
+		blk_window_del(window, blk_mem(blist->head));
 		blk_free(&blist->head);
 		blist->head=blk;
 	}
 }
 
 static void get_wbuf_from_data(struct conf **confs,
-	struct iobuf *wbuf, struct slist *slist, uint8_t end_flags)
+	struct iobuf *wbuf, struct slist *slist, uint8_t end_flags,
+	struct blk_window *window)
 {
 	struct blk *blk;
 	struct blist *blist=slist->blist;
@@ -237,18 +357,60 @@ static void get_wbuf_from_data(struct conf **confs,
 		if(blk==blist->last_requested) break;
 	}
 	// Need to free stuff that is no longer needed.
-	free_stuff(slist);
+	free_stuff(slist, window);
 }
 
-static int iobuf_from_blk_data(struct iobuf *wbuf, struct blk *blk)
+static int iobuf_from_blk_data(struct iobuf *wbuf, struct blk *blk,
+	struct hash_pool *hp)
 {
-	if(blk_md5_update(blk)) return -1;
+	if(hash_pool_wait(hp, blk)) return -1;
 	blk_to_iobuf_sig(blk, wbuf);
 	return 0;
 }
 
+// Return 1 if that was the last signature of the file.
+static int move_on_to_next_sig(struct slist *slist, struct sbuf *sb)
+{
+	if(sb->protocol2->bsighead==sb->protocol2->bend)
+	{
+		slist->blks_to_send=sb->next;
+		sb->protocol2->bsighead=sb->protocol2->bstart;
+		return 1;
+	}
+	sb->protocol2->bsighead=sb->protocol2->bsighead->next;
+	return 0;
+}
+
+// Put as many of the signatures of the file as are ready into one batch.
+static int get_wbuf_from_blks_batch(struct iobuf *wbuf,
+	struct slist *slist, struct sbuf *sb, struct hash_pool *hp,
+	struct blk_window *window)
+{
+	// The batch has to stay put until the wbuf has been written.
+	static struct blk_batch batch;
+	struct blk *blk;
+	struct iobuf rec;
+
+	blk_batch_init(&batch, CMD_SIGS);
+	while((blk=sb->protocol2->bsighead))
+	{
+		if(iobuf_from_blk_data(&rec, blk, hp))
+			return -1;
+		// A signature that does not fit goes in the next batch, and
+		// is not timed until then.
+		if(blk_batch_add(&batch, &rec))
+			break; // Full.
+		blk_window_sent(window, blk->index);
+		if(move_on_to_next_sig(slist, sb))
+			break;
+	}
+	blk_batch_to_iobuf(&batch, wbuf);
+	return 0;
+}
+
 static int get_wbuf_from_blks(struct iobuf *wbuf,
-	struct slist *slist, uint8_t *end_flags)
+	struct slist *slist, uint8_t *end_flags, struct hash_pool *hp,
+	struct blk_window *window, int sig_batch)
 {
 	struct sbuf *sb=slist->blks_to_send;
 
@@ -271,18 +433,15 @@ static int get_wbuf_from_blks(struct iobuf *wbuf,
 		return 0;
 	}
 
-	if(iobuf_from_blk_data(wbuf, sb->protocol2->bsighead)) return -1;
+	if(sig_batch)
+		return get_wbuf_from_blks_batch(wbuf, slist, sb, hp, window);
+
+	if(iobuf_from_blk_data(wbuf, sb->protocol2->bsighead, hp))
+		return -1;
+	blk_window_sent(window, sb->protocol2->bsighead->index);
 
 	// Move on.
-	if(sb->protocol2->bsighead==sb->protocol2->bend)
-	{
-		slist->blks_to_send=sb->next;
-		sb->protocol2->bsighead=sb->protocol2->bstart;
-	}
-	else
-	{
-		sb->protocol2->bsighead=sb->protocol2->bsighead->next;
-	}
+	move_on_to_next_sig(slist, sb);
 	return 0;
 }
 
@@ -295,8 +454,24 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 	struct iobuf *rbuf=NULL;
 	struct iobuf *wbuf=NULL;
 	struct cntr *cntr=NULL;
-
-	if(confs) cntr=get_cntr(confs);
+	struct hash_pool *hp=NULL;
+	enum chunking chunking=CHUNKING_RABIN;
+	enum strong_hash strong_hash=STRONG_HASH_MD5;
+	int hash_threads=0;
+	int sig_batch=0;
+	uint64_t window_max=BLK_WINDOW_MIN;
+	struct blk_window window;
+
+	if(confs)
+	{
+		cntr=get_cntr(confs);
+		chunking=(enum chunking)get_int(confs[OPT_CHUNKING]);
+		strong_hash=(enum strong_hash)get_int(confs[OPT_STRONG_HASH]);
+		hash_threads=get_int(confs[OPT_HASH_THREADS]);
+		sig_batch=get_int(confs[OPT_SIG_BATCH]);
+		window_max=get_uint64_t(confs[OPT_BLK_WINDOW_MAX]);
+	}
+	blk_window_init(&window, window_max, cntr);
 
 	if(!asfd || !asfd->as)
 	{
@@ -309,7 +484,8 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 
 	if(!(slist=slist_alloc())
 	  || !(wbuf=iobuf_alloc())
-	  || blks_generate_init())
+	  || !(hp=hash_pool_alloc(hash_threads, strong_hash))
+	  || blks_generate_init(chunking))
 		goto end;
 	rbuf=asfd->rbuf;
 
@@ -332,11 +508,11 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 		if(!wbuf->len)
 		{
 			get_wbuf_from_data(confs, wbuf, slist,
-				end_flags);
+				end_flags, &window);
 			if(!wbuf->len)
 			{
-				if(get_wbuf_from_blks(wbuf, slist,
-					&end_flags)) goto end;
+				if(get_wbuf_from_blks(wbuf, slist, &end_flags,
+					hp, &window, sig_batch)) goto end;
 			}
 		}
 
@@ -352,17 +528,15 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 			goto end;
 		}
 
-		if(rbuf->buf && deal_with_read(rbuf, slist, cntr, &end_flags))
-			goto end;
+		if(rbuf->buf && deal_with_read(rbuf, slist, cntr,
+			&end_flags, &window))
+				goto end;
 
+		// Need to limit how much block data is held at once.
 		if(slist->head
-		// Need to limit how many blocks are allocated at once.
-		  && (!slist->blist->head
-		   || slist->blist->tail->index
-			- slist->blist->head->index<BLKS_MAX_IN_MEM)
-		)
+		  && !blk_window_full(&window))
 		{
-			if(add_to_blks_list(asfd, confs, slist))
+			if(add_to_blks_list(asfd, confs, slist, hp, &window))
 				goto end;
 		}
 
@@ -390,6 +564,8 @@ int backup_phase2_client_protocol2(struct asfd *asfd,
 
 	ret=0;
 end:
+	// Stop the hash threads before the blocks go away.
+	hash_pool_free(&hp);
 	slist_free(&slist);
 	blks_generate_free();
 	if(wbuf)
@@ -0,0 +1,114 @@
+#include "../../burp.h"
+#include "../../cntr.h"
+#include "blk_window.h"
+
+// The client has to hold on to each block until the server has said
+// whether it wants the data, which takes at least one round trip. The
+// number of bytes held is limited by a window that is sized in much the
+// same way as a TCP congestion window.
+// One block at a time is timed from when its signature is sent until the
+// server gets past it in its data requests. At the end of each sample:
+// - If the window was full at some point, it grows. It doubles until the
+//   response time starts to go up, then grows by an eighth at a time.
+// - If the window was never more than a quarter used, it halves, so that
+//   clients that do not need much do not hold on to much.
+// It never goes over the byte budget from blk_window_max, unless the blocks
+// are so big that a manifest's worth of them does not fit in it.
+
+void blk_window_init(struct blk_window *w, uint64_t max, struct cntr *cntr)
+{
+	memset(w, 0, sizeof(*w));
+	w->max=max;
+	w->size=max<BLK_WINDOW_MIN?max:BLK_WINDOW_MIN;
+	w->slow_start=1;
+	w->cntr=cntr;
+	cntr_set_blk_window(w->cntr, w->size);
+}
+
+// Microseconds.
+static uint64_t now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec*1000000+(uint64_t)tv.tv_usec;
+}
+
+// Return 1 if no more blocks should be generated for now. There is always
+// room for something when nothing is held, or a block bigger than the
+// window could never get in.
+int blk_window_full(struct blk_window *w)
+{
+	if(!w->bytes || w->bytes<w->size || w->blks<MANIFEST_SIG_MAX)
+		return 0;
+	if(w->blks<BLK_WINDOW_MIN_BLKS && w->bytes<w->max)
+		return 0;
+	w->limited=1;
+	return 1;
+}
+
+void blk_window_add(struct blk_window *w, uint64_t bytes)
+{
+	w->bytes+=bytes;
+	w->blks++;
+	if(w->bytes>w->peak)
+		w->peak=w->bytes;
+}
+
+void blk_window_del(struct blk_window *w, uint64_t bytes)
+{
+	w->bytes=bytes>w->bytes?0:w->bytes-bytes;
+	if(w->blks)
+		w->blks--;
+}
+
+// The signature for block 'index' has just been sent.
+void blk_window_sent(struct blk_window *w, uint64_t index)
+{
+	if(w->sample_index)
+		return;
+	w->sample_index=index;
+	w->sample_start=now_usec();
+}
+
+// Resize the window at the end of a sample that took 'rtt' microseconds.
+void blk_window_adjust(struct blk_window *w, uint64_t rtt)
+{
+	uint64_t min=w->max<BLK_WINDOW_MIN?w->max:BLK_WINDOW_MIN;
+
+	if(!w->min_rtt || rtt<w->min_rtt)
+		w->min_rtt=rtt;
+
+	if(w->limited)
+	{
+		// Responses slowing down means that things are queueing up
+		// somewhere, and a bigger window will not help much.
+		if(w->slow_start && rtt>2*w->min_rtt)
+			w->slow_start=0;
+		if(w->slow_start)
+			w->size*=2;
+		else
+			w->size+=w->size/8;
+	}
+	else if(w->peak<w->size/4)
+		w->size/=2;
+
+	if(w->size>w->max)
+		w->size=w->max;
+	if(w->size<min)
+		w->size=min;
+	cntr_set_blk_window(w->cntr, w->size);
+	w->limited=0;
+	w->peak=w->bytes;
+}
+
+// The server has dealt with everything up to block 'index'.
+void blk_window_response(struct blk_window *w, uint64_t index)
+{
+	uint64_t now;
+	if(!w->sample_index || index<w->sample_index)
+		return;
+	now=now_usec();
+	blk_window_adjust(w,
+		now>w->sample_start?now-w->sample_start:1);
+	w->sample_index=0;
+}
@@ -0,0 +1,45 @@
+#ifndef _BLK_WINDOW_H
+#define _BLK_WINDOW_H
+
+#include "../../burp.h"
+#include "../../protocol2/blk.h"
+
+struct cntr;
+
+// The window does not go below this, unless blk_window_max is smaller.
+#define BLK_WINDOW_MIN		(1024*1024)
+
+// The server does not answer until it has a manifest's worth of
+// signatures, so the window is never full with fewer blocks than that,
+// however big they are, or the backup would stall. Up to this many, it is
+// only full when blk_window_max is reached, so that the next manifest's
+// worth can be on its way.
+#define BLK_WINDOW_MIN_BLKS	(2*MANIFEST_SIG_MAX)
+
+// Limits how many bytes of blocks the client holds while it waits for the
+// server to say which ones it wants.
+struct blk_window
+{
+	uint64_t max;		// Byte budget, from blk_window_max.
+	uint64_t size;		// Current window, in bytes.
+	uint64_t bytes;		// Bytes held at the moment.
+	uint64_t blks;		// Blocks held at the moment.
+	uint64_t peak;		// Most bytes held during the current sample.
+	uint64_t min_rtt;	// Shortest response time seen, in microseconds.
+	uint64_t sample_index;	// Block being timed, or 0 for none.
+	uint64_t sample_start;
+	uint8_t slow_start;
+	uint8_t limited;	// Window was full during the current sample.
+	struct cntr *cntr;
+};
+
+extern void blk_window_init(struct blk_window *w, uint64_t max,
+	struct cntr *cntr);
+extern int blk_window_full(struct blk_window *w);
+extern void blk_window_add(struct blk_window *w, uint64_t bytes);
+extern void blk_window_del(struct blk_window *w, uint64_t bytes);
+extern void blk_window_sent(struct blk_window *w, uint64_t index);
+extern void blk_window_response(struct blk_window *w, uint64_t index);
+extern void blk_window_adjust(struct blk_window *w, uint64_t rtt);
+
+#endif
@@ -0,0 +1,209 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../log.h"
+#include "../../protocol2/blk.h"
+#include "hash_pool.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// Strong checksums of the blocks that the client generates are worked out
+// by a pool of threads, so that a backup is not limited to one core.
+// The blocks stay in the blist, in order, and the main loop waits on each
+// one before it sends its signature, so nothing else needs to change.
+// With no threads, or no pthreads, the checksum is done straight away in
+// hash_pool_add().
+
+// How many blocks can be waiting for each thread.
+#define HASH_QUEUE_PER_THREAD	64
+
+struct hash_pool
+{
+	int threads;
+	int error;
+	enum strong_hash strong_hash;
+#ifdef HAVE_PTHREAD
+	int stop;
+	pthread_t *tids;
+	pthread_mutex_t lock;
+	pthread_cond_t work;	// Signalled when a block is queued.
+	pthread_cond_t space;	// Signalled when a block is taken.
+	pthread_cond_t done;	// Signalled when a block is hashed.
+	struct blk **queue;	// Ring buffer.
+	size_t qsize;
+	size_t qhead;
+	size_t qcount;
+#endif
+};
+
+static int hash_blk(struct blk *blk)
+{
+	if(blk_strong_hash_update(blk))
+		return -1;
+	blk->hashed=1;
+	return 0;
+}
+
+#ifdef HAVE_PTHREAD
+static void *hash_worker(void *arg)
+{
+	struct blk *blk;
+	struct hash_pool *hp=(struct hash_pool *)arg;
+
+	pthread_mutex_lock(&hp->lock);
+	while(1)
+	{
+		while(!hp->qcount && !hp->stop)
+			pthread_cond_wait(&hp->work, &hp->lock);
+		// Finish off anything queued before stopping.
+		if(!hp->qcount)
+			break;
+		blk=hp->queue[hp->qhead];
+		hp->qhead=(hp->qhead+1)%hp->qsize;
+		hp->qcount--;
+		pthread_cond_signal(&hp->space);
+		pthread_mutex_unlock(&hp->lock);
+
+		// The block data is not touched by anything else until the
+		// main thread has seen that it has been hashed.
+		if(blk_strong_hash_update(blk))
+		{
+			pthread_mutex_lock(&hp->lock);
+			hp->error=1;
+		}
+		else
+		{
+			pthread_mutex_lock(&hp->lock);
+			blk->hashed=1;
+		}
+		pthread_cond_broadcast(&hp->done);
+	}
+	pthread_mutex_unlock(&hp->lock);
+	return NULL;
+}
+
+static void hash_pool_stop(struct hash_pool *hp)
+{
+	int i;
+	pthread_mutex_lock(&hp->lock);
+	hp->stop=1;
+	pthread_cond_broadcast(&hp->work);
+	pthread_mutex_unlock(&hp->lock);
+	for(i=0; i<hp->threads; i++)
+		pthread_join(hp->tids[i], NULL);
+	hp->threads=0;
+}
+
+static int hash_pool_start(struct hash_pool *hp, int threads)
+{
+	int i;
+	hp->qsize=(size_t)threads*HASH_QUEUE_PER_THREAD;
+	if(!(hp->queue=(struct blk **)
+		calloc_w(hp->qsize, sizeof(struct blk *), __func__))
+	  || !(hp->tids=(pthread_t *)
+		calloc_w(threads, sizeof(pthread_t), __func__)))
+			return -1;
+	pthread_mutex_init(&hp->lock, NULL);
+	pthread_cond_init(&hp->work, NULL);
+	pthread_cond_init(&hp->space, NULL);
+	pthread_cond_init(&hp->done, NULL);
+	for(i=0; i<threads; i++)
+	{
+		if(pthread_create(&hp->tids[i], NULL, hash_worker, hp))
+		{
+			logp("Could not create hash thread: %s\n",
+				strerror(errno));
+			break;
+		}
+		hp->threads++;
+	}
+	return hp->threads?0:-1;
+}
+#endif
+
+struct hash_pool *hash_pool_alloc(int threads, enum strong_hash strong_hash)
+{
+	struct hash_pool *hp;
+	if(!blk_strong_hash_supported(strong_hash))
+	{
+		logp("Strong hash %s not supported\n",
+			strong_hash_to_str(strong_hash));
+		return NULL;
+	}
+	if(!(hp=(struct hash_pool *)
+		calloc_w(1, sizeof(struct hash_pool), __func__)))
+			return NULL;
+	hp->strong_hash=strong_hash;
+	if(threads>HASH_THREADS_MAX)
+		threads=HASH_THREADS_MAX;
+#ifdef HAVE_PTHREAD
+	if(threads>0 && hash_pool_start(hp, threads))
+	{
+		hash_pool_free(&hp);
+		return NULL;
+	}
+#endif
+	return hp;
+}
+
+void hash_pool_free(struct hash_pool **hp)
+{
+	if(!hp || !*hp) return;
+#ifdef HAVE_PTHREAD
+	if((*hp)->tids)
+	{
+		hash_pool_stop(*hp);
+		pthread_mutex_destroy(&(*hp)->lock);
+		pthread_cond_destroy(&(*hp)->work);
+		pthread_cond_destroy(&(*hp)->space);
+		pthread_cond_destroy(&(*hp)->done);
+	}
+	free_v((void **)&(*hp)->tids);
+	free_v((void **)&(*hp)->queue);
+#endif
+	free_v((void **)hp);
+}
+
+// Queue a block for hashing. Blocks if the queue is full.
+int hash_pool_add(struct hash_pool *hp, struct blk *blk)
+{
+	blk->hashed=0;
+	blk->strong_hash=(uint8_t)hp->strong_hash;
+#ifdef HAVE_PTHREAD
+	if(hp->threads)
+	{
+		pthread_mutex_lock(&hp->lock);
+		while(hp->qcount==hp->qsize)
+			pthread_cond_wait(&hp->space, &hp->lock);
+		hp->queue[(hp->qhead+hp->qcount)%hp->qsize]=blk;
+		hp->qcount++;
+		pthread_cond_signal(&hp->work);
+		pthread_mutex_unlock(&hp->lock);
+		return 0;
+	}
+#endif
+	if(hash_blk(blk))
+		hp->error=1;
+	return hp->error?-1:0;
+}
+
+// Wait until a block that was given to hash_pool_add() has been hashed.
+int hash_pool_wait(struct hash_pool *hp, struct blk *blk)
+{
+#ifdef HAVE_PTHREAD
+	if(hp->threads)
+	{
+		pthread_mutex_lock(&hp->lock);
+		while(!blk->hashed && !hp->error)
+			pthread_cond_wait(&hp->done, &hp->lock);
+		pthread_mutex_unlock(&hp->lock);
+	}
+#endif
+	if(hp->error)
+	{
+		logp("Block checksum failed\n");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _HASH_POOL_H
+#define _HASH_POOL_H
+
+#include "../../conf.h"
+
+struct blk;
+struct hash_pool;
+
+// The most hash threads that can be asked for.
+#define HASH_THREADS_MAX	64
+
+extern struct hash_pool *hash_pool_alloc(int threads,
+	enum strong_hash strong_hash);
+extern void hash_pool_free(struct hash_pool **hp);
+extern int hash_pool_add(struct hash_pool *hp, struct blk *blk);
+extern int hash_pool_wait(struct hash_pool *hp, struct blk *blk);
+
+#endif
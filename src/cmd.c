@@ -3,7 +3,7 @@
 
 char *cmd_to_text(enum cmd cmd)
 {
-	static char buf[256];
+	static THREAD_LOCAL char buf[256];
 	size_t len=sizeof(buf);
 	*buf='\0';
 	switch(cmd)
@@ -20,6 +20,12 @@ char *cmd_to_text(enum cmd cmd)
 			snprintf(buf, len, "Block data"); break;
 		case CMD_WRAP_UP:
 			snprintf(buf, len, "Control packet"); break;
+		case CMD_SIGS:
+			snprintf(buf, len, "Batch of block signatures"); break;
+		case CMD_DATA_COMP:
+			snprintf(buf, len, "Compressed block data"); break;
+		case CMD_DATA_REQS:
+			snprintf(buf, len, "Batch of requests for blocks of data"); break;
 		case CMD_FILE:
 			snprintf(buf, len, "Plain file"); break;
 		case CMD_ENC_FILE:
@@ -79,6 +85,8 @@ char *cmd_to_text(enum cmd cmd)
 			snprintf(buf, len, "Bytes received"); break;
 		case CMD_BYTES_SENT:
 			snprintf(buf, len, "Bytes sent"); break;
+		case CMD_BLK_WINDOW:
+			snprintf(buf, len, "Protocol2 block window"); break;
 
 		// Protocol1 only.
 		case CMD_DATAPTH:
@@ -15,8 +15,11 @@ enum cmd
 	CMD_SIG		='S',	/* Signature of a block */
 	CMD_DATA_REQ	='D',	/* Request for block data */
 	CMD_DATA	='B',	/* Block data */
+	CMD_DATA_COMP	='C',	/* Compressed block data, in data files */
 	CMD_WRAP_UP	='W',	/* Control packet - client can free blocks up
 				   to the given index. */
+	CMD_SIGS	='T',	/* Batch of block signatures */
+	CMD_DATA_REQS	='X',	/* Batch of ranges of block data requests */
 
 // File types
 	CMD_FILE	='f',	/* Plain file */
@@ -61,6 +64,7 @@ enum cmd
 	CMD_BYTES_RECV	='P',
 	CMD_BYTES_SENT	='Q',
 	CMD_TIMESTAMP_END='E',
+	CMD_BLK_WINDOW	='K',
 
 // Protocol1 only.
 	CMD_DATAPTH	='t',	/* Path to data on the server */
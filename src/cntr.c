@@ -106,6 +106,8 @@ int cntr_init(struct cntr *cntr, const char *cname, pid_t pid)
 	// comes out in the right order.
 	if(
 	     add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
+		CMD_BLK_WINDOW, "blk_window", "Block window")
+	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
 		CMD_TIMESTAMP_END, "time_end", "End time")
 	  || add_cntr_ent(cntr, CNTR_SINGLE_FIELD,
 		CMD_TIMESTAMP, "time_start", "Start time")
@@ -434,6 +436,11 @@ void cntr_add_bytes(struct cntr *c, uint64_t bytes)
 	incr_count_val(c, CMD_BYTES, bytes);
 }
 
+void cntr_set_blk_window(struct cntr *c, uint64_t bytes)
+{
+	set_count_val(c, CMD_BLK_WINDOW, bytes);
+}
+
 static void cntr_set_sentbytes(struct cntr *c, uint64_t bytes)
 {
 	set_count_val(c, CMD_BYTES_SENT, bytes);
@@ -545,6 +552,12 @@ static void bottom_part(struct cntr *c, enum action act)
 	l=get_count(e, CMD_BYTES_SENT);
 	logc("           Bytes sent:   %11" PRIu64, l);
 	logc("%s\n", bytes_to_human(l));
+
+	if((l=get_count(e, CMD_BLK_WINDOW)))
+	{
+		logc("         Block window:   %11" PRIu64, l);
+		logc("%s\n", bytes_to_human(l));
+	}
 }
 
 void cntr_print(struct cntr *cntr, enum action act)
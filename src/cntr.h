@@ -105,6 +105,7 @@ extern void cntr_add_same(struct cntr *c, char ch);
 extern void cntr_add_changed(struct cntr *c, char ch);
 extern void cntr_add_deleted(struct cntr *c, char ch);
 extern void cntr_add_bytes(struct cntr *c, uint64_t bytes);
+extern void cntr_set_blk_window(struct cntr *c, uint64_t bytes);
 
 extern void cntr_add_phase1(struct cntr *c,
 	char ch, int print);
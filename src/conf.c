@@ -61,6 +61,48 @@ const char *rshash_to_str(enum rshash r)
 	}
 }
 
+const char *chunking_to_str(enum chunking c)
+{
+	switch(c)
+	{
+		case CHUNKING_RABIN: return "rabin";
+		case CHUNKING_GEAR: return "gear";
+		default: return "unknown";
+	}
+}
+
+// Return -1 for an unknown setting.
+int str_to_chunking(const char *str)
+{
+	if(!strcmp(str, "rabin"))
+		return CHUNKING_RABIN;
+	else if(!strcmp(str, "gear"))
+		return CHUNKING_GEAR;
+	logp("Unknown chunking setting: %s\n", str);
+	return -1;
+}
+
+const char *strong_hash_to_str(enum strong_hash s)
+{
+	switch(s)
+	{
+		case STRONG_HASH_MD5: return "md5";
+		case STRONG_HASH_BLAKE2B: return "blake2b";
+		default: return "unknown";
+	}
+}
+
+// Return -1 for an unknown setting.
+int str_to_strong_hash(const char *str)
+{
+	if(!strcmp(str, "md5"))
+		return STRONG_HASH_MD5;
+	else if(!strcmp(str, "blake2b"))
+		return STRONG_HASH_BLAKE2B;
+	logp("Unknown strong_hash setting: %s\n", str);
+	return -1;
+}
+
 enum protocol str_to_protocol(const char *str)
 {
 	if(!strcmp(str, "0"))
@@ -476,9 +518,42 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_RBLK_MEMORY_MAX:
 	  return sc_u64(c[o], 256*1024*1024, // 256 Mb.
 		CONF_FLAG_CC_OVERRIDE, "rblk_memory_max");
+	case OPT_RBLK_LOOKAHEAD:
+	  return sc_int(c[o], 8192,
+		CONF_FLAG_CC_OVERRIDE, "rblk_lookahead");
+	case OPT_RBLK_MMAP:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "rblk_mmap");
+	case OPT_RBLK_THREADS:
+	  return sc_int(c[o], 1,
+		CONF_FLAG_CC_OVERRIDE, "rblk_threads");
 	case OPT_SPARSE_SIZE_MAX:
 	  return sc_u64(c[o], 256*1024*1024, // 256 Mb.
 		CONF_FLAG_CC_OVERRIDE, "sparse_size_max");
+	case OPT_CHUNKING:
+	  return sc_int(c[o], CHUNKING_RABIN,
+		CONF_FLAG_CC_OVERRIDE, "chunking");
+	case OPT_STRONG_HASH:
+	  return sc_int(c[o], STRONG_HASH_MD5,
+		CONF_FLAG_CC_OVERRIDE, "strong_hash");
+	case OPT_BLK_COMPRESSION:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "blk_compression");
+	case OPT_CHAMP_CHOOSER_THREAD:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "champ_chooser_thread");
+	case OPT_CHAMP_CHOOSER_SHARDS:
+	  return sc_int(c[o], 1,
+		CONF_FLAG_CC_OVERRIDE, "champ_chooser_shards");
+	case OPT_CHAMP_CACHE_MAX:
+	  return sc_u64(c[o], 64*1024*1024, // 64 Mb.
+		CONF_FLAG_CC_OVERRIDE, "champ_cache_max");
+	case OPT_GC_RATE_MAX:
+	  return sc_u64(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "gc_rate_max");
+	case OPT_BINARY_MANIFEST:
+	  return sc_int(c[o], 0,
+		CONF_FLAG_CC_OVERRIDE, "binary_manifest");
 	case OPT_MONITOR_LOGFILE:
 	  return sc_str(c[o], 0, 0, "monitor_logfile");
 	case OPT_MONITOR_EXE:
@@ -511,6 +586,11 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_str(c[o], 0, 0, "ca_csr_dir");
 	case OPT_RANDOMISE:
 	  return sc_int(c[o], 0, 0, "randomise");
+	case OPT_HASH_THREADS:
+	  return sc_int(c[o], 0, 0, "hash_threads");
+	case OPT_BLK_WINDOW_MAX:
+	  return sc_u64(c[o], 128*1024*1024, // 128 Mb.
+		0, "blk_window_max");
 	case OPT_RESTORE_LIST:
 	  return sc_str(c[o], 0, 0, "restore_list");
 	case OPT_ENABLED:
@@ -565,6 +645,8 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	  return sc_int(c[o], 1, 0, "restore_script_reserved_args");
 	case OPT_SEND_CLIENT_CNTR:
 	  return sc_int(c[o], 0, 0, "send_client_cntr");
+	case OPT_SIG_BATCH:
+	  return sc_int(c[o], 0, 0, "");
 	case OPT_SUPER_CLIENT:
 	  return sc_str(c[o], 0, 0, "");
 	case OPT_RESTORE_PATH:
@@ -815,6 +897,12 @@ static int reset_conf(struct conf **c, enum conf_opt o)
 	case OPT_INCGLOB:
 	  return sc_lst(c[o], 0,
 		CONF_FLAG_INCEXC|CONF_FLAG_STRLIST_SORTED, "include_glob");
+	case OPT_CHUNK_SIZE:
+	  return sc_str(c[o], 0, CONF_FLAG_INCEXC, "chunk_size");
+	case OPT_CHUNK_SIZE_EXT:
+	  return sc_lst(c[o], 0, CONF_FLAG_INCEXC, "chunk_size_ext");
+	case OPT_CHUNK_SIZE_PATH:
+	  return sc_lst(c[o], 0, CONF_FLAG_INCEXC, "chunk_size_path");
 	case OPT_SEED_SRC:
 	  return sc_str(c[o], 0, 0, "seed_src");
 	case OPT_SEED_DST:
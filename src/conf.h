@@ -35,6 +35,20 @@ enum rshash
 	RSHASH_BLAKE2
 };
 
+enum chunking
+{
+	CHUNKING_RABIN=0,
+	CHUNKING_GEAR
+};
+
+// The strong checksum of protocol2 blocks. The numbers get written to
+// manifests, so do not change them.
+enum strong_hash
+{
+	STRONG_HASH_MD5=0,
+	STRONG_HASH_BLAKE2B
+};
+
 enum vss_restore
 {
 	VSS_RESTORE_OFF=0,
@@ -133,7 +147,18 @@ enum conf_opt
 	OPT_PASSWORD_CHECK,
 	OPT_MANUAL_DELETE,
 	OPT_RBLK_MEMORY_MAX,
+	OPT_RBLK_LOOKAHEAD,
+	OPT_RBLK_MMAP,
+	OPT_RBLK_THREADS,
 	OPT_SPARSE_SIZE_MAX,
+	OPT_CHUNKING,
+	OPT_STRONG_HASH,
+	OPT_BLK_COMPRESSION,
+	OPT_CHAMP_CHOOSER_THREAD,
+	OPT_CHAMP_CHOOSER_SHARDS,
+	OPT_CHAMP_CACHE_MAX,
+	OPT_GC_RATE_MAX,
+	OPT_BINARY_MANIFEST,
 	OPT_MONITOR_LOGFILE, // An ncurses client option, from command line.
 	OPT_MONITOR_BROWSE_CACHE,
 	OPT_MONITOR_EXE,
@@ -159,6 +184,8 @@ enum conf_opt
 	OPT_AUTOUPGRADE_DIR, // also a server option
 	OPT_CA_CSR_DIR,
 	OPT_RANDOMISE,
+	OPT_HASH_THREADS,
+	OPT_BLK_WINDOW_MAX,
 	OPT_SERVER_CAN_OVERRIDE_INCLUDES,
 	OPT_RESTORE_LIST,
 
@@ -179,6 +206,9 @@ enum conf_opt
 	OPT_INCFS, // include filesystems
 	OPT_EXCOM, // exclude from compression
 	OPT_INCGLOB, // include (glob expression)
+	OPT_CHUNK_SIZE, // protocol2 block sizes
+	OPT_CHUNK_SIZE_EXT, // protocol2 block sizes by extension
+	OPT_CHUNK_SIZE_PATH, // protocol2 block sizes by path
 	OPT_SEED_SRC,
 	OPT_SEED_DST,
 	OPT_CROSS_ALL_FILESYSTEMS,
@@ -296,6 +326,10 @@ enum conf_opt
 	// counters on resume/verify/restore.
 	OPT_SEND_CLIENT_CNTR,
 
+	// Set to 1 on both client and server when they both understand
+	// batches of protocol2 signatures and data requests.
+	OPT_SIG_BATCH,
+
 	// Set on the server to the super client name (the one that you
 	// connected with) when the client has switched to a different set of
 	// client backups.
@@ -366,5 +400,9 @@ extern const char *recovery_method_to_str(enum recovery_method r);
 extern enum recovery_method str_to_recovery_method(const char *str);
 extern int set_e_recovery_method(struct conf *conf, enum recovery_method r);
 extern const char *rshash_to_str(enum rshash r);
+extern const char *chunking_to_str(enum chunking c);
+extern int str_to_chunking(const char *str);
+extern const char *strong_hash_to_str(enum strong_hash s);
+extern int str_to_strong_hash(const char *str);
 
 #endif
@@ -11,6 +11,7 @@
 #include "strlist.h"
 #include "times.h"
 #include "client/glob_windows.h"
+#include "protocol2/rabin/rconf.h"
 #include "conffile.h"
 
 static struct strlist *cli_overrides=NULL;
@@ -270,12 +271,30 @@ static int load_conf_field_and_value(struct conf **c,
 		if(compression<0) return -1;
 		set_int(c[OPT_COMPRESSION], compression);
 	}
+	else if(!strcmp(f, "blk_compression"))
+	{
+		int compression=get_compression(v);
+		if(compression<0) return -1;
+		set_int(c[OPT_BLK_COMPRESSION], compression);
+	}
 	else if(!strcmp(f, "ssl_compression"))
 	{
 		int compression=get_compression(v);
 		if(compression<0) return -1;
 		set_int(c[OPT_SSL_COMPRESSION], compression);
 	}
+	else if(!strcmp(f, "chunking"))
+	{
+		int chunking=str_to_chunking(v);
+		if(chunking<0) return -1;
+		set_int(c[OPT_CHUNKING], chunking);
+	}
+	else if(!strcmp(f, "strong_hash"))
+	{
+		int strong_hash=str_to_strong_hash(v);
+		if(strong_hash<0) return -1;
+		set_int(c[OPT_STRONG_HASH], strong_hash);
+	}
 	else if(!strcmp(f, "ratelimit"))
 	{
 		float f=0;
@@ -973,6 +992,41 @@ static void set_max_ext(struct strlist *list)
 	if(list) list->flag=max+1;
 }
 
+static int finalise_chunk_size_list(struct conf *conf, const char *what)
+{
+	struct rconf rconf;
+	struct strlist *l;
+	const char *rest=NULL;
+	for(l=get_strlist(conf); l; l=l->next)
+	{
+		rconf_init(&rconf);
+		if(rconf_parse_blk_sizes(&rconf, l->path, &rest))
+			return -1;
+		if(!*rest)
+		{
+			logp("%s needs to be 'min:avg:max:%s', not '%s'\n",
+				conf->field, what, l->path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Check the protocol2 block sizes now, rather than part way through a backup.
+static int finalise_chunk_sizes(struct conf **c)
+{
+	struct rconf rconf;
+	const char *chunk_size=get_string(c[OPT_CHUNK_SIZE]);
+
+	rconf_init(&rconf);
+	if(chunk_size && rconf_parse_blk_sizes(&rconf, chunk_size, NULL))
+		return -1;
+	if(finalise_chunk_size_list(c[OPT_CHUNK_SIZE_EXT], "extension")
+	  || finalise_chunk_size_list(c[OPT_CHUNK_SIZE_PATH], "path"))
+		return -1;
+	return 0;
+}
+
 static int finalise_fstypes(struct conf **c, int opt)
 {
 	struct strlist *l;
@@ -1161,6 +1215,9 @@ static int conf_finalise(struct conf **c)
 	set_max_ext(get_strlist(c[OPT_EXCEXT]));
 	set_max_ext(get_strlist(c[OPT_EXCOM]));
 
+	if(finalise_chunk_sizes(c))
+		return -1;
+
 	if(burp_mode==BURP_MODE_CLIENT
 	  && finalise_glob(c))
 		return -1;
@@ -10,6 +10,9 @@
 #include "server/protocol1/zlibio.h"
 #endif
 
+// Reading a bigger message makes it grow to fit.
+#define FZP_READ_AHEAD	(64*1024)
+
 static struct fzp *fzp_alloc(void)
 {
 	return (struct fzp *)calloc_w(1, sizeof(struct fzp), __func__);
@@ -19,6 +22,7 @@ static void fzp_free(struct fzp **fzp)
 {
 	if(!fzp || !*fzp) return;
 	free_w(&(*fzp)->buf);
+	free_w(&(*fzp)->ra);
 	free_v((void **)fzp);
 }
 
@@ -137,7 +141,19 @@ int fzp_close(struct fzp **fzp)
 	return ret;
 }
 
-int fzp_read(struct fzp *fzp, void *ptr, size_t nmemb)
+// Data that fzp_read_view() has read ahead is given out before anything
+// else from the file.
+static size_t ra_take(struct fzp *fzp, void *ptr, size_t nmemb)
+{
+	size_t got=fzp->ra_end-fzp->ra_start;
+	if(!got) return 0;
+	if(got>nmemb) got=nmemb;
+	memcpy(ptr, fzp->ra+fzp->ra_start, got);
+	fzp->ra_start+=got;
+	return got;
+}
+
+static int do_fzp_read(struct fzp *fzp, void *ptr, size_t nmemb)
 {
 	if(fzp) switch(fzp->type)
 	{
@@ -154,6 +170,17 @@ error:
 	return 0;
 }
 
+int fzp_read(struct fzp *fzp, void *ptr, size_t nmemb)
+{
+	int r;
+	size_t got=0;
+	if(fzp && (got=ra_take(fzp, ptr, nmemb))==nmemb)
+		return (int)got;
+	if((r=do_fzp_read(fzp, ((char *)ptr)+got, nmemb-got))<0)
+		return got?(int)got:r;
+	return (int)got+r;
+}
+
 size_t fzp_write(struct fzp *fzp, const void *ptr, size_t nmemb)
 {
 	if(fzp) switch(fzp->type)
@@ -171,7 +198,7 @@ error:
 	return 0;
 }
 
-int fzp_eof(struct fzp *fzp)
+static int do_fzp_eof(struct fzp *fzp)
 {
 	if(fzp) switch(fzp->type)
 	{
@@ -189,6 +216,13 @@ error:
 	return -1;
 }
 
+int fzp_eof(struct fzp *fzp)
+{
+	if(fzp && fzp->ra_start<fzp->ra_end)
+		return 0;
+	return do_fzp_eof(fzp);
+}
+
 int fzp_flush(struct fzp *fzp)
 {
 	if(fzp) switch(fzp->type)
@@ -208,6 +242,13 @@ error:
 
 int fzp_seek(struct fzp *fzp, off_t offset, int whence)
 {
+	if(fzp)
+	{
+		// The file is further on than the caller has got to.
+		if(whence==SEEK_CUR)
+			offset-=(off_t)(fzp->ra_end-fzp->ra_start);
+		fzp->ra_start=fzp->ra_end=0;
+	}
 	if(fzp) switch(fzp->type)
 	{
 		case FZP_FILE:
@@ -228,15 +269,20 @@ error:
 
 off_t fzp_tell(struct fzp *fzp)
 {
-	if(fzp) switch(fzp->type)
+	off_t ahead;
+	if(fzp)
 	{
-		case FZP_FILE:
-			return ftello(fzp->fp);
-		case FZP_COMPRESSED:
-			return gztell(fzp->zp);
-		default:
-			unknown_type(fzp->type, __func__);
-			goto error;
+		ahead=(off_t)(fzp->ra_end-fzp->ra_start);
+		switch(fzp->type)
+		{
+			case FZP_FILE:
+				return ftello(fzp->fp)-ahead;
+			case FZP_COMPRESSED:
+				return gztell(fzp->zp)-ahead;
+			default:
+				unknown_type(fzp->type, __func__);
+				goto error;
+		}
 	}
 	not_open(__func__);
 error:
@@ -490,10 +536,10 @@ static void pass_msg(size_t nmemb, size_t got, int pass)
 
 int fzp_read_ensure(struct fzp *fzp, void *ptr, size_t nmemb, const char *func)
 {
-	static int f;
-	static int r;
-	static size_t got;
-	static int pass;
+	static THREAD_LOCAL int f;
+	static THREAD_LOCAL int r;
+	static THREAD_LOCAL size_t got;
+	static THREAD_LOCAL int pass;
 	for(r=0, got=0, pass=0; got!=nmemb; pass++)
 	{
 		r=fzp_read(fzp, ((char *)ptr)+got, nmemb-got);
@@ -530,3 +576,79 @@ int fzp_read_ensure(struct fzp *fzp, void *ptr, size_t nmemb, const char *func)
 	}
 	return 0;
 }
+
+// Make at least nmemb bytes of read ahead data available, unless the file
+// ends first. Returns -1 on error, otherwise how much there is.
+static ssize_t ra_fill(struct fzp *fzp, size_t nmemb)
+{
+	int r;
+	int f;
+	size_t have=fzp->ra_end-fzp->ra_start;
+
+	if(have>=nmemb && fzp->ra)
+		return (ssize_t)have;
+	if(fzp->ra_start)
+	{
+		memmove(fzp->ra, fzp->ra+fzp->ra_start, have);
+		fzp->ra_start=0;
+		fzp->ra_end=have;
+	}
+	if(nmemb>fzp->ra_size || !fzp->ra)
+	{
+		size_t size=nmemb>FZP_READ_AHEAD?nmemb:FZP_READ_AHEAD;
+		if(!(fzp->ra=(char *)realloc_w(fzp->ra, size, __func__)))
+			return -1;
+		fzp->ra_size=size;
+	}
+	while(fzp->ra_end<nmemb)
+	{
+		r=do_fzp_read(fzp, fzp->ra+fzp->ra_end,
+			fzp->ra_size-fzp->ra_end);
+		if(r>0)
+		{
+			fzp->ra_end+=r;
+			continue;
+		}
+		if(r<0)
+			return -1;
+		f=do_fzp_eof(fzp);
+		if(!f) continue; // Not yet end of file, keep trying.
+		if(f<0)
+			return -1;
+		break;
+	}
+	return (ssize_t)fzp->ra_end;
+}
+
+// Like fzp_read_ensure(), but instead of copying the data, points view at
+// it. It stays there until the next read from fzp.
+// fzp_gets() does not know about the read ahead data, so do not use it on
+// the same fzp.
+int fzp_read_view(struct fzp *fzp, char **view, size_t nmemb,
+	const char *func)
+{
+	ssize_t got;
+
+	if(!fzp)
+	{
+		not_open(__func__);
+		return -1;
+	}
+	if((got=ra_fill(fzp, nmemb))<0)
+	{
+		logp("Error in %s, called from %s: %s\n",
+			__func__, func, strerror(errno));
+		return -1;
+	}
+	if((size_t)got<nmemb)
+	{
+		// End of file.
+		if(!got) return 1;
+		logp("Error in %s, called from %s: %lu bytes, eof\n",
+			__func__, func, (unsigned long)got);
+		return -1;
+	}
+	*view=fzp->ra+fzp->ra_start;
+	fzp->ra_start+=nmemb;
+	return 0;
+}
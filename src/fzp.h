@@ -19,6 +19,11 @@ struct fzp
 	};
 	char *buf;
 	size_t s;
+	uint8_t binary;		// Messages are written in binary form.
+	char *ra;		// Read ahead, for fzp_read_view().
+	size_t ra_size;
+	size_t ra_start;	// Next byte that has not been read.
+	size_t ra_end;
 };
 
 extern struct fzp *fzp_open(const char *path, const char *mode);
@@ -53,5 +58,7 @@ extern X509 *fzp_PEM_read_X509(struct fzp *fzp);
 
 extern int fzp_read_ensure(struct fzp *fzp, void *ptr, size_t nmemb,
 	const char *func);
+extern int fzp_read_view(struct fzp *fzp, char **view, size_t nmemb,
+	const char *func);
 
 #endif
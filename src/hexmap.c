@@ -32,8 +32,8 @@ void hexmap_init(void)
 
 static void str_to_bytes(const char *str, uint8_t *bytes, size_t len)
 {
-	static uint8_t bpos;
-	static uint8_t spos;
+	static THREAD_LOCAL uint8_t bpos;
+	static THREAD_LOCAL uint8_t spos;
 
 	for(bpos=0, spos=0; bpos<len && str[spos]; )
 	{
@@ -63,7 +63,7 @@ void md5str_to_bytes(const char *md5str, uint8_t *bytes)
 
 char *bytes_to_md5str(uint8_t *bytes)
 {
-        static char str[64];
+        static THREAD_LOCAL char str[64];
         snprintf(str, sizeof(str), "%016" PRIx64 "%016" PRIx64,
 		htobe64(*(uint64_t *)bytes), htobe64(*(uint64_t *)(bytes+8)));
         return str;
@@ -78,7 +78,7 @@ uint64_t savepathstr_with_sig_to_uint64(const char *savepathstr)
 
 static char *savepathstr_make(uint64_t *be_bytes)
 {
-        static char str[15];
+        static THREAD_LOCAL char str[15];
 	uint8_t *b=(uint8_t *)be_bytes;
         snprintf(str, sizeof(str), "%02X%02X/%02X%02X/%02X%02X",
                 b[0], b[1], b[2], b[3], b[4], b[5]);
@@ -93,7 +93,7 @@ char *uint64_to_savepathstr(uint64_t bytes)
 
 char *uint64_to_savepathstr_with_sig(uint64_t bytes)
 {
-        static char str[20];
+        static THREAD_LOCAL char str[20];
 	uint64_t be_bytes=htobe64(bytes);
 	uint8_t *b=(uint8_t *)&be_bytes;
         snprintf(str, sizeof(str), "%02X%02X/%02X%02X/%02X%02X/%02X%02X",
@@ -126,57 +126,227 @@ int iobuf_is_estimatable(struct iobuf *iobuf)
 	return cmd_is_estimatable(iobuf->cmd);
 }
 
-static int do_iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
+// The value of each hex digit in a text lead, and 0xFF for anything that is
+// not one.
+static const uint8_t hexval[256]={
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+// Returns -1 on error, 0 on OK.
+static int lead_to_len(const char *lead, size_t *len)
+{
+	uint8_t a=hexval[(uint8_t)lead[0]];
+	uint8_t b=hexval[(uint8_t)lead[1]];
+	uint8_t c=hexval[(uint8_t)lead[2]];
+	uint8_t d=hexval[(uint8_t)lead[3]];
+	if((a|b|c|d)&0xF0)
+		return -1;
+	*len=((size_t)a<<12)|((size_t)b<<8)|((size_t)c<<4)|d;
+	return 0;
+}
+
+// Returns -1 on error, 0 on OK.
+static int read_binary_header(struct fzp *fzp)
+{
+	char *version;
+	if(fzp_read_view(fzp, &version, 1, __func__))
+	{
+		logp("Error reading header in %s\n", __func__);
+		return -1;
+	}
+	if((uint8_t)*version!=MSG_BINARY_VERSION)
+	{
+		logp("Unsupported binary message version: %u\n",
+			(unsigned int)(uint8_t)*version);
+		return -1;
+	}
+	return 0;
+}
+
+// Returns -1 on error, 0 on OK.
+static int read_binary_len(struct fzp *fzp, size_t *len)
+{
+	int i;
+	char *v;
+	uint8_t c;
+	*len=0;
+	// MSG_LEN_MAX fits in three bytes.
+	for(i=0; i<3; i++)
+	{
+		if(fzp_read_view(fzp, &v, 1, __func__))
+		{
+			logp("Error reading length in %s\n", __func__);
+			return -1;
+		}
+		c=(uint8_t)*v;
+		*len|=(size_t)(c&0x7F)<<(7*i);
+		if(c&0x80)
+			continue;
+		if(*len>MSG_LEN_MAX)
+			break;
+		return 0;
+	}
+	logp("Bad message length in %s\n", __func__);
+	return -1;
+}
+
+static int do_iobuf_view_from_fzp(struct iobuf *iobuf, struct fzp *fzp,
 	int extra_bytes)
 {
-	unsigned int s;
-	char lead[6]="";
-	char command;
-	int r;
+	char *lead;
+	uint8_t command;
 
-	r=fzp_read_ensure(fzp, lead, sizeof(lead)-1, __func__);
-	lead[5]='\0';
-	switch(r)
+	while(1)
 	{
-		case 0: break; // OK.
-		case 1: return 1; // Finished OK.
-		default:
+		switch(fzp_read_view(fzp, &lead, 1, __func__))
 		{
-			logp("Error reading lead in %s\n", __func__);
-			return -1; // Error.
+			case 0: break; // OK.
+			case 1: return 1; // Finished OK.
+			default:
+			{
+				logp("Error reading lead in %s\n", __func__);
+				return -1; // Error.
+			}
 		}
+		if((uint8_t)*lead!=MSG_BINARY_HEADER)
+			break;
+		if(read_binary_header(fzp))
+			return -1;
 	}
-	if((sscanf(lead, "%c%04X", &command, &s))!=2)
+	command=(uint8_t)*lead;
+	if(command&MSG_BINARY_FLAG)
 	{
-		logp("sscanf failed reading manifest: %s\n", lead);
-		return -1;
+		iobuf->cmd=(enum cmd)(command&~MSG_BINARY_FLAG);
+		if(read_binary_len(fzp, &iobuf->len))
+			return -1;
+		// No newline after binary messages.
+		extra_bytes=0;
 	}
-	iobuf->cmd=(enum cmd)command;
-	iobuf->len=(size_t)s;
-	if(!(iobuf->buf=(char *)malloc_w(
-		iobuf->len+extra_bytes+1, __func__)))
+	else
+	{
+		if(fzp_read_view(fzp, &lead, 4, __func__))
+		{
+			logp("Error reading lead in %s\n", __func__);
 			return -1;
-	switch(fzp_read_ensure(fzp,
-		iobuf->buf, iobuf->len+extra_bytes, __func__))
+		}
+		if(lead_to_len(lead, &iobuf->len))
+		{
+			logp("Bad lead in manifest: %c%.4s\n",
+				command, lead);
+			return -1;
+		}
+		iobuf->cmd=(enum cmd)command;
+	}
+	switch(fzp_read_view(fzp,
+		&iobuf->buf, iobuf->len+extra_bytes, __func__))
 	{
-		case 0: break; // OK.
+		case 0: return 0; // OK.
 		case 1: return 1; // Finished OK.
 		default:
-			logp("Error attempting to read after %s in %s (%c:%u)\n", lead, __func__, iobuf->cmd, s);
+			logp("Error attempting to read after %c:%lu in %s\n",
+				iobuf->cmd, (unsigned long)iobuf->len,
+				__func__);
 			return -1;
 	}
-	iobuf->buf[iobuf->len]='\0';
+}
+
+// The message is left in the read ahead data of fzp, where it stays until
+// the next read from fzp, and it is not NUL terminated. Use iobuf_keep() to
+// hold on to it for longer, and never free it.
+int iobuf_view_from_fzp(struct iobuf *iobuf, struct fzp *fzp)
+{
+	return do_iobuf_view_from_fzp(iobuf, fzp, 1 /*newline*/);
+}
+
+int iobuf_view_from_fzp_data(struct iobuf *iobuf, struct fzp *fzp)
+{
+	return do_iobuf_view_from_fzp(iobuf, fzp, 0 /*no newline*/);
+}
+
+// The same for a data file record that is already in memory, such as one
+// read with pread(). It has to fill all 'len' bytes of buf.
+int iobuf_view_from_buf_data(struct iobuf *iobuf, char *buf, size_t len)
+{
+	if(len<5 || lead_to_len(buf+1, &iobuf->len) || iobuf->len!=len-5)
+	{
+		logp("Bad data record in %s\n", __func__);
+		return -1;
+	}
+	iobuf->cmd=(enum cmd)buf[0];
+	iobuf->buf=buf+5;
+	return 0;
+}
+
+// How long the data file record at the start of buf is, tag included, if
+// all of it is within the 'avail' bytes.
+int iobuf_buf_data_len(const char *buf, size_t avail, size_t *len)
+{
+	if(avail<5 || lead_to_len(buf+1, len) || *len>avail-5)
+		return -1;
+	*len+=5;
+	return 0;
+}
+
+// Turn a view into a NUL terminated copy that belongs to the iobuf.
+int iobuf_keep(struct iobuf *iobuf)
+{
+	char *buf;
+	if(!(buf=(char *)malloc_w(iobuf->len+1, __func__)))
+	{
+		iobuf->buf=NULL;
+		return -1;
+	}
+	memcpy(buf, iobuf->buf, iobuf->len);
+	buf[iobuf->len]='\0';
+	iobuf->buf=buf;
 	return 0;
 }
 
 int iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp)
 {
-	return do_iobuf_fill_from_fzp(iobuf, fzp, 1 /*newline*/);
+	int ret;
+	if((ret=iobuf_view_from_fzp(iobuf, fzp)))
+		return ret;
+	return iobuf_keep(iobuf);
 }
 
 int iobuf_fill_from_fzp_data(struct iobuf *iobuf, struct fzp *fzp)
 {
-	return do_iobuf_fill_from_fzp(iobuf, fzp, 0 /*no newline*/);
+	int ret;
+	if((ret=iobuf_view_from_fzp_data(iobuf, fzp)))
+		return ret;
+	return iobuf_keep(iobuf);
 }
 
 static int is_printable(struct iobuf *iobuf)
@@ -190,7 +360,7 @@ static int is_printable(struct iobuf *iobuf)
 
 const char *iobuf_to_printable(struct iobuf *iobuf)
 {
-	static char str[256]="";
+	static THREAD_LOCAL char str[256]="";
 	if(is_printable(iobuf))
 		snprintf(str, sizeof(str),
 			"%c:%04X:%s", iobuf->cmd, (int)iobuf->len, iobuf->buf);
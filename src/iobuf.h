@@ -36,6 +36,12 @@ extern int iobuf_is_estimatable(struct iobuf *iobuf);
 
 extern int iobuf_fill_from_fzp(struct iobuf *iobuf, struct fzp *fzp);
 extern int iobuf_fill_from_fzp_data(struct iobuf *iobuf, struct fzp *fzp);
+extern int iobuf_view_from_fzp(struct iobuf *iobuf, struct fzp *fzp);
+extern int iobuf_view_from_fzp_data(struct iobuf *iobuf, struct fzp *fzp);
+extern int iobuf_view_from_buf_data(struct iobuf *iobuf, char *buf,
+	size_t len);
+extern int iobuf_buf_data_len(const char *buf, size_t avail, size_t *len);
+extern int iobuf_keep(struct iobuf *iobuf);
 
 extern const char *iobuf_to_printable(struct iobuf *iobuf);
 
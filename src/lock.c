@@ -3,6 +3,64 @@
 #include "lock.h"
 #include "log.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// lockf() locks belong to the process, not to the file descriptor. So a
+// second thread would be given a lock that the process already holds, and
+// closing the descriptor in lock_test() would drop it. So remember which
+// locks this process holds, and check that first.
+struct held
+{
+	char *path;
+	pid_t pid;
+	struct held *next;
+};
+
+static struct held *held_list=NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t held_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void held_mutex_lock(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&held_mutex);
+#endif
+}
+
+static void held_mutex_unlock(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&held_mutex);
+#endif
+}
+
+// Entries left over from before a fork belong to the parent, and lockf()
+// locks are not passed on to children, so they do not count.
+static struct held **held_find(const char *path)
+{
+	struct held **h;
+	pid_t pid=getpid();
+	for(h=&held_list; *h; h=&(*h)->next)
+		if((*h)->pid==pid && !strcmp((*h)->path, path))
+			return h;
+	return NULL;
+}
+
+static void held_remove(const char *path)
+{
+	struct held *h;
+	struct held **hp;
+	if(!(hp=held_find(path)))
+		return;
+	h=*hp;
+	*hp=h->next;
+	free_w(&h->path);
+	free_v((void **)&h);
+}
+
 struct lock *lock_alloc(void)
 {
 	return (struct lock *)calloc_w(1, sizeof(struct lock), __func__);
@@ -36,13 +94,26 @@ void lock_free(struct lock **lock)
 	free_v((void **)lock);
 }
 
-void lock_get_quick(struct lock *lock)
+#if !defined(HAVE_WIN32) && defined(HAVE_LOCKF)
+static int held_add(const char *path)
 {
-#if defined(HAVE_WIN32) || !defined(HAVE_LOCKF)
-	// Would somebody please tell me how to get a lock on Windows?!
-	lock->status=GET_LOCK_GOT;
-	return;
-#else
+	struct held *h;
+	if(!(h=(struct held *)calloc_w(1, sizeof(struct held), __func__))
+	  || !(h->path=strdup_w(path, __func__)))
+	{
+		free_v((void **)&h);
+		return -1;
+	}
+	h->pid=getpid();
+	h->next=held_list;
+	held_list=h;
+	return 0;
+}
+
+static void do_lock_get_quick(struct lock *lock)
+{
+	if(held_find(lock->path))
+		goto notgot;
 	if((lock->fd=open(
 		lock->path,
 #ifdef O_NOFOLLOW
@@ -64,7 +135,8 @@ void lock_get_quick(struct lock *lock)
 			lock->path, strerror(errno));
 		goto error; // Some other error.
 	}
-	if(lock_write_pid(lock))
+	if(lock_write_pid(lock)
+	  || held_add(lock->path))
 		goto error;
 	
 	lock->status=GET_LOCK_GOT;
@@ -75,6 +147,19 @@ error:
 notgot:
 	lock->status=GET_LOCK_NOT_GOT;
 	return;
+}
+#endif
+
+void lock_get_quick(struct lock *lock)
+{
+#if defined(HAVE_WIN32) || !defined(HAVE_LOCKF)
+	// Would somebody please tell me how to get a lock on Windows?!
+	lock->status=GET_LOCK_GOT;
+	return;
+#else
+	held_mutex_lock();
+	do_lock_get_quick(lock);
+	held_mutex_unlock();
 #endif
 }
 
@@ -143,19 +228,24 @@ int lock_test(const char *path)
 #else
 	int r=0;
 	int fdlock;
+	int ret=0;
 
+	held_mutex_lock();
+	if(held_find(path))
+	{
+		// held by this process
+		ret=-1;
+		goto end;
+	}
 	if((fdlock=open(path, O_WRONLY, 0666))<0)
-		return 0; // file does not exist - could have got the lock
+		goto end; // file does not exist - could have got the lock
 	errno=0;
 	if((r=lockf(fdlock, F_TLOCK, 0)) && (errno==EAGAIN || errno==EACCES))
-	{
-		// could not have got the lock
-		close(fdlock);
-		return -1;
-	}
+		ret=-1; // could not have got the lock
 	close(fdlock);
-	// could have got the lock
-	return 0;
+end:
+	held_mutex_unlock();
+	return ret;
 #endif
 }
 
@@ -163,7 +253,14 @@ int lock_release(struct lock *lock)
 {
 	int ret=0;
 	if(!lock || lock->status!=GET_LOCK_GOT) return 0;
-	if(lock->path) unlink(lock->path);
+	// Closing has to happen before another thread can get the lock, or it
+	// would drop the new one.
+	held_mutex_lock();
+	if(lock->path)
+	{
+		unlink(lock->path);
+		held_remove(lock->path);
+	}
 	if(lock->fd>=0)
 	{
 		if((ret=close(lock->fd)))
@@ -171,6 +268,7 @@ int lock_release(struct lock *lock)
 				lock->path, strerror(errno));
 		lock->fd=-1;
 	}
+	held_mutex_unlock();
 	lock->status=GET_LOCK_NOT_GOT;
 	return ret;
 }
@@ -13,6 +13,9 @@ const char *prog="unknown";
 const char *prog_long="unknown";
 
 static struct fzp *logfzp=NULL;
+// Overrides logfzp for the thread that sets it, so that a champ chooser
+// thread can have its own log file.
+static THREAD_LOCAL struct fzp *thread_logfzp=NULL;
 // Start with all logging on, so that something is said when initial startup
 // goes wrong - for example, reading the conf file.
 static int do_syslog=1;
@@ -28,17 +31,23 @@ void log_init(char *progname)
 	else prog=progname;
 }
 
+static struct fzp *get_logfzp(void)
+{
+	return thread_logfzp?thread_logfzp:logfzp;
+}
+
 void logp(const char *fmt, ...)
 {
 #ifndef UTEST
 	int pid;
 	char buf[512]="";
+	struct fzp *fzp=get_logfzp();
 	va_list ap;
 	va_start(ap, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, ap);
 	pid=(int)getpid();
-	if(logfzp)
-		fzp_printf(logfzp, "%s: %s[%d] %s",
+	if(fzp)
+		fzp_printf(fzp, "%s: %s[%d] %s",
 			gettimenow(), prog, pid, buf);
 	else
 	{
@@ -74,12 +83,13 @@ void logp(const char *fmt, ...)
 void logp_ssl_err(const char *fmt, ...)
 {
 	char buf[512]="";
+	struct fzp *fzp=get_logfzp();
 	va_list ap;
 	va_start(ap, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 	logp("%s", buf);
-	if(logfzp) fzp_ERR_print_errors_fp(logfzp);
+	if(fzp) fzp_ERR_print_errors_fp(fzp);
 	else
 	{
 		if(do_syslog)
@@ -106,11 +116,12 @@ void logp_ssl_err(const char *fmt, ...)
 void logc(const char *fmt, ...)
 {
 	char buf[512]="";
+	struct fzp *fzp=get_logfzp();
 	va_list ap;
 	va_start(ap, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, ap);
-	if(logfzp)
-		fzp_printf(logfzp, "%s", buf); // for the server side
+	if(fzp)
+		fzp_printf(fzp, "%s", buf); // for the server side
 	else
 	{
 		if(do_progress_counter
@@ -171,6 +182,13 @@ void log_fzp_set_direct(struct fzp *fzp)
 	logfzp=fzp;
 }
 
+// Only affects the calling thread.
+void log_fzp_set_thread(struct fzp *fzp)
+{
+	fzp_close(&thread_logfzp);
+	thread_logfzp=fzp;
+}
+
 void log_out_of_memory(const char *function)
 {
 	if(function) logp("out of memory in %s()\n", function);
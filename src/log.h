@@ -14,6 +14,7 @@ extern void log_init(char *progname);
 extern const char *progname(void);
 extern int log_fzp_set(const char *path, struct conf **confs);
 extern void log_fzp_set_direct(struct fzp *fzp);
+extern void log_fzp_set_thread(struct fzp *fzp);
 extern void log_out_of_memory(const char *function);
 extern void log_restore_settings(struct conf **cconfs, int srestore);
 extern void log_and_send(struct asfd *asfd, const char *msg);
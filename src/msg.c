@@ -8,8 +8,40 @@
 #include "log.h"
 #include "msg.h"
 
+static int send_msg_fzp_binary(struct fzp *fzp,
+	enum cmd cmd, const char *buf, size_t s)
+{
+	size_t l=0;
+	size_t v=s;
+	uint8_t lead[4];
+
+	if(s>MSG_LEN_MAX)
+	{
+		logp("Message too long to write to file: %lu\n",
+			(unsigned long)s);
+		return -1;
+	}
+	lead[l++]=(uint8_t)cmd|MSG_BINARY_FLAG;
+	do
+	{
+		lead[l]=v&0x7F;
+		if(v>>=7)
+			lead[l]|=0x80;
+		l++;
+	} while(v);
+	if(fzp_write(fzp, lead, l)!=l
+	  || fzp_write(fzp, buf, s)!=s)
+	{
+		logp("Unable to write message to file: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 int send_msg_fzp(struct fzp *fzp, enum cmd cmd, const char *buf, size_t s)
 {
+	if(fzp->binary)
+		return send_msg_fzp_binary(fzp, cmd, buf, s);
 	if(fzp_printf(fzp, "%c%04X", cmd, (unsigned int)s)!=5
 	  || fzp_write(fzp, buf, s)!=s
 	  || fzp_printf(fzp, "\n")!=1)
@@ -20,6 +52,19 @@ int send_msg_fzp(struct fzp *fzp, enum cmd cmd, const char *buf, size_t s)
 	return 0;
 }
 
+// Everything sent to fzp from now on is in binary form.
+int send_msg_fzp_binary_start(struct fzp *fzp)
+{
+	uint8_t header[2]={MSG_BINARY_HEADER, MSG_BINARY_VERSION};
+	if(fzp_write(fzp, header, sizeof(header))!=sizeof(header))
+	{
+		logp("Unable to write header to file: %s\n", strerror(errno));
+		return -1;
+	}
+	fzp->binary=1;
+	return 0;
+}
+
 static int do_write(struct asfd *asfd, struct BFILE *bfd,
 	uint8_t *out, size_t outlen, uint64_t *sent)
 {
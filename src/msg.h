@@ -6,8 +6,18 @@
 #include "cmd.h"
 #include "fzp.h"
 
+// Text messages start with the command and four hex digits of length.
+// Binary ones start with the command with its top bit set, which a text
+// message never has, followed by the length as a varint. A file of binary
+// messages starts with MSG_BINARY_HEADER and a version byte.
+#define MSG_BINARY_FLAG		0x80
+#define MSG_BINARY_HEADER	0xFF
+#define MSG_BINARY_VERSION	1
+#define MSG_LEN_MAX		0xFFFF
+
 extern int send_msg_fzp(struct fzp *fzp,
 	enum cmd cmd, const char *buf, size_t s);
+extern int send_msg_fzp_binary_start(struct fzp *fzp);
 extern int transfer_gzfile_in(struct asfd *asfd, struct BFILE *bfd,
 	uint64_t *rcvd, uint64_t *sent);
 
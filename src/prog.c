@@ -9,8 +9,10 @@
 #include "lock.h"
 #include "log.h"
 #include "strlist.h"
+#include "server/bmanifest.h"
 #include "server/main.h"
 #include "server/protocol1/bedup.h"
+#include "server/protocol2/bcompact.h"
 #include "server/protocol2/bsigs.h"
 #include "server/protocol2/bsparse.h"
 #include "server/protocol2/champ_chooser/champ_server.h"
@@ -328,8 +330,12 @@ int real_main(int argc, char *argv[])
 
 	log_init(argv[0]);
 #ifndef HAVE_WIN32
+	if(!strcmp(prog, "bcompact"))
+		return run_bcompact(argc, argv);
 	if(!strcmp(prog, "bedup"))
 		return run_bedup(argc, argv);
+	if(!strcmp(prog, "bmanifest"))
+		return run_bmanifest(argc, argv);
 	if(!strcmp(prog, "bsigs"))
 		return run_bsigs(argc, argv);
 	if(!strcmp(prog, "bsparse"))
@@ -1,4 +1,5 @@
 #include "../burp.h"
+#include <zlib.h>
 #include "blk.h"
 #include "../alloc.h"
 #include "../hexmap.h"
@@ -7,6 +8,32 @@
 #include "../protocol2/rabin/rabin.h"
 #include "rabin/rconf.h"
 
+struct blk_buf *blk_buf_alloc(size_t len)
+{
+	struct blk_buf *buf=NULL;
+	if(!(buf=(struct blk_buf *)
+		calloc_w(1, sizeof(struct blk_buf), __func__))
+	  || !(buf->buf=(char *)malloc_w(len, __func__)))
+		goto end;
+	buf->len=len;
+	buf->refs=1;
+	return buf;
+end:
+	blk_buf_unref(&buf);
+	return NULL;
+}
+
+void blk_buf_unref(struct blk_buf **buf)
+{
+	if(!buf || !*buf) return;
+	if(--(*buf)->refs<=0)
+	{
+		free_w(&(*buf)->buf);
+		free_v((void **)buf);
+	}
+	*buf=NULL;
+}
+
 struct blk *blk_alloc(void)
 {
 	return (struct blk *)calloc_w(1, sizeof(struct blk), __func__);
@@ -28,9 +55,25 @@ end:
 void blk_free_content(struct blk *blk)
 {
 	if(!blk) return;
+	if(blk->buf)
+	{
+		// The data belongs to the shared buffer.
+		blk->data=NULL;
+		blk_buf_unref(&blk->buf);
+		return;
+	}
 	free_w(&blk->data);
 }
 
+// Point the block at data inside a shared buffer, without copying it.
+void blk_set_data_view(struct blk *blk, struct blk_buf *buf, char *data)
+{
+	blk_free_content(blk);
+	blk->data=data;
+	blk->buf=buf;
+	buf->refs++;
+}
+
 void blk_free(struct blk **blk)
 {
 	if(!blk || !*blk) return;
@@ -51,19 +94,81 @@ static int md5_generation(uint8_t md5sum[], const char *data, uint32_t length)
 	return 0;
 }
 
-int blk_md5_update(struct blk *blk)
+#ifdef HAVE_EVP_BLAKE2B512
+// BLAKE2b is quicker than MD5 on 64 bit machines. The first
+// MD5_DIGEST_LENGTH bytes of the digest are kept, so that the manifests and
+// the champ chooser do not need to change.
+static int blake2b_generation(uint8_t md5sum[],
+	const char *data, uint32_t length)
+{
+	unsigned int len=0;
+	uint8_t digest[EVP_MAX_MD_SIZE];
+	if(!EVP_Digest(data, length, digest, &len, EVP_blake2b512(), NULL)
+	  || len<MD5_DIGEST_LENGTH)
+	{
+		logp("BLAKE2b generation failed.\n");
+		return -1;
+	}
+	memcpy(md5sum, digest, MD5_DIGEST_LENGTH);
+	return 0;
+}
+#endif
+
+int blk_strong_hash_supported(enum strong_hash strong_hash)
+{
+	switch(strong_hash)
+	{
+		case STRONG_HASH_MD5:
+			return 1;
+#ifdef HAVE_EVP_BLAKE2B512
+		case STRONG_HASH_BLAKE2B:
+			return 1;
+#endif
+		default:
+			return 0;
+	}
+}
+
+static int strong_hash_generation(enum strong_hash strong_hash,
+	uint8_t md5sum[], const char *data, uint32_t length)
 {
-	return md5_generation(blk->md5sum, blk->data, blk->length);
+	switch(strong_hash)
+	{
+		case STRONG_HASH_MD5:
+			return md5_generation(md5sum, data, length);
+#ifdef HAVE_EVP_BLAKE2B512
+		case STRONG_HASH_BLAKE2B:
+			return blake2b_generation(md5sum, data, length);
+#endif
+		default:
+			logp("Strong hash %s not supported\n",
+				strong_hash_to_str(strong_hash));
+			return -1;
+	}
+}
+
+int blk_strong_hash_update(struct blk *blk)
+{
+	return strong_hash_generation((enum strong_hash)blk->strong_hash,
+		blk->md5sum, blk->data, blk->length);
 }
 
 int blk_is_zero_length(struct blk *blk)
 {
-	return !blk->fingerprint // All zeroes.
-	  && !memcmp(blk->md5sum, md5sum_of_empty_string, MD5_DIGEST_LENGTH);
+	uint8_t empty[MD5_DIGEST_LENGTH];
+	if(blk->fingerprint) // Not all zeroes.
+		return 0;
+	if(blk->strong_hash==STRONG_HASH_MD5)
+		return !memcmp(blk->md5sum,
+			md5sum_of_empty_string, MD5_DIGEST_LENGTH);
+	if(strong_hash_generation((enum strong_hash)blk->strong_hash,
+		empty, "", 0))
+			return 0;
+	return !memcmp(blk->md5sum, empty, MD5_DIGEST_LENGTH);
 }
 
-int blk_verify(uint64_t fingerprint, uint8_t *md5sum,
-	char *data, size_t length)
+int blk_verify(uint64_t fingerprint, enum strong_hash strong_hash,
+	uint8_t *md5sum, char *data, size_t length)
 {
 	uint8_t md5sum_new[MD5_DIGEST_LENGTH];
 
@@ -74,7 +179,7 @@ int blk_verify(uint64_t fingerprint, uint8_t *md5sum,
 		default: return -1;
 	}
 
-	if(md5_generation(md5sum_new, data, length))
+	if(strong_hash_generation(strong_hash, md5sum_new, data, length))
 		return -1;
 	if(!memcmp(md5sum_new, md5sum, MD5_DIGEST_LENGTH))
 		return 1;
@@ -101,11 +206,35 @@ static void set_fingerprint(struct blk *blk, struct iobuf *iobuf)
 	blk->fingerprint=ETOH(*(uint64_t *)iobuf->buf);
 }
 
-static void set_sig(struct blk *blk, struct iobuf *iobuf)
+// Signatures using a strong hash other than MD5 have an extra byte on the
+// end saying which one it was. Signatures without it are MD5, which keeps
+// the format of older manifests.
+static int set_sig(struct blk *blk, struct iobuf *iobuf, size_t len)
 {
 	set_fingerprint(blk, iobuf);
 	memcpy(blk->md5sum, iobuf->buf+8, 8);
 	memcpy(blk->md5sum+8, iobuf->buf+16, 8);
+	blk->strong_hash=STRONG_HASH_MD5;
+	if(iobuf->len==len)
+		return 0;
+	blk->strong_hash=(uint8_t)iobuf->buf[len];
+	if(blk->strong_hash==STRONG_HASH_MD5)
+	{
+		logp("Signature has unexpected strong hash byte\n");
+		return -1;
+	}
+	if(!blk_strong_hash_supported((enum strong_hash)blk->strong_hash))
+	{
+		logp("Signature has unsupported strong hash: %d\n",
+			blk->strong_hash);
+		return -1;
+	}
+	return 0;
+}
+
+static size_t sig_strong_hash_len(struct blk *blk)
+{
+	return blk->strong_hash==STRONG_HASH_MD5?0:1;
 }
 
 static void set_savepath(struct blk *blk, struct iobuf *iobuf, size_t offset)
@@ -115,27 +244,26 @@ static void set_savepath(struct blk *blk, struct iobuf *iobuf, size_t offset)
 
 int blk_set_from_iobuf_sig(struct blk *blk, struct iobuf *iobuf)
 {
-	if(iobuf->len!=24)
+	if(iobuf->len!=24 && iobuf->len!=25)
 	{
-		logp("Signature wrong length: %lu!=24\n",
+		logp("Signature wrong length: %lu!=24/25\n",
 			(unsigned long)iobuf->len);
 		return -1;
 	}
-	set_sig(blk, iobuf);
-	return 0;
+	return set_sig(blk, iobuf, 24);
 }
 
 int blk_set_from_iobuf_sig_and_savepath(struct blk *blk, struct iobuf *iobuf)
 {
-	if(iobuf->len!=32)
+	if(iobuf->len!=32 && iobuf->len!=33)
 	{
-		logp("Signature with save_path wrong length: %lu!=32\n",
+		logp("Signature with save_path wrong length: %lu!=32/33\n",
 			(unsigned long)iobuf->len);
 		return -1;
 	}
-	set_sig(blk, iobuf);
 	set_savepath(blk, iobuf, 24 /* offset */);
-	return 0;
+	// The strong hash byte comes after the save path.
+	return set_sig(blk, iobuf, 32);
 }
 
 int blk_set_from_iobuf_fingerprint(struct blk *blk, struct iobuf *iobuf)
@@ -192,26 +320,28 @@ int blk_set_from_iobuf_wrap_up(struct blk *blk, struct iobuf *iobuf)
 
 void blk_to_iobuf_sig(struct blk *blk, struct iobuf *iobuf)
 {
-	static union { char c[24]; uint64_t v[3]; } buf;
+	static THREAD_LOCAL union { char c[32]; uint64_t v[4]; } buf;
 	buf.v[0]=HTOE(blk->fingerprint);
 	memcpy(&buf.c[8], blk->md5sum, 8);
 	memcpy(&buf.c[16], blk->md5sum+8, 8);
-	iobuf_set(iobuf, CMD_SIG, buf.c, sizeof(buf));
+	buf.c[24]=(char)blk->strong_hash;
+	iobuf_set(iobuf, CMD_SIG, buf.c, 24+sig_strong_hash_len(blk));
 }
 
 void blk_to_iobuf_sig_and_savepath(struct blk *blk, struct iobuf *iobuf)
 {
-	static union { char c[32]; uint64_t v[4]; } buf;
+	static THREAD_LOCAL union { char c[40]; uint64_t v[5]; } buf;
 	buf.v[0]=HTOE(blk->fingerprint);
 	memcpy(&buf.c[8], blk->md5sum, 8);
 	memcpy(&buf.c[16], blk->md5sum+8, 8);
 	buf.v[3]=HTOE(blk->savepath);
-	iobuf_set(iobuf, CMD_SIG, buf.c, sizeof(buf));
+	buf.c[32]=(char)blk->strong_hash;
+	iobuf_set(iobuf, CMD_SIG, buf.c, 32+sig_strong_hash_len(blk));
 }
 
 static void to_iobuf_uint64(struct iobuf *iobuf, enum cmd cmd, uint64_t val)
 {
-	static union { char c[8]; uint64_t v; } buf;
+	static THREAD_LOCAL union { char c[8]; uint64_t v; } buf;
 	buf.v=HTOE(val);
 	iobuf_set(iobuf, cmd, buf.c, sizeof(buf));
 }
@@ -228,7 +358,7 @@ void blk_to_iobuf_savepath(struct blk *blk, struct iobuf *iobuf)
 
 void blk_to_iobuf_index_and_savepath(struct blk *blk, struct iobuf *iobuf)
 {
-	static union { char c[16]; uint64_t v[2]; } buf;
+	static THREAD_LOCAL union { char c[16]; uint64_t v[2]; } buf;
 	buf.v[0]=HTOE(blk->index);
 	buf.v[1]=HTOE(blk->savepath);
 	iobuf_set(iobuf, CMD_SIG, buf.c, sizeof(buf));
@@ -239,9 +369,161 @@ void blk_to_iobuf_wrap_up(struct blk *blk, struct iobuf *iobuf)
 	to_iobuf_uint64(iobuf, CMD_WRAP_UP, blk->index);
 }
 
+// A request for the data of count blocks, starting at blk->index.
+void blk_to_iobuf_data_req_range(struct blk *blk, uint64_t count,
+	struct iobuf *iobuf)
+{
+	static THREAD_LOCAL union { char c[16]; uint64_t v[2]; } buf;
+	buf.v[0]=HTOE(blk->index);
+	buf.v[1]=HTOE(count);
+	iobuf_set(iobuf, CMD_DATA_REQS, buf.c, sizeof(buf));
+}
+
+int blk_set_from_iobuf_data_req_range(struct blk *blk,
+	uint64_t *count, struct iobuf *iobuf)
+{
+	if(iobuf->len!=16)
+	{
+		logp("Data request range with wrong length: %lu!=16\n",
+			(unsigned long)iobuf->len);
+		return -1;
+	}
+	blk->index=ETOH(*(uint64_t *)iobuf->buf);
+	*count=ETOH(*(uint64_t *)(iobuf->buf+8));
+	if(!*count)
+	{
+		logp("Data request range with no blocks\n");
+		return -1;
+	}
+	return 0;
+}
+
+void blk_batch_init(struct blk_batch *batch, enum cmd cmd)
+{
+	batch->cmd=cmd;
+	batch->reclen=0;
+	batch->count=0;
+}
+
+// Copy a record into the batch. Returns -1 if it will not fit, because the
+// batch is full or the record has a different length to the others. Send
+// the batch and try again in that case.
+int blk_batch_add(struct blk_batch *batch, struct iobuf *rec)
+{
+	if(!rec->len || rec->len>0xFF)
+		return -1;
+	if(batch->count)
+	{
+		if(rec->len!=batch->reclen
+		  || (batch->count+1)*batch->reclen>BLK_BATCH_LEN)
+			return -1;
+	}
+	else
+		batch->reclen=rec->len;
+	memcpy(batch->buf+1+batch->count*batch->reclen, rec->buf, rec->len);
+	batch->count++;
+	return 0;
+}
+
+// Point the iobuf at the records in the batch, and empty the batch for the
+// next lot. The records stay where they are until something else is added,
+// so the iobuf needs to be written first. Returns 0 if the batch was empty.
+int blk_batch_to_iobuf(struct blk_batch *batch, struct iobuf *iobuf)
+{
+	if(!batch->count)
+		return 0;
+	batch->buf[0]=(char)batch->reclen;
+	iobuf_set(iobuf, batch->cmd, batch->buf,
+		1+batch->count*batch->reclen);
+	batch->count=0;
+	return 1;
+}
+
+// Get the next record from a batch that has been read, starting with
+// *offset set to 0. Returns 1 for got a record, 0 for no more, and -1 if
+// the batch is not the right shape.
+int blk_batch_next(struct iobuf *iobuf, size_t *offset, struct iobuf *rec)
+{
+	size_t reclen;
+	if(iobuf->len<2 || !(reclen=(unsigned char)iobuf->buf[0])
+	  || (iobuf->len-1)%reclen)
+	{
+		logp("Batch has wrong length: %lu\n",
+			(unsigned long)iobuf->len);
+		return -1;
+	}
+	if(*offset+reclen>iobuf->len-1)
+		return 0;
+	iobuf_set(rec, iobuf->cmd, iobuf->buf+1+*offset, reclen);
+	*offset+=reclen;
+	return 1;
+}
+
+// Blocks in data files can be stored as CMD_DATA_COMP instead of CMD_DATA.
+// That is the original length in two bytes, big endian, then the zlib data.
+#define BLK_COMP_HDR	2
+
+// Compress a block into 'out', which has room for *outlen bytes. Returns 0
+// if it came out smaller than it went in, 1 if it is not worth storing
+// compressed, and -1 on error.
+int blk_data_compress(int level, const char *in, size_t len,
+	char *out, size_t *outlen)
+{
+	uLongf dlen;
+	if(len>0xFFFF || *outlen<=BLK_COMP_HDR)
+		return 1;
+	dlen=*outlen-BLK_COMP_HDR;
+	switch(compress2((Bytef *)out+BLK_COMP_HDR, &dlen,
+		(const Bytef *)in, (uLong)len, level))
+	{
+		case Z_OK:
+			break;
+		case Z_BUF_ERROR:
+			return 1; // Did not fit.
+		default:
+			logp("Block compression failed\n");
+			return -1;
+	}
+	if(dlen+BLK_COMP_HDR>=len)
+		return 1;
+	out[0]=(char)((len>>8)&0xFF);
+	out[1]=(char)(len&0xFF);
+	*outlen=dlen+BLK_COMP_HDR;
+	return 0;
+}
+
+// Turn a CMD_DATA_COMP iobuf into a newly allocated CMD_DATA one.
+int blk_data_decompress(struct iobuf *in, struct iobuf *out)
+{
+	size_t len;
+	uLongf dlen;
+	char *buf=NULL;
+	if(in->len<=BLK_COMP_HDR)
+	{
+		logp("Compressed block too short: %lu\n",
+			(unsigned long)in->len);
+		return -1;
+	}
+	len=((unsigned char)in->buf[0]<<8)|(unsigned char)in->buf[1];
+	if(!(buf=(char *)malloc_w(len?len:1, __func__)))
+		return -1;
+	dlen=len;
+	if(uncompress((Bytef *)buf, &dlen,
+		(const Bytef *)in->buf+BLK_COMP_HDR,
+		(uLong)(in->len-BLK_COMP_HDR))!=Z_OK
+	  || dlen!=len)
+	{
+		logp("Could not decompress block\n");
+		free_w(&buf);
+		return -1;
+	}
+	iobuf_set(out, CMD_DATA, buf, len);
+	return 0;
+}
+
 int to_fzp_fingerprint(struct fzp *fzp, uint64_t fingerprint)
 {
-	static struct iobuf wbuf;
+	static THREAD_LOCAL struct iobuf wbuf;
 	to_iobuf_uint64(&wbuf, CMD_FINGERPRINT, fingerprint);
 	return iobuf_send_msg_fzp(&wbuf, fzp);
 }
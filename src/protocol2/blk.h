@@ -2,10 +2,13 @@
 #define __RABIN_BLK_H
 
 #include "../burp.h"
+#include "../cmd.h"
+#include "../conf.h"
 
 #include <openssl/md5.h>
 
-// The highest number of blocks that the client will hold in memory.
+// The highest number of blocks that the server will hold in memory. The
+// client is limited by bytes instead, see client/protocol2/blk_window.c.
 #define BLKS_MAX_IN_MEM		20000
 
 // 4096 signatures per data file.
@@ -17,6 +20,10 @@
 #define MANIFEST_SIG_MIN	0x0e0c
 #define MANIFEST_SIG_MAX	0x1000
 
+// The most bytes of records in one batch. A batch has to fit into a single
+// network frame.
+#define BLK_BATCH_LEN		30000
+
 struct fzp;
 struct iobuf;
 
@@ -27,33 +34,64 @@ enum blk_got
 	BLK_GOT
 };
 
+// A buffer that the client reads files into. Blocks point into it instead
+// of having their own copy of the data, and it is freed when the last block
+// that points into it is freed.
+struct blk_buf
+{
+	char *buf;
+	size_t len;
+	int refs;
+};
+
+// Lots of fixed width records, such as signatures, sent in one message
+// instead of one message each. The first byte of the message is the
+// length of each record.
+struct blk_batch
+{
+	enum cmd cmd;
+	size_t reclen;
+	size_t count;
+	char buf[1+BLK_BATCH_LEN];
+};
+
 typedef struct blk blk_t;
 
-// The fingerprinted block. 64 bytes.
+// The fingerprinted block. 80 bytes.
 struct blk
 {
 	char *data;				// 8
+	struct blk_buf *buf;			// 8
 	uint8_t got;				// 1
 	uint8_t requested;			// 1
 	uint8_t got_save_path;			// 1
-	uint8_t pad;				// 1
+	uint8_t hashed;				// 1
 	uint32_t length;			// 4
 	uint64_t fingerprint;			// 8
+	// The strong checksum. Despite the name, it is only MD5 when
+	// strong_hash says so. Other hashes are truncated to fit.
 	uint8_t md5sum[MD5_DIGEST_LENGTH];	// 16
+	uint8_t strong_hash;			// 1
 	uint64_t savepath;			// 8
 	uint64_t index;				// 8
 	struct blk *next;			// 8
 };
 
+extern struct blk_buf *blk_buf_alloc(size_t len);
+extern void blk_buf_unref(struct blk_buf **buf);
+
 extern struct blk *blk_alloc(void);
 extern struct blk *blk_alloc_with_data(uint32_t max_data_length);
 extern void blk_free_content(struct blk *blk);
+extern void blk_set_data_view(struct blk *blk, struct blk_buf *buf,
+	char *data);
 extern void blk_free(struct blk **blk);
-extern int blk_md5_update(struct blk *blk);
+extern int blk_strong_hash_supported(enum strong_hash strong_hash);
+extern int blk_strong_hash_update(struct blk *blk);
 extern int blk_is_zero_length(struct blk *blk);
 
-extern int blk_verify(uint64_t fingerprint, uint8_t *md5sum,
-	char *data, size_t length);
+extern int blk_verify(uint64_t fingerprint, enum strong_hash strong_hash,
+	uint8_t *md5sum, char *data, size_t length);
 extern int blk_fingerprint_is_hook(struct blk *blk);
 
 extern int blk_set_from_iobuf_sig(struct blk *blk, struct iobuf *iobuf);
@@ -73,6 +111,21 @@ extern void blk_to_iobuf_index_and_savepath(struct blk *blk,
 	struct iobuf *iobuf);
 extern void blk_to_iobuf_wrap_up(struct blk *blk, struct iobuf *iobuf);
 
+extern void blk_to_iobuf_data_req_range(struct blk *blk, uint64_t count,
+	struct iobuf *iobuf);
+extern int blk_set_from_iobuf_data_req_range(struct blk *blk,
+	uint64_t *count, struct iobuf *iobuf);
+
+extern void blk_batch_init(struct blk_batch *batch, enum cmd cmd);
+extern int blk_batch_add(struct blk_batch *batch, struct iobuf *rec);
+extern int blk_batch_to_iobuf(struct blk_batch *batch, struct iobuf *iobuf);
+extern int blk_batch_next(struct iobuf *iobuf, size_t *offset,
+	struct iobuf *rec);
+
+extern int blk_data_compress(int level, const char *in, size_t len,
+	char *out, size_t *outlen);
+extern int blk_data_decompress(struct iobuf *in, struct iobuf *out);
+
 extern int to_fzp_fingerprint(struct fzp *fzp, uint64_t fingerprint);
 
 #endif
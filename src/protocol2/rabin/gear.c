@@ -0,0 +1,59 @@
+#include "../../burp.h"
+#include "gear.h"
+
+uint64_t gear_table[256];
+
+// The table has to be identical on every client and every server, forever,
+// so it is generated from a fixed seed with splitmix64 rather than a
+// random source.
+void gear_init(void)
+{
+	static int initialised=0;
+	uint64_t seed=0x6275727067656172ULL; // "burpgear"
+	uint64_t z;
+	int i;
+
+	if(initialised)
+		return;
+	for(i=0; i<256; i++)
+	{
+		z=(seed+=0x9E3779B97F4A7C15ULL);
+		z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+		z=(z^(z>>27))*0x94D049BB133111EBULL;
+		gear_table[i]=z^(z>>31);
+	}
+	initialised=1;
+}
+
+// Build a cut point mask with log2(blk_avg)+level bits set. A positive level
+// makes a cut harder to find, a negative level makes it easier.
+// The bits sit just under the top four bits of the hash, so that a cut point
+// says nothing about whether the block is a hook (see
+// blk_fingerprint_is_hook()), and the low bits that the hash tables key on
+// stay random.
+uint64_t gear_mask(uint32_t blk_avg, int level)
+{
+	int bits=level;
+	while(blk_avg>>=1)
+		bits++;
+	if(bits<1)
+		bits=1;
+	if(bits>28)
+		bits=28;
+	return ((1ULL<<bits)-1)<<(60-bits);
+}
+
+// The fingerprint of a gear block is the hash state at its end, which only
+// depends on the last GEAR_WINDOW bytes.
+uint64_t gear_fingerprint(const char *data, size_t length)
+{
+	uint64_t fingerprint=0;
+	const unsigned char *cp=(const unsigned char *)data;
+	const unsigned char *end=cp+length;
+
+	if(length>GEAR_WINDOW)
+		cp=end-GEAR_WINDOW;
+	for(; cp<end; cp++)
+		fingerprint=(fingerprint<<1)+gear_table[*cp];
+	return fingerprint;
+}
@@ -0,0 +1,16 @@
+#ifndef __RABIN_GEAR_H
+#define __RABIN_GEAR_H
+
+#include "../../burp.h"
+
+// The gear hash only remembers the last 64 bytes that went into it, because
+// each byte is shifted out of the 64 bit state after that many steps.
+#define GEAR_WINDOW	64
+
+extern uint64_t gear_table[256];
+
+extern void gear_init(void);
+extern uint64_t gear_mask(uint32_t blk_avg, int level);
+extern uint64_t gear_fingerprint(const char *data, size_t length);
+
+#endif
@@ -1,42 +1,69 @@
 #include "../../burp.h"
 #include "rabin.h"
+#include "gear.h"
 #include "rconf.h"
 #include "win.h"
 #include "../../alloc.h"
+#include "../../log.h"
 #include "../blk.h"
 #include "../blist.h"
 #include "../../sbuf.h"
 #include "../../client/protocol2/rabin_read.h"
 
+// Files are read into a shared buffer, and finished blocks are given views
+// into it rather than copies of their data. When it fills up, a new buffer
+// is started and the old one lives on until its last block is freed.
+#define GBUF_BLKS	64
+
 static struct blk *blk=NULL;
+static struct blk_buf *gbuf=NULL;
+static char *bstart=NULL; // Start of the data of the block being built.
 static char *gcp=NULL;
-static char *gbuf=NULL;
 static char *gbuf_end=NULL;
 static struct rconf rconf;
 static struct win *win=NULL; // Rabin sliding window.
 static int first=0;
 
-int blks_generate_init(void)
+int blks_generate_init(enum chunking chunking)
 {
 	rconf_init(&rconf);
-	if(!(win=win_alloc(&rconf))
-	  || !(gbuf=(char *)malloc_w(rconf.blk_max, __func__)))
+	rconf.chunking=chunking;
+	gear_init();
+	if(!(win=win_alloc(&rconf)))
 		return -1;
-	gbuf_end=gbuf;
-	gcp=gbuf;
+	bstart=NULL;
+	gcp=NULL;
+	gbuf_end=NULL;
 	return 0;
 }
 
+// Change the block sizes for the next file, using a string starting with
+// 'min:avg:max'. Anything after that is ignored. NULL puts back the defaults.
+int blks_generate_set_blk_sizes(const char *sizes)
+{
+	const char *rest=NULL;
+	if(!sizes)
+	{
+		rconf.blk_min=RABIN_MIN;
+		rconf.blk_avg=RABIN_AVG;
+		rconf.blk_max=RABIN_MAX;
+		rconf.mask_s=gear_mask(rconf.blk_avg, 2);
+		rconf.mask_l=gear_mask(rconf.blk_avg, -2);
+		return 0;
+	}
+	return rconf_parse_blk_sizes(&rconf, sizes, &rest);
+}
+
 void blks_generate_free(void)
 {
-	free_w(&gbuf);
+	blk_buf_unref(&gbuf);
 	blk_free(&blk);
 	win_free(&win);
 }
 
 // This is where the magic happens.
 // Return 1 for got a block, 0 for no block got.
-static int blk_read(void)
+static int blk_read_rabin(void)
 {
 	unsigned char c;
 
@@ -50,8 +77,6 @@ static int blk_read(void)
 		win->data[win->pos] = c;
 
 		win->pos++;
-		if(blk->data)
-			blk->data[blk->length] = c;
 		blk->length++;
 
 		if(win->pos == rconf.win_size)
@@ -68,6 +93,63 @@ static int blk_read(void)
 	return 0;
 }
 
+// Gear hash content defined chunking, with FastCDC style normalisation and
+// cut point skipping. One shift, one add and one table lookup per byte.
+// Return 1 for got a block, 0 for no block got.
+static int blk_read_gear(void)
+{
+	int got=0;
+	uint32_t skip=0;
+	uint32_t length=blk->length;
+	uint64_t fingerprint=blk->fingerprint;
+
+	// Bytes further than GEAR_WINDOW before the earliest possible cut
+	// point cannot affect the hash there, so do not bother hashing them.
+	if(rconf.blk_min>GEAR_WINDOW)
+		skip=rconf.blk_min-GEAR_WINDOW;
+	if(length<skip)
+	{
+		size_t n=skip-length;
+		if(n>(size_t)(gbuf_end-gcp))
+			n=gbuf_end-gcp;
+		gcp+=n;
+		length+=n;
+	}
+
+	while(gcp<gbuf_end)
+	{
+		fingerprint=(fingerprint<<1)
+			+ gear_table[(unsigned char)*gcp++];
+		length++;
+
+		if(length<rconf.blk_min)
+			continue;
+		if(length==rconf.blk_max
+		  || !(fingerprint & (length<rconf.blk_avg?
+			rconf.mask_s:rconf.mask_l)))
+		{
+			got=1;
+			break;
+		}
+	}
+
+	blk->length=length;
+	blk->fingerprint=fingerprint;
+	return got;
+}
+
+static int blk_read(enum chunking chunking)
+{
+	switch(chunking)
+	{
+		case CHUNKING_GEAR:
+			return blk_read_gear();
+		case CHUNKING_RABIN:
+		default:
+			return blk_read_rabin();
+	}
+}
+
 static void win_reset(void)
 {
 	win->checksum=0;
@@ -77,9 +159,11 @@ static void win_reset(void)
 
 static int blk_read_to_list(struct sbuf *sb, struct blist *blist)
 {
-	if(!blk_read()) return 0;
+	if(!blk_read(rconf.chunking)) return 0;
 
 	win_reset();
+	blk_set_data_view(blk, gbuf, bstart);
+	bstart=gcp;
 
 	// Got something.
 	if(first)
@@ -96,6 +180,31 @@ static int blk_read_to_list(struct sbuf *sb, struct blist *blist)
 	return 1;
 }
 
+// Make sure that there is room to read another blk_max bytes into the shared
+// buffer. If not, start a new one, moving over whatever has been read of the
+// block that is being built.
+static int gbuf_make_room(void)
+{
+	size_t partial=0;
+	struct blk_buf *nbuf;
+
+	if(gbuf && gbuf_end+rconf.blk_max<=gbuf->buf+gbuf->len)
+		return 0;
+	if(!(nbuf=blk_buf_alloc((size_t)rconf.blk_max*GBUF_BLKS)))
+		return -1;
+	if(gbuf)
+	{
+		partial=gbuf_end-bstart;
+		memcpy(nbuf->buf, bstart, partial);
+		blk_buf_unref(&gbuf);
+	}
+	gbuf=nbuf;
+	bstart=gbuf->buf;
+	gcp=gbuf->buf+partial;
+	gbuf_end=gcp;
+	return 0;
+}
+
 // The client uses this.
 // Return 0 for OK. 1 for OK, and file ended, -1 for error.
 int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
@@ -103,7 +212,7 @@ int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
 	static ssize_t bytes;
 	first=just_opened;
 
-	if(!blk && !(blk=blk_alloc_with_data(rconf.blk_max)))
+	if(!blk && !(blk=blk_alloc()))
 		return -1;
 
 	if(first)
@@ -117,10 +226,17 @@ int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
 			return 0; // Got a block.
 		// Did not get a block. Carry on and read more.
 	}
-	while((bytes=rabin_read(sb, gbuf, rconf.blk_max)))
+	if(gbuf_make_room())
+		return -1;
+	while((bytes=rabin_read(sb, gbuf_end, rconf.blk_max)))
 	{
-		gcp=gbuf;
-		gbuf_end=gbuf+bytes;
+		if(bytes<0)
+		{
+			logp("Error reading %s\n",
+				iobuf_to_printable(&sb->path));
+			return -1;
+		}
+		gbuf_end+=bytes;
 		sb->protocol2->bytes_read+=bytes;
 		if(blk_read_to_list(sb, blist))
 			return 0; // Got a block
@@ -136,7 +252,6 @@ int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
 	{
 		// Empty file, set up an empty block so that the server
 		// can skip over it.
-		free_w(&blk->data);
 		sb->protocol2->bstart=blk;
 		sb->protocol2->bsighead=blk;
 		blist_add_blk(blist, blk);
@@ -146,6 +261,13 @@ int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
 	{
 		if(blk->length)
 		{
+			blk_set_data_view(blk, gbuf, bstart);
+			bstart=gcp;
+			// A short last block may not have had all of its
+			// tail hashed.
+			if(rconf.chunking==CHUNKING_GEAR)
+				blk->fingerprint=gear_fingerprint(blk->data,
+					blk->length);
 			if(first)
 			{
 				sb->protocol2->bstart=blk;
@@ -164,31 +286,42 @@ int blks_generate(struct sbuf *sb, struct blist *blist, int just_opened)
 	return 1;
 }
 
-int blk_verify_fingerprint(uint64_t fingerprint, char *data, size_t length)
+// Work out the rabin fingerprint of a whole block. This does not depend on
+// the block sizes that the client used to find the cut point.
+static uint64_t rabin_fingerprint(const char *data, size_t length)
 {
-	win_reset();
+	uint64_t fingerprint=0;
+	const unsigned char *cp=(const unsigned char *)data;
+	const unsigned char *end=cp+length;
 
-	memcpy(gbuf, data, length);
-	gbuf_end=gbuf+length;
-	gcp=gbuf;
-	blk_free(&blk);
-	if(!blk && !(blk=blk_alloc())) return -1;
-	blk->length=0;
-	blk->fingerprint=0;
-
-	// FIX THIS: blk_read should return 1 when it has a block.
-	// But, if the block is too small (because the end of the file
-	// happened), it returns 0, and blks_generate treats it as having found
-	// a final block.
-	// So, here the return of blk_read is ignored and we look at the
-	// position of gcp instead.
-	blk_read();
-//printf("%d %d\n", blk->length, length);
-//printf("%016"PRIX64" %016"PRIX64" ",
-//	blk->fingerprint, fingerprint);
-//printf("%s\n", blk->fingerprint==fingerprint?"yes":"no");
-	if(gcp==gbuf_end
-	  && blk->fingerprint==fingerprint)
+	for(; cp<end; cp++)
+		fingerprint=(fingerprint*rconf.prime)+*cp;
+	return fingerprint;
+}
+
+static uint64_t get_fingerprint(enum chunking chunking,
+	char *data, size_t length)
+{
+	switch(chunking)
+	{
+		case CHUNKING_GEAR:
+			return gear_fingerprint(data, length);
+		case CHUNKING_RABIN:
+		default:
+			return rabin_fingerprint(data, length);
+	}
+}
+
+// A dedup group can contain blocks from clients that chunked with different
+// engines and block sizes, so try the engine in use first and then fall back
+// to the other.
+int blk_verify_fingerprint(uint64_t fingerprint, char *data, size_t length)
+{
+	enum chunking other=CHUNKING_GEAR;
+	if(rconf.chunking==CHUNKING_GEAR)
+		other=CHUNKING_RABIN;
+	if(get_fingerprint(rconf.chunking, data, length)==fingerprint
+	  || get_fingerprint(other, data, length)==fingerprint)
 		return 1;
 	return 0;
 }
@@ -1,5 +1,6 @@
 #include "../../burp.h"
 #include "rconf.h"
+#include "gear.h"
 #include "../../log.h"
 
 static uint64_t get_multiplier(uint32_t win, uint64_t prime)
@@ -15,6 +16,8 @@ static uint64_t get_multiplier(uint32_t win, uint64_t prime)
 // Hey you. Probably best not fuck with these.
 void rconf_init(struct rconf *rconf)
 {
+	rconf->chunking=CHUNKING_RABIN;
+
 	rconf->prime=3;		// Not configurable.
 
 	rconf->win_min=17;	// Not configurable.
@@ -26,4 +29,84 @@ void rconf_init(struct rconf *rconf)
 	rconf->blk_max=RABIN_MAX; // Maximum block size.
 
 	rconf->multiplier=get_multiplier(rconf->win_size, rconf->prime);
+
+	rconf->mask_s=gear_mask(rconf->blk_avg, 2);
+	rconf->mask_l=gear_mask(rconf->blk_avg, -2);
+}
+
+int rconf_check(struct rconf *rconf)
+{
+	if(rconf->win_size<rconf->win_min
+	  || rconf->win_size>rconf->win_max)
+	{
+		logp("Window size %u is not between %u and %u\n",
+			rconf->win_size, rconf->win_min, rconf->win_max);
+		return -1;
+	}
+	if(rconf->blk_min<rconf->win_max)
+	{
+		logp("Minimum block size %u is less than %u\n",
+			rconf->blk_min, rconf->win_max);
+		return -1;
+	}
+	if(rconf->blk_avg<rconf->blk_min
+	  || rconf->blk_avg>rconf->blk_max)
+	{
+		logp("Average block size %u is not between %u and %u\n",
+			rconf->blk_avg, rconf->blk_min, rconf->blk_max);
+		return -1;
+	}
+	if(rconf->blk_max>RABIN_LIMIT)
+	{
+		logp("Maximum block size %u is more than %u\n",
+			rconf->blk_max, RABIN_LIMIT);
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_blk_size(const char **str, uint32_t *size)
+{
+	char *end=NULL;
+	unsigned long val;
+	if(!isdigit((unsigned char)**str))
+		return -1;
+	errno=0;
+	val=strtoul(*str, &end, 10);
+	if(errno || val>UINT32_MAX)
+		return -1;
+	*size=(uint32_t)val;
+	*str=end;
+	return 0;
+}
+
+// Set the block sizes from a string like 'min:avg:max'. If rest is given,
+// the sizes may be followed by ':' and something else, which rest is pointed
+// at. Otherwise, the string has to end after the sizes.
+int rconf_parse_blk_sizes(struct rconf *rconf, const char *str,
+	const char **rest)
+{
+	const char *cp=str;
+	struct rconf r=*rconf;
+
+	if(parse_blk_size(&cp, &r.blk_min) || *cp++!=':'
+	  || parse_blk_size(&cp, &r.blk_avg) || *cp++!=':'
+	  || parse_blk_size(&cp, &r.blk_max))
+		goto error;
+	if(rest && *cp==':')
+		cp++;
+	else if(*cp)
+		goto error;
+
+	if(rconf_check(&r))
+		goto error;
+	r.mask_s=gear_mask(r.blk_avg, 2);
+	r.mask_l=gear_mask(r.blk_avg, -2);
+	*rconf=r;
+	if(rest)
+		*rest=cp;
+	return 0;
+error:
+	logp("Could not parse block sizes: %s\n", str);
+	return -1;
 }
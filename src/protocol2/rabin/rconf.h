@@ -4,11 +4,16 @@
 #define RABIN_MIN	4096
 #define RABIN_AVG	5000
 #define RABIN_MAX	8192
+// A block has to fit into a single network frame.
+#define RABIN_LIMIT	32000
 
 #include "../../burp.h"
+#include "../../conf.h"
 
 struct rconf
 {
+	enum chunking chunking;
+
 	uint64_t prime;
 
 	uint32_t win_min;
@@ -20,9 +25,16 @@ struct rconf
 	uint32_t blk_max;
 
 	uint64_t multiplier;
+
+	// Gear cut point masks. FastCDC style normalised chunking - the
+	// harder mask is used until blk_avg is reached, then the easier one.
+	uint64_t mask_s;
+	uint64_t mask_l;
 };
 
 extern void rconf_init(struct rconf *rconf);
 extern int rconf_check(struct rconf *rconf);
+extern int rconf_parse_blk_sizes(struct rconf *rconf, const char *str,
+	const char **rest);
 
 #endif
@@ -326,11 +326,51 @@ static enum parse_ret parse_cmd(struct sbuf *sb, struct asfd *asfd,
 	return PARSE_RET_ERROR;
 }
 
+// Signatures and fingerprints are finished with as soon as they are read,
+// so they are used straight from the read ahead data of the file. Anything
+// else gets kept, so needs copying.
+// Returns -1 on error, 0 for a signature or fingerprint put in blk, 1 for a
+// signature that nobody wanted, and 2 if rbuf now holds something else.
+static int from_view(struct sbuf *sb, struct iobuf *rbuf, struct blk *blk)
+{
+	int ret;
+	switch(rbuf->cmd)
+	{
+		case CMD_SIG:
+			if(!blk)
+			{
+				rbuf->buf=NULL;
+				return 1;
+			}
+			ret=blk_set_from_iobuf_sig_and_savepath(blk, rbuf);
+			rbuf->buf=NULL;
+			if(ret)
+				return -1;
+			blk->got_save_path=1;
+			return 0;
+		case CMD_FINGERPRINT:
+			if(!blk)
+				break;
+			// The caller only gets told what sort of thing it
+			// was in sb->path.
+			ret=blk_set_from_iobuf_fingerprint(blk, rbuf);
+			rbuf->buf=NULL;
+			if(ret)
+				return -1;
+			iobuf_free_content(&sb->path);
+			sb->path.cmd=CMD_FINGERPRINT;
+			return 0;
+		default:
+			break;
+	}
+	return iobuf_keep(rbuf)?-1:2;
+}
+
 static int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 	struct blk *blk, struct cntr *cntr)
 {
-	static struct iobuf *rbuf;
-	static struct iobuf localrbuf;
+	static THREAD_LOCAL struct iobuf *rbuf;
+	static THREAD_LOCAL struct iobuf localrbuf;
 	int ret=-1;
 
 	if(asfd) rbuf=asfd->rbuf;
@@ -345,8 +385,15 @@ static int sbuf_fill(struct sbuf *sb, struct asfd *asfd, struct fzp *fzp,
 		iobuf_free_content(rbuf);
 		if(fzp)
 		{
-			if((ret=iobuf_fill_from_fzp(rbuf, fzp)))
+			if((ret=iobuf_view_from_fzp(rbuf, fzp)))
 				goto end;
+			switch(from_view(sb, rbuf, blk))
+			{
+				case 0: return 0;
+				case 1: continue;
+				case 2: break;
+				default: ret=-1; goto end;
+			}
 		}
 		else
 		{
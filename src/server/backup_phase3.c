@@ -57,7 +57,8 @@ int backup_phase3_server_all(struct sdirs *sdirs, struct conf **confs)
 	if(!(manifesttmp=get_tmp_filename(sdirs->manifest))
 	  || !(newmanio=manio_open_phase3(manifesttmp,
 		comp_level(get_int(confs[OPT_COMPRESSION])),
-		protocol, rmanifest_relative))
+		protocol, rmanifest_relative,
+		get_int(confs[OPT_BINARY_MANIFEST])))
 	  || !(chmanio=manio_open_phase2(sdirs->changed, "rb", protocol))
 	  || !(unmanio=manio_open_phase2(sdirs->unchanged, "rb", protocol))
 	  || !(usb=sbuf_alloc(protocol))
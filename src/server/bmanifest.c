@@ -0,0 +1,145 @@
+#include "../burp.h"
+#include "../alloc.h"
+#include "../fsops.h"
+#include "../fzp.h"
+#include "../handy.h"
+#include "../iobuf.h"
+#include "../log.h"
+#include "../msg.h"
+#include "../prepend.h"
+#include "bmanifest.h"
+#include "compress.h"
+#include "manio.h"
+
+static int usage(void)
+{
+	logfmt("\nUsage: %s [options] <path to manifest>\n", prog);
+	logfmt("\n");
+	logfmt(" Options:\n");
+	logfmt("  -t         Convert to the text form, instead of binary.\n");
+	logfmt("  -z <0-9>   Compression level (default: 9).\n");
+	logfmt("\n");
+	return 1;
+}
+
+static int convert_file(const char *path, int binary, int compression)
+{
+	int ret=-1;
+	char *tmp=NULL;
+	struct fzp *src=NULL;
+	struct fzp *dst=NULL;
+	struct iobuf rbuf;
+
+	memset(&rbuf, 0, sizeof(rbuf));
+	if(!(tmp=get_tmp_filename(path))
+	  || !(src=fzp_gzopen(path, MANIO_MODE_READ))
+	  || !(dst=fzp_gzopen(tmp, comp_level(compression))))
+		goto end;
+	if(binary && send_msg_fzp_binary_start(dst))
+		goto end;
+	while(1)
+	{
+		iobuf_free_content(&rbuf);
+		switch(iobuf_fill_from_fzp(&rbuf, src))
+		{
+			case 0: break;
+			case 1: goto finished;
+			default: goto end;
+		}
+		if(iobuf_send_msg_fzp(&rbuf, dst))
+			goto end;
+	}
+finished:
+	if(fzp_close(&dst))
+	{
+		logp("Error closing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	if(do_rename(tmp, path))
+		goto end;
+	logp("converted: %s\n", path);
+	ret=0;
+end:
+	iobuf_free_content(&rbuf);
+	fzp_close(&src);
+	fzp_close(&dst);
+	if(ret && tmp)
+		unlink(tmp);
+	free_w(&tmp);
+	return ret;
+}
+
+// A protocol1 manifest is a single file. A protocol2 one is a directory of
+// numbered files, alongside the hooks and dindex directories, which are left
+// alone.
+static int convert(const char *path, int binary, int compression)
+{
+	int ret=-1;
+	uint64_t fcount=0;
+	char *fpath=NULL;
+	char tmp[32]="";
+	struct stat statp;
+
+	if(lstat(path, &statp))
+	{
+		logp("Could not lstat %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if(S_ISREG(statp.st_mode))
+		return convert_file(path, binary, compression);
+	if(!S_ISDIR(statp.st_mode))
+	{
+		logp("%s is not a manifest\n", path);
+		return -1;
+	}
+	while(1)
+	{
+		free_w(&fpath);
+		snprintf(tmp, sizeof(tmp), "%08" PRIX64, fcount++);
+		if(!(fpath=prepend_s(path, tmp)))
+			goto end;
+		if(lstat(fpath, &statp))
+			break;
+		if(convert_file(fpath, binary, compression))
+			goto end;
+	}
+	ret=0;
+end:
+	free_w(&fpath);
+	return ret;
+}
+
+int run_bmanifest(int argc, char *argv[])
+{
+	int option;
+	int binary=1;
+	int compression=9;
+
+	while((option=getopt(argc, argv, "tz:Vh?"))!=-1)
+	{
+		switch(option)
+		{
+			case 't':
+				binary=0;
+				break;
+			case 'z':
+				compression=atoi(optarg);
+				if(compression<0 || compression>9)
+					return usage();
+				break;
+			case 'V':
+				logfmt("%s-%s\n", prog, PACKAGE_VERSION);
+				return 0;
+			case 'h':
+			case '?':
+				return usage();
+		}
+	}
+
+	if(optind>=argc || optind<argc-1)
+		return usage();
+
+	if(convert(argv[optind], binary, compression))
+		return 1;
+	return 0;
+}
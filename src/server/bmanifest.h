@@ -0,0 +1,6 @@
+#ifndef _BMANIFEST_H
+#define _BMANIFEST_H
+
+extern int run_bmanifest(int argc, char *argv[]);
+
+#endif
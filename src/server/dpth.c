@@ -5,6 +5,7 @@
 #include "../lock.h"
 #include "../log.h"
 #include "dpth.h"
+#include "protocol2/dpth.h"
 
 struct dpth *dpth_alloc(void)
 {
@@ -27,7 +28,7 @@ int dpth_release_and_move_to_next_in_list(struct dpth *dpth)
 
 	// Try to release (and unlink) the lock even if fzp_close failed, just
 	// to be tidy.
-	if(fzp_close(&dpth->fzp)) ret=-1;
+	if(dpth_protocol2_fclose(dpth)) ret=-1;
 	if(lock_release(dpth->head->lock)) ret=-1;
 	lock_free(&dpth->head->lock);
 
@@ -42,7 +43,7 @@ int dpth_release_all(struct dpth *dpth)
 {
 	int ret=0;
 	if(!dpth) return 0;
-	if(dpth->fzp && fzp_close(&dpth->fzp)) ret=-1;
+	if(dpth_protocol2_fclose(dpth)) ret=-1;
 	while(dpth->head)
 		if(dpth_release_and_move_to_next_in_list(dpth)) ret=-1;
 	return ret;
@@ -2,6 +2,7 @@
 #define __DPTH_H
 
 #include "../burp.h"
+#include "../protocol2/blk.h"
 
 // ext3 maximum number of subdirs is 32000, so leave a little room.
 #define MAX_STORAGE_SUBDIRS	30000
@@ -27,9 +28,15 @@ struct dpth
 	// Whether we need to lock another data file.
 	uint8_t need_data_lock;
 	int max_storage_subdirs;
+	// Protocol2 zlib level for blocks in data files, 0 for none.
+	int compression;
 	// Currently open data file. Only one is open at a time, while many
 	// may be locked.
 	struct fzp *fzp;
+	// Where each block in the currently open data file starts, and where
+	// the next one will, for writing its index when it is closed.
+	uint32_t offsets[DATA_FILE_SIG_MAX+1];
+	uint16_t offsets_len;
 	// For keeping track of files that were created, in case the backup
 	// is interrupted and cleanup is required.
 	struct fzp *cfile_fzp;
@@ -154,6 +154,12 @@ static int send_features(struct asfd *asfd, struct conf **cconfs,
 	if(append_to_feat(&feat, "msg:"))
 		goto end;
 
+	/* Clients can send protocol2 signatures in batches, and be sent
+	   data requests in batches. */
+	if(append_to_feat(&feat, "sig_batch:"))
+		goto end;
+	set_int(cconfs[OPT_SIG_BATCH], 0);
+
 	if(protocol==PROTO_AUTO)
 	{
 		/* If the server is configured to use either protocol, let the
@@ -180,6 +186,26 @@ static int send_features(struct asfd *asfd, struct conf **cconfs,
 	if(append_to_feat(&feat, "seed:"))
 		goto end;
 
+	if(get_int(cconfs[OPT_CHUNKING])==CHUNKING_GEAR)
+	{
+		/* Clients can chunk protocol2 data with the gear engine.
+		   Use rabin unless the client says that it understood. */
+		if(append_to_feat(&feat, "chunking=gear:"))
+			goto end;
+		set_int(cconfs[OPT_CHUNKING], CHUNKING_RABIN);
+	}
+
+#ifdef HAVE_EVP_BLAKE2B512
+	if(get_int(cconfs[OPT_STRONG_HASH])==STRONG_HASH_BLAKE2B)
+	{
+		/* Clients can use BLAKE2b as the protocol2 strong hash.
+		   Use MD5 unless the client says that it understood. */
+		if(append_to_feat(&feat, "strong_hash=blake2b:"))
+			goto end;
+	}
+#endif
+	set_int(cconfs[OPT_STRONG_HASH], STRONG_HASH_MD5);
+
 	//printf("feat: %s\n", feat);
 
 	if(asfd->write_str(asfd, CMD_GEN, feat))
@@ -452,6 +478,26 @@ static int extra_comms_read(struct async *as,
 			goto end;
 #endif
 		}
+		else if(!strncmp_w(rbuf->buf, "chunking=gear"))
+		{
+			set_int(cconfs[OPT_CHUNKING], CHUNKING_GEAR);
+			set_int(globalcs[OPT_CHUNKING], CHUNKING_GEAR);
+		}
+		else if(!strncmp_w(rbuf->buf, "strong_hash=blake2b"))
+		{
+#ifdef HAVE_EVP_BLAKE2B512
+			set_int(cconfs[OPT_STRONG_HASH], STRONG_HASH_BLAKE2B);
+			set_int(globalcs[OPT_STRONG_HASH], STRONG_HASH_BLAKE2B);
+#else
+			logp("Client is trying to use strong hash blake2b, but server does not support it.\n");
+			goto end;
+#endif
+		}
+		else if(!strcmp(rbuf->buf, "sig_batch"))
+		{
+			set_int(cconfs[OPT_SIG_BATCH], 1);
+			set_int(globalcs[OPT_SIG_BATCH], 1);
+		}
 		else if(!strncmp_w(rbuf->buf, "msg"))
 		{
 			set_int(cconfs[OPT_MESSAGE], 1);
@@ -15,6 +15,7 @@
 #include "child.h"
 #include "main.h"
 #include "run_action.h"
+#include "protocol2/champ_chooser/champ_server.h"
 #include "monitor/status_server.h"
 
 #ifdef HAVE_SYSTEMD
@@ -338,6 +339,7 @@ end:
 	if(as && asfd_flush_asio(as->asfd))
 		ret=-1;
 	async_asfd_free_all(&as); // This closes cfd for us.
+	champ_chooser_thread_join();
 	logp("exit child\n");
 	if(cntr) cntr_free(&cntr);
 	if(confs)
@@ -93,6 +93,8 @@ static int manio_open_next_fpath(struct manio *manio)
 		default:
 			if(!(manio->fzp=fzp_gzopen(offset->fpath,
 				manio->mode))) return -1;
+			if(manio->binary)
+				return send_msg_fzp_binary_start(manio->fzp);
 			return 0;
 	}
 }
@@ -115,7 +117,7 @@ static struct manio *manio_alloc(void)
 }
 
 static struct manio *do_manio_open(const char *manifest, const char *mode,
-	enum protocol protocol, int phase)
+	enum protocol protocol, int phase, int binary)
 {
 	struct manio *manio=NULL;
 	if(!(manio=manio_alloc())
@@ -125,6 +127,7 @@ static struct manio *do_manio_open(const char *manifest, const char *mode,
 		goto error;
 	manio->protocol=protocol;
 	manio->phase=phase;
+	manio->binary=binary;
 	if(!strcmp(manio->mode, MANIO_MODE_APPEND))
 	{
 		if(manio->phase!=2)
@@ -151,27 +154,27 @@ error:
 struct manio *manio_open(const char *manifest, const char *mode,
 	enum protocol protocol)
 {
-	return do_manio_open(manifest, mode, protocol, 0);
+	return do_manio_open(manifest, mode, protocol, 0, 0);
 }
 
 struct manio *manio_open_phase1(const char *manifest, const char *mode,
 	enum protocol protocol)
 {
-	return do_manio_open(manifest, mode, protocol, 1);
+	return do_manio_open(manifest, mode, protocol, 1, 0);
 }
 
 struct manio *manio_open_phase2(const char *manifest, const char *mode,
 	enum protocol protocol)
 {
-	return do_manio_open(manifest, mode, protocol, 2);
+	return do_manio_open(manifest, mode, protocol, 2, 0);
 }
 
 struct manio *manio_open_phase3(const char *manifest, const char *mode,
-	enum protocol protocol, const char *rmanifest)
+	enum protocol protocol, const char *rmanifest, int binary)
 {
 	struct manio *manio=NULL;
 
-	if(!(manio=do_manio_open(manifest, mode, protocol, 3)))
+	if(!(manio=do_manio_open(manifest, mode, protocol, 3, binary)))
 		goto end;
 
 	if(protocol==PROTO_2 && rmanifest)
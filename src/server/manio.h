@@ -46,6 +46,7 @@ struct manio
 	int dindex_count;
 	enum protocol protocol;	// Whether running in protocol1/2 mode.
 	int phase;
+	int binary;		// Write the compact binary format.
 
 	man_off_t *offset;
 };
@@ -57,7 +58,7 @@ extern struct manio *manio_open_phase1(const char *manifest, const char *mode,
 extern struct manio *manio_open_phase2(const char *manifest, const char *mode,
 	enum protocol protocol);
 extern struct manio *manio_open_phase3(const char *manifest, const char *mode,
-	enum protocol protocol, const char *rmanifest);
+	enum protocol protocol, const char *rmanifest, int binary);
 extern int manio_close(struct manio **manio);
 
 extern int manio_read_fcount(struct manio *manio);
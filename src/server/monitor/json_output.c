@@ -11,6 +11,8 @@
 #include "../../prepend.h"
 #include "../../strlist.h"
 #include "../../yajl_gen_w.h"
+#include "../protocol2/champ_chooser/champ_server.h"
+#include "../sdirs.h"
 #include "../timestamp.h"
 #include "browse.h"
 #include "json_output.h"
@@ -136,6 +138,19 @@ end:
 
 }
 
+static int lines_to_array(struct fzp *fzp)
+{
+	char *cp=NULL;
+	char buf[1024]="";
+	while(fzp_gets(fzp, buf, sizeof(buf)))
+	{
+		if((cp=strrchr(buf, '\n'))) *cp='\0';
+		if(yajl_gen_str_w(buf))
+			return -1;
+	}
+	return 0;
+}
+
 static int flag_wrap_str_zp(struct bu *bu, uint16_t flag, const char *field,
 	const char *logfile)
 {
@@ -147,21 +162,51 @@ static int flag_wrap_str_zp(struct bu *bu, uint16_t flag, const char *field,
 	if(!(fzp=open_backup_log(bu, logfile))) goto end;
 	if(yajl_gen_str_w(field)) goto end;
 	if(yajl_array_open_w()) goto end;
-	if(fzp)
+	if(fzp && lines_to_array(fzp)) goto end;
+	if(yajl_array_close_w()) goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+// Each champ chooser shard of the dedup_group that the client is in dumps
+// its stats to a file of its own in the data directory. Each file starts
+// with a 'shard' line.
+static int champ_stats_wrap(struct cstat *cstat, const char *logfile)
+{
+	int ret=-1;
+	int shard;
+	char *path=NULL;
+	struct stat statp;
+	struct fzp *fzp=NULL;
+	struct sdirs *sdirs=(struct sdirs *)cstat->sdirs;
+
+	if(!logfile || strcmp(logfile, "champ_stats"))
+		return 0;
+	if(yajl_gen_str_w("champ_stats")
+	  || yajl_array_open_w())
+		return -1;
+	for(shard=0; sdirs && sdirs->data && shard<CHAMP_SHARDS_MAX; shard++)
 	{
-		char *cp=NULL;
-		char buf[1024]="";
-		while(fzp_gets(fzp, buf, sizeof(buf)))
+		if(!(path=sdirs_champ_shard_path(sdirs->data,
+			"cc.stats", shard)))
+				goto end;
+		if(!lstat(path, &statp) && S_ISREG(statp.st_mode))
 		{
-			if((cp=strrchr(buf, '\n'))) *cp='\0';
-			if(yajl_gen_str_w(buf))
+			if(!(fzp=fzp_open(path, "rb"))
+			  || lines_to_array(fzp))
 				goto end;
+			fzp_close(&fzp);
 		}
+		free_w(&path);
 	}
-	if(yajl_array_close_w()) goto end;
+	if(yajl_array_close_w())
+		goto end;
 	ret=0;
 end:
 	fzp_close(&fzp);
+	free_w(&path);
 	return ret;
 }
 
@@ -398,7 +443,7 @@ end:
 }
 
 static int json_send_client_backup_list(struct cstat *cstat, int use_cache,
-	long peer_version)
+	const char *logfile, long peer_version)
 {
 	int ret=-1;
 	struct bu *bu;
@@ -413,7 +458,9 @@ static int json_send_client_backup_list(struct cstat *cstat, int use_cache,
 	}
 	ret=0;
 end:
-	if(json_send_client_end()) ret=-1;
+	if(yajl_array_close_w()) ret=-1;
+	if(!ret && champ_stats_wrap(cstat, logfile)) ret=-1;
+	if(yajl_map_close_w()) ret=-1;
 	return ret;
 }
 
@@ -437,7 +484,7 @@ int json_send(struct asfd *asfd, struct cstat *clist, struct cstat *cstat,
 	else if(cstat)
 	{
 		if(json_send_client_backup_list(cstat,
-			use_cache, peer_version))
+			use_cache, logfile, peer_version))
 				goto end;
 	}
 	else for(c=clist; c; c=c->next)
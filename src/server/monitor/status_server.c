@@ -374,7 +374,8 @@ static int parse_client_data(struct asfd *srfd,
 		  && strcmp(logfile, "verify")
 		  && strcmp(logfile, "backup_stats")
 		  && strcmp(logfile, "restore_stats")
-		  && strcmp(logfile, "verify_stats"))
+		  && strcmp(logfile, "verify_stats")
+		  && strcmp(logfile, "champ_stats"))
 		{
 			if(json_send_warn(srfd, "File not supported"))
 				goto error;
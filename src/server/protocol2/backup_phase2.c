@@ -235,7 +235,8 @@ static int add_data_to_store(struct cntr *cntr,
 
 // FIX THIS
 #ifndef UTEST
-	if(blk_verify(blk->fingerprint, blk->md5sum, rbuf->buf, rbuf->len)<=0)
+	if(blk_verify(blk->fingerprint, (enum strong_hash)blk->strong_hash,
+		blk->md5sum, rbuf->buf, rbuf->len)<=0)
 	{
 		logp("ERROR: Block %" PRIu64 " from client did not verify.\n",
 			blk->index);
@@ -316,6 +317,17 @@ static int add_to_sig_list(struct slist *slist, struct iobuf *rbuf)
 	return 0;
 }
 
+static int add_batch_to_sig_list(struct slist *slist, struct iobuf *rbuf)
+{
+	int ret;
+	size_t offset=0;
+	struct iobuf rec;
+	while((ret=blk_batch_next(rbuf, &offset, &rec))>0)
+		if(add_to_sig_list(slist, &rec))
+			return -1;
+	return ret;
+}
+
 static int deal_with_read(struct iobuf *rbuf, struct slist *slist,
 	struct cntr *cntr, uint8_t *end_flags, struct dpth *dpth)
 {
@@ -347,6 +359,10 @@ static int deal_with_read(struct iobuf *rbuf, struct slist *slist,
 			if(add_to_sig_list(slist, rbuf))
 				goto error;
 			goto end;
+		case CMD_SIGS:
+			if(add_batch_to_sig_list(slist, rbuf))
+				goto error;
+			goto end;
 
 		/* Incoming control/message stuff. */
 		case CMD_MESSAGE:
@@ -387,17 +403,47 @@ end:
 	return ret;
 }
 
+// The most data request ranges to put in one batch.
+#define DATA_REQ_RANGES_MAX	1024
+
+// Add the range that is being built to the batch, and point the wbuf at the
+// batch. Returns 1 if there was anything to send.
+static int data_reqs_to_wbuf(struct blk_batch *batch,
+	struct blk *first, uint64_t count, struct iobuf *wbuf)
+{
+	struct iobuf rec;
+	if(count)
+	{
+		blk_to_iobuf_data_req_range(first, count, &rec);
+		blk_batch_add(batch, &rec);
+	}
+	return blk_batch_to_iobuf(batch, wbuf);
+}
+
+// With sig_batch, blocks that need their data are requested in ranges of
+// consecutive indexes, and as many ranges as possible go in one batch.
 static int get_wbuf_from_sigs(struct iobuf *wbuf, struct slist *slist,
-	uint8_t *end_flags)
+	uint8_t *end_flags, int sig_batch)
 {
 	static char req[32]="";
-	struct sbuf *sb=slist->blks_to_request;
+	// The batch has to stay put until the wbuf has been written.
+	static struct blk_batch batch;
+	struct iobuf rec;
+	uint64_t count=0;
+	struct blk *blk;
+	struct blk *first=NULL;
+	struct sbuf *sb;
 
+	blk_batch_init(&batch, CMD_DATA_REQS);
+again:
+	sb=slist->blks_to_request;
 	while(sb && !(sb->flags & SBUF_NEED_DATA)) sb=sb->next;
 
 	if(!sb)
 	{
 		slist->blks_to_request=NULL;
+		if(data_reqs_to_wbuf(&batch, first, count, wbuf))
+			return 0;
 		if((*end_flags)&END_SIGS && !((*end_flags)&END_BLK_REQUESTS))
 		{
 			iobuf_from_str(wbuf,
@@ -415,6 +461,8 @@ static int get_wbuf_from_sigs(struct iobuf *wbuf, struct slist *slist,
 			slist->blks_to_request=sb->next;
 			printf("move to next\n");
 		}
+		if(data_reqs_to_wbuf(&batch, first, count, wbuf))
+			return 0;
 		if((*end_flags)&END_SIGS && !((*end_flags)&END_BLK_REQUESTS))
 		{
 			iobuf_from_str(wbuf,
@@ -424,14 +472,41 @@ static int get_wbuf_from_sigs(struct iobuf *wbuf, struct slist *slist,
 		return 0;
 	}
 
-	if(sb->protocol2->bsighead->got==BLK_INCOMING)
+	blk=sb->protocol2->bsighead;
+	if(blk->got==BLK_INCOMING)
+	{
+		data_reqs_to_wbuf(&batch, first, count, wbuf);
 		return 0;
+	}
 
-	if(sb->protocol2->bsighead->got==BLK_NOT_GOT)
+	if(blk->got==BLK_NOT_GOT)
 	{
-		base64_from_uint64(sb->protocol2->bsighead->index, req);
-		iobuf_from_str(wbuf, CMD_DATA_REQ, req);
-		sb->protocol2->bsighead->requested=1;
+		if(!sig_batch)
+		{
+			base64_from_uint64(blk->index, req);
+			iobuf_from_str(wbuf, CMD_DATA_REQ, req);
+		}
+		else if(count && blk->index==first->index+count)
+			count++;
+		else
+		{
+			if(count)
+			{
+				blk_to_iobuf_data_req_range(first,
+					count, &rec);
+				blk_batch_add(&batch, &rec);
+				count=0;
+			}
+			if(batch.count>=DATA_REQ_RANGES_MAX)
+			{
+				// Full. Carry on from this block next time.
+				blk_batch_to_iobuf(&batch, wbuf);
+				return 0;
+			}
+			first=blk;
+			count=1;
+		}
+		blk->requested=1;
 	}
 
 	// Move on.
@@ -444,6 +519,8 @@ static int get_wbuf_from_sigs(struct iobuf *wbuf, struct slist *slist,
 	{
 		sb->protocol2->bsighead=sb->protocol2->bsighead->next;
 	}
+	if(sig_batch)
+		goto again;
 	return 0;
 }
 
@@ -674,16 +751,18 @@ end:
 	return ret;
 }
 
-static int append_for_champ_chooser(struct asfd *chfd,
-	struct blist *blist, int end_flags)
+// Fill the wbuf with a batch of signatures for the champ chooser.
+// Returns 1 if there was anything to send.
+static int get_wbuf_for_champ_chooser(struct iobuf *wbuf, struct blist *blist)
 {
-	static int finished_sending=0;
-	static struct iobuf wbuf;
-	static struct blk *blk=NULL;
+	// The batch has to stay put until the wbuf has been written.
+	static struct blk_batch batch;
+	struct iobuf rec;
+	struct blk *blk;
 
-	while(blist->blk_for_champ_chooser)
+	blk_batch_init(&batch, CMD_SIGS);
+	while((blk=blist->blk_for_champ_chooser))
 	{
-		blk=blist->blk_for_champ_chooser;
 		// If we send too many blocks to the champ chooser at once,
 		// it can go faster than we can send paths to completed
 		// manifests to it. This means that deduplication efficiency
@@ -691,10 +770,25 @@ static int append_for_champ_chooser(struct asfd *chfd,
 		// So limit the sending.
 		if(blk->index
 		  - blist->head->index > MANIFEST_SIG_MAX)
-			return 0;
+			break;
 
-		blk_to_iobuf_sig(blk, &wbuf);
+		blk_to_iobuf_sig(blk, &rec);
+		if(blk_batch_add(&batch, &rec))
+			break; // Full.
+		blist->blk_for_champ_chooser=blk->next;
+	}
+	return blk_batch_to_iobuf(&batch, wbuf);
+}
 
+static int append_for_champ_chooser(struct asfd *chfd,
+	struct blist *blist, int end_flags)
+{
+	static int finished_sending=0;
+	static struct iobuf wbuf;
+
+	// A wbuf that did not fit last time has to go first.
+	while(wbuf.len || get_wbuf_for_champ_chooser(&wbuf, blist))
+	{
 		switch(chfd->append_all_to_write_buffer(chfd, &wbuf))
 		{
 			case APPEND_OK: break;
@@ -702,7 +796,6 @@ static int append_for_champ_chooser(struct asfd *chfd,
 				return 0; // Try again later.
 			default: return -1;
 		}
-		blist->blk_for_champ_chooser=blk->next;
 	}
 	if(end_flags&END_SIGS
 	  && !finished_sending && !blist->blk_for_champ_chooser)
@@ -712,6 +805,7 @@ static int append_for_champ_chooser(struct asfd *chfd,
 		{
 			case APPEND_OK: break;
 			case APPEND_BLOCKED:
+				wbuf.len=0;
 				return 0; // Try again later.
 			default: return -1;
 		}
@@ -742,23 +836,14 @@ static int mark_not_got(struct blk *blk, struct dpth *dpth)
 	return 0;
 }
 
-static struct hash_strong *in_local_hash(struct blk *blk)
-{
-	static struct hash_weak *hash_weak;
-
-	if(!(hash_weak=hash_weak_find(blk->fingerprint)))
-		return NULL;
-	return hash_strong_find(hash_weak, blk->md5sum);
-}
-
 static int simple_deduplicate_blk(struct blk *blk)
 {
-	static struct hash_strong *hash_strong;
+	static struct hash_entry *hash_entry;
 	if(blk->got!=BLK_INCOMING)
 		return 0;
-	if((hash_strong=in_local_hash(blk)))
+	if((hash_entry=hash_find(blk->fingerprint, blk->md5sum)))
 	{
-		blk->savepath=hash_strong->savepath;
+		blk->savepath=hash_entry->savepath;
 		blk->got_save_path=1;
 		blk->got=BLK_GOT;
 		return 1;
@@ -809,6 +894,21 @@ static int deal_with_sig_from_chfd(struct iobuf *rbuf, struct blist *blist,
 	return 0;
 }
 
+static int deal_with_sigs_from_chfd(struct iobuf *rbuf, struct blist *blist,
+	struct dpth *dpth, struct cntr *cntr)
+{
+	int ret;
+	size_t offset=0;
+	struct iobuf rec;
+	while((ret=blk_batch_next(rbuf, &offset, &rec))>0)
+	{
+		if(deal_with_sig_from_chfd(&rec, blist, dpth))
+			return -1;
+		cntr_add_same(cntr, CMD_DATA);
+	}
+	return ret;
+}
+
 static int deal_with_wrap_up_from_chfd(struct iobuf *rbuf, struct blist *blist,
 	struct dpth *dpth)
 {
@@ -836,6 +936,11 @@ static int deal_with_read_from_chfd(struct asfd *chfd,
 				goto end;
 			cntr_add_same(cntr, CMD_DATA);
 			break;
+		case CMD_SIGS:
+			if(deal_with_sigs_from_chfd(chfd->rbuf,
+				blist, dpth, cntr))
+					goto end;
+			break;
 		case CMD_WRAP_UP:
 			if(deal_with_wrap_up_from_chfd(chfd->rbuf, blist, dpth))
 				goto end;
@@ -934,7 +1039,7 @@ int do_backup_phase2_server_protocol2(struct async *as, struct asfd *chfd,
 		breakcount=breaking-2000;
 	}
 
-	blks_generate_init();
+	blks_generate_init((enum chunking)get_int(confs[OPT_CHUNKING]));
 
 	logp("Phase 2 begin (recv backup data)\n");
 
@@ -945,6 +1050,7 @@ int do_backup_phase2_server_protocol2(struct async *as, struct asfd *chfd,
 		sdirs->cfiles,
 		get_int(confs[OPT_MAX_STORAGE_SUBDIRS])))
 			goto end;
+	dpth->compression=get_int(confs[OPT_BLK_COMPRESSION]);
 	if(resume)
 	{
 		if(do_resume(&pos_phase1, &pos_current,
@@ -977,7 +1083,8 @@ int do_backup_phase2_server_protocol2(struct async *as, struct asfd *chfd,
 
 		if(!wbuf.len)
 		{
-			if(get_wbuf_from_sigs(&wbuf, slist, &end_flags))
+			if(get_wbuf_from_sigs(&wbuf, slist, &end_flags,
+				get_int(confs[OPT_SIG_BATCH])))
 				goto end;
 			if(!wbuf.len)
 			{
@@ -1008,6 +1115,10 @@ int do_backup_phase2_server_protocol2(struct async *as, struct asfd *chfd,
 			if(asfd->parse_readbuf(asfd))
 				goto end;
 		}
+		// With a sharded champ chooser, this is where the results
+		// from the shards get merged.
+		if(chfd->parse_readbuf(chfd))
+			goto end;
 		while(chfd->rbuf->buf)
 		{
 			if(deal_with_read_from_chfd(chfd,
@@ -1074,7 +1185,7 @@ end:
 	man_off_t_free(&pos_phase1);
 	man_off_t_free(&pos_current);
 	blks_generate_free();
-	hash_delete_all();
+	hash_free();
 	return ret;
 }
 
@@ -1090,7 +1201,6 @@ int backup_phase2_server_protocol2(struct async *as, struct sdirs *sdirs,
 	}
 	ret=do_backup_phase2_server_protocol2(as, chfd, sdirs, resume, confs);
 end:
-	if(chfd) as->asfd_remove(as, chfd);
-	asfd_free(&chfd);
+	champ_chooser_disconnect(as, &chfd);
 	return ret;
 }
@@ -15,6 +15,7 @@
 #include "../../server/manio.h"
 #include "../../server/sdirs.h"
 #include "champ_chooser/champ_chooser.h"
+#include "champ_chooser/sparse_map.h"
 #include "backup_phase4.h"
 #include "clist.h"
 #include "sparse_min.h"
@@ -254,8 +255,8 @@ int dindex_gzprintf(struct fzp *fzp, uint64_t *dindex)
 // Return 0 for OK, -1 for error, 1 for finished reading the file.
 static int get_next_dindex(uint64_t **dnew, struct sbuf *sb, struct fzp *fzp)
 {
-	static struct blk blk;
-	static struct iobuf rbuf;
+	static THREAD_LOCAL struct blk blk;
+	static THREAD_LOCAL struct iobuf rbuf;
 
 	memset(&rbuf, 0, sizeof(rbuf));
 
@@ -417,6 +418,22 @@ end:
 	return ret;
 }
 
+// The map is only there to make the champ chooser start faster, and it can
+// do without it, so failing to write one is not worth failing for. Make sure
+// that an old one does not get left behind, though.
+static void write_sparse_map(const char *global_sparse)
+{
+	char *path;
+	if(!sparse_map_write(global_sparse))
+		return;
+	logp("Could not write sparse map for %s\n", global_sparse);
+	if(!(path=sparse_map_path(global_sparse)))
+		return;
+	if(unlink(path) && errno!=ENOENT)
+		logp("Could not unlink %s: %s\n", path, strerror(errno));
+	free_w(&path);
+}
+
 static int lock_and_merge_into_global_sparse(
 	const char *sparse,
 	const char *global_sparse,
@@ -439,6 +456,8 @@ static int lock_and_merge_into_global_sparse(
 	if(sparse_minimise(conf, sdirs->global_sparse, lock, clist))
 		goto end;
 
+	write_sparse_map(global_sparse);
+
 	ret=0;
 end:
 	lock_release(lock);
@@ -800,7 +819,10 @@ int remove_backup_from_global_sparse(const char *global_sparse,
 
 		if(!strncmp(anew->path, candidate_str, clen)
 		  && *(anew->path+clen)=='/')
+		{
+			hooks_free(&anew);
 			continue;
+		}
 
 		if(hooks_gzprintf(dzp, anew)) goto end;
 		hooks_free(&anew);
@@ -816,6 +838,8 @@ int remove_backup_from_global_sparse(const char *global_sparse,
 	if(do_rename(tmpfile, global_sparse))
 		goto end;
 
+	write_sparse_map(global_sparse);
+
 	ret=0;
 end:
 	fzp_close(&azp);
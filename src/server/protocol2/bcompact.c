@@ -0,0 +1,554 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../base64.h"
+#include "../../bu.h"
+#include "../../cmd.h"
+#include "../../conffile.h"
+#include "../../cstat.h"
+#include "../../fsops.h"
+#include "../../fzp.h"
+#include "../../hexmap.h"
+#include "../../iobuf.h"
+#include "../../lock.h"
+#include "../../log.h"
+#include "../../prepend.h"
+#include "../../protocol2/blk.h"
+#include "../bu_get.h"
+#include "../sdirs.h"
+#include "bcompact.h"
+#include "clist.h"
+#include "dfidx.h"
+
+#include <uthash.h>
+
+// The blocks of a data file that the manifests use, one bit each.
+struct used
+{
+	uint64_t hash_key;
+	uint8_t bits[DATA_FILE_SIG_MAX/8];
+	UT_hash_handle hh;
+};
+
+struct compact_stats
+{
+	uint64_t files;
+	uint64_t compacted;
+	uint64_t dropped;
+	uint64_t bytes;
+};
+
+static struct used *used_hash=NULL;
+static struct cstat *clist=NULL;
+static struct lock *champ_lock=NULL;
+static struct lock *dindex_lock=NULL;
+// The restore and verify locks of all the backups.
+static struct lock *read_locks=NULL;
+
+static int usage(void)
+{
+	logfmt("\nUsage: %s [options] <path to dedup_group>\n", prog);
+	logfmt("\n");
+	logfmt(" Options:\n");
+	logfmt("  -c <path>  Path to config file (default: %s).\n",
+		config_default_path());
+	logfmt("  -n         Only report what would be reclaimed.\n");
+	logfmt("  -r <0-100> Compact data files with fewer than this percent\n");
+	logfmt("             of their blocks still used (default: 50).\n");
+	logfmt("\n");
+	return 1;
+}
+
+static void release_locks(void)
+{
+	clist_unlock(clist);
+	locks_release_and_free(&read_locks);
+	lock_release(dindex_lock);
+	lock_free(&dindex_lock);
+	lock_release(champ_lock);
+	lock_free(&champ_lock);
+}
+
+static void sighandler(__attribute__ ((unused)) int signum)
+{
+	release_locks();
+	exit(1);
+}
+
+static void setup_sighandler(void)
+{
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+}
+
+static struct sdirs *get_sdirs(struct conf **conf)
+{
+	struct sdirs *sdirs=NULL;
+	if(!(sdirs=sdirs_alloc())
+	  || sdirs_init_from_confs(sdirs, conf))
+		sdirs_free(&sdirs);
+	return sdirs;
+}
+
+static int get_lock(struct lock **lock, const char *path)
+{
+	if(!(*lock=lock_alloc_and_init(path)))
+		return -1;
+	lock_get(*lock);
+	if((*lock)->status==GET_LOCK_GOT)
+		return 0;
+	logp("Could not get %s\n", path);
+	return -1;
+}
+
+static void used_free(void)
+{
+	struct used *u;
+	struct used *tmp;
+	HASH_ITER(hh, used_hash, u, tmp)
+	{
+		HASH_DEL(used_hash, u);
+		free_v((void **)&u);
+	}
+}
+
+static int used_mark(uint64_t savepath)
+{
+	struct used *u;
+	uint64_t hash_key=savepath & 0xFFFFFFFFFFFF0000ULL;
+	uint16_t datno=savepath & 0xFFFF;
+
+	if(datno>=DATA_FILE_SIG_MAX)
+	{
+		logp("Block number too big in %s\n",
+			uint64_to_savepathstr_with_sig(savepath));
+		return -1;
+	}
+	HASH_FIND(hh, used_hash, &hash_key, sizeof(hash_key), u);
+	if(!u)
+	{
+		if(!(u=(struct used *)calloc_w(1, sizeof(struct used),
+			__func__)))
+				return -1;
+		u->hash_key=hash_key;
+		HASH_ADD(hh, used_hash, hash_key, sizeof(u->hash_key), u);
+	}
+	u->bits[datno/8]|=1<<(datno%8);
+	return 0;
+}
+
+static int is_used(struct used *u, uint16_t datno)
+{
+	return u->bits[datno/8] & (1<<(datno%8));
+}
+
+static int mark_manifest_file(const char *path)
+{
+	int ret=-1;
+	struct blk blk;
+	struct fzp *fzp=NULL;
+	struct iobuf rbuf;
+
+	iobuf_init(&rbuf);
+	memset(&blk, 0, sizeof(blk));
+	if(!(fzp=fzp_gzopen(path, "rb")))
+		goto end;
+	while(1)
+	{
+		iobuf_free_content(&rbuf);
+		switch(iobuf_fill_from_fzp(&rbuf, fzp))
+		{
+			case 0: break;
+			case 1: ret=0;
+				goto end;
+			default: goto end;
+		}
+		if(rbuf.cmd!=CMD_SIG)
+			continue;
+		if(blk_set_from_iobuf_sig_and_savepath(&blk, &rbuf)
+		  || used_mark(blk.savepath))
+			goto end;
+	}
+end:
+	iobuf_free_content(&rbuf);
+	fzp_close(&fzp);
+	return ret;
+}
+
+static int mark_backup(struct bu *bu)
+{
+	int ret=-1;
+	uint64_t fcount=0;
+	char tmp[32]="";
+	char *manifest=NULL;
+	char *fpath=NULL;
+	struct stat statp;
+
+	if(!(manifest=prepend_s(bu->path, "manifest")))
+		goto end;
+	logp("reading: %s\n", manifest);
+	while(1)
+	{
+		free_w(&fpath);
+		snprintf(tmp, sizeof(tmp), "%08" PRIX64, fcount++);
+		if(!(fpath=prepend_s(manifest, tmp)))
+			goto end;
+		if(lstat(fpath, &statp))
+			break;
+		if(mark_manifest_file(fpath))
+			goto end;
+	}
+	ret=0;
+end:
+	free_w(&manifest);
+	free_w(&fpath);
+	return ret;
+}
+
+// The same things that stop the unused data files being deleted. The
+// manifest of an unfinished backup might use blocks that no finished one
+// does.
+static int client_busy(struct cstat *c)
+{
+	int ret=-1;
+	char *regenerating=NULL;
+	struct stat statp;
+	struct sdirs *s=(struct sdirs *)c->sdirs;
+
+	if(!(regenerating=prepend(s->dfiles, ".regenerating")))
+		goto end;
+	if(!lstat(s->working, &statp)
+	  || !lstat(s->finishing, &statp)
+	  || !lstat(regenerating, &statp))
+	{
+		logp("%s looks like it has a backup in progress.\n", c->name);
+		ret=1;
+		goto end;
+	}
+	ret=0;
+end:
+	free_w(&regenerating);
+	return ret;
+}
+
+// Restores and verifies do not take the client locks, and they remember
+// where they were up to in each data file, so they must not run while the
+// data files are rewritten.
+static int lock_backup_for_read(struct bu *bu)
+{
+	int ret=-1;
+	char *lockfile=NULL;
+	struct lock *lock=NULL;
+
+	if(!(lockfile=prepend_s(bu->path, "lockfile.read"))
+	  || !(lock=lock_alloc_and_init(lockfile)))
+		goto end;
+	lock_get(lock);
+	if(lock->status!=GET_LOCK_GOT)
+	{
+		logp("%s is being restored or verified.\n", bu->path);
+		goto end;
+	}
+	lock_add_to_list(&read_locks, lock);
+	lock=NULL;
+	ret=0;
+end:
+	free_w(&lockfile);
+	lock_free(&lock);
+	return ret;
+}
+
+static int mark_clients(void)
+{
+	int ret=-1;
+	struct cstat *c;
+	struct bu *b=NULL;
+	struct bu *bu_list=NULL;
+
+	for(c=clist; c; c=c->next)
+	{
+		if(client_busy(c))
+			goto end;
+		bu_list_free(&bu_list);
+		if(bu_get_list((struct sdirs *)c->sdirs, &bu_list))
+			goto end;
+		for(b=bu_list; b; b=b->next)
+			if(lock_backup_for_read(b)
+			  || mark_backup(b))
+				goto end;
+	}
+	ret=0;
+end:
+	bu_list_free(&bu_list);
+	return ret;
+}
+
+static int read_data_file(const char *path, char **buf, size_t *len)
+{
+	int ret=-1;
+	struct stat statp;
+	struct fzp *fzp=NULL;
+
+	if(lstat(path, &statp))
+	{
+		logp("Could not lstat %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	*len=(size_t)statp.st_size;
+	if(!(*buf=(char *)malloc_w(*len+1, __func__))
+	  || !(fzp=fzp_open(path, "rb")))
+		goto end;
+	if(fzp_read(fzp, *buf, *len)!=(int)*len)
+	{
+		logp("Could not read %s\n", path);
+		goto end;
+	}
+	ret=0;
+end:
+	fzp_close(&fzp);
+	return ret;
+}
+
+// Blocks that are not used any more become empty blocks, so that the
+// blocks after them keep their numbers, and nothing that refers to them
+// needs to change.
+static int write_compacted(const char *path, const char *buf,
+	struct dfidx *dfidx, struct used *u, uint32_t *offsets)
+{
+	int ret=-1;
+	uint16_t i;
+	uint32_t len;
+	char *tmp=NULL;
+	struct fzp *fzp=NULL;
+
+	if(!(tmp=prepend(path, ".compact"))
+	  || !(fzp=fzp_open(tmp, "wb")))
+		goto end;
+	offsets[0]=0;
+	for(i=0; i<dfidx->count; i++)
+	{
+		len=dfidx->offsets[i+1]-dfidx->offsets[i];
+		if(is_used(u, i))
+		{
+			if(fzp_write(fzp, buf+dfidx->offsets[i], len)!=len)
+				goto error_writing;
+		}
+		else
+		{
+			len=5;
+			if(fzp_printf(fzp, "%c%04X", CMD_DATA, 0)!=(int)len)
+				goto error_writing;
+		}
+		offsets[i+1]=offsets[i]+len;
+	}
+	// The old data file is replaced by a rename, so the new one has to be
+	// on disk first.
+	if(fzp_flush(fzp)
+	  || fsync(fzp_fileno(fzp)))
+		goto error_writing;
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	// The old index would not match the new data file. Readers that find
+	// no index read the data file from the start.
+	if(dfidx_unlink(path)
+	  || do_rename(tmp, path))
+		goto end;
+	if(dfidx_write(path, offsets, dfidx->count))
+		logp("Could not write the index of %s\n", path);
+	ret=0;
+	goto end;
+error_writing:
+	logp("Error writing %s in %s\n", tmp, __func__);
+end:
+	fzp_close(&fzp);
+	if(ret && tmp)
+		unlink(tmp);
+	free_w(&tmp);
+	return ret;
+}
+
+static int compact_data_file(const char *datadir, struct used *u,
+	int percent, int dry_run, struct compact_stats *stats)
+{
+	int ret=-1;
+	uint16_t i;
+	uint32_t len;
+	size_t buflen=0;
+	uint16_t blocks=0;
+	uint16_t dropped=0;
+	uint64_t bytes=0;
+	char *buf=NULL;
+	char *path=NULL;
+	char *lockfile=NULL;
+	const char *savepathstr;
+	struct lock *lock=NULL;
+	struct dfidx dfidx;
+	uint32_t offsets[DATA_FILE_SIG_MAX+1];
+
+	memset(&dfidx, 0, sizeof(dfidx));
+	savepathstr=uint64_to_savepathstr(u->hash_key);
+	if(!(path=prepend_s(datadir, savepathstr))
+	  || !(lockfile=prepend(path, ".lock")))
+		goto end;
+
+	// Lock it the same way as a backup that is writing to it would.
+	if(!(lock=lock_alloc_and_init(lockfile)))
+		goto end;
+	lock_get_quick(lock);
+	if(lock->status!=GET_LOCK_GOT)
+	{
+		logp("Skipping %s, which is locked\n", savepathstr);
+		ret=0;
+		goto end;
+	}
+
+	if(read_data_file(path, &buf, &buflen)
+	  || dfidx_build(&dfidx, buf, buflen))
+		goto end;
+	if(dfidx.offsets[dfidx.count]!=buflen)
+	{
+		logp("Skipping %s, which has a bad block\n", savepathstr);
+		ret=0;
+		goto end;
+	}
+	stats->files++;
+
+	for(i=0; i<dfidx.count; i++)
+	{
+		len=dfidx.offsets[i+1]-dfidx.offsets[i]-5;
+		// Dropped already, by an earlier compaction.
+		if(!len)
+			continue;
+		blocks++;
+		if(is_used(u, i))
+			continue;
+		dropped++;
+		bytes+=len;
+	}
+	if(!dropped
+	  || (blocks-dropped)*100>=percent*blocks)
+	{
+		ret=0;
+		goto end;
+	}
+
+	if(!dry_run
+	  && write_compacted(path, buf, &dfidx, u, offsets))
+		goto end;
+	logp("%s %s: %d of %d blocks unused, %" PRIu64 " bytes\n",
+		dry_run?"would compact":"compacted",
+		savepathstr, dropped, blocks, bytes);
+	stats->compacted++;
+	stats->dropped+=dropped;
+	stats->bytes+=bytes;
+	ret=0;
+end:
+	lock_release(lock);
+	lock_free(&lock);
+	dfidx_free_content(&dfidx);
+	free_w(&buf);
+	free_w(&path);
+	free_w(&lockfile);
+	return ret;
+}
+
+static int compact_data_files(const char *datadir, int percent, int dry_run)
+{
+	struct used *u;
+	struct used *tmp;
+	struct compact_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+	HASH_ITER(hh, used_hash, u, tmp)
+	{
+		if(compact_data_file(datadir, u, percent, dry_run, &stats))
+			return -1;
+	}
+	logp("%" PRIu64 " data files looked at, %" PRIu64 " %s, %" PRIu64
+		" blocks dropped, %" PRIu64 " bytes %s\n",
+		stats.files, stats.compacted,
+		dry_run?"to compact":"compacted",
+		stats.dropped, stats.bytes,
+		dry_run?"to reclaim":"reclaimed");
+	return 0;
+}
+
+int run_bcompact(int argc, char *argv[])
+{
+	int ret=1;
+	int option;
+	int dry_run=0;
+	int percent=50;
+	const char *configfile=NULL;
+	struct sdirs *sdirs=NULL;
+	struct conf **conf=NULL;
+
+	base64_init();
+	hexmap_init();
+	configfile=config_default_path();
+
+	while((option=getopt(argc, argv, "c:nr:Vh?"))!=-1)
+	{
+		switch(option)
+		{
+			case 'c':
+				configfile=optarg;
+				break;
+			case 'n':
+				dry_run=1;
+				break;
+			case 'r':
+				percent=atoi(optarg);
+				if(percent<0 || percent>100)
+					return usage();
+				break;
+			case 'V':
+				logfmt("%s-%s\n", prog, PACKAGE_VERSION);
+				return 0;
+			case 'h':
+			case '?':
+				return usage();
+		}
+	}
+
+	if(optind>=argc || optind<argc-1)
+		return usage();
+
+	if(!(conf=clist_load_conf(configfile, argv[optind]))
+	  || !(sdirs=get_sdirs(conf)))
+		goto end;
+
+	logp("clients: %s\n", sdirs->clients);
+	logp("data: %s\n", sdirs->data);
+
+	setup_sighandler();
+
+	// No champ chooser can run, and no unused data files can be deleted,
+	// while this has these.
+	if(get_lock(&champ_lock, sdirs->champlock)
+	  || get_lock(&dindex_lock, sdirs->champ_dindex_lock))
+		goto end;
+
+	if(get_client_list(&clist, sdirs->clients, conf))
+	{
+		logp("Did not find any client directories\n");
+		goto end;
+	}
+
+	if(clist_lock(clist)
+	  || mark_clients()
+	  || compact_data_files(sdirs->data, percent, dry_run))
+		goto end;
+
+	ret=0;
+end:
+	release_locks();
+	used_free();
+	sdirs_free(&sdirs);
+	confs_free(&conf);
+	clist_free(&clist);
+	return ret;
+}
@@ -0,0 +1,6 @@
+#ifndef _BCOMPACT_H
+#define _BCOMPACT_H
+
+extern int run_bcompact(int argc, char *argv[]);
+
+#endif
@@ -18,6 +18,7 @@
 #include "bsigs.h"
 #include "clist.h"
 #include "champ_chooser/champ_chooser.h"
+#include "champ_chooser/sparse_map.h"
 #include "sparse_min.h"
 
 static struct lock *sparse_lock=NULL;
@@ -36,15 +37,7 @@ static int usage(void)
 
 static void release_locks(struct cstat *clist)
 {
-	struct cstat *c;
-	struct sdirs *s;
-	for(c=clist; c; c=c->next)
-	{
-		s=(struct sdirs *)c->sdirs;
-		if(!s) continue;
-		lock_release(s->lock_storage_for_write);
-		logp("released: %s\n", c->name);
-	}
+	clist_unlock(clist);
 	lock_release(sparse_lock);
 	lock_free(&sparse_lock);
 	logp("released: sparse index\n");
@@ -65,45 +58,6 @@ static struct sdirs *get_sdirs(struct conf **conf)
 	return sdirs;
 }
 
-static int parse_directory(const char *arg,
-	char **directory, char **dedup_group)
-{
-	char *cp;
-	if(!(*directory=strdup_w(arg, __func__)))
-		goto error;
-	strip_trailing_slashes(directory);
-	if(!(cp=strrchr(*directory, '/')))
-	{
-		logp("Could not parse directory '%s'\n", *directory);
-		goto error;
-	}
-	*cp='\0';
-	if(!(*dedup_group=strdup_w(cp+1, __func__)))
-		goto error;
-	if(!*directory || !*dedup_group)
-		goto error;
-	return 0;
-error:
-	free_w(directory);
-	free_w(dedup_group);
-	return -1;
-}
-
-static struct conf **load_conf(const char *configfile,
-	const char *directory, const char *dedup_group)
-{
-	struct conf **conf=NULL;
-	if(!(conf=confs_alloc())
-	  || confs_init(conf)
-	  || conf_load_global_only(configfile, conf)
-	  || set_string(conf[OPT_CNAME], "fake")
-	  || set_string(conf[OPT_DIRECTORY], directory)
-	  || set_string(conf[OPT_DEDUP_GROUP], dedup_group)
-	  || set_protocol(conf, PROTO_2))
-		confs_free(&conf);
-	return conf;
-}
-
 static void setup_sighandler(void)
 {
 	signal(SIGABRT, &sighandler);
@@ -121,39 +75,6 @@ static int get_sparse_lock(const char *sparse)
 	return 0;
 }
 
-static int get_client_locks(struct cstat *clist)
-{
-	struct cstat *c;
-	struct sdirs *s;
-	for(c=clist; c; c=c->next)
-	{
-		s=(struct sdirs *)c->sdirs;
-		if(mkpath(&s->lock_storage_for_write->path, s->lockdir))
-		{
-			logp("problem with lock directory: %s\n", s->lockdir);
-			return -1;
-		}
-
-		lock_get(s->lock_storage_for_write);
-		switch(s->lock_storage_for_write->status)
-		{
-			case GET_LOCK_GOT:
-				logp("locked: %s\n", c->name);
-				break;
-			case GET_LOCK_NOT_GOT:
-				logp("Unable to get lock for client %s\n",
-					c->name);
-				return -1;
-			case GET_LOCK_ERROR:
-			default:
-				logp("Problem with lock file: %s\n",
-					s->lock_storage_for_write->path);
-				return -1;
-		}
-	}
-	return 0;
-}
-
 static int merge_in_client_sparse_indexes(struct cstat *c,
 	const char *global_sparse)
 {
@@ -204,8 +125,6 @@ int run_bsparse(int argc, char *argv[])
 {
 	int ret=1;
 	int option;
-	char *directory=NULL;
-	char *dedup_group=NULL;
 	const char *configfile=NULL;
 	struct sdirs *sdirs=NULL;
 	struct conf **conf=NULL;
@@ -232,14 +151,7 @@ int run_bsparse(int argc, char *argv[])
 	if(optind>=argc || optind<argc-1)
 		return usage();
 
-	if(parse_directory(argv[optind], &directory, &dedup_group))
-		goto end;
-
-	logp("config file: %s\n", configfile);
-	logp("directory: %s\n", directory);
-	logp("dedup_group: %s\n", dedup_group);
-
-	if(!(conf=load_conf(configfile, directory, dedup_group))
+	if(!(conf=clist_load_conf(configfile, argv[optind]))
 	  || !(sdirs=get_sdirs(conf)))
 		goto end;
 
@@ -257,7 +169,7 @@ int run_bsparse(int argc, char *argv[])
 		goto end;
 	}
 
-	if(get_client_locks(clist))
+	if(clist_lock(clist))
 		goto end;
 
 	if(merge_in_all_sparse_indexes(sdirs->global_sparse))
@@ -266,12 +178,13 @@ int run_bsparse(int argc, char *argv[])
 	if(sparse_minimise(conf, sdirs->global_sparse, sparse_lock, clist))
 		goto end;
 
+	if(sparse_map_write(sdirs->global_sparse))
+		goto end;
+
 	ret=0;
 end:
 	release_locks(clist);
 	sdirs_free(&sdirs);
-	free_w(&directory);
-	free_w(&dedup_group);
 	confs_free(&conf);
 	clist_free(&clist);
 	return ret;
@@ -0,0 +1,92 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../log.h"
+#include "bloom.h"
+
+#define BLOOM_WORDS		8	// 64 bytes per block.
+#define BLOOM_BITS_PER_KEY	16	// About 0.05% false positives.
+
+// Fingerprints are not evenly spread, and hooks all have the same top bits,
+// so mix them up before using them.
+static uint64_t bloom_mix(uint64_t x)
+{
+	x^=x>>30;
+	x*=0xbf58476d1ce4e5b9ULL;
+	x^=x>>27;
+	x*=0x94d049bb133111ebULL;
+	x^=x>>31;
+	return x;
+}
+
+struct bloom *bloom_alloc(size_t capacity)
+{
+	size_t count=1;
+	struct bloom *bloom;
+
+	while(count*BLOOM_WORDS*64<capacity*BLOOM_BITS_PER_KEY)
+		count*=2;
+	if(!(bloom=(struct bloom *)calloc_w(1, sizeof(struct bloom), __func__)))
+		return NULL;
+	if(!(bloom->blocks=(uint64_t *)calloc_w(count*BLOOM_WORDS,
+		sizeof(uint64_t), __func__)))
+	{
+		bloom_free(&bloom);
+		return NULL;
+	}
+	bloom->count=count;
+	bloom->capacity=count*BLOOM_WORDS*64/BLOOM_BITS_PER_KEY;
+	return bloom;
+}
+
+void bloom_free(struct bloom **bloom)
+{
+	if(!bloom || !*bloom) return;
+	free_v((void **)&(*bloom)->blocks);
+	free_v((void **)bloom);
+}
+
+// One bit in each word of the block, using six bits of the second hash for
+// each word.
+void bloom_add(struct bloom *bloom, uint64_t key)
+{
+	int i;
+	uint64_t h=bloom_mix(key);
+	uint64_t bits=bloom_mix(h);
+	uint64_t *block=bloom->blocks+(h&(bloom->count-1))*BLOOM_WORDS;
+
+	for(i=0; i<BLOOM_WORDS; i++, bits>>=6)
+		block[i]|=1ULL<<(bits&63);
+	bloom->keys++;
+}
+
+int bloom_maybe(struct bloom *bloom, uint64_t key)
+{
+	int i;
+	uint64_t h=bloom_mix(key);
+	uint64_t bits=bloom_mix(h);
+	uint64_t *block=bloom->blocks+(h&(bloom->count-1))*BLOOM_WORDS;
+
+	bloom->lookups++;
+	for(i=0; i<BLOOM_WORDS; i++, bits>>=6)
+		if(!(block[i]&(1ULL<<(bits&63))))
+			return 0;
+	bloom->passed++;
+	return 1;
+}
+
+size_t bloom_bytes(struct bloom *bloom)
+{
+	return bloom->count*BLOOM_WORDS*sizeof(uint64_t);
+}
+
+void bloom_log(struct bloom *bloom, const char *desc)
+{
+	uint64_t misses;
+	if(!bloom) return;
+	// Only lookups that should have been rejected can be false positives.
+	misses=bloom->lookups-(bloom->passed-bloom->false_positives);
+	logp("%s bloom filter: %zu bytes, %zu keys, %" PRIu64 " lookups, %" PRIu64 " rejected, false positive rate %.4f%%\n",
+		desc, bloom_bytes(bloom), bloom->keys,
+		bloom->lookups, bloom->lookups-bloom->passed,
+		misses?100.0*bloom->false_positives/misses:0.0);
+}
@@ -0,0 +1,26 @@
+#ifndef _CHAMP_CHOOSER_BLOOM_H
+#define _CHAMP_CHOOSER_BLOOM_H
+
+// A blocked Bloom filter. Each key only touches one 64 byte block, so a
+// lookup that misses costs at most one cache line.
+struct bloom
+{
+	uint64_t *blocks;
+	size_t count;		// Number of blocks, always a power of two.
+	size_t keys;
+	size_t capacity;	// Keys that fit before it gets too full.
+
+	// Counters for the stats.
+	uint64_t lookups;
+	uint64_t passed;
+	uint64_t false_positives;
+};
+
+extern struct bloom *bloom_alloc(size_t capacity);
+extern void bloom_free(struct bloom **bloom);
+extern void bloom_add(struct bloom *bloom, uint64_t key);
+extern int bloom_maybe(struct bloom *bloom, uint64_t key);
+extern size_t bloom_bytes(struct bloom *bloom);
+extern void bloom_log(struct bloom *bloom, const char *desc);
+
+#endif
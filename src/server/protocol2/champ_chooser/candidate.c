@@ -7,12 +7,17 @@
 #include "incoming.h"
 #include "scores.h"
 #include "sparse.h"
+#include "sparse_map.h"
 
 #include <assert.h>
 
 struct candidate **candidates=NULL;
 size_t candidates_len=0;
 
+// Candidates by path. They only get added when something looks one up.
+static struct candidate *candidates_by_path=NULL;
+static size_t candidates_indexed=0;
+
 #ifndef UTEST
 static
 #endif
@@ -43,14 +48,19 @@ void candidates_free(void)
 	for(size_t c=0; c<candidates_len; c++)
 		candidate_free(&(candidates[c]));
 	free_v((void **)&candidates);
+	candidates_len=0;
+	HASH_CLEAR(hh, candidates_by_path);
+	candidates_indexed=0;
 }
 
-static void candidates_set_score_pointers(struct candidate **candidates,
-	struct scores *scores)
+// Call after adding candidates, so that each one has somewhere to keep its
+// score.
+int candidates_scores_update(struct scores *scores)
 {
-	size_t a;
-	for(a=0; candidates && a<candidates_len; a++)
-		candidates[a]->score=&(scores->scores[a]);
+	if(scores_grow(scores, candidates_len))
+		return -1;
+	scores_reset(scores);
+	return 0;
 }
 
 struct candidate *candidates_add_new(void)
@@ -62,10 +72,26 @@ struct candidate *candidates_add_new(void)
 	if(!(candidates=(struct candidate **)realloc_w(candidates,
 		(candidates_len+1)*sizeof(struct candidate *), __func__)))
 			return NULL;
+	candidate->id=(uint32_t)candidates_len;
 	candidates[candidates_len++]=candidate;
 	return candidate;
 }
 
+struct candidate *candidates_find(const char *path)
+{
+	struct candidate *candidate;
+	for(; candidates_indexed<candidates_len; candidates_indexed++)
+	{
+		candidate=candidates[candidates_indexed];
+		if(!candidate->path)
+			continue;
+		HASH_ADD_KEYPTR(hh, candidates_by_path, candidate->path,
+			strlen(candidate->path), candidate);
+	}
+	HASH_FIND_STR(candidates_by_path, path, candidate);
+	return candidate;
+}
+
 // This deals with reading in the sparse index, as well as actual candidate
 // manifests.
 enum cand_ret candidate_load(struct candidate *candidate, const char *path,
@@ -102,7 +128,8 @@ enum cand_ret candidate_load(struct candidate *candidate, const char *path,
 		}
 		if(blk_fingerprint_is_hook(blk))
 		{
-			if(sparse_add_candidate(&blk->fingerprint, candidate))
+			if(sparse_in_shard(blk->fingerprint)
+			  && sparse_add_candidate(&blk->fingerprint, candidate))
 			{
 				ret=CAND_RET_PERM;
 				goto error;
@@ -122,13 +149,11 @@ enum cand_ret candidate_load(struct candidate *candidate, const char *path,
 	}
 
 end:
-	if(scores_grow(scores, candidates_len))
+	if(candidates_scores_update(scores))
 	{
 		ret=CAND_RET_PERM;
 		goto error;
 	}
-	candidates_set_score_pointers(candidates, scores);
-	scores_reset(scores);
 	//logp("Now have %d candidates\n", (int)candidates_len);
 	ret=CAND_RET_OK;
 error:
@@ -163,6 +188,11 @@ int candidate_add_fresh(const char *path, const char *directory,
 			// candidates.
 			logp("Removing candidate.\n");
 			candidates_len--;
+			if(candidates_indexed>candidates_len)
+			{
+				HASH_DEL(candidates_by_path, candidate);
+				candidates_indexed=candidates_len;
+			}
 			sparse_delete_fresh_candidate(candidate);
 			candidate_free(&candidate);
 			// Fall through.
@@ -174,78 +204,125 @@ error:
 	return -1;
 }
 
-struct candidate *candidates_choose_champ(struct incoming *in,
-	struct candidate *champ_last, struct scores *scores)
+// The candidates for a hook are the ones from the sparse map, followed by
+// the fresh ones.
+static size_t hit_len(struct incoming_hit *hit)
 {
-	static uint16_t i;
-	static uint16_t s;
-	static struct sparse *sparse;
-	static struct candidate *best;
-	static struct candidate *candidate;
-	static uint16_t *score;
-
-	best=NULL;
+	return hit->mapped_count+(hit->sparse?hit->sparse->size:0);
+}
 
-	//struct timespec tstart={0,0}, tend={0,0};
-	//clock_gettime(CLOCK_MONOTONIC, &tstart);
+static uint32_t hit_id(struct incoming_hit *hit, size_t s)
+{
+	if(s<hit->mapped_count)
+		return hit->mapped[s];
+	return hit->sparse->candidates[s-hit->mapped_count]->id;
+}
 
-	scores_reset(scores);
+static void find_hits(struct incoming *in)
+{
+	uint16_t i;
+	struct incoming_hit *hit;
 
+	in->hits_len=0;
 	for(i=0; i<in->size; i++)
 	{
 		if(in->found[i]) continue;
+		if(!sparse_maybe(in->fingerprints[i]))
+			continue;
+		hit=&in->hits[in->hits_len];
+		hit->mapped_count=0;
+		hit->mapped=sparse_map_find(in->fingerprints[i],
+			&hit->mapped_count);
+		hit->sparse=sparse_find(&in->fingerprints[i]);
+		if(!hit->mapped && !hit->sparse)
+		{
+			sparse_bloom_false_positive();
+			continue;
+		}
+		hit->i=i;
+		in->hits_len++;
+	}
+}
+
+static int hit_has(struct incoming_hit *hit, uint32_t id)
+{
+	size_t s;
+	size_t len=hit_len(hit);
+	for(s=0; s<len; s++)
+		if(hit_id(hit, s)==id)
+			return 1;
+	return 0;
+}
 
-		if(!(sparse=sparse_find(&in->fingerprints[i])))
+// A candidate's score is the number of fingerprints not yet found that it
+// has. Scores include deleted candidates, but they never get chosen.
+// When scores are equal, the newest candidate wins.
+static struct candidate *best_candidate(struct scores *scores)
+{
+	size_t t;
+	uint32_t id;
+	uint16_t score;
+	uint16_t best_score=0;
+	struct candidate *best=NULL;
+
+	for(t=0; scores && t<scores->touched_len; t++)
+	{
+		id=scores->touched[t];
+		score=scores->scores[id];
+		if(!score
+		  || score<best_score
+		  || (best && score==best_score && id<best->id)
+		  || candidates[id]->deleted)
 			continue;
-		for(s=0; s<sparse->size; s++)
+		best=candidates[id];
+		best_score=score;
+	}
+	return best;
+}
+
+// The first call for a set of incoming fingerprints should have no
+// champ_last. It finds the fingerprints that are in the sparse index and
+// scores every candidate that has any of them. Each call after that takes
+// away the fingerprints that the last champ had, along with the scores that
+// they gave, so nothing needs to be looked up or scored again.
+struct candidate *candidates_choose_champ(struct incoming *in,
+	struct candidate *champ_last, struct scores *scores)
+{
+	size_t s;
+	size_t len;
+	uint16_t h;
+	struct incoming_hit *hit;
+
+	if(!champ_last)
+	{
+		scores_reset_touched(scores);
+		find_hits(in);
+		for(h=0; h<in->hits_len; h++)
 		{
-			candidate=sparse->candidates[s];
-			if(candidate->deleted) continue;
-			if(candidate==champ_last)
+			hit=&in->hits[h];
+			len=hit_len(hit);
+			for(s=0; s<len; s++)
 			{
-				int t;
-				// Want to exclude sparse entries that have
-				// already been found.
-				in->found[i]=1;
-				// Need to go back up the list, subtracting
-				// scores.
-				for(t=s-1; t>=0; t--)
-				{
-					(*(sparse->candidates[t]->score))--;
-//	printf("%d %s   fix: %d\n", i, candidate->path, *(sparse->candidates[t]->score));
-				}
-				break;
+				scores_add(scores, hit_id(hit, s));
+				assert(scores->scores[hit_id(hit, s)]
+					<=in->size);
 			}
-			score=candidate->score;
-			(*score)++;
-//			printf("%d %s score: %d\n", i, candidate->path, *score);
-			assert(*score<=in->size);
-			if(!best
-			// Maybe should check for candidate!=best here too.
-			  || *score>*(best->score))
-			{
-				best=candidate;
-/*
-				printf("%s is now best:\n",
-					best->path);
-				printf("    score %p %d\n",
-					best->score, *(best->score));
-*/
-			}
-			// FIX THIS: figure out a way of giving preference to
-			// newer candidates.
 		}
+		return best_candidate(scores);
 	}
-	//clock_gettime(CLOCK_MONOTONIC, &tend);
-	//printf("champ_chooser took about %.5f seconds\n",
-	//	((double)tend.tv_sec + 1.0e-9*tend.tv_nsec) - 
-	//	((double)tstart.tv_sec + 1.0e-9*tstart.tv_nsec));
-
-/*
-	if(best)
-		printf("%s is choice:\nscore %p %d\n", best->path, best->score, *(best->score));
-	else
-		printf("no choice\n");
-*/
-	return best;
+
+	for(h=0; h<in->hits_len; h++)
+	{
+		hit=&in->hits[h];
+		if(in->found[hit->i]
+		  || !hit_has(hit, champ_last->id))
+			continue;
+		// Want to exclude sparse entries that have already been
+		// found.
+		in->found[hit->i]=1;
+		len=hit_len(hit);
+		for(s=0; s<len; s++)
+			scores->scores[hit_id(hit, s)]--;
+	}
+	return best_candidate(scores);
 }
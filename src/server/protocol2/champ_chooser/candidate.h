@@ -1,6 +1,8 @@
 #ifndef _CHAMP_CHOOSER_CANDIDATE_H
 #define _CHAMP_CHOOSER_CANDIDATE_H
 
+#include <uthash.h>
+
 struct incoming;
 struct scores;
 
@@ -13,16 +15,19 @@ enum cand_ret
 
 struct candidate
 {
-	uint16_t *score;
+	uint32_t id;		// Position in the candidates array.
 	uint16_t deleted;
 	char *path;
+	UT_hash_handle hh;	// For finding candidates by path.
 };
 
 extern struct candidate **candidates;
 extern size_t candidates_len;
 
 extern void candidates_free(void);
+extern int candidates_scores_update(struct scores *scores);
 extern struct candidate *candidates_add_new(void);
+extern struct candidate *candidates_find(const char *path);
 extern enum cand_ret candidate_load(struct candidate *candidate,
 	const char *path, struct scores *scores);
 extern int candidate_add_fresh(const char *path, const char *directory,
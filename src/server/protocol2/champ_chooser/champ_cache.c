@@ -0,0 +1,250 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "candidate.h"
+#include "champ_cache.h"
+#include "hash.h"
+
+// A manifest is never changed once it has been written, but it can go away
+// when its backup is deleted. So a cached champ is only used if its file is
+// still there and looks the same as when it was read.
+struct champ_cached
+{
+	struct candidate *candidate;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	struct hash_list list;
+	struct champ_cached *prev;	// More recently used.
+	struct champ_cached *next;	// Less recently used.
+};
+
+static struct champ_cached **by_id=NULL;
+static size_t by_id_len=0;
+static struct champ_cached *lru_head=NULL;
+static struct champ_cached *lru_tail=NULL;
+static struct champ_cache_stats stats;
+
+static uint64_t cached_bytes(struct champ_cached *c)
+{
+	return sizeof(struct champ_cached)
+		+c->list.len*sizeof(struct hash_entry);
+}
+
+static void lru_remove(struct champ_cached *c)
+{
+	if(c->prev) c->prev->next=c->next;
+	else lru_head=c->next;
+	if(c->next) c->next->prev=c->prev;
+	else lru_tail=c->prev;
+	c->prev=c->next=NULL;
+}
+
+static void lru_push(struct champ_cached *c)
+{
+	c->prev=NULL;
+	c->next=lru_head;
+	if(lru_head) lru_head->prev=c;
+	else lru_tail=c;
+	lru_head=c;
+}
+
+static void cached_drop(struct champ_cached *c)
+{
+	lru_remove(c);
+	by_id[c->candidate->id]=NULL;
+	stats.champs--;
+	stats.bytes-=cached_bytes(c);
+	hash_list_free_content(&c->list);
+	free_v((void **)&c);
+}
+
+static struct champ_cached *cached_find(struct candidate *champ)
+{
+	if(champ->id>=by_id_len
+	  || !by_id[champ->id]
+	  || by_id[champ->id]->candidate!=champ)
+		return NULL;
+	return by_id[champ->id];
+}
+
+static int cached_is_current(struct champ_cached *c, struct stat *statp)
+{
+	return c->dev==statp->st_dev
+	  && c->ino==statp->st_ino
+	  && c->size==statp->st_size
+	  && c->mtime==statp->st_mtime;
+}
+
+static int by_id_grow(uint32_t id)
+{
+	size_t len;
+	if(id<by_id_len)
+		return 0;
+	len=by_id_len?by_id_len:64;
+	while(len<=id)
+		len*=2;
+	if(!(by_id=(struct champ_cached **)realloc_w(by_id,
+		len*sizeof(struct champ_cached *), __func__)))
+			return -1;
+	memset(by_id+by_id_len, 0,
+		(len-by_id_len)*sizeof(struct champ_cached *));
+	by_id_len=len;
+	return 0;
+}
+
+// Takes the list, whether or not the champ fits in the cache.
+static int cached_add(struct candidate *champ, struct stat *statp,
+	struct hash_list *list)
+{
+	uint64_t bytes;
+	struct hash_entry *entry;
+	struct champ_cached *c=NULL;
+
+	bytes=sizeof(struct champ_cached)+list->len*sizeof(struct hash_entry);
+	if(bytes>stats.max)
+	{
+		hash_list_free_content(list);
+		return 0;
+	}
+	// The list grows by doubling, so give back what it did not use.
+	if(list->len && list->len<list->allocated
+	  && (entry=(struct hash_entry *)realloc_w(list->entry,
+		list->len*sizeof(struct hash_entry), __func__)))
+	{
+		list->entry=entry;
+		list->allocated=list->len;
+	}
+	if(by_id_grow(champ->id)
+	  || !(c=(struct champ_cached *)
+		calloc_w(1, sizeof(struct champ_cached), __func__)))
+	{
+		hash_list_free_content(list);
+		return -1;
+	}
+	while(lru_tail && stats.bytes+bytes>stats.max)
+	{
+		cached_drop(lru_tail);
+		stats.evictions++;
+	}
+	c->candidate=champ;
+	c->dev=statp->st_dev;
+	c->ino=statp->st_ino;
+	c->size=statp->st_size;
+	c->mtime=statp->st_mtime;
+	c->list=*list;
+	memset(list, 0, sizeof(*list));
+	lru_push(c);
+	by_id[champ->id]=c;
+	stats.champs++;
+	stats.bytes+=bytes;
+	return 0;
+}
+
+int champ_cache_on(void)
+{
+	return stats.max>0;
+}
+
+int champ_cache_has(struct candidate *champ)
+{
+	return cached_find(champ)!=NULL;
+}
+
+// For champs that were read somewhere else. 'statp' should be from before
+// they were read.
+int champ_cache_add(struct candidate *champ, struct stat *statp,
+	struct hash_list *list)
+{
+	struct champ_cached *c;
+	if((c=cached_find(champ)))
+		cached_drop(c);
+	stats.prefetched++;
+	return cached_add(champ, statp, list);
+}
+
+void champ_cache_init(uint64_t max)
+{
+	stats.max=max;
+}
+
+static enum hash_ret cached_load(struct champ_cached *c)
+{
+	size_t i;
+	for(i=0; i<c->list.len; i++)
+		if(hash_add_entry(&c->list.entry[i]))
+			return HASH_RET_PERM;
+	lru_remove(c);
+	lru_push(c);
+	stats.hits++;
+	return HASH_RET_OK;
+}
+
+enum hash_ret champ_cache_load(struct candidate *champ, const char *directory)
+{
+	char *path=NULL;
+	struct stat statp;
+	struct hash_list list;
+	struct champ_cached *c;
+	enum hash_ret ret=HASH_RET_PERM;
+
+	if(!stats.max)
+		return hash_load(champ->path, directory, NULL);
+
+	if(!(path=prepend_s(directory, champ->path)))
+		goto end;
+	c=cached_find(champ);
+	if(lstat(path, &statp))
+	{
+		if(c) cached_drop(c);
+		ret=HASH_RET_TEMP;
+		goto end;
+	}
+	if(c)
+	{
+		if(cached_is_current(c, &statp))
+		{
+			ret=cached_load(c);
+			goto end;
+		}
+		cached_drop(c);
+	}
+
+	stats.misses++;
+	memset(&list, 0, sizeof(list));
+	if((ret=hash_load(champ->path, directory, &list))!=HASH_RET_OK)
+	{
+		hash_list_free_content(&list);
+		goto end;
+	}
+	if(cached_add(champ, &statp, &list))
+		ret=HASH_RET_PERM;
+end:
+	free_w(&path);
+	return ret;
+}
+
+void champ_cache_get_stats(struct champ_cache_stats *s)
+{
+	*s=stats;
+}
+
+void champ_cache_log(void)
+{
+	if(!stats.max) return;
+	logp("champ cache: %zu champs, %" PRIu64 "/%" PRIu64 " bytes, %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions, %" PRIu64 " prefetched\n",
+		stats.champs, stats.bytes, stats.max,
+		stats.hits, stats.misses, stats.evictions,
+		stats.prefetched);
+}
+
+void champ_cache_free(void)
+{
+	while(lru_head)
+		cached_drop(lru_head);
+	free_v((void **)&by_id);
+	by_id_len=0;
+	memset(&stats, 0, sizeof(stats));
+}
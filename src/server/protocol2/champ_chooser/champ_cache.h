@@ -0,0 +1,35 @@
+#ifndef _CHAMP_CHOOSER_CHAMP_CACHE_H
+#define _CHAMP_CHOOSER_CHAMP_CACHE_H
+
+#include "hash.h"
+
+struct candidate;
+struct stat;
+
+struct champ_cache_stats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t prefetched;
+	size_t champs;
+	uint64_t bytes;
+	uint64_t max;
+};
+
+// Keeps the blocks of recently loaded champs in memory, so that a champ
+// that keeps getting chosen, by the same backup or by others in the
+// dedup_group, is only read from disk once. The least recently used champs
+// are dropped to stay under the maximum size. A maximum of 0 turns it off.
+extern void champ_cache_init(uint64_t max);
+extern int champ_cache_on(void);
+extern enum hash_ret champ_cache_load(struct candidate *champ,
+	const char *directory);
+extern int champ_cache_has(struct candidate *champ);
+extern int champ_cache_add(struct candidate *champ, struct stat *statp,
+	struct hash_list *list);
+extern void champ_cache_get_stats(struct champ_cache_stats *stats);
+extern void champ_cache_log(void);
+extern void champ_cache_free(void);
+
+#endif
@@ -7,11 +7,15 @@
 #include "../../../protocol2/blist.h"
 #include "../../../protocol2/blk.h"
 #include "candidate.h"
+#include "champ_cache.h"
 #include "champ_chooser.h"
+#include "champ_prefetch.h"
+#include "champ_stats.h"
 #include "hash.h"
 #include "incoming.h"
 #include "scores.h"
 #include "sparse.h"
+#include "sparse_map.h"
 
 static void try_lock_msg(int seconds)
 {
@@ -87,6 +91,15 @@ static int load_existing_sparse(const char *datadir, struct scores *scores)
 		ret=0;
 		goto end;
 	}
+	switch(sparse_map_load(sparse_path, scores))
+	{
+		case 0:
+			if(!sparse_bloom_rebuild())
+				ret=0;
+			goto end;
+		case -1:
+			goto end;
+	}
 	if(candidate_load(NULL, sparse_path, scores))
 		goto end;
 	ret=0;
@@ -111,34 +124,31 @@ error:
 
 void champ_chooser_free(struct scores **scores)
 {
+	champ_stats_log();
+	sparse_bloom_log();
+	champ_prefetch_free();
+	champ_cache_log();
+	champ_cache_free();
 	candidates_free();
 	sparse_delete_all();
+	sparse_map_close();
+	hash_free();
 	scores_free(scores);
 }
 
 static int already_got_block(struct asfd *asfd, struct blk *blk)
 {
-	static struct hash_weak *hash_weak;
+	static struct hash_entry *hash_entry;
 
 	// If already got, need to overwrite the references.
-	if((hash_weak=hash_weak_find(blk->fingerprint)))
+	if((hash_entry=hash_find(blk->fingerprint, blk->md5sum)))
 	{
-		static struct hash_strong *hash_strong;
-		if((hash_strong=hash_strong_find(
-			hash_weak, blk->md5sum)))
-		{
-			blk->savepath=hash_strong->savepath;
+		blk->savepath=hash_entry->savepath;
 //printf("FOUND: %s %s\n", blk->weak, blk->strong);
 //printf("F");
-			blk->got=BLK_GOT;
-			asfd->in->got++;
-			return 0;
-		}
-		else
-		{
-//      printf("COLLISION: %s %s\n", blk->weak, blk->strong);
-//                      collisions++;
-		}
+		blk->got=BLK_GOT;
+		asfd->in->got++;
+		return 0;
 	}
 
 	blk->got=BLK_NOT_GOT;
@@ -154,32 +164,50 @@ int deduplicate(struct asfd *asfd, const char *directory, struct scores *scores)
 	struct incoming *in=asfd->in;
 	struct candidate *champ;
 	struct candidate *champ_last=NULL;
+	struct candidate *loaded[CHAMPS_MAX];
 	int count=0;
 	int blk_count=0;
+	uint64_t start;
 
 	if(!in) return 0;
 
 	incoming_found_reset(in);
 	count=0;
-	while(count!=CHAMPS_MAX
-	  && (champ=candidates_choose_champ(in, champ_last, scores)))
+	while(count!=CHAMPS_MAX)
 	{
-//		printf("Got champ: %s %d\n", champ->path, *(champ->score));
-		switch(hash_load(champ->path, directory))
+		start=champ_stats_ns();
+		champ=candidates_choose_champ(in, champ_last, scores);
+		champ_stats.score_ns+=champ_stats_ns()-start;
+		if(!champ)
+			break;
+//		printf("Got champ: %s %d\n", champ->path, scores->scores[champ->id]);
+		start=champ_stats_ns();
+		if(champ_prefetch_collect(champ))
+			return -1;
+		switch(champ_cache_load(champ, directory))
 		{
 			case HASH_RET_OK:
-				count++;
+				loaded[count++]=champ;
 				champ_last=champ;
+				champ_stats.champs_loaded++;
 				break;
 			case HASH_RET_PERM:
 				return -1;
 			case HASH_RET_TEMP:
 				champ->deleted=1;
+				champ_stats.champs_gone++;
 				break;
 		}
+		champ_stats.load_ns+=champ_stats_ns()-start;
 	}
 
+	// Get on with reading what the next segment might want while this
+	// one is finished off.
+	if(champ_prefetch_after(loaded, count, directory))
+		return -1;
+
 	blk_count=0;
+	start=champ_stats_ns();
 	for(blk=asfd->blist->blk_to_dedup; blk; blk=blk->next)
 	{
 //printf("try: %lu\n", blk->index);
@@ -200,9 +228,18 @@ int deduplicate(struct asfd *asfd, const char *directory, struct scores *scores)
 //printf("after agb: %lu %d\n", blk->index, blk->got);
 	}
 
+	champ_stats.lookup_ns+=champ_stats_ns()-start;
+
 	logp("%s: %04d/%04zu - %04d/%04d\n",
 		asfd->desc, count, candidates_len, in->got, blk_count);
 
+	champ_stats.segments++;
+	champ_stats.blocks+=blk_count;
+	champ_stats.blocks_found+=in->got;
+	champ_stats.hash_entries+=hash_table.used;
+	if(hash_table.used>champ_stats.hash_entries_max)
+		champ_stats.hash_entries_max=hash_table.used;
+
 	// Start the incoming array again.
 	in->size=0;
 	// Destroy the deduplication hash table.
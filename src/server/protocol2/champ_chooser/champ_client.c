@@ -8,14 +8,16 @@
 #include "../../../lock.h"
 #include "../../../log.h"
 #include "../../../prepend.h"
+#include "../../sdirs.h"
 #include "champ_client.h"
 #include "champ_chooser.h"
+#include "champ_fanout.h"
 #include "champ_server.h"
 
 #include <sys/un.h>
 
 static int champ_chooser_fork(struct sdirs *sdirs, struct conf **confs,
-	int resume)
+	int resume, int shard)
 {
 	pid_t childpid=-1;
 	int cret;
@@ -36,7 +38,8 @@ static int champ_chooser_fork(struct sdirs *sdirs, struct conf **confs,
 		case 0:
 			// Child.
 			log_fzp_set(NULL, confs);
-			switch(champ_chooser_server(sdirs, confs, resume))
+			switch(champ_chooser_server(sdirs, confs, resume,
+				shard))
 			{
 				case 0:
 					cret=0;
@@ -55,7 +58,7 @@ static int champ_chooser_fork(struct sdirs *sdirs, struct conf **confs,
 }
 
 static int connect_to_champ_chooser(struct sdirs *sdirs, struct conf **confs,
-	int resume)
+	int resume, int shard)
 {
 	int len;
 	int s=-1;
@@ -67,7 +70,7 @@ static int connect_to_champ_chooser(struct sdirs *sdirs, struct conf **confs,
 	{
 		// Champ chooser is not running.
 		// Try to fork a new champ chooser process.
-		if(champ_chooser_fork(sdirs, confs, resume))
+		if(champ_chooser_fork(sdirs, confs, resume, shard))
 			return -1;
 	}
 
@@ -107,27 +110,39 @@ static int connect_to_champ_chooser(struct sdirs *sdirs, struct conf **confs,
 	return -1;
 }
 
-struct asfd *champ_chooser_connect(struct async *as,
-	struct sdirs *sdirs, struct conf **confs, int resume)
+// Connect to the champ chooser shard that sdirs is set up for.
+static struct asfd *champ_shard_connect(struct async *as,
+	struct sdirs *sdirs, struct conf **confs, int resume, int shard)
 {
 	int champsock=-1;
 	char *champname=NULL;
 	struct asfd *chfd=NULL;
 	const char *cname=NULL;
 
-	// Connect to champ chooser now.
-	// This may start up a new champ chooser. On a machine with multiple
-	// cores, it may be faster to do now, way before it is actually needed
-	// in phase2.
-	if((champsock=connect_to_champ_chooser(sdirs, confs, resume))<0)
-	{
-		logp("could not connect to champ chooser\n");
-		goto error;
-	}
+	// If nothing is running a champ chooser for the dedup group yet,
+	// maybe run one as a thread of this process.
+	if(!shard
+	  && get_int(confs[OPT_CHAMP_CHOOSER_THREAD])
+	  && !lock_test(sdirs->champlock))
+		chfd=champ_chooser_thread_start(as, sdirs, confs, resume);
 
-	if(!(chfd=setup_asfd(as, "champ chooser socket", &champsock,
-		/*listen*/"")))
+	if(!chfd)
+	{
+		// Connect to champ chooser now.
+		// This may start up a new champ chooser. On a machine with
+		// multiple cores, it may be faster to do now, way before it is
+		// actually needed in phase2.
+		if((champsock=connect_to_champ_chooser(sdirs,
+			confs, resume, shard))<0)
+		{
+			logp("could not connect to champ chooser\n");
 			goto error;
+		}
+
+		if(!(chfd=setup_asfd(as, "champ chooser socket", &champsock,
+			/*listen*/"")))
+				goto error;
+	}
 
 	cname=get_string(confs[OPT_CNAME]);
 	if(!(champname=prepend_n("cname", cname, strlen(cname), ":")))
@@ -146,3 +161,51 @@ error:
 	close_fd(&champsock);
 	return NULL;
 }
+
+struct asfd *champ_chooser_connect(struct async *as,
+	struct sdirs *sdirs, struct conf **confs, int resume)
+{
+	int i;
+	struct asfd *chfd=NULL;
+	struct asfd *shards[CHAMP_SHARDS_MAX];
+	int count=champ_chooser_shards(confs);
+
+	if(count==1)
+		return champ_shard_connect(as, sdirs, confs, resume, 0);
+
+	// The backup talks to all of the shards as if they were one champ
+	// chooser.
+	memset(shards, 0, sizeof(shards));
+	for(i=0; i<count; i++)
+	{
+		if(sdirs_set_champ_shard(sdirs, i)
+		  || !(shards[i]=champ_shard_connect(as, sdirs, confs,
+			resume, i)))
+				goto error;
+	}
+	if(sdirs_set_champ_shard(sdirs, 0)
+	  || !(chfd=champ_fanout_alloc(as, shards, count)))
+		goto error;
+	logp("Connected to %d champ chooser shards.\n", count);
+	return chfd;
+error:
+	sdirs_set_champ_shard(sdirs, 0);
+	for(i=0; i<count; i++)
+	{
+		as->asfd_remove(as, shards[i]);
+		asfd_free(&shards[i]);
+	}
+	return NULL;
+}
+
+void champ_chooser_disconnect(struct async *as, struct asfd **chfd)
+{
+	if(!chfd || !*chfd) return;
+	if((*chfd)->fanout)
+	{
+		champ_fanout_free(as, chfd);
+		return;
+	}
+	as->asfd_remove(as, *chfd);
+	asfd_free(chfd);
+}
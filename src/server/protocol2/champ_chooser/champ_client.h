@@ -5,5 +5,6 @@
 
 extern struct asfd *champ_chooser_connect(struct async *as,
         struct sdirs *sdirs, struct conf **confs, int resume);
+extern void champ_chooser_disconnect(struct async *as, struct asfd **chfd);
 
 #endif
@@ -0,0 +1,327 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../asfd.h"
+#include "../../../async.h"
+#include "../../../cmd.h"
+#include "../../../iobuf.h"
+#include "../../../log.h"
+#include "../../../protocol2/blk.h"
+#include "champ_fanout.h"
+
+// Every shard gets every signature, but chooses champs from only its own
+// part of the sparse index, so each one may find a different set of blocks.
+// A shard gives its results in block order, and a result for a block also
+// means that it has finished with all the blocks before it.
+// So all the shards have finished with every block up to the lowest index
+// that they have all reported. Up to there, a block has been found if any
+// shard found it, and has not been found otherwise. The merged results are
+// given out in the same form as a single champ chooser gives them.
+
+struct champ_found
+{
+	uint64_t index;
+	uint64_t savepath;
+};
+
+struct champ_fanout_shard
+{
+	struct asfd *asfd;
+	struct champ_found *found;	// Not yet merged, in block order.
+	size_t head;
+	size_t len;
+	size_t allocated;
+	uint64_t done;		// Has reported on blocks up to this index.
+	uint8_t sent;		// Has the message that is being written.
+};
+
+static int shard_add_found(struct champ_fanout_shard *s, struct blk *blk)
+{
+	if(s->head==s->len)
+		s->head=s->len=0;
+	else if(s->head && s->len==s->allocated)
+	{
+		memmove(s->found, s->found+s->head,
+			(s->len-s->head)*sizeof(struct champ_found));
+		s->len-=s->head;
+		s->head=0;
+	}
+	if(s->len==s->allocated)
+	{
+		s->allocated=s->allocated?s->allocated*2:64;
+		if(!(s->found=(struct champ_found *)realloc_w(s->found,
+			s->allocated*sizeof(struct champ_found), __func__)))
+				return -1;
+	}
+	s->found[s->len].index=blk->index;
+	s->found[s->len].savepath=blk->savepath;
+	s->len++;
+	return 0;
+}
+
+static int shard_take(struct champ_fanout_shard *s, struct iobuf *rbuf)
+{
+	int ret;
+	size_t offset=0;
+	struct iobuf rec;
+	struct blk blk;
+
+	memset(&blk, 0, sizeof(blk));
+	switch(rbuf->cmd)
+	{
+		case CMD_SIG:
+			if(blk_set_from_iobuf_index_and_savepath(&blk, rbuf)
+			  || shard_add_found(s, &blk))
+				return -1;
+			break;
+		case CMD_SIGS:
+			while((ret=blk_batch_next(rbuf, &offset, &rec))>0)
+				if(blk_set_from_iobuf_index_and_savepath(&blk,
+					&rec)
+				  || shard_add_found(s, &blk))
+					return -1;
+			if(ret)
+				return -1;
+			break;
+		case CMD_WRAP_UP:
+			if(blk_set_from_iobuf_wrap_up(&blk, rbuf))
+				return -1;
+			break;
+		default:
+			iobuf_log_unexpected(rbuf, __func__);
+			return -1;
+	}
+	if(blk.index>s->done)
+		s->done=blk.index;
+	return 0;
+}
+
+static int set_rbuf(struct iobuf *rbuf, struct iobuf *src)
+{
+	char *buf;
+	if(!(buf=(char *)malloc_w(src->len+1, __func__)))
+		return -1;
+	memcpy(buf, src->buf, src->len);
+	buf[src->len]='\0';
+	iobuf_set(rbuf, src->cmd, buf, src->len);
+	return 0;
+}
+
+// Put the next merged result into rbuf, if there is one yet.
+static int fanout_next(struct champ_fanout *f, struct iobuf *rbuf)
+{
+	int i;
+	uint64_t done;
+	struct blk blk;
+	struct iobuf rec;
+	struct champ_fanout_shard *s;
+	struct champ_fanout_shard *low;
+	static struct blk_batch batch;
+
+	done=f->shard[0].done;
+	for(i=1; i<f->count; i++)
+		if(f->shard[i].done<done)
+			done=f->shard[i].done;
+	if(done<=f->out)
+		return 0;
+
+	memset(&blk, 0, sizeof(blk));
+	blk_batch_init(&batch, CMD_SIGS);
+	while(1)
+	{
+		low=NULL;
+		for(i=0; i<f->count; i++)
+		{
+			s=&f->shard[i];
+			if(s->head==s->len
+			  || s->found[s->head].index>done)
+				continue;
+			if(!low || s->found[s->head].index
+				<low->found[low->head].index)
+					low=s;
+		}
+		if(!low)
+			break;
+		blk.index=low->found[low->head].index;
+		blk.savepath=low->found[low->head].savepath;
+		if(blk.index>f->out)
+		{
+			blk_to_iobuf_index_and_savepath(&blk, &rec);
+			if(blk_batch_add(&batch, &rec))
+				break; // Full.
+			f->out=blk.index;
+		}
+		// Otherwise another shard found it too.
+		low->head++;
+	}
+	if(blk_batch_to_iobuf(&batch, &rec))
+		return set_rbuf(rbuf, &rec);
+
+	// No shard found the last block that they have all finished with.
+	blk.index=done;
+	blk_to_iobuf_wrap_up(&blk, &rec);
+	f->out=done;
+	return set_rbuf(rbuf, &rec);
+}
+
+static int champ_fanout_parse_readbuf(struct asfd *asfd)
+{
+	int i;
+	struct asfd *a;
+	struct champ_fanout *f=asfd->fanout;
+
+	if(asfd->rbuf->buf)
+		return 0;
+	for(i=0; i<f->count; i++)
+	{
+		a=f->shard[i].asfd;
+		while(a->rbuf->buf)
+		{
+			if(shard_take(&f->shard[i], a->rbuf))
+			{
+				iobuf_free_content(a->rbuf);
+				return -1;
+			}
+			asfd->rcvd+=a->rbuf->len;
+			iobuf_free_content(a->rbuf);
+			if(a->parse_readbuf(a))
+				return -1;
+		}
+	}
+	return fanout_next(f, asfd->rbuf);
+}
+
+// A message only counts as written once every shard has it. If some of the
+// shards are blocked, the caller tries again with the same message, and it
+// goes to the ones that did not have it yet.
+static enum append_ret champ_fanout_append_all_to_write_buffer(
+	struct asfd *asfd, struct iobuf *wbuf)
+{
+	int i;
+	int blocked=0;
+	struct iobuf copy;
+	struct champ_fanout_shard *s;
+	struct champ_fanout *f=asfd->fanout;
+
+	for(i=0; i<f->count; i++)
+	{
+		s=&f->shard[i];
+		if(s->sent)
+			continue;
+		copy=*wbuf;
+		switch(s->asfd->append_all_to_write_buffer(s->asfd, &copy))
+		{
+			case APPEND_OK:
+				s->sent=1;
+				break;
+			case APPEND_BLOCKED:
+				blocked=1;
+				break;
+			default:
+				return APPEND_ERROR;
+		}
+	}
+	if(blocked)
+		return APPEND_BLOCKED;
+	for(i=0; i<f->count; i++)
+		f->shard[i].sent=0;
+	asfd->sent+=wbuf->len;
+	wbuf->len=0;
+	return APPEND_OK;
+}
+
+static int champ_fanout_write(struct asfd *asfd, struct iobuf *wbuf)
+{
+	int i;
+	struct iobuf copy;
+	struct champ_fanout *f=asfd->fanout;
+
+	for(i=0; i<f->count; i++)
+	{
+		copy=*wbuf;
+		if(f->shard[i].asfd->write(f->shard[i].asfd, &copy))
+			return -1;
+	}
+	asfd->sent+=wbuf->len;
+	wbuf->len=0;
+	return 0;
+}
+
+static int champ_fanout_write_str(struct asfd *asfd,
+	enum cmd wcmd, const char *wsrc)
+{
+	struct iobuf wbuf;
+	iobuf_from_str(&wbuf, wcmd, (char *)wsrc);
+	return asfd->write(asfd, &wbuf);
+}
+
+static int champ_fanout_read(struct asfd *asfd)
+{
+	while(!asfd->rbuf->buf)
+	{
+		if(asfd->as->read_write(asfd->as)
+		  || asfd->parse_readbuf(asfd))
+			return -1;
+	}
+	return 0;
+}
+
+static void champ_fanout_free_content(struct async *as,
+	struct champ_fanout *f)
+{
+	int i;
+	for(i=0; f->shard && i<f->count; i++)
+	{
+		if(f->shard[i].asfd)
+			as->asfd_remove(as, f->shard[i].asfd);
+		asfd_free(&f->shard[i].asfd);
+		free_v((void **)&f->shard[i].found);
+	}
+	free_v((void **)&f->shard);
+}
+
+// The shard asfds should already be in 'as'. If this works, they belong to
+// the returned asfd, which is not itself added to 'as'.
+struct asfd *champ_fanout_alloc(struct async *as,
+	struct asfd **shards, int count)
+{
+	int i;
+	struct asfd *asfd=NULL;
+	struct champ_fanout *f=NULL;
+
+	if(!(asfd=asfd_alloc())
+	  || !(asfd->rbuf=iobuf_alloc())
+	  || !(asfd->desc=strdup_w("champ chooser shards", __func__))
+	  || !(f=(struct champ_fanout *)
+		calloc_w(1, sizeof(struct champ_fanout), __func__))
+	  || !(f->shard=(struct champ_fanout_shard *)
+		calloc_w(count, sizeof(struct champ_fanout_shard), __func__)))
+	{
+		free_v((void **)&f);
+		asfd_free(&asfd);
+		return NULL;
+	}
+	for(i=0; i<count; i++)
+		f->shard[i].asfd=shards[i];
+	f->count=count;
+
+	asfd->as=as;
+	asfd->fanout=f;
+	asfd->parse_readbuf=champ_fanout_parse_readbuf;
+	asfd->append_all_to_write_buffer=
+		champ_fanout_append_all_to_write_buffer;
+	asfd->read=champ_fanout_read;
+	asfd->write=champ_fanout_write;
+	asfd->write_str=champ_fanout_write_str;
+	return asfd;
+}
+
+void champ_fanout_free(struct async *as, struct asfd **asfd)
+{
+	if(!asfd || !*asfd) return;
+	if((*asfd)->fanout)
+	{
+		champ_fanout_free_content(as, (*asfd)->fanout);
+		free_v((void **)&(*asfd)->fanout);
+	}
+	asfd_free(asfd);
+}
@@ -0,0 +1,22 @@
+#ifndef _CHAMP_FANOUT_H
+#define _CHAMP_FANOUT_H
+
+struct async;
+struct asfd;
+struct champ_fanout_shard;
+
+// Lets a backup talk to a dedup group whose champ chooser is split into
+// shards as if it were a single champ chooser. Everything written goes to
+// every shard, and the results from the shards are merged.
+struct champ_fanout
+{
+	struct champ_fanout_shard *shard;
+	int count;
+	uint64_t out;		// Results given out up to this block index.
+};
+
+extern struct asfd *champ_fanout_alloc(struct async *as,
+	struct asfd **shards, int count);
+extern void champ_fanout_free(struct async *as, struct asfd **asfd);
+
+#endif
@@ -0,0 +1,275 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "candidate.h"
+#include "champ_cache.h"
+#include "champ_prefetch.h"
+#include "hash.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// A manifest is split into numbered components, and a backup that matched
+// one component in this segment will usually match the one after it in the
+// next. So after each segment, the components after its champs get read
+// while the backup is sending the next segment, and are put into the champ
+// cache for when they get chosen.
+
+// Manifest components are named with eight hex digits, counting up.
+#ifndef UTEST
+static
+#endif
+char *champ_prefetch_next_path(const char *path)
+{
+	char *end;
+	char *next;
+	uint64_t n;
+	const char *cp;
+	size_t len;
+
+	if((cp=strrchr(path, '/'))) cp++;
+	else cp=path;
+	if(strlen(cp)!=8 || !isxdigit(*cp))
+		return NULL;
+	n=strtoull(cp, &end, 16);
+	if(*end)
+		return NULL;
+	len=strlen(path)+2;
+	if(!(next=(char *)malloc_w(len, __func__)))
+		return NULL;
+	snprintf(next, len, "%.*s%08" PRIX64, (int)(cp-path), path, n+1);
+	return next;
+}
+
+#ifdef HAVE_PTHREAD
+
+// How many champs can be waiting to be read.
+#define PREFETCH_SLOTS	16
+
+enum prefetch_state
+{
+	PREFETCH_FREE=0,
+	PREFETCH_QUEUED,
+	PREFETCH_DONE
+};
+
+struct prefetch
+{
+	enum prefetch_state state;
+	struct candidate *candidate;
+	char *path;
+	struct stat statp;
+	struct hash_list list;
+	enum hash_ret ret;
+};
+
+// The thread reads slots in order, so the ones that are done are always
+// the oldest ones.
+static struct prefetch slot[PREFETCH_SLOTS];
+static size_t head=0;
+static size_t count=0;
+static int running=0;
+static int stop=0;
+static pthread_t tid;
+static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done=PTHREAD_COND_INITIALIZER;
+
+static struct prefetch *slot_at(size_t i)
+{
+	return &slot[(head+i)%PREFETCH_SLOTS];
+}
+
+static struct prefetch *prefetch_queued(void)
+{
+	size_t i;
+	for(i=0; i<count; i++)
+		if(slot_at(i)->state==PREFETCH_QUEUED)
+			return slot_at(i);
+	return NULL;
+}
+
+static struct prefetch *prefetch_find(struct candidate *candidate)
+{
+	size_t i;
+	for(i=0; i<count; i++)
+		if(slot_at(i)->candidate==candidate)
+			return slot_at(i);
+	return NULL;
+}
+
+static void prefetch_free_content(struct prefetch *p)
+{
+	free_w(&p->path);
+	hash_list_free_content(&p->list);
+	memset(p, 0, sizeof(*p));
+}
+
+static void *prefetch_worker(void *arg)
+{
+	struct prefetch *p;
+
+	pthread_mutex_lock(&lock);
+	while(1)
+	{
+		while(!stop && !(p=prefetch_queued()))
+			pthread_cond_wait(&work, &lock);
+		if(stop)
+			break;
+		pthread_mutex_unlock(&lock);
+
+		// Nothing else touches a queued slot.
+		if(lstat(p->path, &p->statp))
+			p->ret=HASH_RET_TEMP;
+		else
+			p->ret=hash_read_list(p->path, &p->list);
+
+		pthread_mutex_lock(&lock);
+		p->state=PREFETCH_DONE;
+		pthread_cond_broadcast(&done);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+int champ_prefetch_init(void)
+{
+	if(running || !champ_cache_on())
+		return 0;
+	stop=0;
+	if(pthread_create(&tid, NULL, prefetch_worker, NULL))
+	{
+		// Carry on without it.
+		logp("Could not create champ prefetch thread: %s\n",
+			strerror(errno));
+		return 0;
+	}
+	running=1;
+	return 0;
+}
+
+// Only this thread changes which slots are in use, so it can look at them
+// without the lock. The lock is for their states, and for telling the
+// worker about new ones.
+int champ_prefetch_after(struct candidate **champs, int c,
+	const char *directory)
+{
+	int i;
+	int wanted=0;
+	char *next=NULL;
+	struct candidate *candidate;
+	struct prefetch want[PREFETCH_SLOTS];
+
+	if(!running)
+		return 0;
+
+	memset(want, 0, sizeof(want));
+	for(i=0; i<c && count+wanted<PREFETCH_SLOTS; i++)
+	{
+		if(!(next=champ_prefetch_next_path(champs[i]->path)))
+			continue;
+		candidate=candidates_find(next);
+		free_w(&next);
+		if(!candidate
+		  || candidate->deleted
+		  || champ_cache_has(candidate)
+		  || prefetch_find(candidate))
+			continue;
+		want[wanted].state=PREFETCH_QUEUED;
+		want[wanted].candidate=candidate;
+		if(!(want[wanted].path=prepend_s(directory, candidate->path)))
+		{
+			for(i=0; i<wanted; i++)
+				prefetch_free_content(&want[i]);
+			return -1;
+		}
+		wanted++;
+	}
+	if(!wanted)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	for(i=0; i<wanted; i++)
+		*slot_at(count++)=want[i];
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+// Puts whatever the thread has finished reading into the cache. If 'want'
+// is still to be read, waits for it first.
+int champ_prefetch_collect(struct candidate *want)
+{
+	int ret=0;
+	size_t ready;
+	struct prefetch *p;
+	struct prefetch got;
+
+	if(!running)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	while(want && (p=prefetch_find(want)) && p->state!=PREFETCH_DONE)
+		pthread_cond_wait(&done, &lock);
+	for(ready=0; ready<count && slot_at(ready)->state==PREFETCH_DONE;
+		ready++) { }
+	pthread_mutex_unlock(&lock);
+
+	// The thread is finished with these.
+	for(; ready; ready--)
+	{
+		pthread_mutex_lock(&lock);
+		got=*slot_at(0);
+		memset(slot_at(0), 0, sizeof(struct prefetch));
+		head=(head+1)%PREFETCH_SLOTS;
+		count--;
+		pthread_mutex_unlock(&lock);
+		if(got.ret==HASH_RET_OK
+		  && !got.candidate->deleted
+		  && champ_cache_add(got.candidate, &got.statp, &got.list))
+			ret=-1;
+		prefetch_free_content(&got);
+	}
+	return ret;
+}
+
+void champ_prefetch_free(void)
+{
+	if(!running)
+		return;
+	pthread_mutex_lock(&lock);
+	stop=1;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+	pthread_join(tid, NULL);
+	running=0;
+	for(; count; count--, head=(head+1)%PREFETCH_SLOTS)
+		prefetch_free_content(slot_at(0));
+	head=0;
+}
+
+#else
+
+int champ_prefetch_init(void)
+{
+	return 0;
+}
+
+int champ_prefetch_after(struct candidate **champs, int count,
+	const char *directory)
+{
+	return 0;
+}
+
+int champ_prefetch_collect(struct candidate *want)
+{
+	return 0;
+}
+
+void champ_prefetch_free(void)
+{
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _CHAMP_CHOOSER_CHAMP_PREFETCH_H
+#define _CHAMP_CHOOSER_CHAMP_PREFETCH_H
+
+struct candidate;
+
+// Reads the champs that the next segment is likely to want into the champ
+// cache, on a thread of its own. Does nothing if the cache is off, or if
+// there are no pthreads.
+extern int champ_prefetch_init(void);
+extern int champ_prefetch_after(struct candidate **champs, int count,
+	const char *directory);
+extern int champ_prefetch_collect(struct candidate *want);
+extern void champ_prefetch_free(void);
+
+#ifdef UTEST
+extern char *champ_prefetch_next_path(const char *path);
+#endif
+
+#endif
@@ -0,0 +1,231 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../asfd.h"
+#include "../../../async.h"
+#include "../../../fsops.h"
+#include "../../../iobuf.h"
+#include "../../../log.h"
+#include "champ_queue.h"
+
+// Each direction is a ring that one thread adds to and the other takes
+// from, so no locking is needed, just the ordering of the head and tail
+// updates.
+// The asfd at each end has one half of a socketpair as its fd, so that
+// the usual select() in async_io() works. async_io() tries parse_readbuf()
+// before it waits, so a reader only waits once its ring is empty. So a
+// byte is sent down the socket only when a message goes into an empty
+// ring, or is taken from a full one, to wake up the other end. The bytes
+// themselves mean nothing. If the other end goes away, the socket gives
+// end of file.
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+struct champ_ring
+{
+	struct iobuf *slots;
+	size_t size;		// A power of two.
+	size_t head;		// Next to take. Only the reader changes it.
+	size_t tail;		// Next to fill. Only the writer changes it.
+};
+
+static struct champ_ring *champ_ring_alloc(size_t slots)
+{
+	size_t size=1;
+	struct champ_ring *ring;
+	while(size<slots)
+		size<<=1;
+	if(!(ring=(struct champ_ring *)
+		calloc_w(1, sizeof(struct champ_ring), __func__)))
+			return NULL;
+	if(!(ring->slots=(struct iobuf *)
+		calloc_w(size, sizeof(struct iobuf), __func__)))
+	{
+		free_v((void **)&ring);
+		return NULL;
+	}
+	ring->size=size;
+	return ring;
+}
+
+static void champ_ring_free(struct champ_ring **ring)
+{
+	size_t i;
+	if(!ring || !*ring) return;
+	for(i=(*ring)->head; i!=(*ring)->tail; i++)
+		iobuf_free_content(&(*ring)->slots[i&((*ring)->size-1)]);
+	free_v((void **)&(*ring)->slots);
+	free_v((void **)ring);
+}
+
+// Returns 0 if the message was added, 1 if the ring is full.
+// Sets 'was_empty' if the reader might have seen the ring empty, and so be
+// waiting for a wake up.
+static int champ_ring_push(struct champ_ring *ring, struct iobuf *iobuf,
+	int *was_empty)
+{
+	char *buf;
+	struct iobuf *slot;
+	size_t tail=ring->tail;
+
+	if(tail-__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)==ring->size)
+		return 1;
+	if(!(buf=(char *)malloc_w(iobuf->len+1, __func__)))
+		return -1;
+	memcpy(buf, iobuf->buf, iobuf->len);
+	buf[iobuf->len]='\0';
+	slot=&ring->slots[tail&(ring->size-1)];
+	iobuf_set(slot, iobuf->cmd, buf, iobuf->len);
+	__atomic_store_n(&ring->tail, tail+1, __ATOMIC_RELEASE);
+	// Pairs with the fence in champ_ring_pop(). Either the reader sees
+	// the new tail before it waits, or this sees that the reader had
+	// caught up.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	*was_empty=(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)==tail);
+	return 0;
+}
+
+// Returns 1 if a message was taken, 0 if the ring is empty.
+static int champ_ring_pop(struct champ_ring *ring, struct iobuf *iobuf,
+	int *was_full)
+{
+	size_t head=ring->head;
+	size_t tail=__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if(head==tail)
+		return 0;
+	*was_full=(tail-head==ring->size);
+	iobuf_move(iobuf, &ring->slots[head&(ring->size-1)]);
+	__atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return 1;
+}
+
+struct champ_queue *champ_queue_alloc(size_t slots)
+{
+	int sv[2];
+	struct champ_queue *queue;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+	{
+		logp("socketpair error in %s: %s\n", __func__, strerror(errno));
+		return NULL;
+	}
+	if(!(queue=(struct champ_queue *)
+		calloc_w(1, sizeof(struct champ_queue), __func__))
+	  || !(queue->ring[0]=champ_ring_alloc(slots))
+	  || !(queue->ring[1]=champ_ring_alloc(slots)))
+	{
+		close_fd(&sv[0]);
+		close_fd(&sv[1]);
+		champ_queue_free(&queue);
+		return NULL;
+	}
+	queue->fd[0]=sv[0];
+	queue->fd[1]=sv[1];
+	queue->end[0].rx=queue->ring[0];
+	queue->end[0].tx=queue->ring[1];
+	queue->end[1].rx=queue->ring[1];
+	queue->end[1].tx=queue->ring[0];
+	return queue;
+}
+
+// Only call this once the asfds at both ends are finished with.
+void champ_queue_free(struct champ_queue **queue)
+{
+	if(!queue || !*queue) return;
+	champ_ring_free(&(*queue)->ring[0]);
+	champ_ring_free(&(*queue)->ring[1]);
+	close_fd(&(*queue)->fd[0]);
+	close_fd(&(*queue)->fd[1]);
+	free_v((void **)queue);
+}
+
+static void wake_other_end(struct asfd *asfd)
+{
+	char c=0;
+	// If the socket buffer is full, the other end has plenty to wake up
+	// to already. If the other end has gone, it does not matter.
+	if(send(asfd->fd, &c, 1, MSG_DONTWAIT|MSG_NOSIGNAL)<0) { }
+}
+
+static enum append_ret champ_queue_append_all_to_write_buffer(
+	struct asfd *asfd, struct iobuf *wbuf)
+{
+	int was_empty=0;
+	switch(champ_ring_push(asfd->queue->tx, wbuf, &was_empty))
+	{
+		case 0:
+			break;
+		case 1:
+			return APPEND_BLOCKED;
+		default:
+			return APPEND_ERROR;
+	}
+	asfd->sent+=wbuf->len;
+	wbuf->len=0;
+	if(was_empty)
+		wake_other_end(asfd);
+	return APPEND_OK;
+}
+
+static int champ_queue_parse_readbuf(struct asfd *asfd)
+{
+	int was_full=0;
+	if(asfd->rbuf->buf) return 0;
+	if(champ_ring_pop(asfd->queue->rx, asfd->rbuf, &was_full))
+	{
+		asfd->rcvd+=asfd->rbuf->len;
+		if(was_full)
+			wake_other_end(asfd);
+		return 0;
+	}
+	// Only give up once everything the other end sent has been read.
+	if(asfd->queue->eof)
+		return -1;
+	return 0;
+}
+
+static int champ_queue_do_read(struct asfd *asfd)
+{
+	ssize_t r;
+	char buf[256];
+	while(1)
+	{
+		if((r=recv(asfd->fd, buf, sizeof(buf), MSG_DONTWAIT))>0)
+			continue;
+		if(!r)
+		{
+			asfd->queue->eof=1;
+			return 0;
+		}
+		if(errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
+			return 0;
+		logp("%s: recv error in %s: %s\n",
+			asfd->desc, __func__, strerror(errno));
+		return -1;
+	}
+}
+
+static int champ_queue_do_write(__attribute__ ((unused)) struct asfd *asfd)
+{
+	// Messages go straight into the ring, so there is never anything
+	// left in the write buffer.
+	return 0;
+}
+
+struct asfd *champ_queue_setup_asfd(struct async *as,
+	const char *desc, struct champ_queue *queue, int end)
+{
+	struct asfd *asfd;
+	if(!(asfd=setup_asfd(as, desc, &queue->fd[end], /*listen*/"")))
+		return NULL;
+	asfd->queue=&queue->end[end];
+	asfd->parse_readbuf=champ_queue_parse_readbuf;
+	asfd->append_all_to_write_buffer=
+		champ_queue_append_all_to_write_buffer;
+	asfd->do_read=champ_queue_do_read;
+	asfd->do_write=champ_queue_do_write;
+	return asfd;
+}
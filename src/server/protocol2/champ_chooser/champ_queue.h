@@ -0,0 +1,34 @@
+#ifndef _CHAMP_QUEUE_H
+#define _CHAMP_QUEUE_H
+
+struct async;
+struct asfd;
+struct champ_ring;
+
+// How many messages can be waiting in each direction.
+#define CHAMP_QUEUE_SLOTS	1024
+
+// One end of a champ_queue.
+struct champ_queue_end
+{
+	struct champ_ring *rx;	// Messages for this end.
+	struct champ_ring *tx;	// Messages for the other end.
+	uint8_t eof;		// The other end has gone away.
+};
+
+// Connects a backup to a champ chooser that is running as a thread in the
+// same process. Messages are passed over in memory instead of being written
+// down a socket.
+struct champ_queue
+{
+	struct champ_ring *ring[2];
+	struct champ_queue_end end[2];
+	int fd[2];
+};
+
+extern struct champ_queue *champ_queue_alloc(size_t slots);
+extern void champ_queue_free(struct champ_queue **queue);
+extern struct asfd *champ_queue_setup_asfd(struct async *as,
+	const char *desc, struct champ_queue *queue, int end);
+
+#endif
@@ -6,6 +6,7 @@
 #include "../../../conf.h"
 #include "../../../conffile.h"
 #include "../../../fsops.h"
+#include "../../../fzp.h"
 #include "../../../handy.h"
 #include "../../../iobuf.h"
 #include "../../../lock.h"
@@ -14,15 +15,24 @@
 #include "../../../protocol2/blk.h"
 #include "../../sdirs.h"
 #include "candidate.h"
+#include "champ_cache.h"
 #include "champ_chooser.h"
+#include "champ_prefetch.h"
+#include "champ_queue.h"
 #include "champ_server.h"
+#include "champ_stats.h"
 #include "dindex.h"
+#include "gc.h"
 #include "incoming.h"
 #include "scores.h"
+#include "sparse.h"
 
 #include <sys/un.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
-static int champ_chooser_new_client(struct async *as, struct conf **confs)
+static int champ_chooser_new_client(struct async *as, int network_timeout)
 {
 	int fd=-1;
 	socklen_t t;
@@ -41,7 +51,7 @@ static int champ_chooser_new_client(struct async *as, struct conf **confs)
 	  || !(newfd=setup_asfd(as, "(unknown)", &fd, /*listen*/"")))
 		goto error;
 	newfd->blist=blist;
-	newfd->set_timeout(newfd, get_int(confs[OPT_NETWORK_TIMEOUT]));
+	newfd->set_timeout(newfd, network_timeout);
 
 	logp("Connected to fd %d\n", newfd->fd);
 
@@ -52,6 +62,68 @@ error:
 	return -1;
 }
 
+// Send the results for a run of found blocks in one batch.
+static int results_to_fd_batch(struct asfd *asfd)
+{
+	static struct iobuf wbuf;
+	static struct blk_batch batch;
+	struct iobuf rec;
+	struct blk *b;
+	struct blk *e;
+	struct blk *l;
+	struct blk *end=asfd->blist->blk_to_dedup;
+
+	for(b=asfd->blist->head; b && b!=end; )
+	{
+		blk_batch_init(&batch, CMD_SIGS);
+		for(e=b; e && e!=end && e->got==BLK_GOT; e=e->next)
+		{
+			blk_to_iobuf_index_and_savepath(e, &rec);
+			if(blk_batch_add(&batch, &rec))
+				break; // Full.
+		}
+		if(blk_batch_to_iobuf(&batch, &wbuf))
+		{
+			switch(asfd->append_all_to_write_buffer(asfd, &wbuf))
+			{
+				case APPEND_OK: break;
+				case APPEND_BLOCKED:
+					asfd->blist->head=b;
+					return 0; // Try again later.
+				default: return -1;
+			}
+			for(; b!=e; b=l)
+			{
+				l=b->next;
+				blk_free(&b);
+			}
+			continue;
+		}
+
+		// If the last in the sequence is BLK_NOT_GOT,
+		// Send a 'wrap_up' message.
+		if(!b->next || b->next==end)
+		{
+			blk_to_iobuf_wrap_up(b, &wbuf);
+			switch(asfd->append_all_to_write_buffer(asfd, &wbuf))
+			{
+				case APPEND_OK: break;
+				case APPEND_BLOCKED:
+					asfd->blist->head=b;
+					return 0; // Try again later.
+				default: return -1;
+			}
+		}
+		l=b->next;
+		blk_free(&b);
+		b=l;
+	}
+
+	asfd->blist->head=b;
+	if(!b) asfd->blist->tail=NULL;
+	return 0;
+}
+
 static int results_to_fd(struct asfd *asfd)
 {
 	static struct iobuf wbuf;
@@ -60,6 +132,9 @@ static int results_to_fd(struct asfd *asfd)
 
 	if(!asfd->blist->last_index) return 0;
 
+	if(asfd->sig_batch)
+		return results_to_fd_batch(asfd);
+
 	// Need to start writing the results down the fd.
 	for(b=asfd->blist->head; b && b!=asfd->blist->blk_to_dedup; b=l)
 	{
@@ -110,7 +185,8 @@ static int deduplicate_maybe(struct asfd *asfd,
 	if(!asfd->in && !(asfd->in=incoming_alloc()))
 		return -1;
 
-	if(blk_fingerprint_is_hook(blk))
+	if(blk_fingerprint_is_hook(blk)
+	  && sparse_in_shard(blk->fingerprint))
 	{
 		if(incoming_grow_maybe(asfd->in))
 			return -1;
@@ -126,10 +202,7 @@ static int deduplicate_maybe(struct asfd *asfd,
 	return 0;
 }
 
-#ifndef UTEST
-static
-#endif
-int champ_server_deal_with_rbuf_sig(struct asfd *asfd,
+static int deal_with_sig(struct asfd *asfd, struct iobuf *rbuf,
 	const char *directory, struct scores *scores)
 {
 	struct blk *blk;
@@ -140,7 +213,7 @@ int champ_server_deal_with_rbuf_sig(struct asfd *asfd,
 	if(!asfd->blist->blk_to_dedup)
 		asfd->blist->blk_to_dedup=blk;
 
-	if(blk_set_from_iobuf_sig(blk, asfd->rbuf))
+	if(blk_set_from_iobuf_sig(blk, rbuf))
 		return -1;
 
 	//logp("Got fingerprint from %d: %lu - %lu\n",
@@ -149,6 +222,29 @@ int champ_server_deal_with_rbuf_sig(struct asfd *asfd,
 	return deduplicate_maybe(asfd, blk, directory, scores);
 }
 
+#ifndef UTEST
+static
+#endif
+int champ_server_deal_with_rbuf_sig(struct asfd *asfd,
+	const char *directory, struct scores *scores)
+{
+	return deal_with_sig(asfd, asfd->rbuf, directory, scores);
+}
+
+// The results go back in batches to anything that sends batches.
+static int deal_with_rbuf_sigs(struct asfd *asfd,
+	const char *directory, struct scores *scores)
+{
+	int ret;
+	size_t offset=0;
+	struct iobuf rec;
+	asfd->sig_batch=1;
+	while((ret=blk_batch_next(asfd->rbuf, &offset, &rec))>0)
+		if(deal_with_sig(asfd, &rec, directory, scores))
+			return -1;
+	return ret;
+}
+
 static int deal_with_client_rbuf(struct asfd *asfd, const char *directory,
 	struct scores *scores)
 {
@@ -185,6 +281,11 @@ static int deal_with_client_rbuf(struct asfd *asfd, const char *directory,
 		if(champ_server_deal_with_rbuf_sig(asfd, directory, scores))
 			goto error;
 	}
+	else if(asfd->rbuf->cmd==CMD_SIGS)
+	{
+		if(deal_with_rbuf_sigs(asfd, directory, scores))
+			goto error;
+	}
 	else if(asfd->rbuf->cmd==CMD_MANIFEST)
 	{
 		// Client has completed a manifest file. Want to start using
@@ -204,42 +305,16 @@ error:
 	return -1;
 }
 
-int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
-	int resume)
+static int champ_chooser_listen(struct sdirs *sdirs)
 {
 	int s;
-	int ret=-1;
 	int len;
-	struct asfd *asfd=NULL;
 	struct sockaddr_un local;
-	struct lock *lock=NULL;
-	struct async *as=NULL;
-	int started=0;
-	struct scores *scores=NULL;
-	const char *directory=get_string(confs[OPT_DIRECTORY]);
-
-	if(!(lock=lock_alloc_and_init(sdirs->champlock))
-	  || build_path_w(sdirs->champlock))
-		goto end;
-	lock_get(lock);
-	switch(lock->status)
-	{
-		case GET_LOCK_GOT:
-			log_fzp_set(sdirs->champlog, confs);
-			logp("Got champ lock for dedup_group: %s\n",
-				get_string(confs[OPT_DEDUP_GROUP]));
-			break;
-		case GET_LOCK_NOT_GOT:
-		case GET_LOCK_ERROR:
-		default:
-			//logp("Did not get champ lock\n");
-			goto end;
-	}
 
 	if((s=socket(AF_UNIX, SOCK_STREAM, 0))<0)
 	{
 		logp("socket error in %s: %s\n", __func__, strerror(errno));
-		goto end;
+		return -1;
 	}
 
 	memset(&local, 0, sizeof(struct sockaddr_un));
@@ -251,33 +326,77 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 	if(bind(s, (struct sockaddr *)&local, len)<0)
 	{
 		logp("bind error in %s: %s\n", __func__, strerror(errno));
-		goto end;
+		close_fd(&s);
+		return -1;
 	}
 
 	if(listen(s, 5)<0)
 	{
 		logp("listen error in %s: %s\n", __func__, strerror(errno));
-		goto end;
+		close_fd(&s);
+		return -1;
 	}
+	return s;
+}
 
-	if(!(as=async_alloc())
-	  || as->init(as, 0)
-	  || !(asfd=setup_asfd(as, "champ chooser main socket", &s,
-		/*listen*/"")))
-			goto end;
-	asfd->fdtype=ASFD_FD_SERVER_LISTEN_MAIN;
+static int champ_chooser_get_lock(struct lock **lock, struct sdirs *sdirs)
+{
+	if(!(*lock=lock_alloc_and_init(sdirs->champlock))
+	  || build_path_w(sdirs->champlock))
+		return -1;
+	lock_get(*lock);
+	switch((*lock)->status)
+	{
+		case GET_LOCK_GOT:
+			return 0;
+		case GET_LOCK_NOT_GOT:
+		case GET_LOCK_ERROR:
+		default:
+			//logp("Did not get champ lock\n");
+			return -1;
+	}
+}
+
+int champ_chooser_shards(struct conf **confs)
+{
+	int shards=get_int(confs[OPT_CHAMP_CHOOSER_SHARDS]);
+	if(shards<1)
+		return 1;
+	if(shards>CHAMP_SHARDS_MAX)
+		return CHAMP_SHARDS_MAX;
+	return shards;
+}
+
+// Deal with the clients until they have all gone. The first asfd in 'as'
+// is the listening socket.
+static int champ_chooser_loop(struct async *as, struct sdirs *sdirs,
+	const char *directory, int network_timeout, int resume, int started,
+	int shard, int shards, uint64_t cache_max, uint64_t gc_rate)
+{
+	int ret=-1;
+	struct asfd *asfd=NULL;
+	struct scores *scores=NULL;
 
 	// I think that this is probably the best point at which to run a
 	// cleanup job to delete unused data files, because no other process
 	// can fiddle with the dedup_group at this point.
 	// Cannot do it on a resume, or it will delete files that are
 	// referenced in the backup we are resuming.
-	if(delete_unused_data_files(sdirs, resume))
-		goto end;
+	// Every backup connects to shard 0 first, so only that one does it.
+	if(!shard
+	  && (delete_unused_data_files(sdirs, resume)
+		|| gc_init(sdirs->data, gc_rate)))
+			goto end;
+
+	sparse_set_shard(shard, shards);
 
 	// Load the sparse indexes for this dedup group.
 	if(!(scores=champ_chooser_init(sdirs->data)))
 		goto end;
+	champ_cache_init(cache_max);
+	if(champ_prefetch_init())
+		goto end;
+	champ_stats_reset();
 
 	while(1)
 	{
@@ -287,6 +406,9 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 			  || asfd->blist->head->got==BLK_INCOMING) continue;
 			if(results_to_fd(asfd)) goto end;
 		}
+		champ_stats_write_maybe(sdirs->champstats, as, shard);
+		if(gc_step(time(NULL))<0)
+			logp("Stopped deleting unused data files\n");
 
 		int removed;
 
@@ -312,8 +434,9 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 				{
 					// Incoming client.
 					as->asfd->new_client=0;
-					if(champ_chooser_new_client(as, confs))
-						goto end;
+					if(champ_chooser_new_client(as,
+						network_timeout))
+							goto end;
 					started=1;
 				}
 				break;
@@ -352,19 +475,273 @@ int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
 	}
 
 end:
-	logp("champ chooser exiting: %d\n", ret);
+	if(scores && champ_stats_write(sdirs->champstats, as, shard))
+		logp("Could not write champ chooser stats to %s\n",
+			sdirs->champstats);
 	champ_chooser_free(&scores);
+	gc_free();
+	return ret;
+}
+
+int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
+	int resume, int shard)
+{
+	int s=-1;
+	int ret=-1;
+	struct asfd *asfd=NULL;
+	struct lock *lock=NULL;
+	struct async *as=NULL;
+	int shards=champ_chooser_shards(confs);
+
+	if(sdirs_set_champ_shard(sdirs, shard)
+	  || champ_chooser_get_lock(&lock, sdirs))
+		goto end;
+	log_fzp_set(sdirs->champlog, confs);
+	logp("Got champ lock for dedup_group: %s\n",
+		get_string(confs[OPT_DEDUP_GROUP]));
+	if(shards>1)
+		logp("Running as shard %d of %d\n", shard, shards);
+
+	if((s=champ_chooser_listen(sdirs))<0)
+		goto end;
+
+	if(!(as=async_alloc())
+	  || as->init(as, 0)
+	  || !(asfd=setup_asfd(as, "champ chooser main socket", &s,
+		/*listen*/"")))
+			goto end;
+	asfd->fdtype=ASFD_FD_SERVER_LISTEN_MAIN;
+
+	ret=champ_chooser_loop(as, sdirs, get_string(confs[OPT_DIRECTORY]),
+		get_int(confs[OPT_NETWORK_TIMEOUT]), resume,
+		0 /* started */, shard, shards,
+		get_uint64_t(confs[OPT_CHAMP_CACHE_MAX]),
+		get_uint64_t(confs[OPT_GC_RATE_MAX]));
+end:
+	logp("champ chooser exiting: %d\n", ret);
 	log_fzp_set(NULL, confs);
-	async_free(&as);
-	asfd_free(&asfd); // This closes s for us.
+	async_asfd_free_all(&as); // This closes s for us.
 	close_fd(&s);
 	unlink(sdirs->champsock);
-// FIX THIS: free asfds.
 	lock_release(lock);
 	lock_free(&lock);
 	return ret;
 }
 
+#ifdef HAVE_PTHREAD
+// A champ chooser running as a thread of this process, instead of as a
+// process of its own. The backup that started it talks to it through a
+// champ_queue. Other backups in the dedup group connect to the socket as
+// usual. This process cannot exit until the thread has finished.
+// If the dedup group is split into shards, the thread is always shard 0.
+struct champ_thread
+{
+	pthread_t tid;
+	struct async *as;
+	struct sdirs *sdirs;
+	struct lock *lock;
+	struct champ_queue *queue;
+	char *directory;
+	int network_timeout;
+	int resume;
+	int shards;
+	uint64_t cache_max;
+	uint64_t gc_rate;
+};
+
+static struct champ_thread *champ_thread=NULL;
+
+static void champ_thread_free(struct champ_thread **thread)
+{
+	if(!thread || !*thread) return;
+	async_asfd_free_all(&(*thread)->as);
+	champ_queue_free(&(*thread)->queue);
+	if((*thread)->sdirs)
+		unlink((*thread)->sdirs->champsock);
+	lock_release((*thread)->lock);
+	lock_free(&(*thread)->lock);
+	sdirs_free(&(*thread)->sdirs);
+	free_w(&(*thread)->directory);
+	free_v((void **)thread);
+}
+
+static void *champ_thread_run(void *arg)
+{
+	int ret;
+	struct fzp *fzp;
+	struct champ_thread *thread=(struct champ_thread *)arg;
+
+	// This only affects this thread, so the backup keeps its own log.
+	if((fzp=fzp_open(thread->sdirs->champlog, "ab")))
+	{
+		fzp_setlinebuf(fzp);
+		log_fzp_set_thread(fzp);
+	}
+	logp("Running as a thread\n");
+	ret=champ_chooser_loop(thread->as, thread->sdirs,
+		thread->directory, thread->network_timeout, thread->resume,
+		1 /* started */, 0 /* shard */, thread->shards,
+		thread->cache_max, thread->gc_rate);
+	logp("champ chooser exiting: %d\n", ret);
+	// Closing our end of the queue tells the backup that we are gone.
+	async_asfd_free_all(&thread->as);
+	log_fzp_set_thread(NULL);
+	return NULL;
+}
+
+// Start a champ chooser thread, if this process can get the champ lock.
+// Returns the asfd that the backup should use to talk to it, which has
+// been added to 'as', or NULL if the thread could not be started.
+struct asfd *champ_chooser_thread_start(struct async *as,
+	struct sdirs *sdirs, struct conf **confs, int resume)
+{
+	int s=-1;
+	struct asfd *asfd=NULL;
+	struct asfd *chfd=NULL;
+	struct blist *blist=NULL;
+	struct champ_thread *thread=NULL;
+
+	if(champ_thread)
+		return NULL;
+	// The other shards would have to be forked from this process while
+	// the thread is running.
+	if(champ_chooser_shards(confs)>1)
+	{
+		logp("champ_chooser_thread is not used when champ_chooser_shards is more than 1\n");
+		return NULL;
+	}
+	if(!(thread=(struct champ_thread *)
+		calloc_w(1, sizeof(struct champ_thread), __func__)))
+			return NULL;
+	if(champ_chooser_get_lock(&thread->lock, sdirs))
+		goto error;
+	logp("Got champ lock for dedup_group: %s\n",
+		get_string(confs[OPT_DEDUP_GROUP]));
+
+	// The thread may outlive the sdirs and confs of the backup.
+	if(!(thread->sdirs=sdirs_alloc())
+	  || sdirs_init_from_confs(thread->sdirs, confs)
+	  || !(thread->directory=strdup_w(
+		get_string(confs[OPT_DIRECTORY]), __func__)))
+			goto error;
+	thread->network_timeout=get_int(confs[OPT_NETWORK_TIMEOUT]);
+	thread->resume=resume;
+	thread->shards=champ_chooser_shards(confs);
+	thread->cache_max=get_uint64_t(confs[OPT_CHAMP_CACHE_MAX]);
+	thread->gc_rate=get_uint64_t(confs[OPT_GC_RATE_MAX]);
+
+	if((s=champ_chooser_listen(sdirs))<0
+	  || !(thread->as=async_alloc())
+	  || thread->as->init(thread->as, 0)
+	  || !(asfd=setup_asfd(thread->as, "champ chooser main socket",
+		&s, /*listen*/"")))
+			goto error;
+	asfd->fdtype=ASFD_FD_SERVER_LISTEN_MAIN;
+
+	if(!(thread->queue=champ_queue_alloc(CHAMP_QUEUE_SLOTS))
+	  || !(blist=blist_alloc())
+	  || !(asfd=champ_queue_setup_asfd(thread->as, "(unknown)",
+		thread->queue, 1)))
+			goto error;
+	asfd->blist=blist;
+	blist=NULL;
+	asfd->set_timeout(asfd, thread->network_timeout);
+
+	if(!(chfd=champ_queue_setup_asfd(as, "champ chooser queue",
+		thread->queue, 0)))
+			goto error;
+
+	if(pthread_create(&thread->tid, NULL, champ_thread_run, thread))
+	{
+		logp("pthread_create failed in %s\n", __func__);
+		goto error;
+	}
+	logp("Started champ chooser thread\n");
+	champ_thread=thread;
+	return chfd;
+error:
+	close_fd(&s);
+	blist_free(&blist);
+	if(chfd)
+	{
+		as->asfd_remove(as, chfd);
+		asfd_free(&chfd);
+	}
+	champ_thread_free(&thread);
+	return NULL;
+}
+
+// Wait for the champ chooser thread, if there is one, to finish. It does not
+// finish until all of the backups that are using it have finished, so this
+// child keeps its place in max_children until then.
+void champ_chooser_thread_join(void)
+{
+	if(!champ_thread)
+		return;
+	logp("Waiting for the backups using the champ chooser thread to finish\n");
+	pthread_join(champ_thread->tid, NULL);
+	champ_thread_free(&champ_thread);
+}
+#else
+struct asfd *champ_chooser_thread_start(
+	__attribute__ ((unused)) struct async *as,
+	__attribute__ ((unused)) struct sdirs *sdirs,
+	__attribute__ ((unused)) struct conf **confs,
+	__attribute__ ((unused)) int resume)
+{
+	logp("champ_chooser_thread is not supported without pthreads\n");
+	return NULL;
+}
+
+void champ_chooser_thread_join(void)
+{
+}
+#endif
+
+// Run the other shards as child processes, and this one as shard 0.
+static int champ_chooser_server_shards(struct sdirs *sdirs,
+	struct conf **cconfs)
+{
+	int ret=0;
+	int shard;
+	int status;
+	pid_t pid;
+	int children=0;
+	int shards=champ_chooser_shards(cconfs);
+
+	for(shard=1; shard<shards; shard++)
+	{
+		switch((pid=fork()))
+		{
+			case -1:
+				logp("fork failed in %s: %s\n",
+					__func__, strerror(errno));
+				ret=-1;
+				break;
+			case 0:
+				exit(champ_chooser_server(sdirs, cconfs,
+					0 /* resume */, shard)?1:0);
+			default:
+				children++;
+				continue;
+		}
+		break;
+	}
+	if(!ret && champ_chooser_server(sdirs, cconfs, 0 /* resume */, 0))
+		ret=-1;
+	for(; children>0; children--)
+	{
+		if(wait(&status)<0)
+		{
+			ret=-1;
+			break;
+		}
+		if(!WIFEXITED(status) || WEXITSTATUS(status))
+			ret=-1;
+	}
+	return ret;
+}
+
 // The return code of this is the return code of the standalone process.
 int champ_chooser_server_standalone(struct conf **globalcs)
 {
@@ -383,7 +760,7 @@ int champ_chooser_server_standalone(struct conf **globalcs)
 	  || conf_load_clientconfdir(globalcs, cconfs)
 	  || !(sdirs=sdirs_alloc())
 	  || sdirs_init_from_confs(sdirs, cconfs)
-	  || champ_chooser_server(sdirs, cconfs, 0 /* resume */))
+	  || champ_chooser_server_shards(sdirs, cconfs))
 		goto end;
 	ret=0;
 end:
@@ -1,12 +1,20 @@
 #ifndef _CHAMP_SERVER_H
 #define _CHAMP_SERVER_H
 
+struct async;
 struct scores;
 struct sdirs;
 
+// The most champ chooser processes that a dedup group can be split into.
+#define CHAMP_SHARDS_MAX	16
+
+extern int champ_chooser_shards(struct conf **confs);
 extern int champ_chooser_server(struct sdirs *sdirs, struct conf **confs,
-	int resume);
+	int resume, int shard);
 extern int champ_chooser_server_standalone(struct conf **globalcs);
+extern struct asfd *champ_chooser_thread_start(struct async *as,
+	struct sdirs *sdirs, struct conf **confs, int resume);
+extern void champ_chooser_thread_join(void);
 
 #ifdef UTEST
 extern int champ_server_deal_with_rbuf_sig(struct asfd *asfd,
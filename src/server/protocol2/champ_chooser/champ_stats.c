@@ -0,0 +1,149 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../asfd.h"
+#include "../../../async.h"
+#include "../../../fsops.h"
+#include "../../../fzp.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "bloom.h"
+#include "candidate.h"
+#include "champ_cache.h"
+#include "champ_stats.h"
+#include "sparse.h"
+
+struct champ_stats champ_stats;
+
+static time_t last_write=0;
+
+uint64_t champ_stats_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000000ULL+(uint64_t)t.tv_nsec;
+}
+
+void champ_stats_reset(void)
+{
+	memset(&champ_stats, 0, sizeof(champ_stats));
+	last_write=0;
+}
+
+static double hit_percent(void)
+{
+	if(!champ_stats.blocks)
+		return 0.0;
+	return 100.0*champ_stats.blocks_found/champ_stats.blocks;
+}
+
+static int write_backups(struct fzp *fzp, struct async *as)
+{
+	int count=0;
+	struct asfd *asfd;
+
+	// The first one is the listening socket.
+	for(asfd=as->asfd->next; asfd; asfd=asfd->next)
+		count++;
+	if(fzp_printf(fzp, "backups:%d\n", count)<0)
+		return -1;
+	// How many blocks each backup has waiting to be deduplicated, and
+	// how much of the results have not been sent back to it yet.
+	for(asfd=as->asfd->next; asfd; asfd=asfd->next)
+		if(fzp_printf(fzp, "backup:%s fd:%d queued:%d unsent:%zu\n",
+			asfd->desc, asfd->fd, asfd->blkcnt,
+			asfd->writebuflen)<0)
+				return -1;
+	return 0;
+}
+
+static int write_stats(struct fzp *fzp, struct async *as, int shard)
+{
+	struct bloom *bloom=sparse_bloom_get();
+	struct champ_cache_stats cache;
+
+	champ_cache_get_stats(&cache);
+	if(fzp_printf(fzp, "shard:%d\n", shard)<0
+	  || fzp_printf(fzp, "time:%" PRIu64 "\n", (uint64_t)time(NULL))<0
+	  || fzp_printf(fzp, "segments:%" PRIu64 "\n",
+		champ_stats.segments)<0
+	  || fzp_printf(fzp, "champs_loaded:%" PRIu64 "\n",
+		champ_stats.champs_loaded)<0
+	  || fzp_printf(fzp, "champs_gone:%" PRIu64 "\n",
+		champ_stats.champs_gone)<0
+	  || fzp_printf(fzp, "hash_entries:%" PRIu64 "\n",
+		champ_stats.hash_entries)<0
+	  || fzp_printf(fzp, "hash_entries_max:%" PRIu64 "\n",
+		champ_stats.hash_entries_max)<0
+	  || fzp_printf(fzp, "candidates:%zu\n", candidates_len)<0
+	  || fzp_printf(fzp, "sparse_hooks:%zu\n", sparse_hooks())<0
+	  || fzp_printf(fzp, "blocks:%" PRIu64 "\n", champ_stats.blocks)<0
+	  || fzp_printf(fzp, "blocks_found:%" PRIu64 "\n",
+		champ_stats.blocks_found)<0
+	  || fzp_printf(fzp, "hit_percent:%.2f\n", hit_percent())<0
+	  || fzp_printf(fzp, "score_ms:%" PRIu64 "\n",
+		champ_stats.score_ns/1000000)<0
+	  || fzp_printf(fzp, "load_ms:%" PRIu64 "\n",
+		champ_stats.load_ns/1000000)<0
+	  || fzp_printf(fzp, "lookup_ms:%" PRIu64 "\n",
+		champ_stats.lookup_ns/1000000)<0
+	  || fzp_printf(fzp, "cache_hits:%" PRIu64 "\n", cache.hits)<0
+	  || fzp_printf(fzp, "cache_misses:%" PRIu64 "\n", cache.misses)<0
+	  || fzp_printf(fzp, "cache_evictions:%" PRIu64 "\n",
+		cache.evictions)<0
+	  || fzp_printf(fzp, "cache_prefetched:%" PRIu64 "\n",
+		cache.prefetched)<0
+	  || fzp_printf(fzp, "cache_bytes:%" PRIu64 "\n", cache.bytes)<0
+	  || fzp_printf(fzp, "bloom_lookups:%" PRIu64 "\n",
+		bloom?bloom->lookups:0)<0
+	  || fzp_printf(fzp, "bloom_rejected:%" PRIu64 "\n",
+		bloom?bloom->lookups-bloom->passed:0)<0)
+		return -1;
+	if(as && write_backups(fzp, as))
+		return -1;
+	return 0;
+}
+
+// Written to a temporary file first, so that anything reading it never sees
+// half of it.
+int champ_stats_write(const char *path, struct async *as, int shard)
+{
+	int ret=-1;
+	char *tmp=NULL;
+	struct fzp *fzp=NULL;
+
+	last_write=time(NULL);
+	if(!(tmp=prepend(path, ".tmp"))
+	  || !(fzp=fzp_open(tmp, "wb"))
+	  || write_stats(fzp, as, shard))
+		goto end;
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	if(do_rename(tmp, path))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_w(&tmp);
+	return ret;
+}
+
+// Not being able to write the stats is no reason to stop deduplicating.
+void champ_stats_write_maybe(const char *path, struct async *as, int shard)
+{
+	if(time(NULL)<last_write+CHAMP_STATS_INTERVAL)
+		return;
+	if(champ_stats_write(path, as, shard))
+		logp("Could not write champ chooser stats to %s\n", path);
+}
+
+void champ_stats_log(void)
+{
+	logp("champ chooser: %" PRIu64 " segments, %" PRIu64 " champs loaded, %" PRIu64 "/%" PRIu64 " blocks found (%.2f%%), %" PRIu64 "ms scoring, %" PRIu64 "ms loading, %" PRIu64 "ms looking up\n",
+		champ_stats.segments, champ_stats.champs_loaded,
+		champ_stats.blocks_found, champ_stats.blocks, hit_percent(),
+		champ_stats.score_ns/1000000, champ_stats.load_ns/1000000,
+		champ_stats.lookup_ns/1000000);
+}
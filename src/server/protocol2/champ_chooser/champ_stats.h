@@ -0,0 +1,34 @@
+#ifndef _CHAMP_CHOOSER_CHAMP_STATS_H
+#define _CHAMP_CHOOSER_CHAMP_STATS_H
+
+struct async;
+
+// How often the stats file gets rewritten while backups are running.
+#define CHAMP_STATS_INTERVAL	10
+
+// Counters for one champ chooser, which is one dedup_group, or one shard of
+// it. The times are in nanoseconds.
+struct champ_stats
+{
+	uint64_t segments;
+	uint64_t champs_loaded;
+	uint64_t champs_gone;
+	uint64_t hash_entries;
+	uint64_t hash_entries_max;
+	uint64_t blocks;
+	uint64_t blocks_found;
+	uint64_t score_ns;
+	uint64_t load_ns;
+	uint64_t lookup_ns;
+};
+
+extern struct champ_stats champ_stats;
+
+extern uint64_t champ_stats_ns(void);
+extern void champ_stats_reset(void);
+extern int champ_stats_write(const char *path, struct async *as, int shard);
+extern void champ_stats_write_maybe(const char *path, struct async *as,
+	int shard);
+extern void champ_stats_log(void);
+
+#endif
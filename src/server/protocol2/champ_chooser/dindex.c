@@ -1,7 +1,6 @@
 #include "../../../burp.h"
 #include "../../../alloc.h"
 #include "../../../fsops.h"
-#include "../../../hexmap.h"
 #include "../../../lock.h"
 #include "../../../log.h"
 #include "../../../prepend.h"
@@ -11,6 +10,7 @@
 #include "../../sdirs.h"
 #include "../backup_phase4.h"
 #include "dindex.h"
+#include "gc.h"
 
 static int backup_in_progress(const char *fullpath)
 {
@@ -114,35 +114,26 @@ end:
 	return ret;
 }
 
-static int do_unlink(struct blk *oblk, const char *datadir)
+static int write_unused(struct fzp *uzp, struct blk *oblk, uint64_t *count)
 {
-	int ret=-1;
-	char *fullpath=NULL;
-	char *savepath=uint64_to_savepathstr(oblk->savepath);
-	if(!(fullpath=prepend_s(datadir, savepath)))
-		goto end;
-	errno=0;
-	if(unlink(fullpath) && errno!=ENOENT)
-	{
-		logp("Could not unlink %s: %s\n", fullpath, strerror(errno));
-		goto end;
-	}
-	logp("Deleted %s\n", savepath);
-	ret=0;
-end:
-	free_w(&fullpath);
-	return ret;
+	struct iobuf wbuf;
+	blk_to_iobuf_savepath(oblk, &wbuf);
+	if(iobuf_send_msg_fzp(&wbuf, uzp))
+		return -1;
+	(*count)++;
+	return 0;
 }
 
 #ifndef UTEST
 static
 #endif
-int compare_dindexes_and_unlink_datafiles(const char *dindex_old,
-	const char *dindex_new, const char *datadir)
+int compare_dindexes(const char *dindex_old, const char *dindex_new,
+	const char *unused, uint64_t *count)
 {
 	int ret=-1;
 	struct fzp *nzp=NULL;
 	struct fzp *ozp=NULL;
+	struct fzp *uzp=NULL;
 	struct iobuf nbuf;
 	struct iobuf obuf;
 	struct blk nblk;
@@ -153,8 +144,10 @@ int compare_dindexes_and_unlink_datafiles(const char *dindex_old,
 	memset(&nblk, 0, sizeof(struct blk));
 	memset(&oblk, 0, sizeof(struct blk));
 	
+	*count=0;
 	if(!(nzp=fzp_gzopen(dindex_new, "rb"))
-	  || !(ozp=fzp_gzopen(dindex_old, "rb")))
+	  || !(ozp=fzp_gzopen(dindex_old, "rb"))
+	  || !(uzp=fzp_gzopen(unused, "wb")))
 		goto end;
 
 	while(nzp || ozp)
@@ -208,7 +201,7 @@ int compare_dindexes_and_unlink_datafiles(const char *dindex_old,
 		else if(!nbuf.buf && obuf.buf)
 		{
 			// No more in the new file. Delete old entry.
-			if(do_unlink(&oblk, datadir))
+			if(write_unused(uzp, &oblk, count))
 				goto end;
 			iobuf_free_content(&obuf);
 		}
@@ -230,19 +223,25 @@ int compare_dindexes_and_unlink_datafiles(const char *dindex_old,
 		else
 		{
 			// Only in the old file.
-			if(do_unlink(&oblk, datadir))
+			if(write_unused(uzp, &oblk, count))
 				goto end;
 			iobuf_free_content(&obuf);
 		}
 	}
 
 
+	if(fzp_close(&uzp))
+	{
+		logp("Error closing %s in %s\n", unused, __func__);
+		goto end;
+	}
 	ret=0;
 end:
 	iobuf_free_content(&nbuf);
 	iobuf_free_content(&obuf);
 	fzp_close(&nzp);
 	fzp_close(&ozp);
+	fzp_close(&uzp);
 	return ret;
 }
 
@@ -250,6 +249,7 @@ int delete_unused_data_files(struct sdirs *sdirs, int resume)
 {
 	int ret=-1;
 	uint64_t fcount=0;
+	uint64_t unused_count=0;
 	char hfile[32];
 	char *hlinks=NULL;
 	char *fullpath=NULL;
@@ -258,6 +258,7 @@ int delete_unused_data_files(struct sdirs *sdirs, int resume)
 	char *dindex_tmp=NULL;
 	char *dindex_new=NULL;
 	char *dindex_old=NULL;
+	char *unused=NULL;
 	struct strlist *s=NULL;
 	struct strlist *slist=NULL;
 	struct stat statp;
@@ -372,12 +373,27 @@ int delete_unused_data_files(struct sdirs *sdirs, int resume)
 		dindex_tmp, "hlinks", fcount, merge_dindexes))
 			goto end;
 
+	// The data files that have dropped out are not deleted here, but
+	// queued for the champ chooser to delete bit by bit. The queue is
+	// written before the new dindex replaces the old one, so that an
+	// interruption cannot lose any of them.
 	if(!lstat(dindex_new, &statp))
 	{
-		if(!lstat(dindex_old, &statp)
-		  && compare_dindexes_and_unlink_datafiles(dindex_old,
-			dindex_new, sdirs->data))
-				goto end;
+		if(!lstat(dindex_old, &statp))
+		{
+			if(!(unused=prepend_s(dindex_tmp, "unused"))
+			  || compare_dindexes(dindex_old, dindex_new,
+				unused, &unused_count))
+					goto end;
+			if(unused_count)
+			{
+				logp("Queueing %" PRIu64
+					" unused data files for deletion\n",
+					unused_count);
+				if(gc_queue_add(sdirs->data, unused))
+					goto end;
+			}
+		}
 		if(do_rename(dindex_new, dindex_old))
 			goto end;
 
@@ -400,5 +416,6 @@ end:
 	free_w(&dindex_tmp);
 	free_w(&dindex_new);
 	free_w(&dindex_old);
+	free_w(&unused);
 	return ret;
 }
@@ -4,8 +4,8 @@
 extern int delete_unused_data_files(struct sdirs *sdirs, int resume);
 
 #ifdef UTEST
-extern int compare_dindexes_and_unlink_datafiles(const char *dindex_old,
-	const char *dindex_new, const char *datadir);
+extern int compare_dindexes(const char *dindex_old, const char *dindex_new,
+	const char *unused, uint64_t *count);
 #endif
 
 #endif
@@ -0,0 +1,299 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../cmd.h"
+#include "../../../fsops.h"
+#include "../../../fzp.h"
+#include "../../../hexmap.h"
+#include "../../../iobuf.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "../../../protocol2/blk.h"
+#include "../../sdirs.h"
+#include "../backup_phase4.h"
+#include "../dfidx.h"
+#include "gc.h"
+
+// The queue is a sorted list of savepaths, like a dindex, so that new ones
+// can be merged in with merge_dindexes(). The position file says how many
+// of them have been dealt with.
+#define GC_QUEUE	"gc_queue"
+#define GC_POS		"gc_queue.pos"
+
+static char *datadir=NULL;
+static char *queue=NULL;
+static char *pos_path=NULL;
+static struct fzp *fzp=NULL;
+static uint64_t pos=0;
+static uint64_t pos_saved=0;
+static uint64_t rate=0;
+static int64_t allowance=0;
+static time_t last=0;
+// Data files that were written after this cannot be the ones in the queue.
+static time_t queued=0;
+static uint64_t deleted=0;
+static uint64_t deleted_bytes=0;
+
+static int unlink_if_there(const char *path)
+{
+	if(unlink(path) && errno!=ENOENT)
+	{
+		logp("Could not unlink %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Adds the data files listed in 'unused' to the queue, and removes 'unused'.
+// The position file has to go before the queue is replaced or removed, or
+// a crash in between could make the position apply to the wrong queue.
+// Starting a queue again from the beginning is harmless.
+int gc_queue_add(const char *dir, const char *unused)
+{
+	int ret=-1;
+	struct stat statp;
+	char *q=NULL;
+	char *p=NULL;
+	char *tmp=NULL;
+
+	if(!(q=prepend_s(dir, GC_QUEUE))
+	  || !(p=prepend_s(dir, GC_POS))
+	  || !(tmp=prepend(q, ".tmp"))
+	  || unlink_if_there(p))
+		goto end;
+	if(lstat(q, &statp))
+	{
+		if(do_rename(unused, q))
+			goto end;
+	}
+	else
+	{
+		if(merge_dindexes(tmp, q, unused)
+		  || do_rename(tmp, q)
+		  || unlink_if_there(unused))
+			goto end;
+	}
+	ret=0;
+end:
+	free_w(&q);
+	free_w(&p);
+	free_w(&tmp);
+	return ret;
+}
+
+static int pos_write(void)
+{
+	int ret=-1;
+	char *tmp=NULL;
+	struct fzp *pzp=NULL;
+
+	if(!(tmp=prepend(pos_path, ".tmp"))
+	  || !(pzp=fzp_open(tmp, "wb")))
+		goto end;
+	fzp_printf(pzp, "%" PRIu64 "\n", pos);
+	if(fzp_close(&pzp))
+	{
+		logp("Error closing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	if(do_rename(tmp, pos_path))
+		goto end;
+	pos_saved=pos;
+	ret=0;
+end:
+	fzp_close(&pzp);
+	free_w(&tmp);
+	return ret;
+}
+
+static uint64_t pos_read(void)
+{
+	char buf[32]="";
+	uint64_t ret=0;
+	struct stat statp;
+	struct fzp *pzp=NULL;
+
+	if(lstat(pos_path, &statp)
+	  || !(pzp=fzp_open(pos_path, "rb")))
+		return 0;
+	if(fzp_gets(pzp, buf, sizeof(buf)))
+		ret=strtoull(buf, NULL, 10);
+	fzp_close(&pzp);
+	return ret;
+}
+
+// Returns 0 with the next savepath, 1 at the end of the queue, or -1 on
+// error.
+static int queue_next(uint64_t *savepath)
+{
+	int ret=-1;
+	struct blk blk;
+	struct iobuf rbuf;
+
+	iobuf_init(&rbuf);
+	memset(&blk, 0, sizeof(blk));
+	switch(iobuf_fill_from_fzp(&rbuf, fzp))
+	{
+		case 0: break;
+		case 1: return 1;
+		default: return -1;
+	}
+	if(rbuf.cmd!=CMD_SAVE_PATH)
+	{
+		logp("unknown cmd in %s: %s\n",
+			__func__, iobuf_to_printable(&rbuf));
+		goto end;
+	}
+	if(blk_set_from_iobuf_savepath(&blk, &rbuf))
+		goto end;
+	*savepath=blk.savepath;
+	ret=0;
+end:
+	iobuf_free_content(&rbuf);
+	return ret;
+}
+
+static int delete_one(uint64_t savepath)
+{
+	int ret=-1;
+	char *path=NULL;
+	struct stat statp;
+	const char *savepathstr=uint64_to_savepathstr(savepath);
+
+	if(!(path=prepend_s(datadir, savepathstr)))
+		goto end;
+	if(lstat(path, &statp))
+	{
+		// Deleted already, before an interruption.
+		ret=0;
+		goto end;
+	}
+	if(statp.st_mtime>queued)
+	{
+		logp("Not deleting %s, which has changed since it was queued\n",
+			savepathstr);
+		ret=0;
+		goto end;
+	}
+	if(unlink_if_there(path)
+	  || dfidx_unlink(path))
+		goto end;
+	logp("Deleted %s\n", savepathstr);
+	deleted++;
+	deleted_bytes+=statp.st_size;
+	allowance-=statp.st_size;
+	ret=0;
+end:
+	free_w(&path);
+	return ret;
+}
+
+int gc_init(const char *dir, uint64_t r)
+{
+	uint64_t savepath;
+	struct stat statp;
+
+	gc_free();
+	rate=r;
+	allowance=(int64_t)rate;
+	if(!(datadir=strdup_w(dir, __func__))
+	  || !(queue=prepend_s(dir, GC_QUEUE))
+	  || !(pos_path=prepend_s(dir, GC_POS)))
+		goto error;
+	if(lstat(queue, &statp))
+		return 0;
+	queued=statp.st_mtime;
+	if(!(fzp=fzp_gzopen(queue, "rb")))
+		goto error;
+	pos_saved=pos_read();
+	while(pos<pos_saved)
+	{
+		switch(queue_next(&savepath))
+		{
+			case 0: pos++;
+				continue;
+			case 1: break;
+			default: goto error;
+		}
+		break;
+	}
+	if(pos)
+		logp("Carrying on deleting unused data files from number %"
+			PRIu64 "\n", pos);
+	return 0;
+error:
+	gc_free();
+	return -1;
+}
+
+static int gc_finish(void)
+{
+	logp("Finished deleting unused data files: %" PRIu64
+		" deleted, %" PRIu64 " bytes\n", deleted, deleted_bytes);
+	fzp_close(&fzp);
+	if(unlink_if_there(pos_path)
+	  || unlink_if_there(queue))
+		return -1;
+	return 1;
+}
+
+// Returns 0 if there is more to do, 1 if there is nothing left, or -1 on
+// error, after which there is nothing more done until gc_init() is called
+// again.
+int gc_step(time_t now)
+{
+	int files=0;
+	uint64_t savepath;
+
+	if(!fzp)
+		return 1;
+	if(rate)
+	{
+		if(last && now>last)
+		{
+			allowance+=(int64_t)(rate*(now-last));
+			if(allowance>(int64_t)rate)
+				allowance=(int64_t)rate;
+		}
+		last=now;
+	}
+	// A big data file can take the allowance below zero, in which case
+	// the next ones wait until it has been paid back.
+	while(files<GC_STEP_FILES && (!rate || allowance>0))
+	{
+		switch(queue_next(&savepath))
+		{
+			case 0: break;
+			case 1: if(gc_finish()<0)
+					goto error;
+				gc_free();
+				return 1;
+			default: goto error;
+		}
+		if(delete_one(savepath))
+			goto error;
+		pos++;
+		files++;
+	}
+	if(pos!=pos_saved && pos_write())
+		goto error;
+	return 0;
+error:
+	gc_free();
+	return -1;
+}
+
+void gc_free(void)
+{
+	fzp_close(&fzp);
+	free_w(&datadir);
+	free_w(&queue);
+	free_w(&pos_path);
+	pos=0;
+	pos_saved=0;
+	rate=0;
+	allowance=0;
+	last=0;
+	queued=0;
+	deleted=0;
+	deleted_bytes=0;
+}
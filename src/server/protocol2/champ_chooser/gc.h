@@ -0,0 +1,18 @@
+#ifndef _CHAMP_CHOOSER_GC_H
+#define _CHAMP_CHOOSER_GC_H
+
+// The most data files that one step deletes, so that the champ chooser gets
+// back to its clients quickly.
+#define GC_STEP_FILES		64
+
+// Data files that no backup uses any more are put in a queue in the data
+// directory of the dedup_group, and deleted a few at a time by the champ
+// chooser between dealing with its clients. How far it got is kept next to
+// the queue, so an interrupted champ chooser carries on where it stopped.
+// A rate of 0 means no limit on the bytes deleted per second.
+extern int gc_queue_add(const char *datadir, const char *unused);
+extern int gc_init(const char *datadir, uint64_t rate);
+extern int gc_step(time_t now);
+extern void gc_free(void);
+
+#endif
@@ -6,112 +6,169 @@
 #include "../../../sbuf.h"
 #include "hash.h"
 
-struct hash_weak *hash_table=NULL;
+// Slots to start with. The table doubles when it gets half full.
+#define HASH_SIZE_MIN	1024
 
-struct hash_weak *hash_weak_find(uint64_t weak)
-{
-	struct hash_weak *hash_weak;
-	HASH_FIND_INT(hash_table, &weak, hash_weak);
-	return hash_weak;
-}
+THREAD_LOCAL struct hash_table hash_table;
 
-struct hash_strong *hash_strong_find(struct hash_weak *hash_weak,
-	uint8_t *md5sum)
+static size_t hash_slot(uint64_t weak, size_t size)
 {
-	struct hash_strong *s;
-	for(s=hash_weak->strong; s; s=s->next)
-		if(!memcmp(s->md5sum, md5sum, MD5_DIGEST_LENGTH)) return s;
-	return NULL;
+	// Fibonacci hashing spreads out fingerprints that differ in only a
+	// few bits.
+	return (size_t)((weak*0x9E3779B97F4A7C15ULL)>>32)&(size-1);
 }
 
-struct hash_weak *hash_weak_add(uint64_t weakint)
+struct hash_entry *hash_find(uint64_t weak, uint8_t *md5sum)
 {
-	struct hash_weak *newweak;
-	if(!(newweak=(struct hash_weak *)
-		malloc_w(sizeof(struct hash_weak), __func__)))
-			return NULL;
-	newweak->weak=weakint;
-//logp("addweak: %016lX\n", weakint);
-	newweak->strong=NULL;
-	HASH_ADD_INT(hash_table, weak, newweak);
-	return newweak;
+	size_t i;
+	size_t mask=hash_table.size-1;
+	struct hash_entry *e;
+
+	if(!hash_table.used)
+		return NULL;
+	for(i=hash_slot(weak, hash_table.size);
+	  hash_table.gen[i]==hash_table.current; i=(i+1)&mask)
+	{
+		e=&hash_table.entry[i];
+		if(e->weak==weak
+		  && !memcmp(e->md5sum, md5sum, MD5_DIGEST_LENGTH))
+			return e;
+	}
+	return NULL;
 }
 
-static struct hash_strong *hash_strong_add(struct hash_weak *hash_weak,
-	struct blk *blk)
+static struct hash_entry *hash_slot_free(struct hash_entry *entry,
+	uint8_t *gen, uint8_t current, size_t size, uint64_t weak)
 {
-	struct hash_strong *newstrong;
-	if(!(newstrong=(struct hash_strong *)
-		malloc_w(sizeof(struct hash_strong), __func__)))
-			return NULL;
-	newstrong->savepath=blk->savepath;
-	memcpy(newstrong->md5sum, blk->md5sum, MD5_DIGEST_LENGTH);
-	newstrong->next=hash_weak->strong;
-	return newstrong;
+	size_t i;
+	for(i=hash_slot(weak, size); gen[i]==current; i=(i+1)&(size-1)) { }
+	gen[i]=current;
+	return &entry[i];
 }
 
-static void hash_strongs_free(struct hash_strong *shead)
+static int hash_grow(void)
 {
-	static struct hash_strong *s;
-	s=shead;
-	while(shead)
+	size_t i;
+	size_t size;
+	uint8_t *gen=NULL;
+	struct hash_entry *entry=NULL;
+
+	size=hash_table.size?hash_table.size*2:HASH_SIZE_MIN;
+	if(!(entry=(struct hash_entry *)
+		malloc_w(size*sizeof(struct hash_entry), __func__))
+	  || !(gen=(uint8_t *)calloc_w(size, sizeof(uint8_t), __func__)))
 	{
-		s=shead;
-		shead=shead->next;
-		free_v((void **)&s);
+		free_v((void **)&entry);
+		return -1;
+	}
+	for(i=0; i<hash_table.size; i++)
+	{
+		if(hash_table.gen[i]!=hash_table.current)
+			continue;
+		*hash_slot_free(entry, gen, 1, size,
+			hash_table.entry[i].weak)=hash_table.entry[i];
 	}
+	free_v((void **)&hash_table.entry);
+	free_v((void **)&hash_table.gen);
+	hash_table.entry=entry;
+	hash_table.gen=gen;
+	hash_table.current=1;
+	hash_table.size=size;
+	return 0;
 }
 
+// Empties the table, but keeps the memory for the next lot of blocks.
 void hash_delete_all(void)
 {
-	struct hash_weak *tmp;
-	struct hash_weak *hash_weak;
-
-	HASH_ITER(hh, hash_table, hash_weak, tmp)
+	hash_table.used=0;
+	if(!hash_table.gen)
+		return;
+	if(!++hash_table.current)
 	{
-		HASH_DEL(hash_table, hash_weak);
-		hash_strongs_free(hash_weak->strong);
-		free_v((void **)&hash_weak);
+		// Wrapped around, so old slots could look current.
+		memset(hash_table.gen, 0, hash_table.size);
+		hash_table.current=1;
 	}
-	hash_table=NULL;
 }
 
-int hash_load_blk(struct blk *blk)
+void hash_free(void)
+{
+	free_v((void **)&hash_table.entry);
+	free_v((void **)&hash_table.gen);
+	memset(&hash_table, 0, sizeof(hash_table));
+}
+
+int hash_add_entry(struct hash_entry *entry)
 {
-	static struct hash_weak *hash_weak;
+	struct hash_entry *e;
 
-	hash_weak=hash_weak_find(blk->fingerprint);
+	if(hash_find(entry->weak, entry->md5sum))
+		return 0;
 
-	// Add to hash table.
-	if(!hash_weak && !(hash_weak=hash_weak_add(blk->fingerprint)))
+	// Keep at least half of the slots free, so that probes stay short.
+	if((hash_table.used+1)*2>hash_table.size
+	  && hash_grow())
 		return -1;
-	if(!hash_strong_find(hash_weak, blk->md5sum))
+
+	e=hash_slot_free(hash_table.entry, hash_table.gen,
+		hash_table.current, hash_table.size, entry->weak);
+	*e=*entry;
+	hash_table.used++;
+	return 0;
+}
+
+static void hash_entry_from_blk(struct hash_entry *e, struct blk *blk)
+{
+	e->weak=blk->fingerprint;
+	e->savepath=blk->savepath;
+	memcpy(e->md5sum, blk->md5sum, MD5_DIGEST_LENGTH);
+}
+
+int hash_load_blk(struct blk *blk)
+{
+	struct hash_entry e;
+	hash_entry_from_blk(&e, blk);
+	return hash_add_entry(&e);
+}
+
+static int hash_list_add(struct hash_list *list, struct blk *blk)
+{
+	if(list->len==list->allocated)
 	{
-		if(!(hash_weak->strong=hash_strong_add(hash_weak, blk)))
-			return -1;
+		list->allocated=list->allocated?list->allocated*2:1024;
+		if(!(list->entry=(struct hash_entry *)realloc_w(list->entry,
+			list->allocated*sizeof(struct hash_entry), __func__)))
+				return -1;
 	}
-
+	hash_entry_from_blk(&list->entry[list->len++], blk);
 	return 0;
 }
 
-enum hash_ret hash_load(const char *champ, const char *directory)
+void hash_list_free_content(struct hash_list *list)
+{
+	if(!list) return;
+	free_v((void **)&list->entry);
+	memset(list, 0, sizeof(*list));
+}
+
+// Reads the blocks of a champ, putting them into the table if 'load' is
+// set, and adding them to 'list' if it is given.
+static enum hash_ret hash_read(const char *path, struct hash_list *list,
+	int load)
 {
 	enum hash_ret ret=HASH_RET_PERM;
-	char *path=NULL;
 	struct fzp *fzp=NULL;
 	struct sbuf *sb=NULL;
-	static struct blk *blk=NULL;
+	struct blk *blk=NULL;
 
-	if(!(path=prepend_s(directory, champ)))
-		goto end;
 	if(!(fzp=fzp_gzopen(path, "rb")))
 	{
 		ret=HASH_RET_TEMP;
 		goto end;
 	}
 
-	if((!sb && !(sb=sbuf_alloc(PROTO_2)))
-	  || (!blk && !(blk=blk_alloc())))
+	if(!(sb=sbuf_alloc(PROTO_2))
+	  || !(blk=blk_alloc()))
 		goto end;
 
 	while(1)
@@ -128,12 +185,36 @@ enum hash_ret hash_load(const char *champ, const char *directory)
 		}
 		if(!blk->got_save_path)
 			continue;
-		if(hash_load_blk(blk))
+		if((load && hash_load_blk(blk))
+		  || (list && hash_list_add(list, blk)))
 			goto end;
 		blk->got_save_path=0;
 	}
 end:
-	free_w(&path);
+	blk_free(&blk);
+	sbuf_free(&sb);
 	fzp_close(&fzp);
 	return ret;
 }
+
+// If 'list' is given, every block that gets loaded is also added to it, so
+// that the caller can load the same champ again without reading it.
+enum hash_ret hash_load(const char *champ, const char *directory,
+	struct hash_list *list)
+{
+	char *path;
+	enum hash_ret ret;
+
+	if(!(path=prepend_s(directory, champ)))
+		return HASH_RET_PERM;
+	ret=hash_read(path, list, 1);
+	free_w(&path);
+	return ret;
+}
+
+// Only reads the blocks into 'list', so this can be done by a thread that
+// does not own the table.
+enum hash_ret hash_read_list(const char *path, struct hash_list *list)
+{
+	return hash_read(path, list, 0);
+}
@@ -1,13 +1,10 @@
 #ifndef _CHAMP_CHOOSER_HASH_H
 #define _CHAMP_CHOOSER_HASH_H
 
-#include <uthash.h>
 #include <openssl/md5.h>
 
 struct blk;
 
-typedef struct hash_strong hash_strong_t;
-
 enum hash_ret
 {
 	HASH_RET_PERM=-2,
@@ -15,30 +12,48 @@ enum hash_ret
 	HASH_RET_OK=0
 };
 
-struct hash_strong
+// One block. Blocks with the same weak checksum but different strong ones
+// each get their own entry.
+struct hash_entry
 {
-	uint8_t md5sum[MD5_DIGEST_LENGTH];
-	hash_strong_t *next;
+	uint64_t weak;
 	uint64_t savepath;
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
 };
 
-struct hash_weak
+// Open addressing with linear probing, so that a lookup walks along
+// neighbouring entries instead of chasing pointers. A slot is in use if its
+// generation matches the current one, which lets the whole table be emptied
+// without touching the entries.
+struct hash_table
 {
-	uint64_t weak;
-	struct hash_strong *strong;
-	UT_hash_handle hh;
+	struct hash_entry *entry;
+	uint8_t *gen;
+	uint8_t current;
+	size_t size;		// Number of slots, always a power of two.
+	size_t used;
 };
 
-extern struct hash_weak *hash_table;
+extern THREAD_LOCAL struct hash_table hash_table;
+
+// The blocks of one champ, as they were loaded into the table.
+struct hash_list
+{
+	struct hash_entry *entry;
+	size_t len;
+	size_t allocated;
+};
 
-extern struct hash_weak *hash_weak_find(uint64_t weak);
-extern struct hash_strong *hash_strong_find(struct hash_weak *hash_weak,
-	uint8_t *md5sum);
-extern struct hash_weak *hash_weak_add(uint64_t weakint);
+extern struct hash_entry *hash_find(uint64_t weak, uint8_t *md5sum);
 
 extern void hash_delete_all(void);
-extern enum hash_ret hash_load(const char *champ, const char *directory);
+extern void hash_free(void);
+extern enum hash_ret hash_load(const char *champ, const char *directory,
+	struct hash_list *list);
+extern enum hash_ret hash_read_list(const char *path, struct hash_list *list);
 
+extern int hash_add_entry(struct hash_entry *entry);
 extern int hash_load_blk(struct blk *blk);
+extern void hash_list_free_content(struct hash_list *list);
 
 #endif
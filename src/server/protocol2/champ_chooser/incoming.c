@@ -12,6 +12,7 @@ static void incoming_free_content(struct incoming *in)
 {
 	free_v((void **)&in->fingerprints);
 	free_v((void **)&in->found);
+	free_v((void **)&in->hits);
 }
 
 void incoming_free(struct incoming **in)
@@ -31,8 +32,11 @@ int incoming_grow_maybe(struct incoming *in)
 		realloc_w(in->fingerprints,
 			in->allocated*sizeof(uint64_t), __func__))
 	  && (in->found=(uint8_t *)
-		realloc_w(in->found, in->allocated*sizeof(uint8_t), __func__)))
-			return 0;
+		realloc_w(in->found, in->allocated*sizeof(uint8_t), __func__))
+	  && (in->hits=(struct incoming_hit *)
+		realloc_w(in->hits, in->allocated*sizeof(struct incoming_hit),
+			__func__)))
+				return 0;
 	return -1;
 }
 
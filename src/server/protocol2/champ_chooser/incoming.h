@@ -1,6 +1,17 @@
 #ifndef _CHAMP_CHOOSER_INCOMING_H
 #define _CHAMP_CHOOSER_INCOMING_H
 
+struct sparse;
+
+// A fingerprint that is in the sparse index, and its candidates.
+struct incoming_hit
+{
+	uint16_t i;
+	size_t mapped_count;
+	const uint32_t *mapped;
+	struct sparse *sparse;
+};
+
 struct incoming
 {
 	uint64_t *fingerprints;
@@ -9,6 +20,11 @@ struct incoming
 	uint16_t allocated;
 
 	uint16_t got;
+
+	// Filled in when choosing the first champ for a set of fingerprints,
+	// so that choosing the next ones does not need to look them up again.
+	struct incoming_hit *hits;
+	uint16_t hits_len;
 };
 
 extern struct incoming *incoming_alloc(void);
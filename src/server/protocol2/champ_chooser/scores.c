@@ -11,6 +11,7 @@ static void scores_free_content(struct scores *scores)
 {
 	if(!scores) return;
 	free_v((void **)&scores->scores);
+	free_v((void **)&scores->touched);
 }
 
 void scores_free(struct scores **scores)
@@ -26,7 +27,9 @@ int scores_grow(struct scores *scores, size_t count)
 	if(!scores || !count) return 0;
 	scores->size=count;
 	if(!(scores->scores=(uint16_t *)realloc_w(scores->scores,
-		sizeof(uint16_t)*scores->size, __func__)))
+		sizeof(uint16_t)*scores->size, __func__))
+	  || !(scores->touched=(uint32_t *)realloc_w(scores->touched,
+		sizeof(uint32_t)*scores->size, __func__)))
 			return -1;
 	return 0;
 }
@@ -38,4 +41,21 @@ void scores_reset(struct scores *scores)
 	  || !scores->size)
 		return;
 	memset(scores->scores, 0, sizeof(scores->scores[0])*scores->size);
+	scores->touched_len=0;
+}
+
+void scores_reset_touched(struct scores *scores)
+{
+	size_t t;
+	if(!scores)
+		return;
+	for(t=0; t<scores->touched_len; t++)
+		scores->scores[scores->touched[t]]=0;
+	scores->touched_len=0;
+}
+
+void scores_add(struct scores *scores, uint32_t id)
+{
+	if(!scores->scores[id]++)
+		scores->touched[scores->touched_len++]=id;
 }
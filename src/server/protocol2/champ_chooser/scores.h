@@ -8,11 +8,17 @@ struct scores
 {
 	uint16_t *scores;
 	size_t size;
+	// The candidates that have been given a score since the last reset,
+	// so that only they need to be looked at and reset again.
+	uint32_t *touched;
+	size_t touched_len;
 };
 
 extern struct scores *scores_alloc(void);
 extern void scores_free(struct scores **scores);
 extern int scores_grow(struct scores *scores, size_t count);
 extern void scores_reset(struct scores *scores);
+extern void scores_reset_touched(struct scores *scores);
+extern void scores_add(struct scores *scores, uint32_t id);
 
 #endif
@@ -1,10 +1,97 @@
 #include "../../../burp.h"
 #include "../../../alloc.h"
+#include "bloom.h"
 #include "candidate.h"
 #include "sparse.h"
+#include "sparse_map.h"
 
 static struct sparse *sparse_table=NULL;
 
+// Most hooks that come in are not in the sparse index, so check them here
+// before looking in the table or the map.
+static struct bloom *sparse_bloom=NULL;
+
+// When the champ chooser is split into shards, each one only indexes the
+// hooks that belong to it.
+static int sparse_shard=0;
+static int sparse_shards=1;
+
+void sparse_set_shard(int shard, int shards)
+{
+	sparse_shard=shard;
+	sparse_shards=shards>0?shards:1;
+}
+
+int sparse_shard_of(uint64_t fingerprint, int shards)
+{
+	// Hooks all have the same top bits set, so mix the whole fingerprint
+	// before picking a shard.
+	fingerprint*=0x9e3779b97f4a7c15ULL;
+	return (int)((fingerprint>>32)%(uint64_t)shards);
+}
+
+int sparse_in_shard(uint64_t fingerprint)
+{
+	if(sparse_shards<=1)
+		return 1;
+	return sparse_shard_of(fingerprint, sparse_shards)==sparse_shard;
+}
+
+// How many hooks are in the sparse index, whether in the table or the map.
+size_t sparse_hooks(void)
+{
+	return HASH_COUNT(sparse_table)+sparse_map_hooks();
+}
+
+// Makes a new bloom filter with room to spare, and puts every hook that is
+// in the table or the map into it.
+int sparse_bloom_rebuild(void)
+{
+	size_t keys;
+	struct sparse *tmp;
+	struct sparse *sparse;
+	struct bloom *bloom;
+
+	keys=sparse_hooks();
+	if(!(bloom=bloom_alloc(keys<512?1024:keys*2)))
+		return -1;
+	HASH_ITER(hh, sparse_table, sparse, tmp)
+		bloom_add(bloom, sparse->fingerprint);
+	sparse_map_add_hooks(bloom);
+	if(sparse_bloom)
+	{
+		bloom->lookups=sparse_bloom->lookups;
+		bloom->passed=sparse_bloom->passed;
+		bloom->false_positives=sparse_bloom->false_positives;
+		bloom_free(&sparse_bloom);
+	}
+	sparse_bloom=bloom;
+	return 0;
+}
+
+int sparse_maybe(uint64_t fingerprint)
+{
+	if(!sparse_bloom)
+		return 1;
+	return bloom_maybe(sparse_bloom, fingerprint);
+}
+
+void sparse_bloom_false_positive(void)
+{
+	if(sparse_bloom)
+		sparse_bloom->false_positives++;
+}
+
+void sparse_bloom_log(void)
+{
+	bloom_log(sparse_bloom, "sparse index");
+}
+
+struct bloom *sparse_bloom_get(void)
+{
+	return sparse_bloom;
+}
+
 static struct sparse *sparse_add(uint64_t fingerprint)
 {
         struct sparse *sparse;
@@ -13,6 +100,10 @@ static struct sparse *sparse_add(uint64_t fingerprint)
 			return NULL;
         sparse->fingerprint=fingerprint;
 	HASH_ADD_INT(sparse_table, fingerprint, sparse);
+	if(sparse_bloom && sparse_bloom->keys<sparse_bloom->capacity)
+		bloom_add(sparse_bloom, fingerprint);
+	else if(sparse_bloom_rebuild())
+		return NULL;
         return sparse;
 }
 
@@ -35,6 +126,7 @@ void sparse_delete_all(void)
 		free_v((void **)&sparse);
 	}
 	sparse_table=NULL;
+	bloom_free(&sparse_bloom);
 }
 
 int sparse_add_candidate(uint64_t *fingerprint, struct candidate *candidate)
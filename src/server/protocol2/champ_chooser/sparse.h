@@ -3,6 +3,8 @@
 
 #include <uthash.h>
 
+struct bloom;
+
 struct sparse
 {
 	uint64_t fingerprint;
@@ -16,5 +18,14 @@ extern void sparse_delete_all(void);
 extern int sparse_add_candidate(uint64_t *fingerprint,
 	struct candidate *candidate);
 extern void sparse_delete_fresh_candidate(struct candidate *candidate);
+extern int sparse_bloom_rebuild(void);
+extern int sparse_maybe(uint64_t fingerprint);
+extern void sparse_bloom_false_positive(void);
+extern void sparse_bloom_log(void);
+extern struct bloom *sparse_bloom_get(void);
+extern size_t sparse_hooks(void);
+extern void sparse_set_shard(int shard, int shards);
+extern int sparse_shard_of(uint64_t fingerprint, int shards);
+extern int sparse_in_shard(uint64_t fingerprint);
 
 #endif
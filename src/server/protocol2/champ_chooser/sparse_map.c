@@ -0,0 +1,531 @@
+#include "../../../burp.h"
+#include "../../../alloc.h"
+#include "../../../fsops.h"
+#include "../../../fzp.h"
+#include "../../../log.h"
+#include "../../../prepend.h"
+#include "../../../sbuf.h"
+#include "../../../protocol2/blk.h"
+#include "bloom.h"
+#include "candidate.h"
+#include "scores.h"
+#include "sparse.h"
+#include "sparse_map.h"
+
+#include <sys/mman.h>
+
+// The layout is a header, then the offset of each candidate name, then a
+// hash table of hooks, then the candidate numbers that each hook points to,
+// then the candidate names. Everything is in host byte order, because the
+// file is only ever read on the machine that wrote it.
+
+#define SPARSE_MAP_MAGIC	"BURPSPM1"
+#define SPARSE_MAP_BYTE_ORDER	0x0102030405060708ULL
+
+struct sparse_map_header
+{
+	char magic[8];
+	uint64_t byte_order;
+	// The sparse index that this was made from.
+	uint64_t sparse_ino;
+	uint64_t sparse_size;
+	uint64_t sparse_mtime;
+	uint64_t candidates;
+	uint64_t slots;		// Always a power of two.
+	uint64_t refs;
+	uint64_t names_len;
+};
+
+struct sparse_map_slot
+{
+	uint64_t fingerprint;	// Zero if empty, which is never a hook.
+	uint32_t start;
+	uint32_t count;
+};
+
+struct sparse_map_ref
+{
+	uint64_t fingerprint;
+	uint32_t candidate;
+};
+
+static struct sparse_map
+{
+	void *addr;
+	size_t len;
+	struct sparse_map_slot *slots;
+	uint64_t mask;
+	uint32_t *refs;
+	size_t hooks;
+} map;
+
+char *sparse_map_path(const char *global_sparse)
+{
+	return prepend_n(global_sparse, "map", strlen("map"), ".");
+}
+
+static size_t sparse_map_len(struct sparse_map_header *h)
+{
+	return sizeof(struct sparse_map_header)
+		+h->candidates*sizeof(uint64_t)
+		+h->slots*sizeof(struct sparse_map_slot)
+		+h->refs*sizeof(uint32_t)
+		+h->names_len;
+}
+
+static uint64_t sparse_map_slot(uint64_t fingerprint, uint64_t mask)
+{
+	// Hooks all have the same top bits set, so mix them up first.
+	return ((fingerprint*0x9e3779b97f4a7c15ULL)>>32)&mask;
+}
+
+static void set_identity(struct sparse_map_header *h, struct stat *statp)
+{
+	h->sparse_ino=(uint64_t)statp->st_ino;
+	h->sparse_size=(uint64_t)statp->st_size;
+	h->sparse_mtime=(uint64_t)statp->st_mtime;
+}
+
+static int ref_cmp(const void *a, const void *b)
+{
+	const struct sparse_map_ref *x=(const struct sparse_map_ref *)a;
+	const struct sparse_map_ref *y=(const struct sparse_map_ref *)b;
+	if(x->fingerprint!=y->fingerprint)
+		return x->fingerprint<y->fingerprint?-1:1;
+	if(x->candidate!=y->candidate)
+		return x->candidate<y->candidate?-1:1;
+	return 0;
+}
+
+struct sparse_map_build
+{
+	struct sparse_map_header header;
+	char **names;
+	struct sparse_map_ref *ref;
+	size_t ref_alloc;
+};
+
+static void sparse_map_build_free(struct sparse_map_build *b)
+{
+	uint64_t c;
+	for(c=0; c<b->header.candidates; c++)
+		free_w(&b->names[c]);
+	free_v((void **)&b->names);
+	free_v((void **)&b->ref);
+}
+
+static int add_name(struct sparse_map_build *b, struct sbuf *sb)
+{
+	if(!(b->names=(char **)realloc_w(b->names,
+		(b->header.candidates+1)*sizeof(char *), __func__)))
+			return -1;
+	b->names[b->header.candidates++]=sb->path.buf;
+	b->header.names_len+=strlen(sb->path.buf)+1;
+	sb->path.buf=NULL;
+	return 0;
+}
+
+static int add_ref(struct sparse_map_build *b, uint64_t fingerprint)
+{
+	// Same as candidate_load(), which ignores hooks before any manifest.
+	if(!b->header.candidates)
+		return 0;
+	if(b->header.refs==UINT32_MAX)
+	{
+		logp("Too many hooks for %s\n", __func__);
+		return -1;
+	}
+	if(b->header.refs==b->ref_alloc)
+	{
+		b->ref_alloc=b->ref_alloc?b->ref_alloc*2:1024;
+		if(!(b->ref=(struct sparse_map_ref *)realloc_w(b->ref,
+			b->ref_alloc*sizeof(struct sparse_map_ref), __func__)))
+				return -1;
+	}
+	b->ref[b->header.refs].fingerprint=fingerprint;
+	b->ref[b->header.refs].candidate=(uint32_t)(b->header.candidates-1);
+	b->header.refs++;
+	return 0;
+}
+
+static int read_global_sparse(struct sparse_map_build *b,
+	const char *global_sparse)
+{
+	int ret=-1;
+	struct fzp *fzp=NULL;
+	struct sbuf *sb=NULL;
+	struct blk *blk=NULL;
+
+	if(!(sb=sbuf_alloc(PROTO_2))
+	  || !(blk=blk_alloc())
+	  || !(fzp=fzp_gzopen(global_sparse, "rb")))
+		goto end;
+	while(1)
+	{
+		sbuf_free_content(sb);
+		switch(sbuf_fill_from_file(sb, fzp, blk))
+		{
+			case 1: ret=0;
+				goto end;
+			case -1:
+				logp("Error reading %s in %s\n",
+					global_sparse, __func__);
+				goto end;
+		}
+		if(blk_fingerprint_is_hook(blk))
+		{
+			if(add_ref(b, blk->fingerprint))
+				goto end;
+		}
+		else if(sb->path.cmd==CMD_MANIFEST)
+		{
+			if(add_name(b, sb))
+				goto end;
+		}
+		blk->fingerprint=0;
+	}
+end:
+	fzp_close(&fzp);
+	sbuf_free(&sb);
+	blk_free(&blk);
+	return ret;
+}
+
+static int write_map(struct sparse_map_build *b, const char *path)
+{
+	int ret=-1;
+	uint64_t c;
+	uint64_t r;
+	uint64_t i;
+	uint64_t hooks=0;
+	uint64_t offset=0;
+	uint64_t *offsets=NULL;
+	uint32_t *refs=NULL;
+	struct sparse_map_slot *slot=NULL;
+	struct sparse_map_slot *slots=NULL;
+	struct fzp *fzp=NULL;
+
+	// A candidate should appear once per hook, in the order that they
+	// were loaded, the same as sparse_add_candidate() does it.
+	qsort(b->ref, b->header.refs, sizeof(struct sparse_map_ref), ref_cmp);
+	for(r=0, i=0; r<b->header.refs; r++)
+	{
+		if(i && !ref_cmp(&b->ref[i-1], &b->ref[r]))
+			continue;
+		if(!i || b->ref[i-1].fingerprint!=b->ref[r].fingerprint)
+			hooks++;
+		b->ref[i++]=b->ref[r];
+	}
+	b->header.refs=i;
+
+	// Keep at least half of the slots free, so that probes stay short.
+	for(b->header.slots=1; b->header.slots<hooks*2; b->header.slots*=2) { }
+
+	if(!(offsets=(uint64_t *)calloc_w(b->header.candidates+1,
+		sizeof(uint64_t), __func__))
+	  || !(slots=(struct sparse_map_slot *)calloc_w(b->header.slots,
+		sizeof(struct sparse_map_slot), __func__))
+	  || !(refs=(uint32_t *)calloc_w(b->header.refs+1,
+		sizeof(uint32_t), __func__)))
+			goto end;
+
+	for(c=0; c<b->header.candidates; c++)
+	{
+		offsets[c]=offset;
+		offset+=strlen(b->names[c])+1;
+	}
+	for(r=0; r<b->header.refs; r++)
+	{
+		refs[r]=b->ref[r].candidate;
+		if(r && b->ref[r-1].fingerprint==b->ref[r].fingerprint)
+		{
+			slot->count++;
+			continue;
+		}
+		for(i=sparse_map_slot(b->ref[r].fingerprint,
+			b->header.slots-1); slots[i].fingerprint;
+			i=(i+1)&(b->header.slots-1)) { }
+		slot=&slots[i];
+		slot->fingerprint=b->ref[r].fingerprint;
+		slot->start=(uint32_t)r;
+		slot->count=1;
+	}
+
+	if(!(fzp=fzp_open(path, "wb")))
+		goto end;
+	if(fzp_write(fzp, &b->header, sizeof(b->header))!=sizeof(b->header)
+	  || fzp_write(fzp, offsets, b->header.candidates*sizeof(uint64_t))
+		!=b->header.candidates*sizeof(uint64_t)
+	  || fzp_write(fzp, slots,
+		b->header.slots*sizeof(struct sparse_map_slot))
+		!=b->header.slots*sizeof(struct sparse_map_slot)
+	  || fzp_write(fzp, refs, b->header.refs*sizeof(uint32_t))
+		!=b->header.refs*sizeof(uint32_t))
+	{
+		logp("Error writing %s in %s\n", path, __func__);
+		goto end;
+	}
+	for(c=0; c<b->header.candidates; c++)
+	{
+		size_t len=strlen(b->names[c])+1;
+		if(fzp_write(fzp, b->names[c], len)!=len)
+		{
+			logp("Error writing %s in %s\n", path, __func__);
+			goto end;
+		}
+	}
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s\n", path, __func__);
+		goto end;
+	}
+	ret=0;
+end:
+	fzp_close(&fzp);
+	free_v((void **)&offsets);
+	free_v((void **)&slots);
+	free_v((void **)&refs);
+	return ret;
+}
+
+// Should be called with the sparse lock held, whenever the global sparse
+// index has been rewritten.
+int sparse_map_write(const char *global_sparse)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *tmp=NULL;
+	struct stat statp;
+	struct sparse_map_build b;
+
+	memset(&b, 0, sizeof(b));
+	memcpy(b.header.magic, SPARSE_MAP_MAGIC, sizeof(b.header.magic));
+	b.header.byte_order=SPARSE_MAP_BYTE_ORDER;
+
+	if(!(path=sparse_map_path(global_sparse))
+	  || !(tmp=prepend_n(path, "tmp", strlen("tmp"), ".")))
+		goto end;
+	// Get rid of the old one first, so that a failure cannot leave it
+	// looking like it is still in use.
+	if(unlink(path) && errno!=ENOENT)
+	{
+		logp("Could not unlink %s: %s\n", path, strerror(errno));
+		goto end;
+	}
+	if(lstat(global_sparse, &statp))
+	{
+		ret=0;
+		goto end;
+	}
+	set_identity(&b.header, &statp);
+
+	if(read_global_sparse(&b, global_sparse)
+	  || write_map(&b, tmp)
+	  || do_rename(tmp, path))
+		goto end;
+	logp("Wrote %s: %" PRIu64 " candidates, %" PRIu64 " references\n",
+		path, b.header.candidates, b.header.refs);
+	ret=0;
+end:
+	if(ret && tmp)
+		unlink(tmp);
+	sparse_map_build_free(&b);
+	free_w(&path);
+	free_w(&tmp);
+	return ret;
+}
+
+// Everything that gets indexed with what is in the map has to be within it,
+// because a corrupt map could otherwise send the champ chooser anywhere.
+static int sparse_map_check_refs(struct sparse_map_header *h)
+{
+	uint64_t i;
+	struct sparse_map_slot *slots;
+	uint32_t *refs;
+
+	slots=(struct sparse_map_slot *)((uint64_t *)(h+1)+h->candidates);
+	refs=(uint32_t *)(slots+h->slots);
+	for(i=0; i<h->slots; i++)
+	{
+		if(!slots[i].fingerprint)
+			continue;
+		if((uint64_t)slots[i].start+slots[i].count>h->refs)
+			return -1;
+	}
+	for(i=0; i<h->refs; i++)
+		if(refs[i]>=h->candidates)
+			return -1;
+	return 0;
+}
+
+// Returns 0 if the map can be used, or 1 if not.
+static int sparse_map_check(struct sparse_map_header *h, size_t len,
+	const char *global_sparse, const char *path)
+{
+	uint64_t c;
+	uint64_t *offsets;
+	const char *names;
+	struct stat statp;
+	struct sparse_map_header expected;
+
+	// The counts have to be checked before they get multiplied up, or a
+	// corrupt one could wrap around to the right length.
+	if(len<sizeof(struct sparse_map_header)
+	  || memcmp(h->magic, SPARSE_MAP_MAGIC, sizeof(h->magic))
+	  || h->byte_order!=SPARSE_MAP_BYTE_ORDER
+	  || h->candidates>len
+	  || h->slots>len
+	  || h->refs>len
+	  || h->names_len>len
+	  || !h->slots
+	  || (h->slots&(h->slots-1))
+	  || sparse_map_len(h)!=len)
+		goto invalid;
+	memset(&expected, 0, sizeof(expected));
+	if(lstat(global_sparse, &statp))
+		return 1;
+	set_identity(&expected, &statp);
+	if(h->sparse_ino!=expected.sparse_ino
+	  || h->sparse_size!=expected.sparse_size
+	  || h->sparse_mtime!=expected.sparse_mtime)
+	{
+		logp("%s is out of date\n", path);
+		return 1;
+	}
+	offsets=(uint64_t *)(h+1);
+	names=(const char *)h+len-h->names_len;
+	if(h->names_len && names[h->names_len-1])
+		goto invalid;
+	for(c=0; c<h->candidates; c++)
+		if(offsets[c]>=h->names_len)
+			goto invalid;
+	if(sparse_map_check_refs(h))
+		goto invalid;
+	return 0;
+invalid:
+	logp("%s is not a valid sparse map\n", path);
+	return 1;
+}
+
+static int add_candidates(struct sparse_map_header *h, size_t len,
+	struct scores *scores)
+{
+	uint64_t c;
+	uint64_t *offsets=(uint64_t *)(h+1);
+	const char *names=(const char *)h+len-h->names_len;
+	struct candidate *candidate;
+
+	for(c=0; c<h->candidates; c++)
+	{
+		if(!(candidate=candidates_add_new())
+		  || !(candidate->path=strdup_w(names+offsets[c], __func__)))
+			return -1;
+	}
+	return candidates_scores_update(scores);
+}
+
+// Returns 0 if the map was loaded, 1 if there is no usable map, so the
+// sparse index needs to be read instead, and -1 on error.
+int sparse_map_load(const char *global_sparse, struct scores *scores)
+{
+	int fd=-1;
+	int ret=-1;
+	uint64_t i;
+	char *path=NULL;
+	void *addr=MAP_FAILED;
+	struct stat statp;
+	struct sparse_map_header *h;
+
+	if(map.addr || candidates_len)
+		return 1;
+	if(!(path=sparse_map_path(global_sparse)))
+		goto end;
+	if((fd=open(path, O_RDONLY))<0)
+	{
+		if(errno!=ENOENT)
+			logp("Could not open %s: %s\n", path, strerror(errno));
+		ret=1;
+		goto end;
+	}
+	if(fstat(fd, &statp) || !statp.st_size)
+	{
+		ret=1;
+		goto end;
+	}
+	if((addr=mmap(NULL, (size_t)statp.st_size, PROT_READ, MAP_SHARED,
+		fd, 0))==MAP_FAILED)
+	{
+		logp("Could not mmap %s: %s\n", path, strerror(errno));
+		ret=1;
+		goto end;
+	}
+	h=(struct sparse_map_header *)addr;
+	if(sparse_map_check(h, (size_t)statp.st_size, global_sparse, path))
+	{
+		ret=1;
+		goto end;
+	}
+	map.addr=addr;
+	map.len=(size_t)statp.st_size;
+	map.slots=(struct sparse_map_slot *)
+		((uint64_t *)(h+1)+h->candidates);
+	map.mask=h->slots-1;
+	map.refs=(uint32_t *)(map.slots+h->slots);
+	for(i=0; i<h->slots; i++)
+		if(map.slots[i].fingerprint)
+			map.hooks++;
+	addr=MAP_FAILED;
+	if(add_candidates(h, map.len, scores))
+		goto end;
+	logp("Mapped %s: %" PRIu64 " candidates, %" PRIu64 " references\n",
+		path, h->candidates, h->refs);
+	ret=0;
+end:
+	if(addr!=MAP_FAILED)
+		munmap(addr, (size_t)statp.st_size);
+	close_fd(&fd);
+	free_w(&path);
+	return ret;
+}
+
+// Gives the candidates for a hook as positions in the candidates array,
+// in the order that they were loaded.
+const uint32_t *sparse_map_find(uint64_t fingerprint, size_t *count)
+{
+	uint64_t i;
+	if(!map.addr || !sparse_in_shard(fingerprint))
+		return NULL;
+	for(i=sparse_map_slot(fingerprint, map.mask);
+	  map.slots[i].fingerprint; i=(i+1)&map.mask)
+	{
+		if(map.slots[i].fingerprint!=fingerprint)
+			continue;
+		*count=map.slots[i].count;
+		return map.refs+map.slots[i].start;
+	}
+	return NULL;
+}
+
+size_t sparse_map_hooks(void)
+{
+	return map.hooks;
+}
+
+void sparse_map_add_hooks(struct bloom *bloom)
+{
+	uint64_t i;
+	for(i=0; map.addr && i<=map.mask; i++)
+	{
+		if(!map.slots[i].fingerprint
+		  || !sparse_in_shard(map.slots[i].fingerprint))
+			continue;
+		bloom_add(bloom, map.slots[i].fingerprint);
+	}
+}
+
+void sparse_map_close(void)
+{
+	if(map.addr)
+		munmap(map.addr, map.len);
+	memset(&map, 0, sizeof(map));
+}
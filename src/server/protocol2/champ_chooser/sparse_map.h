@@ -0,0 +1,19 @@
+#ifndef _CHAMP_CHOOSER_SPARSE_MAP_H
+#define _CHAMP_CHOOSER_SPARSE_MAP_H
+
+struct bloom;
+struct scores;
+
+// A copy of the global sparse index that the champ chooser can mmap()
+// instead of parsing, kept next to it as 'sparse.map'. It only gets used if
+// it was made from the sparse index that is there now.
+extern char *sparse_map_path(const char *global_sparse);
+extern int sparse_map_write(const char *global_sparse);
+
+extern int sparse_map_load(const char *global_sparse, struct scores *scores);
+extern const uint32_t *sparse_map_find(uint64_t fingerprint, size_t *count);
+extern size_t sparse_map_hooks(void);
+extern void sparse_map_add_hooks(struct bloom *bloom);
+extern void sparse_map_close(void);
+
+#endif
@@ -1,10 +1,14 @@
 #include "../../burp.h"
 #include "../../alloc.h"
 #include "../../conf.h"
+#include "../../conffile.h"
 #include "../../cstat.h"
 #include "../../fsops.h"
+#include "../../handy.h"
+#include "../../lock.h"
 #include "../../log.h"
 #include "../../prepend.h"
+#include "../sdirs.h"
 #include "clist.h"
 
 int get_client_list(
@@ -81,3 +85,103 @@ void clist_free(struct cstat **clist)
 		sdirs_free((struct sdirs **)&c->sdirs);
 	cstat_list_free(clist);
 }
+
+// Lock every client in the list for writing, as a backup or delete would,
+// so that none of them can run.
+int clist_lock(struct cstat *clist)
+{
+	struct cstat *c;
+	struct sdirs *s;
+	for(c=clist; c; c=c->next)
+	{
+		s=(struct sdirs *)c->sdirs;
+		if(mkpath(&s->lock_storage_for_write->path, s->lockdir))
+		{
+			logp("problem with lock directory: %s\n", s->lockdir);
+			return -1;
+		}
+
+		lock_get(s->lock_storage_for_write);
+		switch(s->lock_storage_for_write->status)
+		{
+			case GET_LOCK_GOT:
+				logp("locked: %s\n", c->name);
+				break;
+			case GET_LOCK_NOT_GOT:
+				logp("Unable to get lock for client %s\n",
+					c->name);
+				return -1;
+			case GET_LOCK_ERROR:
+			default:
+				logp("Problem with lock file: %s\n",
+					s->lock_storage_for_write->path);
+				return -1;
+		}
+	}
+	return 0;
+}
+
+void clist_unlock(struct cstat *clist)
+{
+	struct cstat *c;
+	struct sdirs *s;
+	for(c=clist; c; c=c->next)
+	{
+		s=(struct sdirs *)c->sdirs;
+		if(!s) continue;
+		lock_release(s->lock_storage_for_write);
+		logp("released: %s\n", c->name);
+	}
+}
+
+static int parse_directory(const char *arg,
+	char **directory, char **dedup_group)
+{
+	char *cp;
+	if(!(*directory=strdup_w(arg, __func__)))
+		goto error;
+	strip_trailing_slashes(directory);
+	if(!(cp=strrchr(*directory, '/')))
+	{
+		logp("Could not parse directory '%s'\n", *directory);
+		goto error;
+	}
+	*cp='\0';
+	if(!(*dedup_group=strdup_w(cp+1, __func__)))
+		goto error;
+	if(!*directory || !*dedup_group)
+		goto error;
+	return 0;
+error:
+	free_w(directory);
+	free_w(dedup_group);
+	return -1;
+}
+
+// For the programs that work on a whole dedup_group, given the path to it.
+struct conf **clist_load_conf(const char *configfile, const char *path)
+{
+	char *directory=NULL;
+	char *dedup_group=NULL;
+	struct conf **conf=NULL;
+
+	if(parse_directory(path, &directory, &dedup_group))
+		goto end;
+
+	logp("config file: %s\n", configfile);
+	logp("directory: %s\n", directory);
+	logp("dedup_group: %s\n", dedup_group);
+
+	if(!(conf=confs_alloc())
+	  || confs_init(conf)
+	  || conf_load_global_only(configfile, conf)
+	  || set_string(conf[OPT_CNAME], "fake")
+	  || set_string(conf[OPT_DIRECTORY], directory)
+	  || set_string(conf[OPT_DEDUP_GROUP], dedup_group)
+	  || set_protocol(conf, PROTO_2))
+		confs_free(&conf);
+end:
+	free_w(&directory);
+	free_w(&dedup_group);
+	return conf;
+}
@@ -9,5 +9,9 @@ extern int get_client_list(
 extern void clist_free(
 	struct cstat **clist
 );
+extern int clist_lock(struct cstat *clist);
+extern void clist_unlock(struct cstat *clist);
+extern struct conf **clist_load_conf(const char *configfile,
+	const char *path);
 
 #endif
@@ -0,0 +1,211 @@
+#include "../../burp.h"
+#include "../../alloc.h"
+#include "../../fsops.h"
+#include "../../fzp.h"
+#include "../../iobuf.h"
+#include "../../log.h"
+#include "../../prepend.h"
+#include "../../protocol2/blk.h"
+#include "dfidx.h"
+
+// The layout is a header, then the offsets. Everything is in host byte
+// order, because the file is only ever read on the machine that wrote it.
+
+#define DFIDX_MAGIC		"BURPDFX1"
+#define DFIDX_BYTE_ORDER	0x0102030405060708ULL
+
+struct dfidx_header
+{
+	char magic[8];
+	uint64_t byte_order;
+	uint64_t data_size;
+	uint64_t count;
+};
+
+char *dfidx_path(const char *datafile)
+{
+	return prepend_n(datafile, "idx", strlen("idx"), ".");
+}
+
+// Not having an index only makes reading slower, so the callers can carry
+// on if this fails.
+int dfidx_write(const char *datafile, const uint32_t *offsets, uint16_t count)
+{
+	int ret=-1;
+	char *path=NULL;
+	char *tmp=NULL;
+	struct fzp *fzp=NULL;
+	struct dfidx_header header;
+	size_t len=(count+1)*sizeof(uint32_t);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DFIDX_MAGIC, sizeof(header.magic));
+	header.byte_order=DFIDX_BYTE_ORDER;
+	header.data_size=offsets[count];
+	header.count=count;
+
+	if(!(path=dfidx_path(datafile))
+	  || !(tmp=prepend_n(path, "tmp", strlen("tmp"), "."))
+	  || !(fzp=fzp_open(tmp, "wb")))
+		goto end;
+	if(fzp_write(fzp, &header, sizeof(header))!=sizeof(header)
+	  || fzp_write(fzp, offsets, len)!=len)
+	{
+		logp("Error writing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	if(fzp_close(&fzp))
+	{
+		logp("Error closing %s in %s\n", tmp, __func__);
+		goto end;
+	}
+	if(do_rename(tmp, path))
+		goto end;
+	ret=0;
+end:
+	fzp_close(&fzp);
+	if(ret && tmp)
+		unlink(tmp);
+	free_w(&path);
+	free_w(&tmp);
+	return ret;
+}
+
+static int dfidx_check(struct dfidx_header *h, struct dfidx *dfidx,
+	struct stat *statp, const char *path)
+{
+	uint16_t i;
+
+	if(memcmp(h->magic, DFIDX_MAGIC, sizeof(h->magic))
+	  || h->byte_order!=DFIDX_BYTE_ORDER)
+	{
+		logp("%s is not a data file index\n", path);
+		return -1;
+	}
+	// The data file was changed after the index was written.
+	if(h->data_size!=(uint64_t)statp->st_size
+	  || dfidx->offsets[0]
+	  || dfidx->offsets[dfidx->count]!=h->data_size)
+	{
+		logp("%s does not match its data file\n", path);
+		return -1;
+	}
+	for(i=0; i<dfidx->count; i++)
+	{
+		// Each one has at least the five bytes of the tag.
+		if(dfidx->offsets[i+1]<dfidx->offsets[i]+5)
+		{
+			logp("%s has bad offsets\n", path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Returns 0 if the index was loaded, 1 if the data file has no index that
+// can be used, and -1 on error. fd is the data file.
+int dfidx_load(struct dfidx *dfidx, const char *datafile, int fd)
+{
+	int ret=-1;
+	size_t len;
+	char *path=NULL;
+	struct fzp *fzp=NULL;
+	struct stat statp;
+	struct dfidx_header header;
+
+	dfidx_free_content(dfidx);
+	if(!(path=dfidx_path(datafile)))
+		goto end;
+	// Data files written by older versions have none.
+	if(lstat(path, &statp) || !(fzp=fzp_open(path, "rb")))
+	{
+		ret=1;
+		goto end;
+	}
+	if(fzp_read(fzp, &header, sizeof(header))!=(int)sizeof(header)
+	  || header.count>DATA_FILE_SIG_MAX)
+	{
+		logp("%s is short or corrupt\n", path);
+		ret=1;
+		goto end;
+	}
+	if(fstat(fd, &statp))
+	{
+		logp("Could not fstat data file for %s: %s\n",
+			path, strerror(errno));
+		goto end;
+	}
+	dfidx->count=(uint16_t)header.count;
+	len=(dfidx->count+1)*sizeof(uint32_t);
+	if(!(dfidx->offsets=(uint32_t *)malloc_w(len, __func__)))
+		goto end;
+	if(fzp_read(fzp, dfidx->offsets, len)!=(int)len)
+	{
+		logp("%s is short\n", path);
+		ret=1;
+		goto end;
+	}
+	if(dfidx_check(&header, dfidx, &statp, path))
+	{
+		ret=1;
+		goto end;
+	}
+	ret=0;
+end:
+	if(ret)
+		dfidx_free_content(dfidx);
+	fzp_close(&fzp);
+	free_w(&path);
+	return ret;
+}
+
+// For a data file that has no index, work one out by going through the
+// whole of it, which is in buf. Anything after a bad block is left out.
+int dfidx_build(struct dfidx *dfidx, const char *buf, size_t len)
+{
+	size_t off=0;
+	size_t reclen;
+	uint16_t count=0;
+
+	dfidx_free_content(dfidx);
+	if(!(dfidx->offsets=(uint32_t *)malloc_w(
+		(DATA_FILE_SIG_MAX+1)*sizeof(uint32_t), __func__)))
+			return -1;
+	dfidx->offsets[0]=0;
+	while(count<DATA_FILE_SIG_MAX && off<len)
+	{
+		if(iobuf_buf_data_len(buf+off, len-off, &reclen))
+		{
+			logp("Bad block %d in data file in %s\n",
+				count, __func__);
+			break;
+		}
+		off+=reclen;
+		dfidx->offsets[++count]=(uint32_t)off;
+	}
+	dfidx->count=count;
+	return 0;
+}
+
+void dfidx_free_content(struct dfidx *dfidx)
+{
+	free_v((void **)&dfidx->offsets);
+	dfidx->count=0;
+}
+
+int dfidx_unlink(const char *datafile)
+{
+	int ret=-1;
+	char *path=NULL;
+	if(!(path=dfidx_path(datafile)))
+		return -1;
+	if(unlink(path) && errno!=ENOENT)
+	{
+		logp("Could not unlink %s: %s\n", path, strerror(errno));
+		goto end;
+	}
+	ret=0;
+end:
+	free_w(&path);
+	return ret;
+}
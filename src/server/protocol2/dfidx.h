@@ -0,0 +1,23 @@
+#ifndef _DFIDX_H
+#define _DFIDX_H
+
+// Where each block starts in a protocol2 data file, kept next to it as
+// '<data file>.idx', so that a block can be read without reading all of the
+// ones before it. Data files that have no index, or whose index does not
+// match them, have to be read from the start.
+struct dfidx
+{
+	uint16_t count;
+	// count+1 entries. The last one is the size of the data file.
+	uint32_t *offsets;
+};
+
+extern char *dfidx_path(const char *datafile);
+extern int dfidx_write(const char *datafile,
+	const uint32_t *offsets, uint16_t count);
+extern int dfidx_load(struct dfidx *dfidx, const char *datafile, int fd);
+extern int dfidx_build(struct dfidx *dfidx, const char *buf, size_t len);
+extern void dfidx_free_content(struct dfidx *dfidx);
+extern int dfidx_unlink(const char *datafile);
+
+#endif
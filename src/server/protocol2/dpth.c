@@ -8,6 +8,7 @@
 #include "../../log.h"
 #include "../../prepend.h"
 #include "../../protocol2/blk.h"
+#include "dfidx.h"
 #include "dpth.h"
 
 static int get_data_lock(struct lock *lock, const char *path)
@@ -283,6 +284,42 @@ static int fwrite_buf(enum cmd cmd,
 	return 0;
 }
 
+// Store the block compressed if that makes it smaller.
+static int fwrite_data(struct dpth *dpth, struct iobuf *iobuf)
+{
+	static char buf[0x10000];
+	enum cmd cmd=CMD_DATA;
+	const char *data=iobuf->buf;
+	size_t len=iobuf->len<sizeof(buf)?iobuf->len:sizeof(buf);
+	if(dpth->compression)
+	{
+		switch(blk_data_compress(dpth->compression,
+			iobuf->buf, iobuf->len, buf, &len))
+		{
+			case 0:
+				cmd=CMD_DATA_COMP;
+				data=buf;
+				break;
+			case 1:
+				len=iobuf->len;
+				break;
+			default:
+				return -1;
+		}
+	}
+	else
+		len=iobuf->len;
+	if(fwrite_buf(cmd, data, len, dpth->fzp))
+		return -1;
+	if(dpth->offsets_len<DATA_FILE_SIG_MAX)
+	{
+		dpth->offsets[dpth->offsets_len+1]
+			=dpth->offsets[dpth->offsets_len]+5+len;
+		dpth->offsets_len++;
+	}
+	return 0;
+}
+
 static struct fzp *file_open_w(const char *path)
 {
 	if(build_path_w(path)) return NULL;
@@ -351,8 +388,36 @@ int dpth_protocol2_fwrite(struct dpth *dpth,
 		return -1;
 
 	// Open the current list head if we have no fzp.
-	if(!dpth->fzp
-	  && !(dpth->fzp=open_data_file_for_write(dpth, blk))) return -1;
+	if(!dpth->fzp)
+	{
+		if(!(dpth->fzp=open_data_file_for_write(dpth, blk)))
+			return -1;
+		dpth->offsets[0]=0;
+		dpth->offsets_len=0;
+	}
 
-	return fwrite_buf(CMD_DATA, iobuf->buf, iobuf->len, dpth->fzp);
+	return fwrite_data(dpth, iobuf);
+}
+
+// Close the data file that is being written, and write the index of where
+// its blocks start. Restores can do without the index, so failing to write
+// it is not an error.
+int dpth_protocol2_fclose(struct dpth *dpth)
+{
+	char *path=NULL;
+
+	if(!dpth->fzp)
+		return 0;
+	if(fzp_close(&dpth->fzp))
+		return -1;
+	if(!dpth->offsets_len)
+		return 0;
+	if(!(path=prepend_slash(dpth->base_path, dpth->head->save_path,
+		strlen(dpth->head->save_path))))
+			return -1;
+	if(dfidx_write(path, dpth->offsets, dpth->offsets_len))
+		logp("Could not write the index of %s\n", path);
+	dpth->offsets_len=0;
+	free_w(&path);
+	return 0;
 }
@@ -12,6 +12,7 @@ extern int dpth_protocol2_incr_sig(struct dpth *dpth);
 extern char *dpth_protocol2_mk(struct dpth *dpth);
 extern char *dpth_protocol2_get_save_path(struct dpth *dpth);
 
+extern int dpth_protocol2_fclose(struct dpth *dpth);
 extern int dpth_protocol2_fwrite(struct dpth *dpth,
 	struct iobuf *iobuf, struct blk *blk);
 
@@ -1,5 +1,6 @@
 #include "../../burp.h"
 #include "../../alloc.h"
+#include "../../asfd.h"
 #include "../../cmd.h"
 #include "../../fzp.h"
 #include "../../hexmap.h"
@@ -7,209 +8,985 @@
 #include "../../log.h"
 #include "../../prepend.h"
 #include "../../protocol2/blk.h"
+#include "../../sbuf.h"
+#include "../manio.h"
+#include "dfidx.h"
 #include "rblk.h"
 
+#include <sys/mman.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// Restoring reads the blocks of the manifest from the data files. The blocks
+// of a file are usually spread over several data files, and reading them in
+// manifest order means jumping back and forth between them. So the manifest
+// is also read on ahead of the restore, and the blocks that it is about to
+// want are read in batches, in data file order, and kept until they are sent.
+// Data files that have an index get just the wanted blocks read from them.
+// With rblk_mmap, data files are mapped instead of read, and blocks that are
+// not compressed are used straight from the mapping.
+
 static ssize_t rblk_mem=0;
 static ssize_t rblk_mem_max=0;
+static int rblk_mem_warned=0;
+static int rblk_mmap=0;
 
-// For retrieving stored data.
-struct rblk
+// A block that the restore wants, or has got.
+struct rchunk
+{
+	uint64_t savepath;
+	uint32_t want;		// Times it appears in the look ahead window.
+	struct iobuf data;	// Not set until it has been read.
+	struct rfile *map;	// If set, data points into its mapping.
+	UT_hash_handle hh;
+};
+
+// How far each data file has been read, so that the next read can carry on
+// from there.
+struct rfile
 {
 	uint64_t hash_key;
-	struct iobuf readbuf[DATA_FILE_SIG_MAX];
-	uint16_t rlen;
-	struct fzp *fzp;
+	uint16_t rlen;		// Blocks read so far.
+	off_t offset;		// Where the next one starts.
+	// With rblk_mmap, the mapping and where the blocks are in it.
+	char *map;
+	size_t map_len;
+	struct dfidx dfidx;
+	int refs;		// Blocks that point into the mapping.
+	struct rfile *prev;	// Most recently used mapping first.
+	struct rfile *next;
 	UT_hash_handle hh;
 };
 
-static void rblk_free_content(struct rblk *rblk)
+static struct rchunk *rchunk_hash=NULL;
+static struct rfile *rfile_hash=NULL;
+static struct rfile *mapped_head=NULL;
+static struct rfile *mapped_tail=NULL;
+
+// The block that was handed out last. It is kept until the next one is asked
+// for, because the caller is still using its data.
+static struct rchunk *last=NULL;
+
+// Something that reads data files. With rblk_threads, there are several of
+// them, each reading a different data file at the same time. A data file is
+// always read by the same one, which keeps the last one that it read open,
+// because the next read is often from the same one.
+struct rreader
+{
+	struct fzp *fzp;
+	struct rfile *rfile;
+	// Its index, if it has one, and somewhere to pread() its blocks into.
+	struct dfidx dfidx;
+	char *pread_buf;
+	size_t pread_size;
+	// Loaded, but not added to rblk_mem yet.
+	ssize_t mem;
+	// Progress, for the log.
+	uint64_t files;
+	uint64_t blocks;
+	uint64_t bytes;
+	// The data file to load next, when loading several at once.
+	struct rfile *job_rfile;
+	uint64_t *job_savepaths;
+	size_t job_count;
+	const char *job_datpath;
+#ifdef HAVE_PTHREAD
+	pthread_t tid;
+#endif
+};
+
+static struct rreader *readers=NULL;
+static int readers_len=0;
+
+// The most to read from a data file in one go.
+#define RBLK_PREAD_MAX	0x100000
+
+// The look ahead window, in manifest order.
+static struct manio *plan_manio=NULL;
+static struct sbuf *plan_sb=NULL;
+static struct blk *plan_blk=NULL;
+static uint64_t *plan_win=NULL;
+static size_t plan_size=0;
+static size_t plan_head=0;
+static size_t plan_len=0;
+
+static struct rchunk *rchunk_find(uint64_t savepath)
+{
+	struct rchunk *rchunk;
+	HASH_FIND(hh, rchunk_hash, &savepath, sizeof(savepath), rchunk);
+	return rchunk;
+}
+
+static struct rchunk *rchunk_get(uint64_t savepath)
+{
+	struct rchunk *rchunk;
+	if((rchunk=rchunk_find(savepath)))
+		return rchunk;
+	if(!(rchunk=(struct rchunk *)
+		calloc_w(1, sizeof(struct rchunk), __func__)))
+			return NULL;
+	rchunk->savepath=savepath;
+	HASH_ADD(hh, rchunk_hash, savepath, sizeof(rchunk->savepath), rchunk);
+	rblk_mem+=sizeof(struct rchunk);
+	return rchunk;
+}
+
+static void rchunk_free(struct rchunk **rchunk)
 {
-	for(int j=0; j<rblk->rlen; j++)
+	HASH_DEL(rchunk_hash, *rchunk);
+	rblk_mem-=sizeof(struct rchunk);
+	if((*rchunk)->map)
+		(*rchunk)->map->refs--;
+	else
 	{
-		rblk_mem-=rblk->readbuf[j].len;
-		iobuf_free_content(&rblk->readbuf[j]);
+		rblk_mem-=(*rchunk)->data.len;
+		iobuf_free_content(&(*rchunk)->data);
 	}
-	fzp_close(&rblk->fzp);
+	free_v((void **)rchunk);
 }
 
-static void rblk_free(struct rblk **rblk)
+static void rchunk_free_if_unwanted(struct rchunk *rchunk)
 {
-/*
-uint16_t datno;
-char *x;
-x=uint64_to_savepathstr_with_sig_uint((*rblk)->hash_key, &datno);
-logp("close: %s\n", x);
-*/
-	rblk_free_content(*rblk);
-	rblk_mem-=sizeof(struct rblk);
-	free_v((void **)rblk);
+	if(rchunk->want || rchunk==last)
+		return;
+	rchunk_free(&rchunk);
 }
 
-static struct rblk *rblk_hash=NULL;
+static void last_release(void)
+{
+	struct rchunk *rchunk=last;
+	last=NULL;
+	if(rchunk)
+		rchunk_free_if_unwanted(rchunk);
+}
 
-static struct rblk *rblk_hash_find(uint64_t savepath)
+static struct rfile *rfile_get(uint64_t hash_key)
 {
-	struct rblk *rblk;
-	HASH_FIND_INT(rblk_hash, &savepath, rblk);
-	return rblk;
+	struct rfile *rfile;
+	HASH_FIND(hh, rfile_hash, &hash_key, sizeof(hash_key), rfile);
+	if(rfile)
+		return rfile;
+	if(!(rfile=(struct rfile *)
+		calloc_w(1, sizeof(struct rfile), __func__)))
+			return NULL;
+	rfile->hash_key=hash_key;
+	HASH_ADD(hh, rfile_hash, hash_key, sizeof(rfile->hash_key), rfile);
+	return rfile;
 }
 
-static void rblk_hash_add(struct rblk *rblk)
+static int rfile_close(struct rreader *reader)
 {
-	HASH_ADD_INT(rblk_hash, hash_key, rblk);
+	int ret=0;
+	if(!reader->fzp)
+		return 0;
+	dfidx_free_content(&reader->dfidx);
+	if((reader->rfile->offset=fzp_tell(reader->fzp))<0)
+	{
+		// Start again next time.
+		reader->rfile->offset=0;
+		reader->rfile->rlen=0;
+	}
+	if(fzp_close(&reader->fzp))
+		ret=-1;
+	reader->rfile=NULL;
+	return ret;
 }
 
-static struct rblk *rblk_alloc(void)
+// After an error, nothing is known about where the file is up to.
+static void rfile_reset(struct rreader *reader, struct rfile *rfile)
 {
-	struct rblk *rblk;
-	rblk=(struct rblk *)calloc_w(1, sizeof(struct rblk), __func__);
-	if(rblk)
-		rblk_mem+=sizeof(struct rblk);
-	return rblk;
+	if(reader->rfile==rfile)
+	{
+		dfidx_free_content(&reader->dfidx);
+		fzp_close(&reader->fzp);
+		reader->rfile=NULL;
+	}
+	rfile->rlen=0;
+	rfile->offset=0;
 }
 
-void rblks_init(ssize_t rblk_memory_max)
+// Make 'rfile' the open data file, along with its index if it has one.
+static struct fzp *rfile_open(struct rreader *reader, struct rfile *rfile,
+	const char *datpath)
 {
-	rblk_mem_max=rblk_memory_max;
+	char *fulldatpath=NULL;
+
+	if(reader->rfile==rfile)
+		return reader->fzp;
+	if(rfile_close(reader))
+		return NULL;
+	if(!(fulldatpath=prepend_s(datpath,
+		uint64_to_savepathstr(rfile->hash_key))))
+			return NULL;
+	if(!(reader->fzp=fzp_open(fulldatpath, "rb")))
+		goto end;
+	reader->rfile=rfile;
+	if(dfidx_load(&reader->dfidx, fulldatpath,
+		fzp_fileno(reader->fzp))<0)
+	{
+		rfile_reset(reader, rfile);
+		goto end;
+	}
+	// Without an index, carry on from where it was read up to before.
+	if(!reader->dfidx.offsets
+	  && fzp_seek(reader->fzp, rfile->offset, SEEK_SET))
+		rfile_reset(reader, rfile);
+end:
+	free_w(&fulldatpath);
+	return reader->fzp;
 }
 
-void rblks_free(void)
+static uint16_t savepath_datno(uint64_t savepath)
 {
-	struct rblk *tmp;
-	struct rblk *rblk;
+	return (uint16_t)(savepath&0xFFFF);
+}
 
-	HASH_ITER(hh, rblk_hash, rblk, tmp)
+// rbuf is a view into the data file. Blocks that were stored compressed get
+// decompressed straight from there. The others get copied, unless the data
+// file is mapped, in which case they get used from the mapping.
+static int rbuf_to_rchunk(struct rreader *reader, struct iobuf *rbuf,
+	struct rchunk *rchunk, struct rfile *map)
+{
+	reader->blocks++;
+	reader->bytes+=rbuf->len;
+	switch(rbuf->cmd)
 	{
-		HASH_DEL(rblk_hash, rblk);
-		rblk_free(&rblk);
+		case CMD_DATA:
+			if(map)
+			{
+				rchunk->data=*rbuf;
+				rchunk->map=map;
+				map->refs++;
+				return 0;
+			}
+			if(iobuf_keep(rbuf))
+				return -1;
+			iobuf_move(&rchunk->data, rbuf);
+			break;
+		case CMD_DATA_COMP:
+			if(blk_data_decompress(rbuf, &rchunk->data))
+				return -1;
+			break;
+		default:
+			logp("unknown cmd in %s: %c\n", __func__, rbuf->cmd);
+			return -1;
 	}
-	rblk_hash=NULL;
+	reader->mem+=rchunk->data.len;
+	return 0;
 }
 
-static int rblks_free_one_except(struct rblk *keep)
+// Read the open data file from the start of the wanted blocks to the end of
+// them, keeping the ones that are wanted. 'savepaths' are sorted, and are
+// all in the same data file.
+static int load_sequential(struct rreader *reader, struct rfile *rfile,
+	uint64_t *savepaths, size_t count)
 {
-	uint64_t before=rblk_mem;
-	struct rblk *tmp;
-	struct rblk *rblk;
+	uint16_t target=savepath_datno(savepaths[count-1]);
+	struct iobuf rbuf;
+	struct rchunk *rchunk;
+
+	// Already read past it, so start again.
+	if(savepath_datno(savepaths[0])<rfile->rlen)
+	{
+		if(fzp_seek(reader->fzp, 0, SEEK_SET))
+			goto error;
+		rfile->rlen=0;
+		rfile->offset=0;
+	}
 
-	HASH_ITER(hh, rblk_hash, rblk, tmp)
+	iobuf_init(&rbuf);
+	for(; rfile->rlen<DATA_FILE_SIG_MAX && rfile->rlen<=target;
+		rfile->rlen++)
 	{
-		if(rblk==keep)
+		switch(iobuf_view_from_fzp_data(&rbuf, reader->fzp))
+		{
+			case 0:
+				break;
+			case 1:
+				// Hit the end of the file. Anything after
+				// this will be reported missing.
+				return 0;
+			default:
+				goto error;
+		}
+		if(!(rchunk=rchunk_find(rfile->hash_key|rfile->rlen))
+		  || rchunk->data.buf)
 			continue;
-		HASH_DEL(rblk_hash, rblk);
-		rblk_free(&rblk);
-		break;
+		if(rbuf_to_rchunk(reader, &rbuf, rchunk, NULL))
+			goto error;
 	}
-	if(before!=rblk_mem)
-		return 0;
+	return 0;
+error:
+	rfile_reset(reader, rfile);
 	return -1;
 }
 
-static int rblk_init(struct rblk *rblk, struct blk *blk,
-	uint64_t hash_key, const char *datpath, const char *savepathstr)
+// Read blocks 'a' to 'b' of the open data file with one pread(), keeping
+// the ones that are wanted.
+static int load_span(struct rreader *reader, uint16_t a, uint16_t b)
 {
+	uint16_t d;
+	char *tmp;
+	struct iobuf rbuf;
+	struct rchunk *rchunk;
+	uint64_t hash_key=reader->rfile->hash_key;
+	uint32_t *offsets=reader->dfidx.offsets;
+	size_t len=offsets[b+1]-offsets[a];
+
+	if(len>reader->pread_size)
+	{
+		if(!(tmp=(char *)realloc_w(reader->pread_buf,
+			len, __func__)))
+				return -1;
+		reader->pread_buf=tmp;
+		reader->pread_size=len;
+	}
+	if(pread(fzp_fileno(reader->fzp), reader->pread_buf,
+		len, offsets[a])!=(ssize_t)len)
+	{
+		logp("Short read from %s in %s\n",
+			uint64_to_savepathstr(hash_key), __func__);
+		return -1;
+	}
+	iobuf_init(&rbuf);
+	for(d=a; d<=b; d++)
+	{
+		if(!(rchunk=rchunk_find(hash_key|d))
+		  || rchunk->data.buf)
+			continue;
+		if(iobuf_view_from_buf_data(&rbuf,
+			reader->pread_buf+offsets[d]-offsets[a],
+			offsets[d+1]-offsets[d])
+		  || rbuf_to_rchunk(reader, &rbuf, rchunk, NULL))
+			return -1;
+	}
+	return 0;
+}
+
+// Read just the wanted blocks of the open data file, using its index.
+// Neighbouring ones are read together.
+static int load_indexed(struct rreader *reader, struct rfile *rfile,
+	uint64_t *savepaths, size_t count)
+{
+	size_t i;
+	size_t j;
+	uint16_t a;
+	uint16_t b;
+	uint16_t d;
+	uint32_t *offsets=reader->dfidx.offsets;
+
+	for(i=0; i<count; i=j)
+	{
+		a=savepath_datno(savepaths[i]);
+		// They are sorted, so none of the rest are in the file either.
+		if(a>=reader->dfidx.count)
+			break;
+		for(b=a, j=i+1; j<count; b=d, j++)
+		{
+			d=savepath_datno(savepaths[j]);
+			if(d>b+1
+			  || d>=reader->dfidx.count
+			  || offsets[d+1]-offsets[a]>RBLK_PREAD_MAX)
+				break;
+		}
+		if(load_span(reader, a, b))
+		{
+			rfile_reset(reader, rfile);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void mapped_remove(struct rfile *rfile)
+{
+	if(rfile->prev)
+		rfile->prev->next=rfile->next;
+	else
+		mapped_head=rfile->next;
+	if(rfile->next)
+		rfile->next->prev=rfile->prev;
+	else
+		mapped_tail=rfile->prev;
+	rfile->prev=NULL;
+	rfile->next=NULL;
+}
+
+static void mapped_push(struct rfile *rfile)
+{
+	rfile->next=mapped_head;
+	if(mapped_head)
+		mapped_head->prev=rfile;
+	mapped_head=rfile;
+	if(!mapped_tail)
+		mapped_tail=rfile;
+}
+
+static void rfile_unmap(struct rfile *rfile)
+{
+	mapped_remove(rfile);
+	munmap(rfile->map, rfile->map_len);
+	rblk_mem-=rfile->map_len;
+	rfile->map=NULL;
+	rfile->map_len=0;
+	dfidx_free_content(&rfile->dfidx);
+}
+
+// Unmap the data files that were used longest ago and that no blocks point
+// into any more, until the mappings fit into rblk_memory_max again.
+static void rfile_unmap_old(void)
+{
+	struct rfile *rfile;
+	struct rfile *prev;
+	for(rfile=mapped_tail; rfile && rblk_mem>rblk_mem_max; rfile=prev)
+	{
+		prev=rfile->prev;
+		if(!rfile->refs)
+			rfile_unmap(rfile);
+	}
+}
+
+static int rfile_map(struct rfile *rfile, const char *datpath)
+{
+	int fd=-1;
 	int ret=-1;
+	void *addr;
+	struct stat statp;
 	char *fulldatpath=NULL;
 
-	rblk->hash_key=hash_key;
-	if(!(fulldatpath=prepend_s(datpath, savepathstr)))
+	if(rfile->map)
+	{
+		mapped_remove(rfile);
+		mapped_push(rfile);
+		return 0;
+	}
+	rfile_unmap_old();
+	if(!(fulldatpath=prepend_s(datpath,
+		uint64_to_savepathstr(rfile->hash_key))))
+			goto end;
+	if((fd=open(fulldatpath, O_RDONLY))<0
+	  || fstat(fd, &statp))
+	{
+		logp("could not open %s: %s\n", fulldatpath, strerror(errno));
 		goto end;
-	logp("open: %s\n", savepathstr);
-	if(!(rblk->fzp=fzp_open(fulldatpath, "rb")))
+	}
+	if(!statp.st_size)
+	{
+		logp("%s is empty\n", fulldatpath);
 		goto end;
+	}
+	if((addr=mmap(NULL, statp.st_size, PROT_READ, MAP_SHARED, fd, 0))
+		==MAP_FAILED)
+	{
+		logp("could not mmap %s: %s\n", fulldatpath, strerror(errno));
+		goto end;
+	}
+	rfile->map=(char *)addr;
+	rfile->map_len=statp.st_size;
+	rblk_mem+=rfile->map_len;
+	mapped_push(rfile);
+	switch(dfidx_load(&rfile->dfidx, fulldatpath, fd))
+	{
+		case 0:
+			break;
+		case 1:
+			// Working it out means going through all of it.
+			madvise(rfile->map, rfile->map_len, MADV_SEQUENTIAL);
+			if(dfidx_build(&rfile->dfidx,
+				rfile->map, rfile->map_len))
+			{
+				rfile_unmap(rfile);
+				goto end;
+			}
+			break;
+		default:
+			rfile_unmap(rfile);
+			goto end;
+	}
+	// From now on, only the blocks that the restore is about to want get
+	// read, and they get asked for with MADV_WILLNEED.
+	madvise(rfile->map, rfile->map_len, MADV_RANDOM);
 	ret=0;
 end:
+	if(fd>=0)
+		close(fd);
 	free_w(&fulldatpath);
 	return ret;
 }
 
-static int rblk_load_more_chunks(struct rblk *rblk, uint16_t datno_target)
+static void rfile_willneed(struct rfile *rfile, uint32_t start, uint32_t end)
 {
-	int ret=-1;
-	int done=0;
-	struct iobuf rbuf;
+	static size_t pagesize=0;
+	size_t aligned;
+	if(!pagesize)
+		pagesize=(size_t)sysconf(_SC_PAGESIZE);
+	aligned=start&~(pagesize-1);
+	madvise(rfile->map+aligned, end-aligned, MADV_WILLNEED);
+}
 
-	iobuf_init(&rbuf);
+// Point the wanted blocks at the mapping of the data file. The kernel is
+// told about all of them first, so that it can be reading them in while
+// the restore sends the ones before.
+static int load_mapped(struct rreader *reader, struct rfile *rfile,
+	uint64_t *savepaths, size_t count)
+{
+	size_t i;
+	size_t j;
+	uint16_t a;
+	uint16_t b;
+	uint16_t d;
+	struct iobuf rbuf;
+	struct rchunk *rchunk;
+	uint32_t *offsets=rfile->dfidx.offsets;
 
-	for(
-		;
-		rblk->rlen<DATA_FILE_SIG_MAX && rblk->rlen<=datno_target;
-		rblk->rlen++
-	) {
-		switch(iobuf_fill_from_fzp_data(&rbuf, rblk->fzp))
+	for(i=0; i<count; i=j)
+	{
+		a=savepath_datno(savepaths[i]);
+		if(a>=rfile->dfidx.count)
+			break;
+		for(b=a, j=i+1; j<count; b=d, j++)
 		{
-			case 0:
-				if(rbuf.cmd!=CMD_DATA)
-				{
-					logp("unknown cmd in %s: %c\n",
-						__func__, rbuf.cmd);
-					goto end;
-				}
-				iobuf_move(&rblk->readbuf[rblk->rlen], &rbuf);
-				rblk_mem+=rblk->readbuf[rblk->rlen].len;
-				continue;
-			case 1:
-				done++;
+			d=savepath_datno(savepaths[j]);
+			if(d>b+1 || d>=rfile->dfidx.count)
 				break;
-			default:
-				goto end;
 		}
-		if(done)
+		rfile_willneed(rfile, offsets[a], offsets[b+1]);
+	}
+
+	iobuf_init(&rbuf);
+	for(i=0; i<count; i++)
+	{
+		d=savepath_datno(savepaths[i]);
+		if(d>=rfile->dfidx.count)
 			break;
+		if(!(rchunk=rchunk_find(savepaths[i]))
+		  || rchunk->data.buf)
+			continue;
+		if(iobuf_view_from_buf_data(&rbuf, rfile->map+offsets[d],
+			offsets[d+1]-offsets[d])
+		  || rbuf_to_rchunk(reader, &rbuf, rchunk, rfile))
+			return -1;
 	}
-	ret=0;
-end:
+	return 0;
+}
+
+// The reader that always reads this data file.
+static struct rreader *reader_for(struct rfile *rfile)
+{
+	return &readers[(rfile->hash_key>>16)%readers_len];
+}
+
+// Load the wanted blocks from one data file. 'savepaths' are sorted, and
+// are all in the same data file.
+static int load_file(struct rreader *reader, struct rfile *rfile,
+	uint64_t *savepaths, size_t count, const char *datpath)
+{
+	reader->files++;
+	if(rblk_mmap)
+	{
+		if(rfile_map(rfile, datpath))
+			return -1;
+		return load_mapped(reader, rfile, savepaths, count);
+	}
+	if(!rfile_open(reader, rfile, datpath))
+		return -1;
+	if(reader->dfidx.offsets)
+		return load_indexed(reader, rfile, savepaths, count);
+	return load_sequential(reader, rfile, savepaths, count);
+}
+
+static int load_now(uint64_t *savepaths, size_t count, const char *datpath)
+{
+	int ret;
+	struct rfile *rfile;
+	struct rreader *reader;
+
+	if(!(rfile=rfile_get(uint64_to_savepath_hash_key(savepaths[0]))))
+		return -1;
+	reader=reader_for(rfile);
+	ret=load_file(reader, rfile, savepaths, count, datpath);
+	rblk_mem+=reader->mem;
+	reader->mem=0;
 	return ret;
 }
 
-int rblk_retrieve_data(struct asfd *asfd, struct cntr *cntr,
-	struct blk *blk, const char *datpath)
+// Blocks that could not be loaded here get another go when the restore
+// gets to them, which is when it gets reported.
+static void *reader_run(void *arg)
 {
-	uint16_t datno=0;
-	uint64_t hash_key;
-	char *savepathstr;
-	struct rblk *rblk=NULL;
+	struct rreader *reader=(struct rreader *)arg;
+	load_file(reader, reader->job_rfile,
+		reader->job_savepaths, reader->job_count, reader->job_datpath);
+	return NULL;
+}
 
-	hash_key=uint64_to_savepath_hash_key(blk->savepath);
-	savepathstr=uint64_to_savepathstr_with_sig_uint(blk->savepath, &datno);
+// Run the readers that have a data file to load, at the same time.
+static void readers_run(void)
+{
+	int i;
+#ifdef HAVE_PTHREAD
+	int *started=NULL;
 
-	if(!(rblk=rblk_hash_find(hash_key)))
+	if(readers_len>1
+	  && !(started=(int *)calloc_w(readers_len, sizeof(int), __func__)))
+		return;
+	for(i=1; i<readers_len; i++)
 	{
-		if(!(rblk=rblk_alloc())
-		  || rblk_init(rblk, blk, hash_key, datpath, savepathstr))
+		if(!readers[i].job_count)
+			continue;
+		if(pthread_create(&readers[i].tid, NULL,
+			reader_run, &readers[i]))
 		{
-			rblk_free(&rblk);
-			return -1;
+			logp("Could not create rblk thread: %s\n",
+				strerror(errno));
+			reader_run(&readers[i]);
+			continue;
 		}
-		rblk_hash_add(rblk);
+		started[i]=1;
+	}
+	if(readers[0].job_count)
+		reader_run(&readers[0]);
+	for(i=1; i<readers_len; i++)
+		if(started[i])
+			pthread_join(readers[i].tid, NULL);
+	free_v((void **)&started);
+#else
+	for(i=0; i<readers_len; i++)
+		if(readers[i].job_count)
+			reader_run(&readers[i]);
+#endif
+	for(i=0; i<readers_len; i++)
+	{
+		rblk_mem+=readers[i].mem;
+		readers[i].mem=0;
+		readers[i].job_count=0;
 	}
+}
+
+static int uint64_cmp(const void *a, const void *b)
+{
+	uint64_t x=*(const uint64_t *)a;
+	uint64_t y=*(const uint64_t *)b;
+	if(x<y) return -1;
+	if(x>y) return 1;
+	return 0;
+}
+
+// Give each reader the first data file in todo that is for it, starting at
+// 'first', and run them. Returns how many were given out.
+static int load_round(uint64_t *todo, size_t count, uint8_t *done,
+	size_t first, const char *datpath)
+{
+	int given=0;
+	size_t i;
+	size_t j;
+	uint64_t key;
+	struct rfile *rfile;
+	struct rreader *reader;
 
-	if(datno>=rblk->rlen)
+	for(i=first; i<count && given<readers_len; i=j)
 	{
-		// Need to load more from this data file.
-		if(rblk_load_more_chunks(rblk, datno))
+		key=uint64_to_savepath_hash_key(todo[i]);
+		for(j=i; j<count && uint64_to_savepath_hash_key(todo[j])==key;
+			j++) { }
+		if(done[i])
+			continue;
+		if(!(rfile=rfile_get(key)))
 			return -1;
+		reader=reader_for(rfile);
+		if(reader->job_count)
+			continue;
+		reader->job_rfile=rfile;
+		reader->job_savepaths=todo+i;
+		reader->job_count=j-i;
+		reader->job_datpath=datpath;
+		memset(done+i, 1, j-i);
+		given++;
 	}
+	if(given)
+		readers_run();
+	return given;
+}
 
-	while(rblk_mem>rblk_mem_max)
+// Read everything in the look ahead window that has not been read yet,
+// grouped by data file and in data file order. The one that is needed now
+// is read first, and the rest are read for as long as there is memory for
+// them, a data file for each reader at a time.
+static int load_window(struct rchunk *need, const char *datpath)
+{
+	int ret=-1;
+	size_t i;
+	size_t j;
+	size_t count=0;
+	size_t first=0;
+	uint64_t key;
+	uint64_t *todo=NULL;
+	uint8_t *done=NULL;
+	struct rchunk *rchunk;
+
+	if(!(todo=(uint64_t *)malloc_w((plan_len+1)*sizeof(uint64_t),
+		__func__))
+	  || !(done=(uint8_t *)calloc_w(plan_len+1, sizeof(uint8_t),
+		__func__)))
+			goto end;
+	todo[count++]=need->savepath;
+	for(i=0; i<plan_len; i++)
 	{
-		if(rblks_free_one_except(rblk))
+		key=plan_win[(plan_head+i)%plan_size];
+		if((rchunk=rchunk_find(key)) && !rchunk->data.buf)
+			todo[count++]=key;
+	}
+	qsort(todo, count, sizeof(uint64_t), uint64_cmp);
+
+	key=uint64_to_savepath_hash_key(need->savepath);
+	for(i=0; i<count && uint64_to_savepath_hash_key(todo[i])!=key; i++)
+		{ }
+	for(j=i; j<count && uint64_to_savepath_hash_key(todo[j])==key; j++)
+		{ }
+	memset(done+i, 1, j-i);
+	if(load_now(todo+i, j-i, datpath))
+		goto end;
+	if(rblk_mem>rblk_mem_max && !rblk_mem_warned)
+	{
+		logp("rblk_memory_max is too low for the look ahead\n");
+		rblk_mem_warned=1;
+	}
+
+	while(rblk_mem<rblk_mem_max)
+	{
+		for(; first<count && done[first]; first++) { }
+		switch(load_round(todo, count, done, first, datpath))
 		{
-			logw(asfd, cntr, "rblk_memory_max is too low!\n");
-			break;
+			case -1:
+				goto end;
+			case 0:
+				ret=0;
+				goto end;
+			default:
+				break;
+		}
+	}
+	ret=0;
+end:
+	free_v((void **)&todo);
+	free_v((void **)&done);
+	return ret;
+}
+
+// Read the manifest on ahead until the window is full.
+static int plan_fill(void)
+{
+	struct rchunk *rchunk;
+	while(plan_manio && plan_len<plan_size)
+	{
+		plan_blk->got_save_path=0;
+		switch(manio_read_with_blk(plan_manio, plan_sb, plan_blk))
+		{
+			case 0:
+				break;
+			case 1:
+				manio_close(&plan_manio);
+				return 0;
+			default:
+				return -1;
 		}
+		sbuf_free_content(plan_sb);
+		if(!plan_blk->got_save_path)
+			continue;
+		if(!(rchunk=rchunk_get(plan_blk->savepath)))
+			return -1;
+		rchunk->want++;
+		plan_win[(plan_head+plan_len++)%plan_size]=plan_blk->savepath;
+	}
+	return 0;
+}
+
+static void plan_pop(void)
+{
+	struct rchunk *rchunk;
+	if((rchunk=rchunk_find(plan_win[plan_head])))
+	{
+		rchunk->want--;
+		rchunk_free_if_unwanted(rchunk);
+	}
+	plan_head=(plan_head+1)%plan_size;
+	plan_len--;
+}
+
+// Move the window on to the block that the restore is asking for. Anything
+// before it was skipped by the restore, and is not wanted any more.
+static struct rchunk *plan_next(uint64_t savepath)
+{
+	size_t i;
+	struct rchunk *rchunk=NULL;
+
+	for(i=0; i<plan_len; i++)
+		if(plan_win[(plan_head+i)%plan_size]==savepath)
+			break;
+	while(i--)
+		plan_pop();
+	while(1)
+	{
+		if(!plan_len && plan_fill())
+			return NULL;
+		if(!plan_len)
+			return NULL;
+		if(plan_win[plan_head]==savepath)
+			break;
+		plan_pop();
+	}
+	// Take it out of the window, but keep hold of it until the next call.
+	rchunk=rchunk_find(savepath);
+	plan_win[plan_head]=0;
+	plan_head=(plan_head+1)%plan_size;
+	plan_len--;
+	if(rchunk)
+		rchunk->want--;
+	return rchunk;
+}
+
+static void plan_free(void)
+{
+	manio_close(&plan_manio);
+	sbuf_free(&plan_sb);
+	blk_free(&plan_blk);
+	free_v((void **)&plan_win);
+	plan_size=0;
+	plan_head=0;
+	plan_len=0;
+}
+
+int rblks_init(ssize_t rblk_memory_max, int use_mmap, int threads)
+{
+	rblk_mem_max=rblk_memory_max;
+	rblk_mem_warned=0;
+	rblk_mmap=use_mmap;
+	// Mapping data files is only done from the one thread.
+	if(threads<1 || rblk_mmap)
+		threads=1;
+	free_v((void **)&readers);
+	if(!(readers=(struct rreader *)
+		calloc_w(threads, sizeof(struct rreader), __func__)))
+	{
+		readers_len=0;
+		return -1;
+	}
+	readers_len=threads;
+	return 0;
+}
+
+int rblks_plan(const char *manifest, int lookahead)
+{
+	plan_free();
+	if(lookahead<=0)
+		return 0;
+	if(!(plan_win=(uint64_t *)calloc_w(lookahead, sizeof(uint64_t),
+		__func__))
+	  || !(plan_manio=manio_open(manifest, "rb", PROTO_2))
+	  || !(plan_sb=sbuf_alloc(PROTO_2))
+	  || !(plan_blk=blk_alloc()))
+	{
+		plan_free();
+		return -1;
 	}
+	plan_size=(size_t)lookahead;
+	return 0;
+}
 
-// printf("lookup: %s (%u)\n", savepathstr, datno);
-	if(datno>=rblk->rlen)
+void rblks_free(void)
+{
+	int i;
+	struct rchunk *rchunk;
+	struct rchunk *rtmp;
+	struct rfile *rfile;
+	struct rfile *ftmp;
+
+	plan_free();
+	last=NULL;
+	for(i=0; i<readers_len; i++)
 	{
-		logp("datno %d is greater than rlen: %d\n",
-			datno, rblk->rlen);
+		if(readers[i].files)
+			logp("rblk reader %d: %" PRIu64 " data files, %" PRIu64 " blocks, %" PRIu64 " bytes\n",
+				i, readers[i].files, readers[i].blocks,
+				readers[i].bytes);
+		rfile_close(&readers[i]);
+		free_w(&readers[i].pread_buf);
+	}
+	free_v((void **)&readers);
+	readers_len=0;
+	HASH_ITER(hh, rchunk_hash, rchunk, rtmp)
+		rchunk_free(&rchunk);
+	HASH_ITER(hh, rfile_hash, rfile, ftmp)
+	{
+		if(rfile->map)
+			rfile_unmap(rfile);
+		HASH_DEL(rfile_hash, rfile);
+		free_v((void **)&rfile);
+	}
+	rchunk_hash=NULL;
+	rfile_hash=NULL;
+}
+
+static int rchunk_to_blk(struct rchunk *rchunk, struct blk *blk)
+{
+	uint16_t datno=0;
+	char *savepathstr;
+	if(!rchunk->data.buf)
+	{
+		savepathstr=uint64_to_savepathstr_with_sig_uint(
+			rchunk->savepath, &datno);
+		logp("could not read %s:%d\n", savepathstr, datno);
+		rchunk_free_if_unwanted(rchunk);
 		return -1;
 	}
-	blk->data=rblk->readbuf[datno].buf;
-	blk->length=rblk->readbuf[datno].len;
-// printf("length: %d\n", blk->length);
+	last=rchunk;
+	blk->data=rchunk->data.buf;
+	blk->length=rchunk->data.len;
+	return 0;
+}
 
-        return 0;
+// Get a block from anywhere, without looking ahead.
+int rblk_retrieve_data(struct asfd *asfd, struct cntr *cntr,
+	struct blk *blk, const char *datpath)
+{
+	struct rchunk *rchunk;
+
+	last_release();
+	if(!(rchunk=rchunk_get(blk->savepath)))
+		return -1;
+	if(!rchunk->data.buf
+	  && load_now(&rchunk->savepath, 1, datpath))
+	{
+		rchunk_free_if_unwanted(rchunk);
+		return -1;
+	}
+	return rchunk_to_blk(rchunk, blk);
+}
+
+// Get the next block that the restore wants, in manifest order.
+int rblk_retrieve_next(struct asfd *asfd, struct cntr *cntr,
+	struct blk *blk, const char *datpath)
+{
+	struct rchunk *rchunk;
+
+	if(!plan_size)
+		return rblk_retrieve_data(asfd, cntr, blk, datpath);
+
+	last_release();
+	if(!(rchunk=plan_next(blk->savepath)))
+	{
+		// Not in the rest of the manifest. Should not happen, but
+		// carry on without looking ahead.
+		logw(asfd, cntr, "lost track of the manifest while restoring\n");
+		plan_free();
+		return rblk_retrieve_data(asfd, cntr, blk, datpath);
+	}
+	if(plan_fill()
+	  || (!rchunk->data.buf && load_window(rchunk, datpath)))
+	{
+		rchunk_free_if_unwanted(rchunk);
+		return -1;
+	}
+	return rchunk_to_blk(rchunk, blk);
 }
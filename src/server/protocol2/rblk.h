@@ -3,9 +3,12 @@
 
 #include <uthash.h>
 
-extern void rblks_init(ssize_t rblk_memory_max);
+extern int rblks_init(ssize_t rblk_memory_max, int use_mmap, int threads);
+extern int rblks_plan(const char *manifest, int lookahead);
 extern void rblks_free(void);
 extern int rblk_retrieve_data(struct asfd *asfd, struct cntr *cntr,
 	struct blk *blk, const char *datpath);
+extern int rblk_retrieve_next(struct asfd *asfd, struct cntr *cntr,
+	struct blk *blk, const char *datpath);
 
 #endif
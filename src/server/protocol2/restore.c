@@ -31,8 +31,9 @@ static int send_data(struct asfd *asfd, struct blk *blk,
 		case ACTION_VERIFY:
 			// Need to check that the block has the correct
 			// checksums.
-			switch(blk_verify(blk->fingerprint, blk->md5sum,
-				blk->data, blk->length))
+			switch(blk_verify(blk->fingerprint,
+				(enum strong_hash)blk->strong_hash,
+				blk->md5sum, blk->data, blk->length))
 			{
 				case 1:
 					iobuf_set(&wbuf, CMD_DATA, (char *)"0", 1);
@@ -637,7 +637,7 @@ static int restore_stream(struct asfd *asfd, struct sdirs *sdirs,
 			if(blk->got_save_path)
 			{
 				blk->got_save_path=0;
-				if(rblk_retrieve_data(asfd, cntr,
+				if(rblk_retrieve_next(asfd, cntr,
 					blk, sdirs->data))
 				{
 					log_missing_block(asfd, cntr,
@@ -707,7 +707,13 @@ static int actual_restore(struct asfd *asfd, struct bu *bu,
 		goto end;
 
 	if(get_protocol(cconfs)==PROTO_2)
-		rblks_init(get_uint64_t(cconfs[OPT_RBLK_MEMORY_MAX]));
+	{
+		if(rblks_init(get_uint64_t(cconfs[OPT_RBLK_MEMORY_MAX]),
+			get_int(cconfs[OPT_RBLK_MMAP]),
+			get_int(cconfs[OPT_RBLK_THREADS]))
+		  || rblks_plan(manifest, get_int(cconfs[OPT_RBLK_LOOKAHEAD])))
+			goto end;
+	}
 
 	if(restore_stream(asfd, sdirs, slist,
 		bu, manifest, regex,
@@ -783,7 +789,8 @@ static int restore_manifest(struct asfd *asfd, struct bu *bu,
 
 	protocol=get_protocol(cconfs);
 	if(protocol==PROTO_2
-	  && blks_generate_init())
+	  && blks_generate_init(
+		(enum chunking)get_int(cconfs[OPT_CHUNKING])))
 		goto end;
 
 	if(!(lockfile=prepend_s(bu->path, "lockfile.read"))
@@ -167,6 +167,40 @@ static int do_protocol1_dirs(struct sdirs *sdirs, const char *cname,
 	return 0;
 }
 
+char *sdirs_champ_shard_path(const char *data, const char *fname, int shard)
+{
+	char *path;
+	char suffix[16]="";
+	if(!(path=prepend_s(data, fname)))
+		return NULL;
+	if(!shard)
+		return path;
+	snprintf(suffix, sizeof(suffix), ".%d", shard);
+	if(astrcat(&path, suffix, __func__))
+		free_w(&path);
+	return path;
+}
+
+// Each champ chooser shard has its own lock, socket, log and stats files.
+// Shard 0 uses the names that an unsharded champ chooser has always used.
+int sdirs_set_champ_shard(struct sdirs *sdirs, int shard)
+{
+	free_w(&sdirs->champlock);
+	free_w(&sdirs->champsock);
+	free_w(&sdirs->champlog);
+	free_w(&sdirs->champstats);
+	if(!(sdirs->champlock=sdirs_champ_shard_path(sdirs->data,
+		"cc.lock", shard))
+	  || !(sdirs->champsock=sdirs_champ_shard_path(sdirs->data,
+		"cc.sock", shard))
+	  || !(sdirs->champlog=sdirs_champ_shard_path(sdirs->data,
+		"cc.log", shard))
+	  || !(sdirs->champstats=sdirs_champ_shard_path(sdirs->data,
+		"cc.stats", shard)))
+		return -1;
+	return 0;
+}
+
 static int do_protocol2_dirs(struct sdirs *sdirs,
 	const char *cname, const char *dedup_group, const char *manual_delete)
 {
@@ -184,9 +218,7 @@ static int do_protocol2_dirs(struct sdirs *sdirs,
 	  || !(sdirs->data=prepend_s(sdirs->dedup, DATA_DIR))
 	  || !(sdirs->cfiles=prepend_s(sdirs->data, "cfiles"))
 	  || !(sdirs->global_sparse=prepend_s(sdirs->data, "sparse"))
-	  || !(sdirs->champlock=prepend_s(sdirs->data, "cc.lock"))
-	  || !(sdirs->champsock=prepend_s(sdirs->data, "cc.sock"))
-	  || !(sdirs->champlog=prepend_s(sdirs->data, "cc.log"))
+	  || sdirs_set_champ_shard(sdirs, 0)
 	  || !(sdirs->champ_dindex_lock=prepend_s(sdirs->data, "dindex.lock"))
 	  || !(sdirs->manifest=prepend_s(sdirs->working, "manifest"))
 	  || !(sdirs->cmanifest=prepend_s(sdirs->current, "manifest")))
@@ -263,6 +295,7 @@ void sdirs_free_content(struct sdirs *sdirs)
 	free_w(&sdirs->champlock);
 	free_w(&sdirs->champsock);
 	free_w(&sdirs->champlog);
+	free_w(&sdirs->champstats);
 	free_w(&sdirs->champ_dindex_lock);
 	free_w(&sdirs->data);
 	free_w(&sdirs->clients);
@@ -16,6 +16,7 @@ struct sdirs
 	char *champlock;
 	char *champsock;
 	char *champlog;
+	char *champstats;
 	char *champ_dindex_lock;
 	char *data;
 	char *clients;
@@ -71,6 +72,9 @@ extern int sdirs_init_from_confs_plus_cname(
 extern int sdirs_init(struct sdirs *sdirs, enum protocol protocol,
 	const char *directory, const char *cname, const char *conf_lockdir,
 	const char *dedup_group, const char *manual_delete);
+extern int sdirs_set_champ_shard(struct sdirs *sdirs, int shard);
+extern char *sdirs_champ_shard_path(const char *data, const char *fname,
+	int shard);
 extern void sdirs_free_content(struct sdirs *sdirs);
 extern void sdirs_free(struct sdirs **sdirs);
 
@@ -3,7 +3,7 @@
 
 static const char *format_datestr(const struct tm *ctm)
 {
-	static char buf[32]="";
+	static THREAD_LOCAL char buf[32]="";
 	strftime(buf, sizeof(buf), DEFAULT_TIMESTAMP_FORMAT, ctm);
 	return buf;
 }
@@ -27,7 +27,7 @@ const char *gettimenow(void)
 
 const char *time_taken(time_t d)
 {
-	static char str[32]="";
+	static THREAD_LOCAL char str[32]="";
 	int seconds=0;
 	int minutes=0;
 	int hours=0;
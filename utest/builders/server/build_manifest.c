@@ -169,14 +169,14 @@ static struct slist *build_manifest_phase2(const char *path,
 	return slist;
 }
 
-static struct slist *build_manifest_phase3(const char *path,
-	enum protocol protocol, int entries)
+static struct slist *do_build_manifest_phase3(const char *path,
+	enum protocol protocol, int entries, int binary)
 {
 	struct slist *slist=NULL;
 	struct manio *manio=NULL;
 
 	fail_unless((manio=manio_open_phase3(path, "wb", protocol,
-		RMANIFEST_RELATIVE))!=NULL);
+		RMANIFEST_RELATIVE, binary))!=NULL);
 	slist=do_build_manifest(manio,
 		protocol, entries, 0 /*with_data_files*/);
 	fail_unless(!manio_close(&manio));
@@ -184,6 +184,12 @@ static struct slist *build_manifest_phase3(const char *path,
 	return slist;
 }
 
+static struct slist *build_manifest_phase3(const char *path,
+	enum protocol protocol, int entries)
+{
+	return do_build_manifest_phase3(path, protocol, entries, 0);
+}
+
 static struct slist *build_manifest_final(const char *path,
 	enum protocol protocol, int entries)
 {
@@ -207,6 +213,12 @@ struct slist *build_manifest(const char *path,
 	}
 }
 
+struct slist *build_manifest_binary(const char *path,
+	enum protocol protocol, int entries)
+{
+	return do_build_manifest_phase3(path, protocol, entries, 1);
+}
+
 struct slist *build_manifest_with_data_files(const char *path,
 	const char *datapath, int entries, int data_files)
 {
@@ -218,7 +230,7 @@ struct slist *build_manifest_with_data_files(const char *path,
 	char cpath[256]="";
 
 	fail_unless((manio=manio_open_phase3(path, "wb", PROTO_2,
-		RMANIFEST_RELATIVE))!=NULL);
+		RMANIFEST_RELATIVE, 0))!=NULL);
 	slist=do_build_manifest(manio, PROTO_2, entries, data_files);
 	fail_unless(!manio_close(&manio));
 
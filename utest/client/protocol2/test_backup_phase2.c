@@ -44,12 +44,15 @@ static struct async *setup_async(void)
         return as;
 }
 
+static int hash_threads=0;
+
 static struct conf **setup_conf(void)
 {
 	struct conf **confs=NULL;
 	fail_unless((confs=confs_alloc())!=NULL);
 	fail_unless(!confs_init(confs));
 	set_int(confs[OPT_COMPRESSION], 0);
+	set_int(confs[OPT_HASH_THREADS], hash_threads);
 	return confs;
 }
 
@@ -236,6 +239,7 @@ static void build_file_and_assert_writes(struct sbuf *s,
 	attribs_encode(s);
 	s->attr.cmd=CMD_ATTRIBS_SIGS;
 	asfd_assert_write_iobuf(asfd, w, 0, &s->attr);
+	memset(&blk, 0, sizeof(blk));
 	blk.fingerprint=0x0000000000000031;
 	md5str_to_bytes("c4ca4238a0b923820dcc509a6f75849b", blk.md5sum);
 	blk_to_iobuf_sig(&blk, &iobuf);
@@ -350,6 +354,14 @@ START_TEST(test_phase2_happy_path)
 }
 END_TEST
 
+START_TEST(test_phase2_happy_path_hash_threads)
+{
+	hash_threads=4;
+	run_test(0, 10, setup_asfds_happy_path);
+	hash_threads=0;
+}
+END_TEST
+
 START_TEST(test_phase2_happy_path_missing_file_1)
 {
 	run_test(0, 10, setup_asfds_happy_path_missing_file_1);
@@ -378,6 +390,7 @@ Suite *suite_client_protocol2_backup_phase2(void)
 	tcase_add_test(tc_core, test_phase2_server_bad_initial_response);
 	tcase_add_test(tc_core, test_phase2_ok_file_request_missing_file);
 	tcase_add_test(tc_core, test_phase2_happy_path);
+	tcase_add_test(tc_core, test_phase2_happy_path_hash_threads);
 	tcase_add_test(tc_core, test_phase2_happy_path_missing_file_1);
 	tcase_add_test(tc_core, test_phase2_happy_path_missing_file_2);
 
@@ -0,0 +1,203 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/client/protocol2/blk_window.h"
+
+#define MAX	(16*BLK_WINDOW_MIN)
+
+// Get past the block count floor with empty blocks, so that only the
+// bytes matter.
+static void hold_blks(struct blk_window *w)
+{
+	int i;
+	for(i=0; i<BLK_WINDOW_MIN_BLKS; i++)
+		blk_window_add(w, 0);
+}
+
+START_TEST(test_blk_window_full)
+{
+	struct blk_window w;
+	blk_window_init(&w, MAX, NULL);
+	fail_unless(w.size==BLK_WINDOW_MIN);
+	// Always room for one block, however big.
+	fail_unless(!blk_window_full(&w));
+	blk_window_add(&w, BLK_WINDOW_MIN*2);
+	// Too few blocks for the server to answer yet.
+	fail_unless(!blk_window_full(&w));
+	fail_unless(!w.limited);
+	hold_blks(&w);
+	fail_unless(blk_window_full(&w));
+	fail_unless(w.limited==1);
+	blk_window_del(&w, BLK_WINDOW_MIN*2);
+	fail_unless(!blk_window_full(&w));
+	blk_window_del(&w, 1);
+	fail_unless(w.bytes==0);
+	fail_unless(w.blks==BLK_WINDOW_MIN_BLKS-1);
+}
+END_TEST
+
+START_TEST(test_blk_window_slow_start)
+{
+	struct blk_window w;
+	blk_window_init(&w, MAX, NULL);
+	hold_blks(&w);
+	blk_window_add(&w, BLK_WINDOW_MIN);
+	fail_unless(blk_window_full(&w));
+	blk_window_adjust(&w, 1000);
+	fail_unless(w.size==BLK_WINDOW_MIN*2);
+	fail_unless(!w.limited);
+
+	// Not full this time, but more than a quarter used, so no change.
+	blk_window_adjust(&w, 1000);
+	fail_unless(w.size==BLK_WINDOW_MIN*2);
+
+	blk_window_add(&w, BLK_WINDOW_MIN);
+	fail_unless(blk_window_full(&w));
+	blk_window_adjust(&w, 1000);
+	fail_unless(w.size==BLK_WINDOW_MIN*4);
+
+	// Slower responses end the slow start.
+	blk_window_add(&w, BLK_WINDOW_MIN*2);
+	fail_unless(blk_window_full(&w));
+	blk_window_adjust(&w, 3000);
+	fail_unless(!w.slow_start);
+	fail_unless(w.size==BLK_WINDOW_MIN*4+BLK_WINDOW_MIN/2);
+	fail_unless(w.min_rtt==1000);
+}
+END_TEST
+
+START_TEST(test_blk_window_limits)
+{
+	int i;
+	struct blk_window w;
+	blk_window_init(&w, MAX, NULL);
+	hold_blks(&w);
+	blk_window_add(&w, MAX*2);
+	for(i=0; i<10; i++)
+	{
+		fail_unless(blk_window_full(&w));
+		blk_window_adjust(&w, 1000);
+	}
+	fail_unless(w.size==MAX);
+
+	// Hardly used, so it shrinks, but not below the minimum.
+	blk_window_del(&w, MAX*2);
+	blk_window_adjust(&w, 1000); // The peak was in this sample.
+	fail_unless(w.size==MAX);
+	blk_window_adjust(&w, 1000);
+	fail_unless(w.size==MAX/2);
+	for(i=0; i<10; i++)
+		blk_window_adjust(&w, 1000);
+	fail_unless(w.size==BLK_WINDOW_MIN);
+
+	// A budget smaller than the minimum.
+	blk_window_init(&w, 1000, NULL);
+	fail_unless(w.size==1000);
+	hold_blks(&w);
+	blk_window_add(&w, 1000);
+	fail_unless(blk_window_full(&w));
+	blk_window_adjust(&w, 1000);
+	fail_unless(w.size==1000);
+}
+END_TEST
+
+// With chunks as big as the 32000 byte profiles make, twice a manifest's
+// worth of blocks would be more than the default budget.
+START_TEST(test_blk_window_big_blocks)
+{
+	uint64_t max=128*1024*1024;
+	uint64_t blk_size=32000;
+	struct blk_window w;
+	blk_window_init(&w, max, NULL);
+	w.size=max;
+	while(!blk_window_full(&w))
+		blk_window_add(&w, blk_size);
+	fail_unless(w.bytes>=max);
+	fail_unless(w.bytes<max+blk_size);
+	fail_unless(w.blks>MANIFEST_SIG_MAX);
+	fail_unless(w.blks<BLK_WINDOW_MIN_BLKS);
+
+	// The block count floor wins over a small window, but not over the
+	// budget.
+	blk_window_init(&w, max, NULL);
+	while(!blk_window_full(&w))
+		blk_window_add(&w, blk_size);
+	fail_unless(w.bytes<max+blk_size);
+
+	// Blocks so big that a manifest's worth does not fit.
+	blk_window_init(&w, max, NULL);
+	blk_size=max/MANIFEST_SIG_MAX*2;
+	while(!blk_window_full(&w))
+		blk_window_add(&w, blk_size);
+	fail_unless(w.blks==MANIFEST_SIG_MAX);
+}
+END_TEST
+
+START_TEST(test_blk_window_samples)
+{
+	struct blk_window w;
+	blk_window_init(&w, MAX, NULL);
+	blk_window_sent(&w, 5);
+	fail_unless(w.sample_index==5);
+	// Only one block is timed at once.
+	blk_window_sent(&w, 6);
+	fail_unless(w.sample_index==5);
+	blk_window_response(&w, 4);
+	fail_unless(w.sample_index==5);
+	fail_unless(!w.min_rtt);
+	blk_window_response(&w, 6);
+	fail_unless(w.sample_index==0);
+	fail_unless(w.min_rtt>0);
+	blk_window_sent(&w, 7);
+	fail_unless(w.sample_index==7);
+}
+END_TEST
+
+// A stretch that is all deduplicated gets wrap ups from the server, and no
+// data requests. Each wrap up ends a sample, so the next one starts fresh
+// instead of timing the whole stretch.
+START_TEST(test_blk_window_wrap_ups_only)
+{
+	int i;
+	uint64_t size;
+	uint64_t index=1;
+	struct blk_window w;
+	blk_window_init(&w, MAX, NULL);
+	hold_blks(&w);
+	for(i=0; i<4; i++)
+	{
+		size=w.size;
+		blk_window_sent(&w, index);
+		fail_unless(w.sample_index==index);
+		blk_window_add(&w, w.size);
+		fail_unless(blk_window_full(&w));
+		index+=MANIFEST_SIG_MAX;
+		// Wrapped up past the timed block, which ends the sample, and
+		// the window was full, so it grows.
+		blk_window_response(&w, index-1);
+		fail_unless(!w.sample_index);
+		fail_unless(w.size>size);
+		blk_window_del(&w, w.bytes);
+	}
+	fail_unless(w.min_rtt>0);
+}
+END_TEST
+
+Suite *suite_client_protocol2_blk_window(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_protocol2_blk_window");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_blk_window_full);
+	tcase_add_test(tc_core, test_blk_window_slow_start);
+	tcase_add_test(tc_core, test_blk_window_limits);
+	tcase_add_test(tc_core, test_blk_window_big_blocks);
+	tcase_add_test(tc_core, test_blk_window_samples);
+	tcase_add_test(tc_core, test_blk_window_wrap_ups_only);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,96 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/client/protocol2/hash_pool.h"
+
+#define BLKS	1000
+
+static void do_test_hash_pool(int threads)
+{
+	int i;
+	struct blk *blks[BLKS];
+	struct hash_pool *hp;
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+
+	alloc_check_init();
+	fail_unless((hp=hash_pool_alloc(threads, STRONG_HASH_MD5))!=NULL);
+	for(i=0; i<BLKS; i++)
+	{
+		fail_unless((blks[i]=blk_alloc_with_data(i+1))!=NULL);
+		blks[i]->length=i+1;
+		memset(blks[i]->data, i, blks[i]->length);
+		fail_unless(!hash_pool_add(hp, blks[i]));
+	}
+	for(i=0; i<BLKS; i++)
+	{
+		fail_unless(!hash_pool_wait(hp, blks[i]));
+		fail_unless(blks[i]->hashed==1);
+		memcpy(md5sum, blks[i]->md5sum, MD5_DIGEST_LENGTH);
+		fail_unless(!blk_strong_hash_update(blks[i]));
+		fail_unless(!memcmp(md5sum, blks[i]->md5sum,
+			MD5_DIGEST_LENGTH));
+	}
+	hash_pool_free(&hp);
+	fail_unless(hp==NULL);
+	for(i=0; i<BLKS; i++)
+		blk_free(&blks[i]);
+	alloc_check();
+}
+
+START_TEST(test_hash_pool_no_threads)
+{
+	do_test_hash_pool(0);
+}
+END_TEST
+
+START_TEST(test_hash_pool_threads)
+{
+	do_test_hash_pool(4);
+}
+END_TEST
+
+START_TEST(test_hash_pool_too_many_threads)
+{
+	do_test_hash_pool(HASH_THREADS_MAX+1);
+}
+END_TEST
+
+START_TEST(test_hash_pool_free_with_queue)
+{
+	int i;
+	struct blk *blks[BLKS];
+	struct hash_pool *hp;
+
+	alloc_check_init();
+	fail_unless((hp=hash_pool_alloc(2, STRONG_HASH_MD5))!=NULL);
+	for(i=0; i<BLKS; i++)
+	{
+		fail_unless((blks[i]=blk_alloc_with_data(1))!=NULL);
+		blks[i]->length=1;
+		fail_unless(!hash_pool_add(hp, blks[i]));
+	}
+	// Freeing the pool finishes off the queued blocks first.
+	hash_pool_free(&hp);
+	for(i=0; i<BLKS; i++)
+		blk_free(&blks[i]);
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_client_protocol2_hash_pool(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("client_protocol2_hash_pool");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_hash_pool_no_threads);
+	tcase_add_test(tc_core, test_hash_pool_threads);
+	tcase_add_test(tc_core, test_hash_pool_too_many_threads);
+	tcase_add_test(tc_core, test_hash_pool_free_with_queue);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
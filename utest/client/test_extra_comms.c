@@ -430,6 +430,20 @@ static void setup_msg(struct asfd *asfd, struct conf **confs)
 	setup_extra_comms_end(asfd, &r, &w);
 }
 
+static void check_sig_batch(struct conf **confs,
+	enum action action, const char *incexc)
+{
+	fail_unless(get_int(confs[OPT_SIG_BATCH])==1);
+}
+
+static void setup_sig_batch(struct asfd *asfd, struct conf **confs)
+{
+	int r=0; int w=0;
+	setup_extra_comms_begin(asfd, &r, &w, "sig_batch");
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, "sig_batch");
+	setup_extra_comms_end(asfd, &r, &w);
+}
+
 static void check_rshash(struct conf **confs,
 	enum action action, const char *incexc)
 {
@@ -482,6 +496,7 @@ START_TEST(test_client_extra_comms)
 	run_test(0,  ACTION_BACKUP, setup_forceproto2, check_proto2);
 	run_test(-1, ACTION_BACKUP, setup_forceproto2_proto1, NULL);
 	run_test(0,  ACTION_BACKUP, setup_msg, check_msg);
+	run_test(0,  ACTION_BACKUP, setup_sig_batch, check_sig_batch);
 	run_test(0,  ACTION_BACKUP, setup_rshash, check_rshash);
 }
 END_TEST
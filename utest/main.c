@@ -39,7 +39,9 @@ int main(int argc, char *argv[], char *envp[])
 #endif
 #endif
 	srunner_add_suite(sr, suite_client_monitor_lline());
+	srunner_add_suite(sr, suite_client_protocol2_blk_window());
 #ifdef HAVE_XATTR
+	srunner_add_suite(sr, suite_client_protocol2_hash_pool());
 	srunner_add_suite(sr, suite_client_protocol2_rabin_read());
 	srunner_add_suite(sr, suite_client_xattr());
 #endif
@@ -52,6 +54,7 @@ int main(int argc, char *argv[], char *envp[])
 	srunner_add_suite(sr, suite_protocol1_rs_buf());
 	srunner_add_suite(sr, suite_protocol2_blist());
 	srunner_add_suite(sr, suite_protocol2_blk());
+	srunner_add_suite(sr, suite_protocol2_rabin_gear());
 	srunner_add_suite(sr, suite_protocol2_rabin_rabin());
 	srunner_add_suite(sr, suite_protocol2_rabin_rconf());
 	srunner_add_suite(sr, suite_protocol2_rabin_win());
@@ -110,15 +113,30 @@ int main(int argc, char *argv[], char *envp[])
 	srunner_add_suite(sr, suite_server_protocol1_restore());
 	srunner_add_suite(sr, suite_server_protocol2_backup_phase2());
 	srunner_add_suite(sr, suite_server_protocol2_backup_phase4());
+	srunner_add_suite(sr, suite_server_protocol2_bcompact());
 	srunner_add_suite(sr, suite_server_protocol2_bsparse());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_bloom());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_candidate());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_champ_cache());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_champ_chooser());
+	srunner_add_suite(sr,
+		suite_server_protocol2_champ_chooser_champ_fanout());
+	srunner_add_suite(sr,
+		suite_server_protocol2_champ_chooser_champ_prefetch());
+	srunner_add_suite(sr,
+		suite_server_protocol2_champ_chooser_champ_queue());
 	srunner_add_suite(sr,
 		suite_server_protocol2_champ_chooser_champ_server());
+	srunner_add_suite(sr,
+		suite_server_protocol2_champ_chooser_champ_stats());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_dindex());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_gc());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_hash());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_scores());
 	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_sparse());
+	srunner_add_suite(sr, suite_server_protocol2_champ_chooser_sparse_map());
 	srunner_add_suite(sr, suite_server_protocol2_dpth());
+	srunner_add_suite(sr, suite_server_protocol2_rblk());
 	srunner_add_suite(sr, suite_server_restore());
 	srunner_add_suite(sr, suite_server_resume());
 	srunner_add_suite(sr, suite_server_run_action());
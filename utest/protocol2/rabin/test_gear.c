@@ -0,0 +1,212 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/asfd.h"
+#include "../../../src/client/protocol2/rabin_read.h"
+#include "../../../src/conffile.h"
+#include "../../../src/fsops.h"
+#include "../../../src/hexmap.h"
+#include "../../../src/protocol2/blist.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/protocol2/rabin/gear.h"
+#include "../../../src/protocol2/rabin/rabin.h"
+#include "../../../src/protocol2/rabin/rconf.h"
+#include "../../../src/sbuf.h"
+#include "../../builders/build_file.h"
+
+#define BASE		"utest_protocol2_rabin_gear"
+#define CONFFILE	BASE "/burp.conf"
+#define MYFILE		BASE "/myfile"
+
+static int bits_set(uint64_t mask)
+{
+	int bits=0;
+	for(; mask; mask>>=1)
+		bits+=mask&1;
+	return bits;
+}
+
+START_TEST(test_gear_mask)
+{
+	struct rconf rconf;
+	rconf_init(&rconf);
+
+	fail_unless(bits_set(rconf.mask_s)==bits_set(rconf.mask_l)+4);
+	// Cut points must not overlap the hook bits, or the low bits that
+	// the hash tables use.
+	fail_unless(!(rconf.mask_s & 0xF000000000000000ULL));
+	fail_unless(!(rconf.mask_l & 0xF000000000000000ULL));
+	fail_unless(!(rconf.mask_s & 0x00000000FFFFFFFFULL));
+	fail_unless(!(rconf.mask_l & 0x00000000FFFFFFFFULL));
+
+	fail_unless(gear_mask(1, -2)==(1ULL<<59));
+	fail_unless(bits_set(gear_mask(0xFFFFFFFF, 2))==28);
+}
+END_TEST
+
+START_TEST(test_gear_fingerprint)
+{
+	int i;
+	char a[256];
+	char b[256];
+	gear_init();
+	for(i=0; i<(int)sizeof(a); i++)
+	{
+		a[i]=(char)i;
+		b[i]=(char)(255-i);
+	}
+	// Only the last GEAR_WINDOW bytes count.
+	memcpy(b+sizeof(b)-GEAR_WINDOW, a+sizeof(a)-GEAR_WINDOW, GEAR_WINDOW);
+	fail_unless(gear_fingerprint(a, sizeof(a))
+		==gear_fingerprint(b, sizeof(b)));
+	fail_unless(gear_fingerprint(a, sizeof(a))
+		!=gear_fingerprint(a, sizeof(a)-1));
+	fail_unless(gear_fingerprint(a, 0)==0);
+	fail_unless(gear_fingerprint(a, 1)==gear_table[0]);
+}
+END_TEST
+
+#ifndef HAVE_WIN32
+static void build_random_file(const char *path, size_t len)
+{
+	FILE *fp;
+	uint32_t x=12345;
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	while(len--)
+	{
+		x=x*1103515245+12345;
+		fputc((x>>16)&0xFF, fp);
+	}
+	fail_unless(!fclose(fp));
+}
+
+static struct blist *generate(struct conf **confs, enum chunking chunking,
+	const char *sizes, size_t *total)
+{
+	int ret;
+	struct sbuf *sb;
+	struct blist *blist;
+	fail_unless((blist=blist_alloc())!=NULL);
+	fail_unless((sb=sbuf_alloc(PROTO_2))!=NULL);
+	iobuf_from_str(&sb->path, CMD_FILE, strdup_w(MYFILE, __func__));
+	fail_unless(rabin_open_file(sb, NULL/*asfd*/, NULL/*cntr*/, confs)==1);
+	fail_unless(!blks_generate_init(chunking));
+	fail_unless(!blks_generate_set_blk_sizes(sizes));
+	while(!(ret=blks_generate(sb, blist, blist->head==NULL)))
+		;
+	fail_unless(ret==1);
+	*total=sb->protocol2->bytes_read;
+	blks_generate_free();
+	fail_unless(!rabin_close_file(sb, NULL/*asfd*/));
+	sbuf_free(&sb);
+	return blist;
+}
+
+// The blocks point into shared read buffers, which get replaced as they fill
+// up. Make sure that the data still comes out in the right order.
+static void check_content(struct blist *blist)
+{
+	FILE *fp;
+	struct blk *b;
+	char buf[RABIN_LIMIT];
+	fail_unless((fp=fopen(MYFILE, "rb"))!=NULL);
+	for(b=blist->head; b; b=b->next)
+	{
+		fail_unless(b->length<=sizeof(buf));
+		fail_unless(fread(buf, 1, b->length, fp)==b->length);
+		fail_unless(!memcmp(buf, b->data, b->length));
+	}
+	fail_unless(fgetc(fp)==EOF);
+	fail_unless(!fclose(fp));
+}
+
+static void do_test_gear_blks_generate(enum chunking verify_with,
+	const char *sizes)
+{
+	size_t len=0;
+	size_t total=0;
+	struct blk *b;
+	struct blist *blist;
+	struct conf **confs;
+	struct rconf rconf;
+
+	alloc_check_init();
+	rconf_init(&rconf);
+	if(sizes)
+		fail_unless(!rconf_parse_blk_sizes(&rconf, sizes, NULL));
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	build_file(CONFFILE, MIN_CLIENT_CONF);
+	fail_unless((confs=confs_alloc())!=NULL);
+	fail_unless(!confs_init(confs));
+	fail_unless(!conf_load_global_only(CONFFILE, confs));
+	build_random_file(MYFILE, 1000000);
+
+	blist=generate(confs, CHUNKING_GEAR, sizes, &total);
+	fail_unless(total==1000000);
+	check_content(blist);
+
+	// The verifier does not need to know the block sizes.
+	fail_unless(!blks_generate_init(verify_with));
+	for(b=blist->head; b; b=b->next)
+	{
+		len+=b->length;
+		fail_unless(b->length<=rconf.blk_max);
+		if(b->next)
+			fail_unless(b->length>=rconf.blk_min);
+		fail_unless(blk_verify_fingerprint(b->fingerprint,
+			b->data, b->length)==1);
+		// Flipping a byte in the window changes the fingerprint.
+		b->data[b->length-1]^=0x01;
+		fail_unless(blk_verify_fingerprint(b->fingerprint,
+			b->data, b->length)==0);
+	}
+	fail_unless(len==total);
+	blks_generate_free();
+
+	blist_free(&blist);
+	confs_free(&confs);
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+START_TEST(test_gear_blks_generate)
+{
+	do_test_gear_blks_generate(CHUNKING_GEAR, NULL);
+}
+END_TEST
+
+START_TEST(test_gear_blks_generate_big_blks)
+{
+	do_test_gear_blks_generate(CHUNKING_GEAR, "16384:24000:32000");
+}
+END_TEST
+
+// A server set up for rabin still needs to verify blocks from gear clients.
+START_TEST(test_gear_blks_verify_with_rabin)
+{
+	do_test_gear_blks_generate(CHUNKING_RABIN, NULL);
+}
+END_TEST
+#endif
+
+Suite *suite_protocol2_rabin_gear(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("protocol2_rabin_gear");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_gear_mask);
+	tcase_add_test(tc_core, test_gear_fingerprint);
+#ifndef HAVE_WIN32
+	tcase_add_test(tc_core, test_gear_blks_generate);
+	tcase_add_test(tc_core, test_gear_blks_generate_big_blks);
+	tcase_add_test(tc_core, test_gear_blks_verify_with_rabin);
+#endif
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
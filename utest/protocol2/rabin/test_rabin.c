@@ -37,7 +37,7 @@ START_TEST(test_rabin_blk_verify_fingerprint)
 	struct blk *blk;
 	alloc_check_init();
 	hexmap_init();
-	blks_generate_init();
+	blks_generate_init(CHUNKING_RABIN);
 	fail_unless((blk=blk_alloc_with_data(1))!=NULL);
 	FOREACH(b)
 	{
@@ -87,7 +87,7 @@ START_TEST(test_rabin_blks_generate_empty_file)
 		NULL, /*asfd*/
 		NULL, /*cntr*/
 		confs)==1);
-	fail_unless(!blks_generate_init());
+	fail_unless(!blks_generate_init(CHUNKING_RABIN));
 
 	// 1 means no more to read from the file.
 	fail_unless(blks_generate(sb, blist, 1/*just_opened*/)==1);
@@ -25,6 +25,91 @@ START_TEST(test_rconf_init)
 }
 END_TEST
 
+START_TEST(test_rconf_check)
+{
+	struct rconf rconf;
+	alloc_check_init();
+
+	rconf_init(&rconf);
+	fail_unless(!rconf_check(&rconf));
+	rconf.win_size=rconf.win_max+1;
+	fail_unless(rconf_check(&rconf)==-1);
+
+	rconf_init(&rconf);
+	rconf.blk_min=rconf.win_max-1;
+	fail_unless(rconf_check(&rconf)==-1);
+
+	rconf_init(&rconf);
+	rconf.blk_avg=rconf.blk_max+1;
+	fail_unless(rconf_check(&rconf)==-1);
+
+	rconf_init(&rconf);
+	rconf.blk_max=RABIN_LIMIT+1;
+	fail_unless(rconf_check(&rconf)==-1);
+	rconf.blk_max=RABIN_LIMIT;
+	fail_unless(!rconf_check(&rconf));
+
+	tear_down();
+}
+END_TEST
+
+struct sdata
+{
+	const char *str;
+	int with_rest;
+	int expected_ret;
+	uint32_t blk_min;
+	uint32_t blk_avg;
+	uint32_t blk_max;
+	const char *rest;
+};
+
+static struct sdata s[] = {
+	{ "8192:16384:32000", 0, 0, 8192, 16384, 32000, NULL },
+	{ "100:100:100", 0, 0, 100, 100, 100, NULL },
+	{ "8192:16384:32000:vmdk", 1, 0, 8192, 16384, 32000, "vmdk" },
+	{ "8192:16384:32000:/a:b", 1, 0, 8192, 16384, 32000, "/a:b" },
+	{ "8192:16384:32000", 1, 0, 8192, 16384, 32000, "" },
+	{ "8192:16384:32000:vmdk", 0, -1, 0, 0, 0, NULL },
+	{ "8192:16384", 0, -1, 0, 0, 0, NULL },
+	{ "8192::32000", 0, -1, 0, 0, 0, NULL },
+	{ "-1:16384:32000", 0, -1, 0, 0, 0, NULL },
+	{ "8192:16384:32001", 0, -1, 0, 0, 0, NULL },
+	{ "8192:4096:32000", 0, -1, 0, 0, 0, NULL },
+	{ "99999999999:16384:32000", 0, -1, 0, 0, 0, NULL },
+	{ "", 0, -1, 0, 0, 0, NULL },
+};
+
+START_TEST(test_rconf_parse_blk_sizes)
+{
+	struct rconf rconf;
+	struct rconf orig;
+	alloc_check_init();
+	FOREACH(s)
+	{
+		const char *rest=NULL;
+		rconf_init(&rconf);
+		orig=rconf;
+		fail_unless(rconf_parse_blk_sizes(&rconf, s[i].str,
+			s[i].with_rest?&rest:NULL)==s[i].expected_ret);
+		if(s[i].expected_ret)
+		{
+			// Left alone on error.
+			fail_unless(!memcmp(&rconf, &orig, sizeof(rconf)));
+			continue;
+		}
+		fail_unless(rconf.blk_min==s[i].blk_min);
+		fail_unless(rconf.blk_avg==s[i].blk_avg);
+		fail_unless(rconf.blk_max==s[i].blk_max);
+		if(s[i].rest)
+			ck_assert_str_eq(rest, s[i].rest);
+		if(s[i].blk_avg>orig.blk_avg)
+			fail_unless(rconf.mask_s>orig.mask_s);
+	}
+	tear_down();
+}
+END_TEST
+
 Suite *suite_protocol2_rabin_rconf(void)
 {
 	Suite *s;
@@ -35,6 +120,8 @@ Suite *suite_protocol2_rabin_rconf(void)
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_rconf_init);
+	tcase_add_test(tc_core, test_rconf_check);
+	tcase_add_test(tc_core, test_rconf_parse_blk_sizes);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -24,7 +24,7 @@ START_TEST(test_protocol2_blk)
 	struct blk *blk;
 	alloc_check_init();
 	hexmap_init();
-	blks_generate_init();
+	blks_generate_init(CHUNKING_RABIN);
 	fail_unless((blk=blk_alloc_with_data(1))!=NULL);
 	FOREACH(b)
 	{
@@ -33,8 +33,9 @@ START_TEST(test_protocol2_blk)
 		md5str_to_bytes(b[i].md5str, blk->md5sum);
 		blk->length=1;
 		memcpy(blk->data, &x, blk->length);
-		fail_unless(blk_verify(blk->fingerprint, blk->md5sum,
-			blk->data, blk->length)==b[i].expected_result);
+		fail_unless(blk_verify(blk->fingerprint, STRONG_HASH_MD5,
+			blk->md5sum, blk->data, blk->length)
+				==b[i].expected_result);
 	}
 	blk_free(&blk);
 	blks_generate_free();
@@ -42,6 +43,97 @@ START_TEST(test_protocol2_blk)
 }
 END_TEST
 
+static void check_sig_round_trip(enum strong_hash strong_hash,
+	size_t expected_len, size_t expected_len_with_savepath)
+{
+	struct iobuf iobuf;
+	struct blk blk1;
+	struct blk blk2;
+	memset(&blk1, 0, sizeof(blk1));
+	memset(&blk2, 0, sizeof(blk2));
+	blk1.fingerprint=0x0102030405060708ULL;
+	blk1.savepath=0x1112131415161718ULL;
+	blk1.strong_hash=strong_hash;
+	memset(blk1.md5sum, 0xAB, MD5_DIGEST_LENGTH);
+
+	blk_to_iobuf_sig(&blk1, &iobuf);
+	fail_unless(iobuf.len==expected_len);
+	fail_unless(!blk_set_from_iobuf_sig(&blk2, &iobuf));
+	fail_unless(blk2.fingerprint==blk1.fingerprint);
+	fail_unless(blk2.strong_hash==blk1.strong_hash);
+	fail_unless(!memcmp(blk2.md5sum, blk1.md5sum, MD5_DIGEST_LENGTH));
+
+	memset(&blk2, 0, sizeof(blk2));
+	blk_to_iobuf_sig_and_savepath(&blk1, &iobuf);
+	fail_unless(iobuf.len==expected_len_with_savepath);
+	fail_unless(!blk_set_from_iobuf_sig_and_savepath(&blk2, &iobuf));
+	fail_unless(blk2.fingerprint==blk1.fingerprint);
+	fail_unless(blk2.savepath==blk1.savepath);
+	fail_unless(blk2.strong_hash==blk1.strong_hash);
+	fail_unless(!memcmp(blk2.md5sum, blk1.md5sum, MD5_DIGEST_LENGTH));
+}
+
+START_TEST(test_protocol2_blk_sig_strong_hash)
+{
+	alloc_check_init();
+	// MD5 signatures keep the original length.
+	check_sig_round_trip(STRONG_HASH_MD5, 24, 32);
+#ifdef HAVE_EVP_BLAKE2B512
+	check_sig_round_trip(STRONG_HASH_BLAKE2B, 25, 33);
+#endif
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_sig_unknown_strong_hash)
+{
+	struct iobuf iobuf;
+	struct blk blk1;
+	struct blk blk2;
+	memset(&blk1, 0, sizeof(blk1));
+	memset(&blk2, 0, sizeof(blk2));
+	blk1.strong_hash=0xFE;
+
+	blk_to_iobuf_sig(&blk1, &iobuf);
+	fail_unless(iobuf.len==25);
+	fail_unless(blk_set_from_iobuf_sig(&blk2, &iobuf)==-1);
+	blk_to_iobuf_sig_and_savepath(&blk1, &iobuf);
+	fail_unless(iobuf.len==33);
+	fail_unless(blk_set_from_iobuf_sig_and_savepath(&blk2, &iobuf)==-1);
+}
+END_TEST
+
+#ifdef HAVE_EVP_BLAKE2B512
+START_TEST(test_protocol2_blk_blake2b)
+{
+	struct blk *blk;
+	alloc_check_init();
+	hexmap_init();
+	blks_generate_init(CHUNKING_RABIN);
+	fail_unless((blk=blk_alloc_with_data(1))!=NULL);
+	blk->strong_hash=STRONG_HASH_BLAKE2B;
+	blk->fingerprint=0xF3;
+	blk->length=1;
+	blk->data[0]=(char)243;
+	fail_unless(!blk_strong_hash_update(blk));
+	fail_unless(blk_verify(blk->fingerprint, STRONG_HASH_BLAKE2B,
+		blk->md5sum, blk->data, blk->length)==1);
+	// Same data, but checked as if it were MD5.
+	fail_unless(blk_verify(blk->fingerprint, STRONG_HASH_MD5,
+		blk->md5sum, blk->data, blk->length)==0);
+
+	// Empty blocks are still spotted.
+	blk->length=0;
+	blk->fingerprint=0;
+	fail_unless(!blk_strong_hash_update(blk));
+	fail_unless(blk_is_zero_length(blk));
+	blk_free(&blk);
+	blks_generate_free();
+	alloc_check();
+}
+END_TEST
+#endif
+
 START_TEST(test_protocol2_blk_length_errors)
 {
 	struct iobuf iobuf;
@@ -68,6 +160,145 @@ START_TEST(test_protocol2_blk_alloc_error)
 }
 END_TEST
 
+START_TEST(test_protocol2_blk_data_view)
+{
+	struct blk_buf *buf;
+	struct blk *blk1;
+	struct blk *blk2;
+	alloc_check_init();
+	fail_unless((buf=blk_buf_alloc(16))!=NULL);
+	fail_unless((blk1=blk_alloc())!=NULL);
+	fail_unless((blk2=blk_alloc())!=NULL);
+	blk_set_data_view(blk1, buf, buf->buf);
+	blk_set_data_view(blk2, buf, buf->buf+8);
+	fail_unless(buf->refs==3);
+	fail_unless(blk2->data==buf->buf+8);
+	blk_buf_unref(&buf);
+	fail_unless(buf==NULL);
+	blk_free(&blk1);
+	fail_unless(blk2->buf->refs==1);
+	blk_free(&blk2);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_buf_alloc_error)
+{
+	alloc_check_init();
+	alloc_errors=1;
+	fail_unless(blk_buf_alloc(16)==NULL);
+	alloc_errors=2;
+	fail_unless(blk_buf_alloc(16)==NULL);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_batch)
+{
+	int i;
+	size_t offset=0;
+	struct blk blk;
+	struct blk blk2;
+	struct iobuf iobuf;
+	struct iobuf rec;
+	static struct blk_batch batch;
+	alloc_check_init();
+	memset(&blk, 0, sizeof(blk));
+	blk_batch_init(&batch, CMD_SIGS);
+	fail_unless(blk_batch_to_iobuf(&batch, &iobuf)==0);
+	for(i=0; i<3; i++)
+	{
+		blk.fingerprint=i;
+		memset(blk.md5sum, i, MD5_DIGEST_LENGTH);
+		blk_to_iobuf_sig(&blk, &rec);
+		fail_unless(!blk_batch_add(&batch, &rec));
+	}
+	// Records in a batch all have to be the same length.
+	blk_to_iobuf_fingerprint(&blk, &rec);
+	fail_unless(blk_batch_add(&batch, &rec)==-1);
+	fail_unless(blk_batch_to_iobuf(&batch, &iobuf)==1);
+	fail_unless(iobuf.cmd==CMD_SIGS);
+	fail_unless(batch.count==0);
+	for(i=0; i<3; i++)
+	{
+		fail_unless(blk_batch_next(&iobuf, &offset, &rec)==1);
+		fail_unless(!blk_set_from_iobuf_sig(&blk2, &rec));
+		fail_unless(blk2.fingerprint==(uint64_t)i);
+	}
+	fail_unless(blk_batch_next(&iobuf, &offset, &rec)==0);
+	iobuf.len--;
+	fail_unless(blk_batch_next(&iobuf, &offset, &rec)==-1);
+	alloc_check();
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_batch_full)
+{
+	size_t count=0;
+	struct blk blk;
+	struct iobuf rec;
+	static struct blk_batch batch;
+	memset(&blk, 0, sizeof(blk));
+	blk_batch_init(&batch, CMD_SIGS);
+	blk_to_iobuf_sig(&blk, &rec);
+	while(!blk_batch_add(&batch, &rec))
+		count++;
+	fail_unless(count==BLK_BATCH_LEN/rec.len);
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_data_req_range)
+{
+	uint64_t count=0;
+	struct blk blk;
+	struct blk blk2;
+	struct iobuf iobuf;
+	blk.index=12345;
+	blk_to_iobuf_data_req_range(&blk, 67, &iobuf);
+	fail_unless(iobuf.cmd==CMD_DATA_REQS);
+	fail_unless(!blk_set_from_iobuf_data_req_range(&blk2, &count, &iobuf));
+	fail_unless(blk2.index==12345);
+	fail_unless(count==67);
+	blk_to_iobuf_data_req_range(&blk, 0, &iobuf);
+	fail_unless(blk_set_from_iobuf_data_req_range(&blk2,
+		&count, &iobuf)==-1);
+	iobuf.len--;
+	fail_unless(blk_set_from_iobuf_data_req_range(&blk2,
+		&count, &iobuf)==-1);
+}
+END_TEST
+
+START_TEST(test_protocol2_blk_data_compression)
+{
+	size_t len;
+	char in[1000];
+	char out[1000];
+	struct iobuf iobuf;
+	struct iobuf data;
+	alloc_check_init();
+	memset(in, 'x', sizeof(in));
+	len=sizeof(out);
+	fail_unless(!blk_data_compress(1, in, sizeof(in), out, &len));
+	fail_unless(len<sizeof(in));
+	iobuf_set(&iobuf, CMD_DATA_COMP, out, len);
+	fail_unless(!blk_data_decompress(&iobuf, &data));
+	fail_unless(data.len==sizeof(in));
+	fail_unless(!memcmp(data.buf, in, sizeof(in)));
+	iobuf_free_content(&data);
+
+	// Corrupt data.
+	out[len-1]^=0xFF;
+	fail_unless(blk_data_decompress(&iobuf, &data)==-1);
+	iobuf.len=2;
+	fail_unless(blk_data_decompress(&iobuf, &data)==-1);
+
+	// Not worth it.
+	len=sizeof(out);
+	fail_unless(blk_data_compress(1, "abc", 3, out, &len)==1);
+	alloc_check();
+}
+END_TEST
+
 Suite *suite_protocol2_blk(void)
 {
 	Suite *s;
@@ -78,8 +309,19 @@ Suite *suite_protocol2_blk(void)
 	tc_core=tcase_create("Core");
 
 	tcase_add_test(tc_core, test_protocol2_blk);
+	tcase_add_test(tc_core, test_protocol2_blk_data_view);
+	tcase_add_test(tc_core, test_protocol2_blk_sig_strong_hash);
+	tcase_add_test(tc_core, test_protocol2_blk_sig_unknown_strong_hash);
+#ifdef HAVE_EVP_BLAKE2B512
+	tcase_add_test(tc_core, test_protocol2_blk_blake2b);
+#endif
+	tcase_add_test(tc_core, test_protocol2_blk_buf_alloc_error);
 	tcase_add_test(tc_core, test_protocol2_blk_length_errors);
 	tcase_add_test(tc_core, test_protocol2_blk_alloc_error);
+	tcase_add_test(tc_core, test_protocol2_blk_batch);
+	tcase_add_test(tc_core, test_protocol2_blk_batch_full);
+	tcase_add_test(tc_core, test_protocol2_blk_data_req_range);
+	tcase_add_test(tc_core, test_protocol2_blk_data_compression);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -264,6 +264,42 @@ START_TEST(test_json_send_client_specific)
 }
 END_TEST
 
+START_TEST(test_json_send_client_champ_stats)
+{
+	char *tz;
+	char *path;
+	struct asfd *asfd;
+	struct sdirs *sdirs;
+	struct cstat *clist=NULL;
+	const char *cnames[] ={"cli1", NULL};
+	tz=setup_tz();
+	fail_unless(recursive_delete(CLIENTCONFDIR)==0);
+	build_clientconfdir_files(cnames, NULL);
+	fail_unless(!cstat_get_client_names(&clist, CLIENTCONFDIR));
+	clist->permitted=1;
+	clist->protocol=PROTO_2;
+	fail_unless((sdirs=setup_sdirs(clist->protocol, clist->name))!=NULL);
+	clist->sdirs=sdirs;
+	build_storage_dirs(sdirs, sd1, ARR_LEN(sd1));
+	fail_unless(!cstat_set_backup_list(clist));
+
+	// Shard 1 has not written anything.
+	build_file(sdirs->champstats, "shard:0\nsegments:3\n");
+	fail_unless((path=sdirs_champ_shard_path(sdirs->data,
+		"cc.stats", 2))!=NULL);
+	build_file(path, "shard:2\nsegments:1\n");
+	free_w(&path);
+
+	asfd=asfd_setup(BASE "/client_champ_stats");
+	fail_unless(!json_send(asfd, clist, clist, NULL, "champ_stats", NULL,
+		0/*cache*/, version_to_long(VERSION)));
+	cstat_list_free_sdirs(clist);
+	cstat_list_free(&clist);
+	fail_unless(!recursive_delete(SDIRS));
+	tear_down(&asfd, &tz);
+}
+END_TEST
+
 static void do_assert_files_equal(const char *opath, const char *npath,
 	int compressed)
 {
@@ -352,6 +388,7 @@ Suite *suite_server_monitor_json_output(void)
 	tcase_add_test(tc_core, test_json_send_clients_with_backups_finishing);
 	tcase_add_test(tc_core, test_json_send_clients_with_backups_working);
 	tcase_add_test(tc_core, test_json_send_client_specific);
+	tcase_add_test(tc_core, test_json_send_client_champ_stats);
 	tcase_add_test(tc_core, test_json_matching_output);
 	tcase_add_test(tc_core, cleanup);
 
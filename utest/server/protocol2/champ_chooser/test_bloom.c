@@ -0,0 +1,73 @@
+#include "../../../test.h"
+#include "../../../prng.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/server/protocol2/champ_chooser/bloom.h"
+
+static void tear_down(void)
+{
+	alloc_check();
+}
+
+START_TEST(test_bloom_alloc_error)
+{
+	alloc_errors=1;
+	fail_unless(bloom_alloc(1000)==NULL);
+	alloc_errors=2;
+	fail_unless(bloom_alloc(1000)==NULL);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_bloom)
+{
+	size_t i;
+	size_t passed=0;
+	struct bloom *bloom;
+	uint64_t keys[5000];
+
+	prng_init(0);
+	fail_unless((bloom=bloom_alloc(5000))!=NULL);
+	fail_unless(bloom->capacity>=5000);
+	// Whole blocks of 64 bytes.
+	fail_unless(!(bloom_bytes(bloom)%64));
+	for(i=0; i<5000; i++)
+	{
+		// Hooks all have the same top bits.
+		keys[i]=prng_next64()|0xF000000000000000ULL;
+		bloom_add(bloom, keys[i]);
+	}
+	fail_unless(bloom->keys==5000);
+
+	// No false negatives.
+	for(i=0; i<5000; i++)
+		fail_unless(bloom_maybe(bloom, keys[i]));
+
+	// Very few false positives.
+	for(i=0; i<100000; i++)
+		passed+=bloom_maybe(bloom,
+			prng_next64()|0xF000000000000000ULL);
+	fail_unless(passed<100);
+	fail_unless(bloom->lookups==105000);
+	fail_unless(bloom->passed==5000+passed);
+
+	bloom_free(&bloom);
+	fail_unless(!bloom);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_bloom(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_bloom");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_bloom_alloc_error);
+	tcase_add_test(tc_core, test_bloom);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
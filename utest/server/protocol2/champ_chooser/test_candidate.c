@@ -0,0 +1,244 @@
+#include "../../../test.h"
+#include "../../../prng.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/incoming.h"
+#include "../../../../src/server/protocol2/champ_chooser/scores.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+
+// Set UTEST_BENCH in the environment to time candidates_choose_champ() over
+// a big synthetic sparse index, instead of checking its results over a
+// small one.
+
+#define CHAMPS_MAX	10
+
+struct synth
+{
+	int candidates;
+	int hooks_per_candidate;
+	int pool;		// Number of different hooks.
+	int segments;
+	int segment_size;
+};
+
+static uint64_t pool_hook(int p)
+{
+	// Hooks all have the same top bits.
+	return 0xF000000000000000ULL|((uint64_t)p*0x9E3779B97F4A7ULL);
+}
+
+static void build(struct synth *synth, struct scores *scores)
+{
+	int c;
+	int h;
+	uint64_t f;
+	struct candidate *candidate;
+
+	for(c=0; c<synth->candidates; c++)
+	{
+		fail_unless((candidate=candidates_add_new())!=NULL);
+		fail_unless((candidate->path=strdup_w("x", __func__))!=NULL);
+		for(h=0; h<synth->hooks_per_candidate; h++)
+		{
+			f=pool_hook(prng_next()%synth->pool);
+			fail_unless(!sparse_add_candidate(&f, candidate));
+		}
+	}
+	fail_unless(!candidates_scores_update(scores));
+}
+
+static void fill_segment(struct synth *synth, struct incoming *in)
+{
+	int i;
+	in->size=0;
+	for(i=0; i<synth->segment_size; i++)
+	{
+		fail_unless(!incoming_grow_maybe(in));
+		// Some that are not in the sparse index.
+		if(prng_next()%4)
+			in->fingerprints[i]=pool_hook(prng_next()%synth->pool);
+		else
+			in->fingerprints[i]=pool_hook(synth->pool+prng_next());
+	}
+	incoming_found_reset(in);
+}
+
+// Works out the best candidate the slow way, with its own idea of which
+// fingerprints have been found.
+static struct candidate *reference(struct incoming *in, uint8_t *found,
+	uint16_t *best_score)
+{
+	size_t c;
+	size_t s;
+	uint16_t i;
+	uint16_t *score;
+	struct sparse *sparse;
+	struct candidate *best=NULL;
+
+	fail_unless((score=(uint16_t *)calloc_w(candidates_len,
+		sizeof(uint16_t), __func__))!=NULL);
+	for(i=0; i<in->size; i++)
+	{
+		if(found[i]
+		  || !(sparse=sparse_find(&in->fingerprints[i])))
+			continue;
+		for(s=0; s<sparse->size; s++)
+			score[sparse->candidates[s]->id]++;
+	}
+	*best_score=0;
+	for(c=0; c<candidates_len; c++)
+	{
+		if(!score[c] || candidates[c]->deleted)
+			continue;
+		if(score[c]>=*best_score)
+		{
+			best=candidates[c];
+			*best_score=score[c];
+		}
+	}
+	free_v((void **)&score);
+	return best;
+}
+
+static void mark_found(struct incoming *in, uint8_t *found,
+	struct candidate *champ)
+{
+	size_t s;
+	uint16_t i;
+	struct sparse *sparse;
+	for(i=0; i<in->size; i++)
+	{
+		if(!(sparse=sparse_find(&in->fingerprints[i])))
+			continue;
+		for(s=0; s<sparse->size; s++)
+			if(sparse->candidates[s]==champ)
+				found[i]=1;
+	}
+}
+
+static void check_segment(struct incoming *in, struct scores *scores)
+{
+	int count;
+	uint16_t best_score;
+	uint8_t found[4096];
+	struct candidate *champ;
+	struct candidate *expected;
+	struct candidate *champ_last=NULL;
+
+	memset(found, 0, sizeof(found));
+	for(count=0; count<CHAMPS_MAX; count++)
+	{
+		champ=candidates_choose_champ(in, champ_last, scores);
+		if(champ_last)
+			mark_found(in, found, champ_last);
+		expected=reference(in, found, &best_score);
+		fail_unless(champ==expected);
+		if(!champ)
+			break;
+		fail_unless(scores->scores[champ->id]==best_score);
+		// Sometimes the champ cannot be loaded, and the next one
+		// is chosen with the same champ_last.
+		if(prng_next()%3)
+			champ_last=champ;
+		else
+			champ->deleted=1;
+	}
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec+1.0e-9*t.tv_nsec;
+}
+
+static void run(struct synth *synth, int bench)
+{
+	int seg;
+	int count;
+	double start;
+	double taken=0;
+	struct incoming *in;
+	struct scores *scores;
+	struct candidate *champ;
+	struct candidate *champ_last;
+
+	prng_init(0);
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless((in=incoming_alloc())!=NULL);
+	build(synth, scores);
+
+	for(seg=0; seg<synth->segments; seg++)
+	{
+		fill_segment(synth, in);
+		if(!bench)
+		{
+			check_segment(in, scores);
+			continue;
+		}
+		start=now();
+		champ_last=NULL;
+		for(count=0; count<CHAMPS_MAX
+		  && (champ=candidates_choose_champ(in, champ_last, scores));
+		  count++)
+			champ_last=champ;
+		taken+=now()-start;
+	}
+	if(bench)
+		fprintf(stderr, "candidates_choose_champ: %d candidates, "
+			"%d segments of %d: %.3f seconds\n",
+			synth->candidates, synth->segments,
+			synth->segment_size, taken);
+
+	incoming_free(&in);
+	scores_free(&scores);
+	candidates_free();
+	sparse_delete_all();
+	alloc_check();
+}
+
+START_TEST(test_candidates_choose_champ)
+{
+	struct synth small={ 200, 50, 2000, 50, 500 };
+	struct synth big={ 20000, 200, 1000000, 200, 4096 };
+	if(getenv("UTEST_BENCH"))
+		run(&big, 1);
+	else
+		run(&small, 0);
+}
+END_TEST
+
+START_TEST(test_candidates_choose_champ_none)
+{
+	struct synth synth={ 0, 0, 100, 1, 100 };
+	struct scores *scores;
+	struct incoming *in;
+
+	prng_init(0);
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless((in=incoming_alloc())!=NULL);
+	fill_segment(&synth, in);
+	fail_unless(candidates_choose_champ(in, NULL, scores)==NULL);
+	incoming_free(&in);
+	scores_free(&scores);
+	sparse_delete_all();
+	alloc_check();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_candidate(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_candidate");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 600);
+
+	tcase_add_test(tc_core, test_candidates_choose_champ);
+	tcase_add_test(tc_core, test_candidates_choose_champ_none);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
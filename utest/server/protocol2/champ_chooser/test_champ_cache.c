@@ -0,0 +1,237 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/iobuf.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_cache.h"
+#include "../../../../src/server/protocol2/champ_chooser/hash.h"
+
+#define BASE	"utest_server_protocol2_champ_chooser_champ_cache"
+
+static void tear_down(void)
+{
+	champ_cache_free();
+	candidates_free();
+	hash_free();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void set_blk(struct blk *blk, uint64_t n, uint64_t savepath)
+{
+	memset(blk, 0, sizeof(*blk));
+	blk->fingerprint=0xF000000000000000ULL|n;
+	memset(blk->md5sum, (int)(n&0xFF), MD5_DIGEST_LENGTH);
+	blk->savepath=savepath;
+}
+
+// A manifest with 'count' blocks, starting from block number 'first'.
+static void write_manifest(const char *name, uint64_t first, int count,
+	uint64_t savepath)
+{
+	int i;
+	char path[256];
+	struct blk blk;
+	struct iobuf iobuf;
+	struct fzp *fzp;
+
+	snprintf(path, sizeof(path), BASE "/%s", name);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_gzopen(path, "wb"))!=NULL);
+	for(i=0; i<count; i++)
+	{
+		set_blk(&blk, first+i, savepath);
+		blk_to_iobuf_sig_and_savepath(&blk, &iobuf);
+		fail_unless(!iobuf_send_msg_fzp(&iobuf, fzp));
+	}
+	fail_unless(!fzp_close(&fzp));
+}
+
+static struct candidate *add_candidate(const char *name)
+{
+	struct candidate *candidate;
+	fail_unless((candidate=candidates_add_new())!=NULL);
+	fail_unless((candidate->path=strdup_w(name, __func__))!=NULL);
+	return candidate;
+}
+
+static void assert_loaded(uint64_t first, int count, uint64_t savepath)
+{
+	int i;
+	struct blk blk;
+	struct hash_entry *e;
+	for(i=0; i<count; i++)
+	{
+		set_blk(&blk, first+i, savepath);
+		fail_unless((e=hash_find(blk.fingerprint, blk.md5sum))!=NULL);
+		fail_unless(e->savepath==savepath);
+	}
+}
+
+static void assert_stats(uint64_t hits, uint64_t misses, uint64_t evictions,
+	size_t champs)
+{
+	struct champ_cache_stats stats;
+	champ_cache_get_stats(&stats);
+	fail_unless(stats.hits==hits);
+	fail_unless(stats.misses==misses);
+	fail_unless(stats.evictions==evictions);
+	fail_unless(stats.champs==champs);
+	fail_unless(stats.bytes<=stats.max);
+}
+
+START_TEST(test_champ_cache_hit)
+{
+	struct candidate *c0;
+	struct candidate *c1;
+
+	fail_unless(!recursive_delete(BASE));
+	write_manifest("m0", 0, 100, 1);
+	write_manifest("m1", 1000, 50, 2);
+	c0=add_candidate("m0");
+	c1=add_candidate("m1");
+	champ_cache_init(1024*1024);
+
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	fail_unless(champ_cache_load(c1, BASE)==HASH_RET_OK);
+	assert_loaded(0, 100, 1);
+	assert_loaded(1000, 50, 2);
+	assert_stats(0, 2, 0, 2);
+
+	// The next segment gets the same champ from memory.
+	hash_delete_all();
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	assert_loaded(0, 100, 1);
+	fail_unless(hash_table.used==100);
+	assert_stats(1, 2, 0, 2);
+
+	// Its backup got deleted.
+	hash_delete_all();
+	fail_unless(!unlink(BASE "/m0"));
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_TEMP);
+	fail_unless(!hash_table.used);
+	assert_stats(1, 2, 0, 1);
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_changed)
+{
+	struct candidate *c0;
+
+	fail_unless(!recursive_delete(BASE));
+	write_manifest("m0", 0, 100, 1);
+	c0=add_candidate("m0");
+	champ_cache_init(1024*1024);
+
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	hash_delete_all();
+	write_manifest("m0", 500, 10, 3);
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	assert_loaded(500, 10, 3);
+	fail_unless(hash_table.used==10);
+	assert_stats(0, 2, 0, 1);
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_evict)
+{
+	struct candidate *c0;
+	struct candidate *c1;
+	struct candidate *c2;
+
+	fail_unless(!recursive_delete(BASE));
+	write_manifest("m0", 0, 100, 1);
+	write_manifest("m1", 1000, 100, 2);
+	write_manifest("m2", 2000, 1000, 3);
+	c0=add_candidate("m0");
+	c1=add_candidate("m1");
+	c2=add_candidate("m2");
+	// Room for two of the small ones.
+	champ_cache_init(250*sizeof(struct hash_entry));
+
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	fail_unless(champ_cache_load(c1, BASE)==HASH_RET_OK);
+	assert_stats(0, 2, 0, 2);
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	assert_stats(1, 2, 0, 2);
+
+	// Too big to keep, so nothing gets evicted for it.
+	fail_unless(champ_cache_load(c2, BASE)==HASH_RET_OK);
+	assert_loaded(2000, 1000, 3);
+	assert_stats(1, 3, 0, 2);
+
+	// c1 was used least recently.
+	write_manifest("m3", 3000, 100, 4);
+	fail_unless(champ_cache_load(add_candidate("m3"), BASE)==HASH_RET_OK);
+	assert_stats(1, 4, 1, 2);
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	assert_stats(2, 4, 1, 2);
+	fail_unless(champ_cache_load(c1, BASE)==HASH_RET_OK);
+	assert_stats(2, 5, 2, 2);
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_off)
+{
+	struct candidate *c0;
+
+	fail_unless(!recursive_delete(BASE));
+	write_manifest("m0", 0, 100, 1);
+	c0=add_candidate("m0");
+	champ_cache_init(0);
+
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_OK);
+	assert_loaded(0, 100, 1);
+	assert_stats(0, 0, 0, 0);
+	fail_unless(champ_cache_load(add_candidate("missing"), BASE)
+		==HASH_RET_TEMP);
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_cache_alloc_error)
+{
+	struct candidate *c0;
+
+	fail_unless(!recursive_delete(BASE));
+	write_manifest("m0", 0, 100, 1);
+	c0=add_candidate("m0");
+	champ_cache_init(1024*1024);
+
+	alloc_errors=1;
+	fail_unless(champ_cache_load(c0, BASE)==HASH_RET_PERM);
+	alloc_errors=0;
+	assert_stats(0, 0, 0, 0);
+
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_champ_cache(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_champ_cache");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_champ_cache_hit);
+	tcase_add_test(tc_core, test_champ_cache_changed);
+	tcase_add_test(tc_core, test_champ_cache_evict);
+	tcase_add_test(tc_core, test_champ_cache_off);
+	tcase_add_test(tc_core, test_champ_cache_alloc_error);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
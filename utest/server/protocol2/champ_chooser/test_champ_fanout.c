@@ -0,0 +1,251 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/asfd.h"
+#include "../../../../src/async.h"
+#include "../../../../src/iobuf.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_fanout.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_queue.h"
+
+#define SHARDS	2
+
+// The shards are connected with champ_queues, which behave like sockets
+// without needing a champ chooser on the other end.
+static struct async *as;
+static struct async *ccas[SHARDS];
+static struct asfd *cc[SHARDS];
+static struct asfd *fanout;
+static struct champ_queue *queue[SHARDS];
+
+static struct async *setup_async(void)
+{
+	struct async *a;
+	fail_unless((a=async_alloc())!=NULL);
+	fail_unless(!a->init(a, 0));
+	// Do not wait around in select().
+	a->setsec=0;
+	a->setusec=1000;
+	return a;
+}
+
+static void setup(size_t slots)
+{
+	int i;
+	struct asfd *shards[SHARDS];
+	as=setup_async();
+	for(i=0; i<SHARDS; i++)
+	{
+		ccas[i]=setup_async();
+		fail_unless((queue[i]=champ_queue_alloc(slots))!=NULL);
+		fail_unless((shards[i]=champ_queue_setup_asfd(as,
+			"shard", queue[i], 0))!=NULL);
+		fail_unless((cc[i]=champ_queue_setup_asfd(ccas[i],
+			"cc", queue[i], 1))!=NULL);
+	}
+	fail_unless((fanout=champ_fanout_alloc(as, shards, SHARDS))!=NULL);
+}
+
+static void tear_down(void)
+{
+	int i;
+	champ_fanout_free(as, &fanout);
+	async_asfd_free_all(&as);
+	for(i=0; i<SHARDS; i++)
+	{
+		async_asfd_free_all(&ccas[i]);
+		champ_queue_free(&queue[i]);
+	}
+	alloc_check();
+}
+
+static void cc_send(int shard, struct iobuf *wbuf)
+{
+	fail_unless(cc[shard]->append_all_to_write_buffer(cc[shard], wbuf)
+		==APPEND_OK);
+}
+
+static void cc_send_found(int shard, uint64_t index, uint64_t savepath)
+{
+	struct blk blk;
+	struct iobuf wbuf;
+	memset(&blk, 0, sizeof(blk));
+	blk.index=index;
+	blk.savepath=savepath;
+	blk_to_iobuf_index_and_savepath(&blk, &wbuf);
+	cc_send(shard, &wbuf);
+}
+
+static void cc_send_wrap_up(int shard, uint64_t index)
+{
+	struct blk blk;
+	struct iobuf wbuf;
+	memset(&blk, 0, sizeof(blk));
+	blk.index=index;
+	blk_to_iobuf_wrap_up(&blk, &wbuf);
+	cc_send(shard, &wbuf);
+}
+
+static void cc_expect_str(int shard, const char *str)
+{
+	fail_unless(!cc[shard]->parse_readbuf(cc[shard]));
+	fail_unless(cc[shard]->rbuf->buf!=NULL);
+	ck_assert_str_eq(cc[shard]->rbuf->buf, str);
+	iobuf_free_content(cc[shard]->rbuf);
+}
+
+static void cc_expect_nothing(int shard)
+{
+	fail_unless(!cc[shard]->parse_readbuf(cc[shard]));
+	fail_unless(cc[shard]->rbuf->buf==NULL);
+}
+
+static void merge(void)
+{
+	fail_unless(!as->read_write(as));
+	fail_unless(!fanout->parse_readbuf(fanout));
+}
+
+static void expect_nothing(void)
+{
+	merge();
+	fail_unless(fanout->rbuf->buf==NULL);
+}
+
+// 'expected' is pairs of index and savepath, ending with a zero index.
+static void expect_found(uint64_t *expected)
+{
+	size_t offset=0;
+	struct iobuf rec;
+	struct blk blk;
+
+	merge();
+	fail_unless(fanout->rbuf->cmd==CMD_SIGS);
+	for(; *expected; expected+=2)
+	{
+		fail_unless(blk_batch_next(fanout->rbuf, &offset, &rec)==1);
+		fail_unless(!blk_set_from_iobuf_index_and_savepath(&blk, &rec));
+		fail_unless(blk.index==expected[0]);
+		fail_unless(blk.savepath==expected[1]);
+	}
+	fail_unless(!blk_batch_next(fanout->rbuf, &offset, &rec));
+	iobuf_free_content(fanout->rbuf);
+}
+
+static void expect_wrap_up(uint64_t index)
+{
+	struct blk blk;
+	merge();
+	fail_unless(fanout->rbuf->cmd==CMD_WRAP_UP);
+	fail_unless(!blk_set_from_iobuf_wrap_up(&blk, fanout->rbuf));
+	fail_unless(blk.index==index);
+	iobuf_free_content(fanout->rbuf);
+}
+
+START_TEST(test_champ_fanout_write)
+{
+	int i;
+	setup(4);
+	fail_unless(!fanout->write_str(fanout, CMD_GEN, "hello"));
+	for(i=0; i<SHARDS; i++)
+	{
+		cc_expect_str(i, "hello");
+		cc_expect_nothing(i);
+	}
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_fanout_append_blocked)
+{
+	struct iobuf wbuf;
+	setup(2);
+	// The second shard does not read anything yet, so it fills up.
+	iobuf_from_str(&wbuf, CMD_GEN, (char *)"a");
+	fail_unless(fanout->append_all_to_write_buffer(fanout, &wbuf)
+		==APPEND_OK);
+	iobuf_from_str(&wbuf, CMD_GEN, (char *)"b");
+	fail_unless(fanout->append_all_to_write_buffer(fanout, &wbuf)
+		==APPEND_OK);
+	cc_expect_str(0, "a");
+	cc_expect_str(0, "b");
+
+	iobuf_from_str(&wbuf, CMD_GEN, (char *)"c");
+	fail_unless(fanout->append_all_to_write_buffer(fanout, &wbuf)
+		==APPEND_BLOCKED);
+	fail_unless(wbuf.len==1);
+
+	// Trying again once there is room does not send it to the first
+	// shard twice.
+	cc_expect_str(1, "a");
+	fail_unless(fanout->append_all_to_write_buffer(fanout, &wbuf)
+		==APPEND_OK);
+	fail_unless(!wbuf.len);
+	cc_expect_str(0, "c");
+	cc_expect_nothing(0);
+	cc_expect_str(1, "b");
+	cc_expect_str(1, "c");
+	cc_expect_nothing(1);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_fanout_merge)
+{
+	uint64_t first[]={2, 20, 3, 30, 5, 50, 0};
+	uint64_t second[]={7, 70, 0};
+	setup(16);
+
+	cc_send_found(0, 2, 20);
+	cc_send_found(0, 5, 50);
+	cc_send_wrap_up(0, 6);
+	expect_nothing(); // The second shard has not said anything yet.
+
+	cc_send_found(1, 3, 30);
+	cc_send_found(1, 5, 51);
+	// Both shards found block 5, but it is only given out once.
+	expect_found(first);
+	expect_nothing();
+
+	// Neither found block 6.
+	cc_send_wrap_up(1, 8);
+	expect_wrap_up(6);
+	expect_nothing();
+
+	cc_send_found(0, 7, 70);
+	expect_found(second);
+	cc_send_wrap_up(0, 8);
+	expect_wrap_up(8);
+	expect_nothing();
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_fanout_bad_result)
+{
+	struct iobuf wbuf;
+	setup(4);
+	iobuf_from_str(&wbuf, CMD_GEN, (char *)"rubbish");
+	cc_send(0, &wbuf);
+	fail_unless(!as->read_write(as));
+	fail_unless(fanout->parse_readbuf(fanout)==-1);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_champ_fanout(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_champ_fanout");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_champ_fanout_write);
+	tcase_add_test(tc_core, test_champ_fanout_append_blocked);
+	tcase_add_test(tc_core, test_champ_fanout_merge);
+	tcase_add_test(tc_core, test_champ_fanout_bad_result);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
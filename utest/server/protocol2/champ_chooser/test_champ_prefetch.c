@@ -0,0 +1,161 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/iobuf.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_cache.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_prefetch.h"
+#include "../../../../src/server/protocol2/champ_chooser/hash.h"
+
+#define BASE	"utest_server_protocol2_champ_chooser_champ_prefetch"
+#define M	"client/0000001 1970-01-01 00:00:00/manifest/"
+
+static void tear_down(void)
+{
+	champ_prefetch_free();
+	champ_cache_free();
+	candidates_free();
+	hash_free();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void assert_next_path(const char *path, const char *expected)
+{
+	char *next=champ_prefetch_next_path(path);
+	if(!expected)
+	{
+		fail_unless(next==NULL);
+		return;
+	}
+	fail_unless(next!=NULL);
+	ck_assert_str_eq(next, expected);
+	free_w(&next);
+}
+
+START_TEST(test_champ_prefetch_next_path)
+{
+	assert_next_path(M "00000000", M "00000001");
+	assert_next_path(M "0000000F", M "00000010");
+	assert_next_path("00000009", "0000000A");
+	assert_next_path(M "0000000", NULL);
+	assert_next_path(M "0000000G", NULL);
+	assert_next_path(M "sparse", NULL);
+	assert_next_path("", NULL);
+	alloc_check();
+}
+END_TEST
+
+static struct candidate *add_manifest(const char *name, int blocks)
+{
+	int i;
+	char path[256];
+	struct blk blk;
+	struct iobuf iobuf;
+	struct fzp *fzp;
+	struct candidate *candidate;
+
+	snprintf(path, sizeof(path), BASE "/%s", name);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_gzopen(path, "wb"))!=NULL);
+	memset(&blk, 0, sizeof(blk));
+	for(i=0; i<blocks; i++)
+	{
+		blk.fingerprint=0xF000000000000000ULL|(uint64_t)i;
+		blk.savepath=(uint64_t)i;
+		blk_to_iobuf_sig_and_savepath(&blk, &iobuf);
+		fail_unless(!iobuf_send_msg_fzp(&iobuf, fzp));
+	}
+	fail_unless(!fzp_close(&fzp));
+
+	fail_unless((candidate=candidates_add_new())!=NULL);
+	fail_unless((candidate->path=strdup_w(name, __func__))!=NULL);
+	return candidate;
+}
+
+static void assert_stats(uint64_t hits, uint64_t misses, uint64_t prefetched)
+{
+	struct champ_cache_stats stats;
+	champ_cache_get_stats(&stats);
+	fail_unless(stats.hits==hits);
+	fail_unless(stats.misses==misses);
+	fail_unless(stats.prefetched==prefetched);
+}
+
+START_TEST(test_champ_prefetch)
+{
+	struct candidate *c[4];
+
+	fail_unless(!recursive_delete(BASE));
+	c[0]=add_manifest(M "00000000", 100);
+	c[1]=add_manifest(M "00000001", 100);
+	c[2]=add_manifest(M "00000002", 100);
+	c[3]=add_manifest(M "00000003", 100);
+	champ_cache_init(1024*1024);
+	fail_unless(!champ_prefetch_init());
+
+	fail_unless(champ_cache_load(c[0], BASE)==HASH_RET_OK);
+	fail_unless(!champ_prefetch_after(&c[0], 1, BASE));
+	fail_unless(!champ_prefetch_collect(c[1]));
+#ifdef HAVE_PTHREAD
+	fail_unless(champ_cache_has(c[1]));
+	hash_delete_all();
+	fail_unless(champ_cache_load(c[1], BASE)==HASH_RET_OK);
+	fail_unless(hash_table.used==100);
+	assert_stats(1, 1, 1);
+
+	// Already cached, or the next one is gone.
+	fail_unless(!champ_prefetch_after(&c[0], 1, BASE));
+	fail_unless(!recursive_delete(BASE "/" M "00000002"));
+	fail_unless(!champ_prefetch_after(&c[1], 1, BASE));
+	fail_unless(!champ_prefetch_collect(c[2]));
+	fail_unless(!champ_cache_has(c[2]));
+	assert_stats(1, 1, 1);
+
+	// Deleted candidates are left alone.
+	c[3]->deleted=1;
+	fail_unless(!champ_prefetch_after(&c[2], 1, BASE));
+	fail_unless(!champ_prefetch_collect(NULL));
+	fail_unless(!champ_cache_has(c[3]));
+#else
+	fail_unless(!champ_cache_has(c[1]));
+#endif
+
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_prefetch_cache_off)
+{
+	struct candidate *c[2];
+
+	fail_unless(!recursive_delete(BASE));
+	c[0]=add_manifest(M "00000000", 10);
+	c[1]=add_manifest(M "00000001", 10);
+	champ_cache_init(0);
+	fail_unless(!champ_prefetch_init());
+	fail_unless(!champ_prefetch_after(&c[0], 1, BASE));
+	fail_unless(!champ_prefetch_collect(c[1]));
+	fail_unless(!champ_cache_has(c[1]));
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_champ_prefetch(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_champ_prefetch");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_champ_prefetch_next_path);
+	tcase_add_test(tc_core, test_champ_prefetch);
+	tcase_add_test(tc_core, test_champ_prefetch_cache_off);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,164 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/asfd.h"
+#include "../../../../src/async.h"
+#include "../../../../src/iobuf.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_queue.h"
+
+static struct async *as[2];
+static struct asfd *asfd[2];
+static struct champ_queue *queue;
+
+static void setup(size_t slots)
+{
+	int i;
+	fail_unless((queue=champ_queue_alloc(slots))!=NULL);
+	for(i=0; i<2; i++)
+	{
+		fail_unless((as[i]=async_alloc())!=NULL);
+		fail_unless(!as[i]->init(as[i], 0));
+		fail_unless((asfd[i]=champ_queue_setup_asfd(as[i],
+			"queue", queue, i))!=NULL);
+		// Do not wait around in select().
+		as[i]->setsec=0;
+		as[i]->setusec=1000;
+	}
+}
+
+static void tear_down(void)
+{
+	async_asfd_free_all(&as[0]);
+	async_asfd_free_all(&as[1]);
+	champ_queue_free(&queue);
+	alloc_check();
+}
+
+static void send_str(struct asfd *a, const char *str)
+{
+	struct iobuf wbuf;
+	iobuf_from_str(&wbuf, CMD_GEN, (char *)str);
+	fail_unless(a->append_all_to_write_buffer(a, &wbuf)==APPEND_OK);
+	fail_unless(!wbuf.len);
+}
+
+static void expect_str(struct asfd *a, const char *str)
+{
+	fail_unless(!a->read(a));
+	fail_unless(a->rbuf->cmd==CMD_GEN);
+	fail_unless(a->rbuf->len==strlen(str));
+	ck_assert_str_eq(a->rbuf->buf, str);
+	iobuf_free_content(a->rbuf);
+}
+
+START_TEST(test_champ_queue_both_ways)
+{
+	setup(4);
+	send_str(asfd[0], "one");
+	send_str(asfd[0], "two");
+	send_str(asfd[1], "three");
+	expect_str(asfd[1], "one");
+	expect_str(asfd[1], "two");
+	expect_str(asfd[0], "three");
+	fail_unless(asfd[0]->sent==6);
+	fail_unless(asfd[1]->rcvd==6);
+	tear_down();
+}
+END_TEST
+
+static int wake_ups_waiting(struct asfd *a)
+{
+	int count=0;
+	char buf[16];
+	ssize_t r;
+	while((r=recv(a->fd, buf, sizeof(buf), MSG_DONTWAIT))>0)
+		count+=(int)r;
+	return count;
+}
+
+START_TEST(test_champ_queue_wake_ups)
+{
+	setup(4);
+	// Only going from empty to not empty wakes up the reader.
+	send_str(asfd[0], "one");
+	send_str(asfd[0], "two");
+	send_str(asfd[0], "three");
+	fail_unless(wake_ups_waiting(asfd[1])==1);
+	expect_str(asfd[1], "one");
+	send_str(asfd[0], "four");
+	fail_unless(!wake_ups_waiting(asfd[1]));
+	expect_str(asfd[1], "two");
+	expect_str(asfd[1], "three");
+	expect_str(asfd[1], "four");
+	send_str(asfd[0], "five");
+	fail_unless(wake_ups_waiting(asfd[1])==1);
+	expect_str(asfd[1], "five");
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_queue_full)
+{
+	int i;
+	struct iobuf wbuf;
+	setup(3); // Rounded up to 4.
+	for(i=0; i<4; i++)
+		send_str(asfd[0], "x");
+	iobuf_from_str(&wbuf, CMD_GEN, (char *)"y");
+	fail_unless(asfd[0]->append_all_to_write_buffer(asfd[0], &wbuf)
+		==APPEND_BLOCKED);
+	fail_unless(wbuf.len==1);
+
+	// Taking one makes room, and wakes up the writer.
+	expect_str(asfd[1], "x");
+	fail_unless(!as[0]->read_write(as[0]));
+	fail_unless(asfd[0]->append_all_to_write_buffer(asfd[0], &wbuf)
+		==APPEND_OK);
+	for(i=0; i<3; i++)
+		expect_str(asfd[1], "x");
+	expect_str(asfd[1], "y");
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_queue_other_end_gone)
+{
+	setup(4);
+	send_str(asfd[0], "last");
+	as[0]->asfd_remove(as[0], asfd[0]);
+	asfd_free(&asfd[0]);
+
+	// Whatever was sent before going is still read.
+	expect_str(asfd[1], "last");
+	fail_unless(asfd[1]->read(asfd[1])==-1);
+	fail_unless(asfd[1]->want_to_remove);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_champ_queue_free_unread)
+{
+	setup(4);
+	send_str(asfd[0], "never");
+	send_str(asfd[0], "read");
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_champ_queue(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_champ_queue");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_champ_queue_both_ways);
+	tcase_add_test(tc_core, test_champ_queue_wake_ups);
+	tcase_add_test(tc_core, test_champ_queue_full);
+	tcase_add_test(tc_core, test_champ_queue_other_end_gone);
+	tcase_add_test(tc_core, test_champ_queue_free_unread);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
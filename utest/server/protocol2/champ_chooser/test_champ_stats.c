@@ -0,0 +1,119 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/asfd.h"
+#include "../../../../src/async.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/server/protocol2/champ_chooser/champ_stats.h"
+
+#define BASE	"utest_server_protocol2_champ_chooser_champ_stats"
+#define STATS	BASE "/cc.stats"
+
+static void tear_down(struct async **as)
+{
+	async_asfd_free_all(as);
+	champ_stats_reset();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static struct asfd *add_asfd(struct async *as, const char *desc)
+{
+	struct asfd *asfd;
+	fail_unless((asfd=asfd_alloc())!=NULL);
+	fail_unless((asfd->desc=strdup_w(desc, __func__))!=NULL);
+	asfd->fd=-1;
+	as->asfd_add(as, asfd);
+	return asfd;
+}
+
+static void assert_line(const char *line)
+{
+	int found=0;
+	char buf[256];
+	struct fzp *fzp;
+	fail_unless((fzp=fzp_open(STATS, "rb"))!=NULL);
+	while(!found && fzp_gets(fzp, buf, sizeof(buf)))
+	{
+		buf[strcspn(buf, "\n")]='\0';
+		found=!strcmp(buf, line);
+	}
+	fzp_close(&fzp);
+	fail_unless(found);
+}
+
+START_TEST(test_champ_stats_write)
+{
+	struct asfd *asfd;
+	struct async *as;
+	struct stat statp;
+
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(STATS));
+	fail_unless((as=async_alloc())!=NULL);
+	as->init(as, 0 /* estimate */);
+	add_asfd(as, "listener");
+	asfd=add_asfd(as, "cli1");
+	asfd->blkcnt=100;
+	asfd->writebuflen=20;
+	asfd=add_asfd(as, "cli2");
+	asfd->blkcnt=5;
+
+	champ_stats_reset();
+	champ_stats.segments=4;
+	champ_stats.champs_loaded=7;
+	champ_stats.blocks=400;
+	champ_stats.blocks_found=100;
+	champ_stats.score_ns=3000000;
+	champ_stats.load_ns=12000000;
+	fail_unless(!champ_stats_write(STATS, as, 2));
+
+	assert_line("shard:2");
+	assert_line("segments:4");
+	assert_line("champs_loaded:7");
+	assert_line("blocks:400");
+	assert_line("blocks_found:100");
+	assert_line("hit_percent:25.00");
+	assert_line("score_ms:3");
+	assert_line("load_ms:12");
+	assert_line("backups:2");
+	assert_line("backup:cli1 fd:-1 queued:100 unsent:20");
+	assert_line("backup:cli2 fd:-1 queued:5 unsent:0");
+	fail_unless(lstat(STATS ".tmp", &statp));
+
+	// Not rewritten until the interval has passed.
+	champ_stats.segments=5;
+	champ_stats_write_maybe(STATS, as, 2);
+	assert_line("segments:4");
+
+	tear_down(&as);
+}
+END_TEST
+
+START_TEST(test_champ_stats_write_alloc_error)
+{
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!build_path_w(STATS));
+	champ_stats_reset();
+	alloc_errors=1;
+	fail_unless(champ_stats_write(STATS, NULL, 0)==-1);
+	alloc_errors=0;
+	tear_down(NULL);
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_champ_stats(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_champ_stats");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_champ_stats_write);
+	tcase_add_test(tc_core, test_champ_stats_write_alloc_error);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
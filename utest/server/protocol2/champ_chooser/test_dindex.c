@@ -9,6 +9,7 @@
 #include "../../../../src/hexmap.h"
 #include "../../../../src/prepend.h"
 #include "../../../../src/server/protocol2/champ_chooser/dindex.h"
+#include "../../../../src/server/protocol2/champ_chooser/gc.h"
 #include "../../../../src/server/sdirs.h"
 
 #define CNAME	"utestclient"
@@ -100,6 +101,17 @@ static void assert_existences(const char *dir,
 		assert_existence(dir, arr[l], exists);
 }
 
+// Delete everything that is in the queue.
+static void run_gc(const char *datadir)
+{
+	int r;
+	fail_unless(!gc_init(datadir, 0));
+	while(!(r=gc_step(0)))
+		;
+	fail_unless(r==1);
+	gc_free();
+}
+
 static void common_di(uint64_t *dold, size_t dolen,
 	uint64_t *dnew, size_t dnlen,
 	uint64_t *deleted, size_t deletedlen)
@@ -107,17 +119,24 @@ static void common_di(uint64_t *dold, size_t dolen,
 	struct sdirs *sdirs;
 	char *dold_path;
 	char *dnew_path;
+	char *unused_path;
+	uint64_t count=0;
 	sdirs=setup();
 	fail_unless((dold_path=prepend_s(sdirs->data, "dindex.old"))!=NULL);
 	fail_unless((dnew_path=prepend_s(sdirs->data, "dindex.new"))!=NULL);
+	fail_unless((unused_path=prepend_s(sdirs->data, "unused"))!=NULL);
 	build_dindex(dold, dolen, dold_path);
 	build_dindex(dnew, dnlen, dnew_path);
 
 	create_data_files(sdirs->data, dold, dolen);
 	create_data_files(sdirs->data, dnew, dnlen);
 
-	fail_unless(!compare_dindexes_and_unlink_datafiles(dold_path,
-		dnew_path, sdirs->data));
+	fail_unless(!compare_dindexes(dold_path,
+		dnew_path, unused_path, &count));
+	fail_unless(count==deletedlen);
+	if(count)
+		fail_unless(!gc_queue_add(sdirs->data, unused_path));
+	run_gc(sdirs->data);
 	assert_existences(sdirs->data,
 		deleted, deletedlen, 0 /* does not exist */);
 	assert_existences(sdirs->data,
@@ -125,6 +144,7 @@ static void common_di(uint64_t *dold, size_t dolen,
 
 	free_w(&dold_path);
 	free_w(&dnew_path);
+	free_w(&unused_path);
 	tear_down(&sdirs);
 }
 
@@ -240,6 +260,7 @@ static void do_delete_unused_data_files(
 	create_data_files(sdirs->data, dfiles, dfileslen);
 
 	fail_unless(!delete_unused_data_files(sdirs, resume));
+	run_gc(sdirs->data);
 
 	assert_existences(sdirs->data,
 		exists, existslen, 1 /* does exist */);
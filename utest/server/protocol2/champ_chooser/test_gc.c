@@ -0,0 +1,239 @@
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <utime.h>
+#include "../../../test.h"
+#include "../../../builders/server/protocol2/champ_chooser/build_dindex.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/hexmap.h"
+#include "../../../../src/prepend.h"
+#include "../../../../src/server/protocol2/champ_chooser/gc.h"
+#include "../../../../src/server/protocol2/dfidx.h"
+
+#define BASE		"utest_gc"
+#define DATA_LEN	100
+
+static uint64_t savepaths[GC_STEP_FILES*2];
+
+static char *get_path(uint64_t savepath)
+{
+	char *path=NULL;
+	fail_unless((path=prepend_s(BASE,
+		uint64_to_savepathstr(savepath)))!=NULL);
+	return path;
+}
+
+static void create_data_file(uint64_t savepath, time_t mtime)
+{
+	FILE *fp;
+	char *path;
+	char *idx;
+	char buf[DATA_LEN];
+	struct utimbuf times;
+
+	memset(buf, 'a', sizeof(buf));
+	path=get_path(savepath);
+	fail_unless(!build_path_w(path));
+	fail_unless((fp=fopen(path, "wb"))!=NULL);
+	fail_unless(fwrite(buf, 1, sizeof(buf), fp)==sizeof(buf));
+	fail_unless(!fclose(fp));
+	fail_unless((idx=dfidx_path(path))!=NULL);
+	fail_unless((fp=fopen(idx, "wb"))!=NULL);
+	fail_unless(!fclose(fp));
+	if(mtime)
+	{
+		times.actime=mtime;
+		times.modtime=mtime;
+		fail_unless(!utime(path, &times));
+	}
+	free_w(&path);
+	free_w(&idx);
+}
+
+static int exists(uint64_t savepath)
+{
+	int ret;
+	char *path;
+	char *idx;
+	struct stat statp;
+	path=get_path(savepath);
+	fail_unless((idx=dfidx_path(path))!=NULL);
+	ret=!lstat(path, &statp);
+	// The index goes with its data file.
+	fail_unless(ret==!lstat(idx, &statp));
+	free_w(&path);
+	free_w(&idx);
+	return ret;
+}
+
+static int count_existing(void)
+{
+	size_t i;
+	int count=0;
+	for(i=0; i<ARR_LEN(savepaths); i++)
+		count+=exists(savepaths[i]);
+	return count;
+}
+
+static int base_has(const char *fname)
+{
+	int ret;
+	char *path;
+	struct stat statp;
+	fail_unless((path=prepend_s(BASE, fname))!=NULL);
+	ret=!lstat(path, &statp);
+	free_w(&path);
+	return ret;
+}
+
+static void queue(uint64_t *arr, size_t len)
+{
+	char *unused;
+	fail_unless((unused=prepend_s(BASE, "unused"))!=NULL);
+	build_dindex(arr, len, unused);
+	fail_unless(!gc_queue_add(BASE, unused));
+	fail_unless(!base_has("unused"));
+	free_w(&unused);
+}
+
+static void setup(void)
+{
+	size_t i;
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless(!mkdir(BASE, 0777));
+	for(i=0; i<ARR_LEN(savepaths); i++)
+	{
+		savepaths[i]=0x1111222200000000ULL+(i<<16);
+		create_data_file(savepaths[i], 0);
+	}
+}
+
+static void tear_down(void)
+{
+	gc_free();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+START_TEST(test_gc_nothing_queued)
+{
+	setup();
+	fail_unless(!gc_init(BASE, 0));
+	fail_unless(gc_step(0)==1);
+	fail_unless(count_existing()==ARR_LEN(savepaths));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_gc_steps)
+{
+	setup();
+	queue(savepaths, ARR_LEN(savepaths));
+	fail_unless(!gc_init(BASE, 0));
+	fail_unless(gc_step(0)==0);
+	fail_unless(count_existing()==GC_STEP_FILES);
+	fail_unless(base_has("gc_queue.pos"));
+	fail_unless(gc_step(0)==0);
+	fail_unless(count_existing()==0);
+	fail_unless(gc_step(0)==1);
+	fail_unless(!base_has("gc_queue"));
+	fail_unless(!base_has("gc_queue.pos"));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_gc_resume)
+{
+	setup();
+	queue(savepaths, ARR_LEN(savepaths));
+	fail_unless(!gc_init(BASE, 0));
+	fail_unless(gc_step(0)==0);
+	gc_free();
+
+	// Put back one that was done, to show that it is not done again.
+	create_data_file(savepaths[0], 1);
+	fail_unless(!gc_init(BASE, 0));
+	fail_unless(gc_step(0)==0);
+	fail_unless(gc_step(0)==1);
+	fail_unless(count_existing()==1);
+	fail_unless(exists(savepaths[0]));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_gc_rate)
+{
+	setup();
+	queue(savepaths, ARR_LEN(savepaths));
+	fail_unless(!gc_init(BASE, DATA_LEN*2));
+	fail_unless(gc_step(1000)==0);
+	fail_unless(count_existing()==ARR_LEN(savepaths)-2);
+	fail_unless(gc_step(1000)==0);
+	fail_unless(count_existing()==ARR_LEN(savepaths)-2);
+	fail_unless(gc_step(1001)==0);
+	fail_unless(count_existing()==ARR_LEN(savepaths)-4);
+	// Time spent idle does not build up more than a second's worth.
+	fail_unless(gc_step(2000)==0);
+	fail_unless(count_existing()==ARR_LEN(savepaths)-6);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_gc_changed_since_queued)
+{
+	setup();
+	queue(savepaths, 3);
+	create_data_file(savepaths[1], time(NULL)+1000);
+	fail_unless(!gc_init(BASE, 0));
+	fail_unless(gc_step(0)==1);
+	fail_unless(!exists(savepaths[0]));
+	fail_unless(exists(savepaths[1]));
+	fail_unless(!exists(savepaths[2]));
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_gc_queue_add_merges)
+{
+	setup();
+	queue(savepaths, 3);
+	fail_unless(!gc_init(BASE, DATA_LEN));
+	fail_unless(gc_step(1000)==0);
+	fail_unless(!exists(savepaths[0]));
+	gc_free();
+	fail_unless(base_has("gc_queue.pos"));
+
+	// Adding more starts the queue from the beginning again.
+	queue(savepaths+2, 2);
+	fail_unless(!base_has("gc_queue.pos"));
+	fail_unless(!gc_init(BASE, 0));
+	fail_unless(gc_step(0)==1);
+	fail_unless(count_existing()==ARR_LEN(savepaths)-4);
+	fail_unless(!exists(savepaths[3]));
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_gc(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_gc");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+
+	tcase_add_test(tc_core, test_gc_nothing_queued);
+	tcase_add_test(tc_core, test_gc_steps);
+	tcase_add_test(tc_core, test_gc_resume);
+	tcase_add_test(tc_core, test_gc_rate);
+	tcase_add_test(tc_core, test_gc_changed_since_queued);
+	tcase_add_test(tc_core, test_gc_queue_add_merges);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
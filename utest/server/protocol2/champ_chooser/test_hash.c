@@ -1,41 +1,124 @@
 #include "../../../test.h"
 #include "../../../../src/alloc.h"
+#include "../../../../src/protocol2/blk.h"
 #include "../../../../src/server/protocol2/champ_chooser/hash.h"
 
 static void tear_down(void)
 {
-	hash_delete_all();
+	hash_free();
 	alloc_check();
 }
 
-START_TEST(test_hash_weak_add_alloc_error)
+static void set_blk(struct blk *blk, uint64_t weak, uint8_t strong,
+	uint64_t savepath)
 {
-	uint64_t f0=0xFF11223344556699;
+	memset(blk, 0, sizeof(*blk));
+	blk->fingerprint=weak;
+	memset(blk->md5sum, strong, MD5_DIGEST_LENGTH);
+	blk->savepath=savepath;
+}
+
+static void assert_found(uint64_t weak, uint8_t strong, uint64_t savepath)
+{
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+	struct hash_entry *e;
+	memset(md5sum, strong, MD5_DIGEST_LENGTH);
+	fail_unless((e=hash_find(weak, md5sum))!=NULL);
+	fail_unless(e->savepath==savepath);
+}
+
+static void assert_not_found(uint64_t weak, uint8_t strong)
+{
+	uint8_t md5sum[MD5_DIGEST_LENGTH];
+	memset(md5sum, strong, MD5_DIGEST_LENGTH);
+	fail_unless(hash_find(weak, md5sum)==NULL);
+}
+
+START_TEST(test_hash_load_blk_alloc_error)
+{
+	struct blk blk;
+	set_blk(&blk, 0xFF11223344556699, 1, 1);
 	alloc_errors=1;
-	fail_unless(!hash_weak_add(f0));
+	fail_unless(hash_load_blk(&blk)==-1);
+	assert_not_found(0xFF11223344556699, 1);
 	tear_down();
 }
 END_TEST
 
-START_TEST(test_hash_weak_add)
+START_TEST(test_hash_load_blk)
 {
+	struct blk blk;
 	uint64_t f0=0xFF11223344556699;
 	uint64_t f1=0xFF11223344556690;
 	uint64_t f2=0xFF00112233445566;
-	uint64_t f3=0xFF001122AA445566;
-	fail_unless(hash_weak_add(f0)!=NULL);
-	fail_unless(hash_weak_add(f1)!=NULL);
-	fail_unless(hash_weak_find(f0)!=NULL);
-	fail_unless(hash_weak_find(f1)!=NULL);
-	fail_unless(hash_weak_find(f2)==NULL);
-	fail_unless(hash_weak_find(f3)==NULL);
+
+	set_blk(&blk, f0, 1, 10);
+	fail_unless(!hash_load_blk(&blk));
+	set_blk(&blk, f1, 1, 11);
+	fail_unless(!hash_load_blk(&blk));
+	// Same weak checksum, different strong one.
+	set_blk(&blk, f0, 2, 12);
+	fail_unless(!hash_load_blk(&blk));
+	// Already there, so the first savepath is kept.
+	set_blk(&blk, f0, 1, 13);
+	fail_unless(!hash_load_blk(&blk));
+	fail_unless(hash_table.used==3);
+
+	assert_found(f0, 1, 10);
+	assert_found(f1, 1, 11);
+	assert_found(f0, 2, 12);
+	assert_not_found(f1, 2);
+	assert_not_found(f2, 1);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_hash_grow)
+{
+	uint64_t i;
+	struct blk blk;
+	for(i=0; i<10000; i++)
+	{
+		set_blk(&blk, i<<40, (uint8_t)i, i+1);
+		fail_unless(!hash_load_blk(&blk));
+	}
+	fail_unless(hash_table.used==10000);
+	fail_unless(hash_table.used*2<=hash_table.size);
+	for(i=0; i<10000; i++)
+		assert_found(i<<40, (uint8_t)i, i+1);
+	assert_not_found(i<<40, (uint8_t)i);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_hash_delete_all)
+{
+	int i;
+	size_t size;
+	struct blk blk;
+
+	set_blk(&blk, 0xFF11223344556699, 1, 1);
+	fail_unless(!hash_load_blk(&blk));
+	size=hash_table.size;
+	// Enough to wrap the slot generations around.
+	for(i=0; i<600; i++)
+	{
+		hash_delete_all();
+		fail_unless(!hash_table.used);
+		fail_unless(hash_table.size==size);
+		assert_not_found(0xFF11223344556699, 1);
+		set_blk(&blk, 0xFF11223344556699, 1, i);
+		fail_unless(!hash_load_blk(&blk));
+		assert_found(0xFF11223344556699, 1, i);
+		fail_unless(hash_table.used==1);
+	}
 	tear_down();
 }
 END_TEST
 
 START_TEST(test_hash_load_fail_to_open)
 {
-	fail_unless(hash_load("champ", "dir")==HASH_RET_TEMP);
+	fail_unless(hash_load("champ", "dir", NULL)==HASH_RET_TEMP);
 }
 END_TEST
 
@@ -48,8 +131,10 @@ Suite *suite_server_protocol2_champ_chooser_hash(void)
 
 	tc_core=tcase_create("Core");
 
-	tcase_add_test(tc_core, test_hash_weak_add_alloc_error);
-	tcase_add_test(tc_core, test_hash_weak_add);
+	tcase_add_test(tc_core, test_hash_load_blk_alloc_error);
+	tcase_add_test(tc_core, test_hash_load_blk);
+	tcase_add_test(tc_core, test_hash_grow);
+	tcase_add_test(tc_core, test_hash_delete_all);
 	tcase_add_test(tc_core, test_hash_load_fail_to_open);
 	suite_add_tcase(s, tc_core);
 
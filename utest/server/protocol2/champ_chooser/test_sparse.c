@@ -62,6 +62,9 @@ START_TEST(test_sparse_add_many)
 	fail_unless(!sparse_add_candidate(&f2, candidate5)); // Try same again. 
 
 	fail_unless((sparse=sparse_find(&f0))==NULL);
+	fail_unless(!sparse_maybe(f0));
+	fail_unless(sparse_maybe(f1));
+	fail_unless(sparse_maybe(f2));
 
 	fail_unless((sparse=sparse_find(&f1))!=NULL);
 	fail_unless(sparse->size==2);
@@ -84,6 +87,29 @@ START_TEST(test_sparse_add_many)
 }
 END_TEST
 
+START_TEST(test_sparse_shards)
+{
+	int i;
+	int count[3]={0, 0, 0};
+	uint64_t f;
+
+	for(i=0; i<3000; i++)
+	{
+		// Hooks all have the same top bits.
+		f=0xF000000000000000ULL|((uint64_t)i<<8);
+		count[sparse_shard_of(f, 3)]++;
+		sparse_set_shard(1, 3);
+		fail_unless(sparse_in_shard(f)==(sparse_shard_of(f, 3)==1));
+		sparse_set_shard(0, 1);
+		fail_unless(sparse_in_shard(f));
+	}
+	// Spread out fairly evenly.
+	for(i=0; i<3; i++)
+		fail_unless(count[i]>800);
+	tear_down();
+}
+END_TEST
+
 Suite *suite_server_protocol2_champ_chooser_sparse(void)
 {
 	Suite *s;
@@ -96,6 +122,7 @@ Suite *suite_server_protocol2_champ_chooser_sparse(void)
 	tcase_add_test(tc_core, test_sparse_add_alloc_error);
 	tcase_add_test(tc_core, test_sparse_add_one);
 	tcase_add_test(tc_core, test_sparse_add_many);
+	tcase_add_test(tc_core, test_sparse_shards);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,334 @@
+#include "../../../test.h"
+#include "../../../../src/alloc.h"
+#include "../../../../src/fsops.h"
+#include "../../../../src/fzp.h"
+#include "../../../../src/hexmap.h"
+#include "../../../../src/protocol2/blk.h"
+#include "../../../../src/server/protocol2/backup_phase4.h"
+#include "../../../../src/server/protocol2/champ_chooser/candidate.h"
+#include "../../../../src/server/protocol2/champ_chooser/incoming.h"
+#include "../../../../src/server/protocol2/champ_chooser/scores.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse.h"
+#include "../../../../src/server/protocol2/champ_chooser/sparse_map.h"
+
+#define BASE	"utest_server_protocol2_champ_chooser_sparse_map"
+#define SPARSE	BASE "/sparse"
+#define MAP	BASE "/sparse.map"
+
+#define H0	0xF000000000000001ULL
+#define H1	0xF100000000000002ULL
+#define H2	0xF200000000000003ULL
+#define H3	0xF300000000000004ULL
+#define NOT_HOOK	0x0100000000000005ULL
+
+static void tear_down(void)
+{
+	candidates_free();
+	sparse_delete_all();
+	sparse_map_close();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void write_manifest(struct fzp *fzp, const char *path,
+	uint64_t *f, size_t len)
+{
+	size_t i;
+	fzp_printf(fzp, "%c%04lX%s\n", CMD_MANIFEST, strlen(path), path);
+	for(i=0; i<len; i++)
+		fail_unless(!to_fzp_fingerprint(fzp, f[i]));
+}
+
+static void build_sparse(int extra)
+{
+	struct fzp *fzp;
+	uint64_t f0[]={H0, H1, NOT_HOOK};
+	uint64_t f1[]={H1, H1, H2};
+	uint64_t f2[]={H2, H0};
+	uint64_t f3[]={H3};
+
+	fail_unless(!build_path_w(SPARSE));
+	fail_unless((fzp=fzp_gzopen(SPARSE, "wb"))!=NULL);
+	write_manifest(fzp, "a/manifest/0", f0, 3);
+	write_manifest(fzp, "b/manifest/1", f1, 3);
+	write_manifest(fzp, "c/manifest/2", f2, 2);
+	if(extra)
+		write_manifest(fzp, "d/manifest/3", f3, 1);
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void assert_refs(uint64_t fingerprint, uint32_t *expected, size_t len)
+{
+	size_t i;
+	size_t count=0;
+	const uint32_t *refs;
+	refs=sparse_map_find(fingerprint, &count);
+	if(!len)
+	{
+		fail_unless(refs==NULL);
+		return;
+	}
+	fail_unless(refs!=NULL);
+	fail_unless(count==len);
+	for(i=0; i<len; i++)
+		fail_unless(refs[i]==expected[i]);
+}
+
+START_TEST(test_sparse_map_load)
+{
+	struct scores *scores;
+	uint32_t r0[]={0, 2};
+	uint32_t r1[]={0, 1};
+	uint32_t r2[]={1, 2};
+
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	build_sparse(0);
+	fail_unless(!sparse_map_write(SPARSE));
+	fail_unless(is_reg_lstat(MAP)==1);
+
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(!sparse_map_load(SPARSE, scores));
+	fail_unless(candidates_len==3);
+	fail_unless(scores->size==3);
+	ck_assert_str_eq(candidates[0]->path, "a/manifest/0");
+	ck_assert_str_eq(candidates[1]->path, "b/manifest/1");
+	ck_assert_str_eq(candidates[2]->path, "c/manifest/2");
+
+	assert_refs(H0, r0, 2);
+	assert_refs(H1, r1, 2);
+	assert_refs(H2, r2, 2);
+	assert_refs(H3, NULL, 0);
+	assert_refs(NOT_HOOK, NULL, 0);
+
+	fail_unless(!sparse_bloom_rebuild());
+	fail_unless(sparse_maybe(H0));
+	fail_unless(sparse_maybe(H1));
+	fail_unless(sparse_maybe(H2));
+	fail_unless(!sparse_maybe(H3));
+
+	// Only the hooks that belong to this shard are found.
+	sparse_set_shard(sparse_shard_of(H0, 7)==0?1:0, 7);
+	assert_refs(H0, NULL, 0);
+	sparse_set_shard(0, 1);
+
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_sparse_map_out_of_date)
+{
+	struct scores *scores;
+
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((scores=scores_alloc())!=NULL);
+
+	// No sparse index, so no map.
+	fail_unless(!sparse_map_write(SPARSE));
+	fail_unless(is_reg_lstat(MAP)<=0);
+	fail_unless(sparse_map_load(SPARSE, scores)==1);
+
+	build_sparse(0);
+	fail_unless(!sparse_map_write(SPARSE));
+	build_sparse(1);
+	fail_unless(sparse_map_load(SPARSE, scores)==1);
+	fail_unless(!candidates_len);
+
+	fail_unless(!sparse_map_write(SPARSE));
+	fail_unless(!sparse_map_load(SPARSE, scores));
+	fail_unless(candidates_len==4);
+
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
+// The map starts with a header of nine 64 bit fields. These are the ones
+// with the counts in.
+#define HDR_FIELDS	9
+#define HDR_CANDIDATES	5
+#define HDR_SLOTS	6
+#define HDR_REFS	7
+
+enum corruption
+{
+	CORRUPT_SLOT,
+	CORRUPT_REF
+};
+
+static void corrupt_map(enum corruption corruption)
+{
+	FILE *fp;
+	uint64_t i;
+	uint64_t slot[2];
+	uint32_t ref=99;
+	uint64_t h[HDR_FIELDS];
+	long slots_start;
+	long refs_start;
+
+	fail_unless((fp=fopen(MAP, "r+b"))!=NULL);
+	fail_unless(fread(h, sizeof(h), 1, fp)==1);
+	slots_start=sizeof(h)+h[HDR_CANDIDATES]*sizeof(uint64_t);
+	refs_start=slots_start+h[HDR_SLOTS]*sizeof(slot);
+	switch(corruption)
+	{
+		case CORRUPT_SLOT:
+			// Point the first hook past the end of the references.
+			for(i=0; i<h[HDR_SLOTS]; i++)
+			{
+				fail_unless(!fseek(fp,
+					slots_start+i*sizeof(slot), SEEK_SET));
+				fail_unless(fread(slot, sizeof(slot), 1, fp)==1);
+				if(slot[0])
+					break;
+			}
+			fail_unless(i<h[HDR_SLOTS]);
+			((uint32_t *)&slot[1])[1]=(uint32_t)h[HDR_REFS]+1;
+			fail_unless(!fseek(fp,
+				slots_start+i*sizeof(slot), SEEK_SET));
+			fail_unless(fwrite(slot, sizeof(slot), 1, fp)==1);
+			break;
+		case CORRUPT_REF:
+			// A candidate that does not exist.
+			fail_unless(!fseek(fp, refs_start, SEEK_SET));
+			fail_unless(fwrite(&ref, sizeof(ref), 1, fp)==1);
+			break;
+	}
+	fail_unless(!fclose(fp));
+}
+
+static void do_test_sparse_map_corrupt(enum corruption corruption)
+{
+	struct scores *scores;
+
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((scores=scores_alloc())!=NULL);
+	build_sparse(0);
+	fail_unless(!sparse_map_write(SPARSE));
+	corrupt_map(corruption);
+	fail_unless(sparse_map_load(SPARSE, scores)==1);
+	fail_unless(!candidates_len);
+
+	// The sparse index itself can still be read.
+	fail_unless(candidate_load(NULL, SPARSE, scores)==CAND_RET_OK);
+	fail_unless(candidates_len==3);
+
+	scores_free(&scores);
+	tear_down();
+}
+
+START_TEST(test_sparse_map_corrupt_slot)
+{
+	do_test_sparse_map_corrupt(CORRUPT_SLOT);
+}
+END_TEST
+
+START_TEST(test_sparse_map_corrupt_ref)
+{
+	do_test_sparse_map_corrupt(CORRUPT_REF);
+}
+END_TEST
+
+// The map is only a cache, so the sparse index gets updated even if the map
+// cannot be written, and the old map does not get used after that.
+START_TEST(test_sparse_map_write_fails)
+{
+	struct scores *scores;
+
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	fail_unless((scores=scores_alloc())!=NULL);
+	build_sparse(0);
+	fail_unless(!sparse_map_write(SPARSE));
+	fail_unless(is_reg_lstat(MAP)==1);
+	fail_unless(!mkdir(MAP ".tmp", 0777));
+
+	fail_unless(!remove_backup_from_global_sparse(SPARSE, "b"));
+	fail_unless(is_reg_lstat(MAP)<=0);
+	fail_unless(sparse_map_load(SPARSE, scores)==1);
+	fail_unless(candidate_load(NULL, SPARSE, scores)==CAND_RET_OK);
+	fail_unless(candidates_len==2);
+
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
+static struct candidate *choose(struct incoming *in, struct scores *scores)
+{
+	struct candidate *champ;
+	incoming_found_reset(in);
+	fail_unless((champ=candidates_choose_champ(in, NULL, scores))!=NULL);
+	// Choosing again with the last champ excluded.
+	return candidates_choose_champ(in, champ, scores);
+}
+
+START_TEST(test_sparse_map_choose_champ)
+{
+	size_t i;
+	char *first;
+	char *second;
+	struct candidate *champ;
+	struct scores *scores;
+	struct incoming *in;
+	uint64_t f[]={H0, H1, H2, H2};
+
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	build_sparse(0);
+	fail_unless((in=incoming_alloc())!=NULL);
+	for(i=0; i<4; i++)
+	{
+		fail_unless(!incoming_grow_maybe(in));
+		in->fingerprints[i]=f[i];
+	}
+
+	// Reading the sparse index and mapping it give the same champs.
+	fail_unless((scores=scores_alloc())!=NULL);
+	fail_unless(candidate_load(NULL, SPARSE, scores)==CAND_RET_OK);
+	incoming_found_reset(in);
+	fail_unless((champ=candidates_choose_champ(in, NULL, scores))!=NULL);
+	fail_unless((first=strdup_w(champ->path, __func__))!=NULL);
+	fail_unless((champ=choose(in, scores))!=NULL);
+	fail_unless((second=strdup_w(champ->path, __func__))!=NULL);
+	candidates_free();
+	sparse_delete_all();
+
+	fail_unless(!sparse_map_write(SPARSE));
+	fail_unless(!sparse_map_load(SPARSE, scores));
+	incoming_found_reset(in);
+	fail_unless((champ=candidates_choose_champ(in, NULL, scores))!=NULL);
+	ck_assert_str_eq(champ->path, first);
+	fail_unless((champ=choose(in, scores))!=NULL);
+	ck_assert_str_eq(champ->path, second);
+
+	free_w(&first);
+	free_w(&second);
+	incoming_free(&in);
+	scores_free(&scores);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_champ_chooser_sparse_map(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_champ_chooser_sparse_map");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_sparse_map_load);
+	tcase_add_test(tc_core, test_sparse_map_out_of_date);
+	tcase_add_test(tc_core, test_sparse_map_corrupt_slot);
+	tcase_add_test(tc_core, test_sparse_map_corrupt_ref);
+	tcase_add_test(tc_core, test_sparse_map_write_fails);
+	tcase_add_test(tc_core, test_sparse_map_choose_champ);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
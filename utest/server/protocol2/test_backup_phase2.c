@@ -298,6 +298,7 @@ static void setup_reads_from_slist(struct asfd *asfd,
 	struct blk blk;
 	struct iobuf iobuf;
 	if(!slist) return;
+	memset(&blk, 0, sizeof(blk));
 	for(s=slist->head; s; s=s->next)
 	{
 		if(sbuf_is_filedata(s)
@@ -328,14 +329,23 @@ static void setup_reads_from_slist(struct asfd *asfd,
 	}
 }
 
-static void setup_chfd_writes_from_slist(struct asfd *chfd,
-	int *cw, struct slist *slist, int number_of_blks, uint64_t interrupt)
+// The sigs arrive one at a time, so each one goes to the champ chooser in a
+// batch of its own, apart from sigs batch_start to batch_end, which go
+// batch_len at a time.
+static void setup_chfd_writes_from_slist_batched(struct asfd *chfd,
+	int *cw, struct slist *slist, int number_of_blks, uint64_t interrupt,
+	int batch_start, int batch_end, int batch_len)
 {
 	struct sbuf *s;
 	struct blk blk;
 	struct iobuf iobuf;
+	struct iobuf rec;
+	static struct blk_batch batch;
 	uint64_t file_no=1;
+	int sig_no=0;
 	if(!slist) return;
+	memset(&blk, 0, sizeof(blk));
+	blk_batch_init(&batch, CMD_SIGS);
 	for(s=slist->head; s; s=s->next)
 	{
 		if(sbuf_is_filedata(s)
@@ -346,13 +356,30 @@ static void setup_chfd_writes_from_slist(struct asfd *chfd,
 				continue;
 			blk.fingerprint=file_no;
 			memset(&blk.md5sum, file_no, MD5_DIGEST_LENGTH);
-			blk_to_iobuf_sig(&blk, &iobuf);
+			blk_to_iobuf_sig(&blk, &rec);
 			for(b=0; b<number_of_blks; b++)
+			{
+				sig_no++;
+				fail_unless(!blk_batch_add(&batch, &rec));
+				if(sig_no>=batch_start
+				  && sig_no<batch_end
+				  && (sig_no-batch_start+1)%batch_len)
+					continue;
+				fail_unless(blk_batch_to_iobuf(&batch,
+					&iobuf)==1);
 				asfd_assert_write_iobuf(chfd, cw, 0, &iobuf);
+			}
 		}
 	}
 }
 
+static void setup_chfd_writes_from_slist(struct asfd *chfd,
+	int *cw, struct slist *slist, int number_of_blks, uint64_t interrupt)
+{
+	setup_chfd_writes_from_slist_batched(chfd, cw, slist,
+		number_of_blks, interrupt, 0, 0, 1);
+}
+
 static void setup_chfd_reads_from_slist_blks_got(struct asfd *chfd,
 	int *cr, struct slist *slist, int number_of_blks, uint64_t interrupt)
 {
@@ -362,6 +389,7 @@ static void setup_chfd_reads_from_slist_blks_got(struct asfd *chfd,
 	struct iobuf iobuf;
 	struct sbuf *s;
 	if(!slist) return;
+	memset(&blk, 0, sizeof(blk));
 	for(s=slist->head; s; s=s->next)
 	{
 		if(sbuf_is_filedata(s)
@@ -390,6 +418,7 @@ static void setup_chfd_reads_from_slist_blks_not_got(struct asfd *chfd,
 	struct iobuf iobuf;
 	struct sbuf *s;
 	if(!slist) return;
+	memset(&blk, 0, sizeof(blk));
 	for(s=slist->head; s; s=s->next)
 	{
 		if(sbuf_is_filedata(s)
@@ -443,6 +472,7 @@ static void setup_reads_from_slist_blks(struct asfd *asfd,
 	struct iobuf iobuf;
 	uint64_t file_no=1;
 	if(!slist) return;
+	memset(&blk, 0, sizeof(blk));
 	for(s=slist->head; s; s=s->next)
 	{
 		if(sbuf_is_filedata(s)
@@ -641,7 +671,11 @@ static void setup_asfds_happy_path_three_blks_per_file_no_dedup_big(
 	setup_reads_from_slist_blks(asfd, &ar, slist, 3, 0);
 	asfd_mock_read(asfd, &ar, 0, CMD_GEN, "backup_end");
 
-	setup_chfd_writes_from_slist(chfd, &cw, slist, 3, 0);
+	// The champ chooser is only allowed MANIFEST_SIG_MAX sigs ahead. Once
+	// that is reached, blocks are freed a file at a time, so the sigs go
+	// three at a time for a while.
+	setup_chfd_writes_from_slist_batched(chfd, &cw, slist, 3, 0,
+		MANIFEST_SIG_MAX+2, 5984, 3);
 	asfd_mock_read_no_op(chfd, &cr, 25600);
 	setup_chfd_reads_from_slist_blks_not_got(chfd, &cr, slist, 3, 0);
 	asfd_mock_read_no_op(chfd, &cr, 25600);
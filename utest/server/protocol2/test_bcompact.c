@@ -0,0 +1,364 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/bu.h"
+#include "../../../src/cmd.h"
+#include "../../../src/fsops.h"
+#include "../../../src/fzp.h"
+#include "../../../src/hexmap.h"
+#include "../../../src/iobuf.h"
+#include "../../../src/lock.h"
+#include "../../../src/prepend.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/server/protocol2/bcompact.h"
+#include "../../../src/server/protocol2/dfidx.h"
+#include "../../../src/server/sdirs.h"
+#include "../../builders/build.h"
+#include "../../builders/build_file.h"
+
+#define BASE		"utest_bcompact"
+#define CLIENTCONFDIR	"clientconfdir"
+#define GLOBAL_CONF	BASE "/burp-server.conf"
+#define DATA		BASE "/a_group/data"
+#define BLOCKS		4
+
+static const char *cnames[] = {"cli1", "cli2", NULL};
+
+// The first data file has half of its blocks used, the second has all of
+// them used.
+static uint64_t data_files[] = {
+	0x0000000000000000ULL,
+	0x0000000000010000ULL
+};
+
+static uint64_t cli1_sigs[] = {
+	0x0000000000000000ULL,
+	0x0000000000010000ULL,
+	0x0000000000010001ULL,
+	0x0000000000010002ULL,
+	0x0000000000010003ULL
+};
+
+static uint64_t cli2_sigs[] = {
+	0x0000000000000002ULL
+};
+
+static struct sd sd1[] = {
+	{ "0000001 1970-01-01 00:00:00", 1, 1, BU_CURRENT }
+};
+
+static void clean(void)
+{
+	fail_unless(recursive_delete(BASE)==0);
+	fail_unless(recursive_delete(CLIENTCONFDIR)==0);
+}
+
+static void tear_down(void)
+{
+	clean();
+	alloc_check();
+}
+
+static void do_sdirs_init(struct sdirs *sdirs, const char *cname)
+{
+	fail_unless(!sdirs_init(sdirs, PROTO_2,
+		BASE, // directory
+		cname,
+		NULL, // client_lockdir
+		"a_group", // dedup_group
+		NULL // manual_delete
+	));
+}
+
+static char *get_data_path(uint64_t savepath)
+{
+	char *path;
+	fail_unless((path=prepend_s(DATA,
+		uint64_to_savepathstr(savepath)))!=NULL);
+	return path;
+}
+
+static char *get_block(uint64_t savepath, uint16_t datno)
+{
+	static char block[64];
+	snprintf(block, sizeof(block), "data file %" PRIX64 " block %d",
+		savepath>>16, datno);
+	return block;
+}
+
+static void write_data_file(uint64_t savepath)
+{
+	uint16_t i;
+	char *path;
+	char *block;
+	struct fzp *fzp;
+	uint32_t offsets[BLOCKS+1];
+
+	path=get_data_path(savepath);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+	offsets[0]=0;
+	for(i=0; i<BLOCKS; i++)
+	{
+		block=get_block(savepath, i);
+		fzp_printf(fzp, "%c%04X%s", CMD_DATA, (int)strlen(block), block);
+		offsets[i+1]=offsets[i]+5+strlen(block);
+	}
+	fail_unless(!fzp_close(&fzp));
+	fail_unless(!dfidx_write(path, offsets, BLOCKS));
+	free_w(&path);
+}
+
+static void write_manifest(const char *cname, uint64_t *sigs, size_t len)
+{
+	size_t i;
+	struct blk blk;
+	struct iobuf iobuf;
+	struct fzp *fzp;
+	char path[256];
+
+	snprintf(path, sizeof(path),
+		BASE "/a_group/clients/%s/%s/manifest/00000000",
+		cname, sd1[0].timestamp);
+	fail_unless(!build_path_w(path));
+	fail_unless((fzp=fzp_gzopen(path, "wb"))!=NULL);
+	memset(&blk, 0, sizeof(blk));
+	for(i=0; i<len; i++)
+	{
+		blk.fingerprint=i;
+		blk.savepath=sigs[i];
+		blk_to_iobuf_sig_and_savepath(&blk, &iobuf);
+		fail_unless(!iobuf_send_msg_fzp(&iobuf, fzp));
+	}
+	fail_unless(!fzp_close(&fzp));
+}
+
+static void setup(void)
+{
+	int i;
+	size_t f;
+	struct sdirs *sdirs;
+
+	clean();
+	hexmap_init();
+	build_clientconfdir_files(cnames, NULL);
+	build_file(GLOBAL_CONF, MIN_SERVER_CONF);
+	for(i=0; cnames[i]; i++)
+	{
+		fail_unless((sdirs=sdirs_alloc())!=NULL);
+		do_sdirs_init(sdirs, cnames[i]);
+		build_storage_dirs(sdirs, sd1, ARR_LEN(sd1));
+		sdirs_free(&sdirs);
+	}
+	write_manifest("cli1", cli1_sigs, ARR_LEN(cli1_sigs));
+	write_manifest("cli2", cli2_sigs, ARR_LEN(cli2_sigs));
+	for(f=0; f<ARR_LEN(data_files); f++)
+		write_data_file(data_files[f]);
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+	char *buf;
+	struct stat statp;
+	struct fzp *fzp;
+
+	fail_unless(!lstat(path, &statp));
+	*len=(size_t)statp.st_size;
+	fail_unless((buf=(char *)malloc_w(*len+1, __func__))!=NULL);
+	fail_unless((fzp=fzp_open(path, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, buf, *len)==(int)*len);
+	fail_unless(!fzp_close(&fzp));
+	return buf;
+}
+
+static off_t get_size(const char *path)
+{
+	struct stat statp;
+	fail_unless(!lstat(path, &statp));
+	return statp.st_size;
+}
+
+// Checks that the blocks are where the index says, and that the unused
+// ones are empty.
+static void check_data_file(uint64_t savepath, int used[BLOCKS])
+{
+	uint16_t i;
+	int fd;
+	char *buf;
+	char *path;
+	char *block;
+	size_t len;
+	struct iobuf iobuf;
+	struct dfidx dfidx;
+
+	memset(&dfidx, 0, sizeof(dfidx));
+	path=get_data_path(savepath);
+	buf=read_file(path, &len);
+	fail_unless((fd=open(path, O_RDONLY))>=0);
+	fail_unless(!dfidx_load(&dfidx, path, fd));
+	close(fd);
+	fail_unless(dfidx.count==BLOCKS);
+	fail_unless(dfidx.offsets[BLOCKS]==len);
+	for(i=0; i<BLOCKS; i++)
+	{
+		fail_unless(!iobuf_view_from_buf_data(&iobuf,
+			buf+dfidx.offsets[i],
+			dfidx.offsets[i+1]-dfidx.offsets[i]));
+		fail_unless(iobuf.cmd==CMD_DATA);
+		if(!used[i])
+		{
+			fail_unless(!iobuf.len);
+			continue;
+		}
+		block=get_block(savepath, i);
+		fail_unless(iobuf.len==strlen(block));
+		fail_unless(!memcmp(iobuf.buf, block, iobuf.len));
+	}
+	dfidx_free_content(&dfidx);
+	free_w(&buf);
+	free_w(&path);
+}
+
+static void check_untouched(void)
+{
+	size_t f;
+	int used[BLOCKS]={1, 1, 1, 1};
+	for(f=0; f<ARR_LEN(data_files); f++)
+		check_data_file(data_files[f], used);
+}
+
+static void bad_options(int argc, const char *argv[])
+{
+	fail_unless(run_bcompact(argc, (char **)argv)==1);
+	tear_down();
+}
+
+START_TEST(test_bcompact_not_enough_args)
+{
+	const char *argv[]={"utest"};
+	bad_options(ARR_LEN(argv), argv);
+}
+END_TEST
+
+START_TEST(test_bcompact_usage)
+{
+	const char *argv[]={"utest", "-h"};
+	bad_options(ARR_LEN(argv), argv);
+}
+END_TEST
+
+START_TEST(test_bcompact_bad_ratio)
+{
+	const char *argv[]={"utest", "-r", "101", BASE "/a_group"};
+	bad_options(ARR_LEN(argv), argv);
+}
+END_TEST
+
+START_TEST(test_bcompact_version)
+{
+	const char *argv[]={"utest", "-V"};
+	fail_unless(run_bcompact(ARR_LEN(argv), (char **)argv)==0);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_bcompact_dry_run)
+{
+	const char *argv[]={"utest", "-c", GLOBAL_CONF, "-n", "-r", "75",
+		BASE "/a_group"};
+	setup();
+	fail_unless(run_bcompact(ARR_LEN(argv), (char **)argv)==0);
+	check_untouched();
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_bcompact_above_ratio)
+{
+	const char *argv[]={"utest", "-c", GLOBAL_CONF, BASE "/a_group"};
+	setup();
+	fail_unless(run_bcompact(ARR_LEN(argv), (char **)argv)==0);
+	check_untouched();
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_bcompact_run)
+{
+	off_t size;
+	char *path;
+	int used[BLOCKS]={1, 0, 1, 0};
+	int all[BLOCKS]={1, 1, 1, 1};
+	const char *argv[]={"utest", "-c", GLOBAL_CONF, "-r", "75",
+		BASE "/a_group"};
+	setup();
+	path=get_data_path(data_files[0]);
+	size=get_size(path);
+	fail_unless(run_bcompact(ARR_LEN(argv), (char **)argv)==0);
+	fail_unless(get_size(path)==size-2*(off_t)strlen(get_block(0, 0)));
+	check_data_file(data_files[0], used);
+	check_data_file(data_files[1], all);
+
+	// Blocks that were dropped already do not count the next time.
+	size=get_size(path);
+	optind=1;
+	fail_unless(run_bcompact(ARR_LEN(argv), (char **)argv)==0);
+	fail_unless(get_size(path)==size);
+	check_data_file(data_files[0], used);
+	free_w(&path);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_bcompact_busy)
+{
+	const char *argv[]={"utest", "-c", GLOBAL_CONF, "-r", "75",
+		BASE "/a_group"};
+	setup();
+	fail_unless(!symlink(sd1[0].timestamp,
+		BASE "/a_group/clients/cli2/working"));
+	fail_unless(run_bcompact(ARR_LEN(argv), (char **)argv)==1);
+	check_untouched();
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_bcompact_restoring)
+{
+	struct lock *lock;
+	const char *argv[]={"utest", "-c", GLOBAL_CONF, "-r", "75",
+		BASE "/a_group"};
+	setup();
+	fail_unless((lock=lock_alloc_and_init(BASE "/a_group/clients/cli2/"
+		"0000001 1970-01-01 00:00:00/lockfile.read"))!=NULL);
+	lock_get(lock);
+	fail_unless(lock->status==GET_LOCK_GOT);
+	fail_unless(run_bcompact(ARR_LEN(argv), (char **)argv)==1);
+	check_untouched();
+	lock_release(lock);
+	lock_free(&lock);
+	tear_down();
+}
+END_TEST
+
+Suite *suite_server_protocol2_bcompact(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_bcompact");
+
+	tc_core=tcase_create("Core");
+	tcase_set_timeout(tc_core, 60);
+	tcase_add_test(tc_core, test_bcompact_not_enough_args);
+	tcase_add_test(tc_core, test_bcompact_usage);
+	tcase_add_test(tc_core, test_bcompact_bad_ratio);
+	tcase_add_test(tc_core, test_bcompact_version);
+	tcase_add_test(tc_core, test_bcompact_dry_run);
+	tcase_add_test(tc_core, test_bcompact_above_ratio);
+	tcase_add_test(tc_core, test_bcompact_run);
+	tcase_add_test(tc_core, test_bcompact_busy);
+	tcase_add_test(tc_core, test_bcompact_restoring);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -9,6 +9,7 @@
 #include "../../../src/iobuf.h"
 #include "../../../src/lock.h"
 #include "../../../src/prepend.h"
+#include "../../../src/server/protocol2/dfidx.h"
 #include "../../../src/server/protocol2/dpth.h"
 #include "../../../src/protocol2/blk.h"
 #include "../../builders/build_file.h"
@@ -49,20 +50,27 @@ static void tear_down(struct dpth **dpth)
 	alloc_check();
 }
 
-static int write_to_dpth(struct dpth *dpth, const char *savepathstr)
+static int write_buf_to_dpth(struct dpth *dpth, const char *savepathstr,
+	const char *buf, size_t len)
 {
 	int ret;
 	struct iobuf wbuf;
 	struct blk *blk=blk_alloc();
 	blk->savepath=savepathstr_with_sig_to_uint64(savepathstr);
-	wbuf.buf=strdup_w("abc", __FUNCTION__);
-	wbuf.len=3;
+	wbuf.buf=(char *)malloc_w(len, __FUNCTION__);
+	memcpy(wbuf.buf, buf, len);
+	wbuf.len=len;
 	ret=dpth_protocol2_fwrite(dpth, &wbuf, blk);
 	free_w(&wbuf.buf);
 	blk_free(&blk);
 	return ret;
 }
 
+static int write_to_dpth(struct dpth *dpth, const char *savepathstr)
+{
+	return write_buf_to_dpth(dpth, savepathstr, "abc", 3);
+}
+
 static void do_fork(void)
 {
 	switch(fork())
@@ -296,6 +304,93 @@ START_TEST(test_init)
 }
 END_TEST
 
+START_TEST(test_compression)
+{
+	char buf[4096];
+	const char *savepath;
+	struct dpth *dpth;
+	struct fzp *fzp;
+	struct iobuf rbuf;
+	struct iobuf data;
+
+	memset(buf, 'a', sizeof(buf));
+	dpth=setup();
+	fail_unless(dpth_protocol2_init(dpth,
+		LOCKPATH,
+		TESTCLIENT,
+		CFILES,
+		MAX_STORAGE_SUBDIRS)==0);
+	dpth->compression=6;
+	savepath=dpth_protocol2_mk(dpth);
+	fail_unless(!write_buf_to_dpth(dpth, savepath, buf, sizeof(buf)));
+	fail_unless(!dpth_protocol2_incr_sig(dpth));
+	savepath=dpth_protocol2_mk(dpth);
+	// Too short to be worth compressing.
+	fail_unless(!write_to_dpth(dpth, savepath));
+	fail_unless(!dpth_release_all(dpth));
+
+	iobuf_init(&rbuf);
+	fail_unless((fzp=fzp_open(LOCKPATH "/0000/0000/0000", "rb"))!=NULL);
+	fail_unless(!iobuf_fill_from_fzp_data(&rbuf, fzp));
+	fail_unless(rbuf.cmd==CMD_DATA_COMP);
+	fail_unless(rbuf.len<sizeof(buf));
+	fail_unless(!blk_data_decompress(&rbuf, &data));
+	fail_unless(data.cmd==CMD_DATA);
+	fail_unless(data.len==sizeof(buf));
+	fail_unless(!memcmp(data.buf, buf, sizeof(buf)));
+	iobuf_free_content(&data);
+	iobuf_free_content(&rbuf);
+	fail_unless(!iobuf_fill_from_fzp_data(&rbuf, fzp));
+	fail_unless(rbuf.cmd==CMD_DATA);
+	fail_unless(rbuf.len==3);
+	iobuf_free_content(&rbuf);
+	fail_unless(iobuf_fill_from_fzp_data(&rbuf, fzp)==1);
+	fzp_close(&fzp);
+
+	tear_down(&dpth);
+}
+END_TEST
+
+START_TEST(test_index)
+{
+	int fd;
+	const char *savepath;
+	struct dpth *dpth;
+	struct dfidx dfidx;
+
+	memset(&dfidx, 0, sizeof(dfidx));
+	dpth=setup();
+	fail_unless(dpth_protocol2_init(dpth,
+		LOCKPATH,
+		TESTCLIENT,
+		CFILES,
+		MAX_STORAGE_SUBDIRS)==0);
+	savepath=dpth_protocol2_mk(dpth);
+	fail_unless(!write_to_dpth(dpth, savepath));
+	fail_unless(!dpth_protocol2_incr_sig(dpth));
+	savepath=dpth_protocol2_mk(dpth);
+	fail_unless(!write_buf_to_dpth(dpth, savepath, "defgh", 5));
+	fail_unless(!dpth_release_all(dpth));
+
+	fail_unless((fd=open(LOCKPATH "/0000/0000/0000", O_RDONLY))>=0);
+	fail_unless(!dfidx_load(&dfidx, LOCKPATH "/0000/0000/0000", fd));
+	fail_unless(dfidx.count==2);
+	fail_unless(dfidx.offsets[0]==0);
+	fail_unless(dfidx.offsets[1]==8);
+	fail_unless(dfidx.offsets[2]==18);
+	dfidx_free_content(&dfidx);
+	close(fd);
+
+	// Without the index, the data file has to be read from the start.
+	fail_unless(!dfidx_unlink(LOCKPATH "/0000/0000/0000"));
+	fail_unless((fd=open(LOCKPATH "/0000/0000/0000", O_RDONLY))>=0);
+	fail_unless(dfidx_load(&dfidx, LOCKPATH "/0000/0000/0000", fd)==1);
+	close(fd);
+
+	tear_down(&dpth);
+}
+END_TEST
+
 Suite *suite_server_protocol2_dpth(void)
 {
 	Suite *s;
@@ -309,6 +404,8 @@ Suite *suite_server_protocol2_dpth(void)
 	tcase_add_test(tc_core, test_simple_lock_with_existant_data_files);
 	tcase_add_test(tc_core, test_incr_sig);
 	tcase_add_test(tc_core, test_init);
+	tcase_add_test(tc_core, test_compression);
+	tcase_add_test(tc_core, test_index);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,411 @@
+#include "../../test.h"
+#include "../../../src/alloc.h"
+#include "../../../src/cmd.h"
+#include "../../../src/fsops.h"
+#include "../../../src/fzp.h"
+#include "../../../src/hexmap.h"
+#include "../../../src/protocol2/blk.h"
+#include "../../../src/server/manio.h"
+#include "../../../src/server/protocol2/dfidx.h"
+#include "../../../src/server/protocol2/rblk.h"
+
+#define BASE		"utest_server_protocol2_rblk"
+#define DATA		BASE "/data"
+#define MANIFEST	BASE "/manifest"
+
+#define FILES		3
+#define BLKS		4
+
+// Blocks from each data file in turn, so that restoring them in manifest
+// order jumps between the data files.
+static int order[][2]={
+	{ 0, 0 }, { 1, 0 }, { 2, 0 },
+	{ 0, 1 }, { 1, 1 }, { 2, 1 },
+	{ 2, 3 }, { 0, 0 }, { 1, 2 },
+	{ 0, 3 }, { 1, 3 }, { 0, 2 },
+};
+
+// The data files only differ in the upper half of their savepaths, so that
+// anything that only looked at the lower half would mix them up.
+static uint64_t savepath(int file, int datno)
+{
+	char savepathstr[20];
+	snprintf(savepathstr, sizeof(savepathstr),
+		"0000/%04X/0000/%04X", file, datno);
+	return savepathstr_with_sig_to_uint64(savepathstr);
+}
+
+static void data_for(char *buf, size_t len, int file, int datno)
+{
+	snprintf(buf, len, "data file %d block %d", file, datno);
+}
+
+static void setup(int with_index)
+{
+	int f;
+	int d;
+	size_t i;
+	char buf[64];
+	char path[256];
+	uint32_t offsets[BLKS+1];
+	struct fzp *fzp;
+	struct blk *blk;
+	struct manio *manio;
+
+	hexmap_init();
+	fail_unless(!recursive_delete(BASE));
+	for(f=0; f<FILES; f++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", DATA,
+			uint64_to_savepathstr(savepath(f, 0)));
+		fail_unless(!build_path_w(path));
+		fail_unless((fzp=fzp_open(path, "wb"))!=NULL);
+		offsets[0]=0;
+		for(d=0; d<BLKS; d++)
+		{
+			data_for(buf, sizeof(buf), f, d);
+			fzp_printf(fzp, "%c%04X%s",
+				CMD_DATA, strlen(buf), buf);
+			offsets[d+1]=offsets[d]+5+strlen(buf);
+		}
+		fail_unless(!fzp_close(&fzp));
+		if(with_index)
+			fail_unless(!dfidx_write(path, offsets, BLKS));
+	}
+
+	fail_unless((manio=manio_open_phase3(MANIFEST, "wb", PROTO_2,
+		NULL, 0))!=NULL);
+	fail_unless((blk=blk_alloc())!=NULL);
+	for(i=0; i<ARR_LEN(order); i++)
+	{
+		blk->savepath=savepath(order[i][0], order[i][1]);
+		fail_unless(!manio_write_sig_and_path(manio, blk));
+	}
+	blk_free(&blk);
+	fail_unless(!manio_close(&manio));
+}
+
+static void tear_down(void)
+{
+	rblks_free();
+	fail_unless(!recursive_delete(BASE));
+	alloc_check();
+}
+
+static void assert_blk(struct blk *blk, int file, int datno)
+{
+	char buf[64];
+	data_for(buf, sizeof(buf), file, datno);
+	fail_unless(blk->length==strlen(buf));
+	fail_unless(!memcmp(blk->data, buf, blk->length));
+	// The data belongs to rblk.
+	blk->data=NULL;
+}
+
+static void retrieve_next(struct blk *blk, int file, int datno)
+{
+	blk->savepath=savepath(file, datno);
+	fail_unless(!rblk_retrieve_next(NULL, NULL, blk, DATA));
+	assert_blk(blk, file, datno);
+}
+
+static void run_in_order(int with_index, int use_mmap, int threads,
+	int lookahead, ssize_t memory_max, int skip)
+{
+	size_t i;
+	struct blk *blk;
+
+	setup(with_index);
+	fail_unless(!rblks_init(memory_max, use_mmap, threads));
+	fail_unless(!rblks_plan(MANIFEST, lookahead));
+	fail_unless((blk=blk_alloc())!=NULL);
+	for(i=0; i<ARR_LEN(order); i++)
+	{
+		// Like a restore that only wants some of the files.
+		if(skip && i%skip)
+			continue;
+		retrieve_next(blk, order[i][0], order[i][1]);
+	}
+	blk_free(&blk);
+	tear_down();
+}
+
+START_TEST(test_rblk_in_order)
+{
+	run_in_order(0, 0, 1, 8192, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_small_lookahead)
+{
+	run_in_order(0, 0, 1, 2, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_no_lookahead)
+{
+	run_in_order(0, 0, 1, 0, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_small_memory)
+{
+	run_in_order(0, 0, 1, 8192, 1, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_skipped)
+{
+	run_in_order(0, 0, 1, 8192, 256*1024*1024, 3);
+}
+END_TEST
+
+START_TEST(test_rblk_out_of_order)
+{
+	struct blk *blk;
+
+	setup(0);
+	fail_unless(!rblks_init(256*1024*1024, 0, 1));
+	fail_unless(!rblks_plan(MANIFEST, 4));
+	fail_unless((blk=blk_alloc())!=NULL);
+	retrieve_next(blk, 0, 1);
+	// Not in the rest of the manifest, so it carries on without the look
+	// ahead.
+	retrieve_next(blk, 1, 0);
+	retrieve_next(blk, 2, 1);
+	blk_free(&blk);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_random_access)
+{
+	struct blk *blk;
+
+	setup(0);
+	fail_unless(!rblks_init(256*1024*1024, 0, 1));
+	fail_unless((blk=blk_alloc())!=NULL);
+	blk->savepath=savepath(1, 3);
+	fail_unless(!rblk_retrieve_data(NULL, NULL, blk, DATA));
+	assert_blk(blk, 1, 3);
+	blk->savepath=savepath(1, 1);
+	fail_unless(!rblk_retrieve_data(NULL, NULL, blk, DATA));
+	assert_blk(blk, 1, 1);
+	blk_free(&blk);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_missing)
+{
+	struct blk *blk;
+
+	setup(0);
+	fail_unless(!rblks_init(256*1024*1024, 0, 1));
+	fail_unless((blk=blk_alloc())!=NULL);
+	blk->savepath=savepath(0, BLKS);
+	fail_unless(rblk_retrieve_data(NULL, NULL, blk, DATA)==-1);
+	blk->savepath=savepath(FILES, 0);
+	fail_unless(rblk_retrieve_data(NULL, NULL, blk, DATA)==-1);
+	blk_free(&blk);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_indexed_in_order)
+{
+	run_in_order(1, 0, 1, 8192, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_indexed_no_lookahead)
+{
+	run_in_order(1, 0, 1, 0, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_indexed_small_memory)
+{
+	run_in_order(1, 0, 1, 8192, 1, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_indexed_skipped)
+{
+	run_in_order(1, 0, 1, 8192, 256*1024*1024, 3);
+}
+END_TEST
+
+START_TEST(test_rblk_indexed_reads_only_wanted)
+{
+	FILE *fp;
+	char path[256];
+	struct blk *blk;
+
+	setup(1);
+	// Break the first block, which reading the data file from the start
+	// would trip over.
+	snprintf(path, sizeof(path), "%s/%s", DATA,
+		uint64_to_savepathstr(savepath(2, 0)));
+	fail_unless((fp=fopen(path, "r+b"))!=NULL);
+	fail_unless(fwrite("ZZZZ", 1, 4, fp)==4);
+	fail_unless(!fclose(fp));
+
+	fail_unless(!rblks_init(256*1024*1024, 0, 1));
+	fail_unless((blk=blk_alloc())!=NULL);
+	blk->savepath=savepath(2, BLKS);
+	fail_unless(rblk_retrieve_data(NULL, NULL, blk, DATA)==-1);
+	blk->savepath=savepath(2, 2);
+	fail_unless(!rblk_retrieve_data(NULL, NULL, blk, DATA));
+	assert_blk(blk, 2, 2);
+	blk_free(&blk);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_stale_index)
+{
+	char path[256];
+	struct fzp *fzp;
+	struct blk *blk;
+
+	setup(1);
+	// The data file has grown since its index was written, so the index
+	// is not used.
+	snprintf(path, sizeof(path), "%s/%s", DATA,
+		uint64_to_savepathstr(savepath(1, 0)));
+	fail_unless((fzp=fzp_open(path, "ab"))!=NULL);
+	fzp_printf(fzp, "%c%04X%s", CMD_DATA, strlen("extra"), "extra");
+	fail_unless(!fzp_close(&fzp));
+
+	fail_unless(!rblks_init(256*1024*1024, 0, 1));
+	fail_unless((blk=blk_alloc())!=NULL);
+	blk->savepath=savepath(1, BLKS);
+	fail_unless(!rblk_retrieve_data(NULL, NULL, blk, DATA));
+	fail_unless(blk->length==strlen("extra"));
+	fail_unless(!memcmp(blk->data, "extra", blk->length));
+	blk->data=NULL;
+	blk_free(&blk);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_mmap_in_order)
+{
+	run_in_order(0, 1, 1, 8192, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_mmap_indexed_in_order)
+{
+	run_in_order(1, 1, 1, 8192, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_mmap_no_lookahead)
+{
+	run_in_order(1, 1, 1, 0, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_mmap_small_memory)
+{
+	// Every data file gets unmapped as soon as nothing points into it.
+	run_in_order(0, 1, 1, 8192, 1, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_mmap_skipped)
+{
+	run_in_order(1, 1, 1, 8192, 256*1024*1024, 3);
+}
+END_TEST
+
+START_TEST(test_rblk_mmap_missing)
+{
+	struct blk *blk;
+
+	setup(0);
+	fail_unless(!rblks_init(256*1024*1024, 1, 1));
+	fail_unless((blk=blk_alloc())!=NULL);
+	blk->savepath=savepath(0, BLKS);
+	fail_unless(rblk_retrieve_data(NULL, NULL, blk, DATA)==-1);
+	blk->savepath=savepath(FILES, 0);
+	fail_unless(rblk_retrieve_data(NULL, NULL, blk, DATA)==-1);
+	blk->savepath=savepath(0, BLKS-1);
+	fail_unless(!rblk_retrieve_data(NULL, NULL, blk, DATA));
+	assert_blk(blk, 0, BLKS-1);
+	blk_free(&blk);
+	tear_down();
+}
+END_TEST
+
+START_TEST(test_rblk_threads_in_order)
+{
+	run_in_order(0, 0, 4, 8192, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_threads_indexed_in_order)
+{
+	run_in_order(1, 0, 2, 8192, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_threads_small_lookahead)
+{
+	run_in_order(1, 0, 3, 2, 256*1024*1024, 0);
+}
+END_TEST
+
+START_TEST(test_rblk_threads_skipped)
+{
+	run_in_order(0, 0, 3, 8192, 256*1024*1024, 3);
+}
+END_TEST
+
+START_TEST(test_rblk_threads_with_mmap)
+{
+	// Mapping is only done from the one thread.
+	run_in_order(1, 1, 4, 8192, 256*1024*1024, 0);
+}
+END_TEST
+
+Suite *suite_server_protocol2_rblk(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s=suite_create("server_protocol2_rblk");
+
+	tc_core=tcase_create("Core");
+
+	tcase_add_test(tc_core, test_rblk_in_order);
+	tcase_add_test(tc_core, test_rblk_small_lookahead);
+	tcase_add_test(tc_core, test_rblk_no_lookahead);
+	tcase_add_test(tc_core, test_rblk_small_memory);
+	tcase_add_test(tc_core, test_rblk_skipped);
+	tcase_add_test(tc_core, test_rblk_out_of_order);
+	tcase_add_test(tc_core, test_rblk_random_access);
+	tcase_add_test(tc_core, test_rblk_missing);
+	tcase_add_test(tc_core, test_rblk_indexed_in_order);
+	tcase_add_test(tc_core, test_rblk_indexed_no_lookahead);
+	tcase_add_test(tc_core, test_rblk_indexed_small_memory);
+	tcase_add_test(tc_core, test_rblk_indexed_skipped);
+	tcase_add_test(tc_core, test_rblk_indexed_reads_only_wanted);
+	tcase_add_test(tc_core, test_rblk_stale_index);
+	tcase_add_test(tc_core, test_rblk_mmap_in_order);
+	tcase_add_test(tc_core, test_rblk_mmap_indexed_in_order);
+	tcase_add_test(tc_core, test_rblk_mmap_no_lookahead);
+	tcase_add_test(tc_core, test_rblk_mmap_small_memory);
+	tcase_add_test(tc_core, test_rblk_mmap_skipped);
+	tcase_add_test(tc_core, test_rblk_mmap_missing);
+	tcase_add_test(tc_core, test_rblk_threads_in_order);
+	tcase_add_test(tc_core, test_rblk_threads_indexed_in_order);
+	tcase_add_test(tc_core, test_rblk_threads_small_lookahead);
+	tcase_add_test(tc_core, test_rblk_threads_skipped);
+	tcase_add_test(tc_core, test_rblk_threads_with_mmap);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
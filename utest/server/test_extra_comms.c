@@ -163,7 +163,7 @@ static const char *get_features(enum protocol protocol, int srestore,
 	if(version && !strcmp(version, "1.4.40"))
 		old_version=1;
 
-	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:failover:vss_restore:%s%smsg:%s%sseed:", srestore?"srestore:":"", old_version?"":"counters_json:", proto, rshash);
+	snprintf(features, sizeof(features), "extra_comms_begin ok:autoupgrade:incexc:orig_client:uname:failover:vss_restore:%s%smsg:sig_batch:%s%sseed:", srestore?"srestore:":"", old_version?"":"counters_json:", proto, rshash);
 	return features;
 }
 
@@ -476,6 +476,85 @@ static void checks_rshash_blake2(struct conf **confs, struct conf **cconfs,
 #endif
 }
 
+static void setup_chunking_gear(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	int r=0; int w=0;
+	char features[256]="";
+	enum protocol protocol=PROTO_AUTO;
+	common_confs(cconfs, PACKAGE_VERSION, protocol);
+	set_int(cconfs[OPT_CHUNKING], CHUNKING_GEAR);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "extra_comms_begin");
+	snprintf(features, sizeof(features), "%schunking=gear:",
+		get_features(protocol, /*srestore*/0, PACKAGE_VERSION));
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, features);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "chunking=gear");
+	setup_send_features_proto_end(asfd, &r, &w);
+}
+
+static void checks_chunking_gear(struct conf **confs, struct conf **cconfs,
+	const char *incexc, int srestore)
+{
+	fail_unless(get_int(confs[OPT_CHUNKING])==CHUNKING_GEAR);
+	fail_unless(get_int(cconfs[OPT_CHUNKING])==CHUNKING_GEAR);
+}
+
+static void setup_chunking_gear_old_client(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	int r=0; int w=0;
+	char features[256]="";
+	enum protocol protocol=PROTO_AUTO;
+	common_confs(cconfs, PACKAGE_VERSION, protocol);
+	set_int(cconfs[OPT_CHUNKING], CHUNKING_GEAR);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "extra_comms_begin");
+	snprintf(features, sizeof(features), "%schunking=gear:",
+		get_features(protocol, /*srestore*/0, PACKAGE_VERSION));
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, features);
+	setup_send_features_proto_end(asfd, &r, &w);
+}
+
+// A client that does not reply with the chunking setting must be treated as
+// chunking with rabin.
+static void checks_chunking_gear_old_client(struct conf **confs,
+	struct conf **cconfs, const char *incexc, int srestore)
+{
+	fail_unless(get_int(cconfs[OPT_CHUNKING])==CHUNKING_RABIN);
+}
+
+#ifdef HAVE_EVP_BLAKE2B512
+static void setup_strong_hash_blake2b(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	int r=0; int w=0;
+	char features[256]="";
+	enum protocol protocol=PROTO_AUTO;
+	common_confs(cconfs, PACKAGE_VERSION, protocol);
+	set_int(cconfs[OPT_STRONG_HASH], STRONG_HASH_BLAKE2B);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "extra_comms_begin");
+	snprintf(features, sizeof(features), "%sstrong_hash=blake2b:",
+		get_features(protocol, /*srestore*/0, PACKAGE_VERSION));
+	asfd_assert_write(asfd, &w, 0, CMD_GEN, features);
+	asfd_mock_read(asfd, &r, 0, CMD_GEN, "strong_hash=blake2b");
+	setup_send_features_proto_end(asfd, &r, &w);
+}
+
+static void checks_strong_hash_blake2b(struct conf **confs,
+	struct conf **cconfs, const char *incexc, int srestore)
+{
+	fail_unless(get_int(confs[OPT_STRONG_HASH])==STRONG_HASH_BLAKE2B);
+	fail_unless(get_int(cconfs[OPT_STRONG_HASH])==STRONG_HASH_BLAKE2B);
+}
+#else
+// A client should not ask for a hash that the server did not offer.
+static void setup_strong_hash_blake2b(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	setup_simple(asfd, confs, cconfs, "strong_hash=blake2b",
+		/*srestore*/0);
+}
+#endif
+
 static void setup_msg(struct asfd *asfd,
 	struct conf **confs, struct conf **cconfs)
 {
@@ -489,6 +568,19 @@ static void checks_msg(struct conf **confs, struct conf **cconfs,
 	fail_unless(get_int(cconfs[OPT_MESSAGE])==1);
 }
 
+static void setup_sig_batch(struct asfd *asfd,
+	struct conf **confs, struct conf **cconfs)
+{
+	setup_simple(asfd, confs, cconfs, "sig_batch", /*srestore*/0);
+}
+
+static void checks_sig_batch(struct conf **confs, struct conf **cconfs,
+	const char *incexc, int srestore)
+{
+	fail_unless(get_int(confs[OPT_SIG_BATCH])==1);
+	fail_unless(get_int(cconfs[OPT_SIG_BATCH])==1);
+}
+
 static void setup_counters_ok(struct asfd *asfd,
 	struct conf **confs, struct conf **cconfs)
 {
@@ -785,9 +877,18 @@ START_TEST(test_server_extra_comms)
 	run_test(0, setup_rshash_blake2, checks_rshash_blake2);
 #else
 	run_test(-1, setup_rshash_blake2, checks_rshash_blake2);
+#endif
+	run_test(0, setup_chunking_gear, checks_chunking_gear);
+	run_test(0, setup_chunking_gear_old_client,
+		checks_chunking_gear_old_client);
+#ifdef HAVE_EVP_BLAKE2B512
+	run_test(0, setup_strong_hash_blake2b, checks_strong_hash_blake2b);
+#else
+	run_test(-1, setup_strong_hash_blake2b, NULL);
 #endif
 	run_test(0, setup_counters_ok, checks_counters_ok);
 	run_test(0, setup_msg, checks_msg);
+	run_test(0, setup_sig_batch, checks_sig_batch);
 	run_test(0, setup_uname, checks_uname);
 	run_test(0, setup_uname_is_windows, checks_uname_is_windows);
 	run_test(-1, setup_unexpected_feature, NULL);
@@ -9,10 +9,12 @@
 #include "../../src/fsops.h"
 #include "../../src/hexmap.h"
 #include "../../src/log.h"
+#include "../../src/msg.h"
 #include "../../src/pathcmp.h"
 #include "../../src/sbuf.h"
 #include "../../src/slist.h"
 #include "../../src/protocol2/blk.h"
+#include "../../src/server/bmanifest.h"
 #include "../../src/server/manio.h"
 
 static const char *path="utest_manio";
@@ -257,6 +259,116 @@ START_TEST(test_man_protocol2_phase2_tell_seek)
 }
 END_TEST
 
+static void read_whole_manifest(struct slist *slist, enum protocol protocol,
+	int entries)
+{
+	struct manio *manio;
+	struct sbuf *sb=slist->head;
+	fail_unless((manio=manio_open(path, "rb", protocol))!=NULL);
+	read_manifest(&sb, manio, 0, entries, protocol, 0 /* phase */);
+	fail_unless(sb==NULL);
+	fail_unless(!manio_close(&manio));
+}
+
+static uint8_t first_byte(enum protocol protocol)
+{
+	uint8_t c;
+	struct fzp *fzp;
+	char fpath[256];
+	if(protocol==PROTO_1)
+		snprintf(fpath, sizeof(fpath), "%s", path);
+	else
+		snprintf(fpath, sizeof(fpath), "%s/00000000", path);
+	fail_unless((fzp=fzp_gzopen(fpath, "rb"))!=NULL);
+	fail_unless(fzp_read(fzp, &c, 1)==1);
+	fail_unless(!fzp_close(&fzp));
+	return c;
+}
+
+static void test_manifest_binary(enum protocol protocol)
+{
+	struct slist *slist;
+	int entries=1000;
+	prng_init(0);
+	base64_init();
+	hexmap_init();
+	recursive_delete(path);
+
+	slist=build_manifest_binary(path, protocol, entries);
+	fail_unless(slist!=NULL);
+	fail_unless(first_byte(protocol)==MSG_BINARY_HEADER);
+	read_whole_manifest(slist, protocol, entries);
+
+	slist_free(&slist);
+	tear_down();
+}
+
+START_TEST(test_man_protocol1_binary)
+{
+	test_manifest_binary(PROTO_1);
+}
+END_TEST
+
+START_TEST(test_man_protocol2_binary)
+{
+	test_manifest_binary(PROTO_2);
+}
+END_TEST
+
+static void run_bmanifest_ok(int argc, const char *argv[])
+{
+	// getopt() needs resetting, because this runs more than once.
+	optind=0;
+	fail_unless(!run_bmanifest(argc, (char **)argv));
+}
+
+static void test_bmanifest(enum protocol protocol)
+{
+	struct slist *slist;
+	int entries=1000;
+	const char *to_binary[]={"utest", path};
+	const char *to_text[]={"utest", "-t", "-z", "1", path};
+	prng_init(0);
+	base64_init();
+	hexmap_init();
+	recursive_delete(path);
+
+	slist=build_manifest(path, protocol, entries, 0 /* phase */);
+	fail_unless(slist!=NULL);
+	fail_unless(first_byte(protocol)!=MSG_BINARY_HEADER);
+
+	run_bmanifest_ok(ARR_LEN(to_binary), to_binary);
+	fail_unless(first_byte(protocol)==MSG_BINARY_HEADER);
+	read_whole_manifest(slist, protocol, entries);
+
+	run_bmanifest_ok(ARR_LEN(to_text), to_text);
+	fail_unless(first_byte(protocol)!=MSG_BINARY_HEADER);
+	read_whole_manifest(slist, protocol, entries);
+
+	slist_free(&slist);
+	tear_down();
+}
+
+START_TEST(test_man_protocol1_bmanifest)
+{
+	test_bmanifest(PROTO_1);
+}
+END_TEST
+
+START_TEST(test_man_protocol2_bmanifest)
+{
+	test_bmanifest(PROTO_2);
+}
+END_TEST
+
+START_TEST(test_man_bmanifest_usage)
+{
+	const char *argv[]={"utest"};
+	fail_unless(run_bmanifest(ARR_LEN(argv), (char **)argv)==1);
+	tear_down();
+}
+END_TEST
+
 static const char *get_extra_path(int i, const char *dir)
 {
 	static char p[64]="";
@@ -461,6 +573,12 @@ Suite *suite_server_manio(void)
 
 	tcase_add_test(tc_core, test_man_protocol2_hooks);
 
+	tcase_add_test(tc_core, test_man_protocol1_binary);
+	tcase_add_test(tc_core, test_man_protocol2_binary);
+	tcase_add_test(tc_core, test_man_protocol1_bmanifest);
+	tcase_add_test(tc_core, test_man_protocol2_bmanifest);
+	tcase_add_test(tc_core, test_man_bmanifest_usage);
+
 	tcase_add_test(tc_core, test_man_find_boundary);
 
 	suite_add_tcase(s, tc_core);
@@ -93,6 +93,7 @@ static void protocol1_tests(struct sdirs *sdirs)
 	fail_unless(sdirs->champlock==NULL);
 	fail_unless(sdirs->champsock==NULL);
 	fail_unless(sdirs->champlog==NULL);
+	fail_unless(sdirs->champstats==NULL);
 	fail_unless(sdirs->champ_dindex_lock==NULL);
 	fail_unless(sdirs->data==NULL);
 	ck_assert_str_eq(sdirs->clients, BASE);
@@ -136,6 +137,7 @@ static void protocol2_tests(struct sdirs *sdirs)
 	ck_assert_str_eq(sdirs->champlock, DATA "/cc.lock");
 	ck_assert_str_eq(sdirs->champsock, DATA "/cc.sock");
 	ck_assert_str_eq(sdirs->champlog, DATA "/cc.log");
+	ck_assert_str_eq(sdirs->champstats, DATA "/cc.stats");
 	ck_assert_str_eq(sdirs->champ_dindex_lock, DATA "/dindex.lock");
 	ck_assert_str_eq(sdirs->data, DATA);
 	ck_assert_str_eq(sdirs->clients, CLIENTS);
@@ -165,6 +167,17 @@ static void protocol2_tests(struct sdirs *sdirs)
 	fail_unless(sdirs->cincexc==NULL);
 	fail_unless(sdirs->deltmppath==NULL);
 
+	fail_unless(!sdirs_set_champ_shard(sdirs, 2));
+	ck_assert_str_eq(sdirs->champlock, DATA "/cc.lock.2");
+	ck_assert_str_eq(sdirs->champsock, DATA "/cc.sock.2");
+	ck_assert_str_eq(sdirs->champlog, DATA "/cc.log.2");
+	ck_assert_str_eq(sdirs->champstats, DATA "/cc.stats.2");
+	fail_unless(!sdirs_set_champ_shard(sdirs, 0));
+	ck_assert_str_eq(sdirs->champlock, DATA "/cc.lock");
+	ck_assert_str_eq(sdirs->champsock, DATA "/cc.sock");
+	ck_assert_str_eq(sdirs->champlog, DATA "/cc.log");
+	ck_assert_str_eq(sdirs->champstats, DATA "/cc.stats");
+
 	check_dynamic_paths(sdirs, PROTO_2, "manifest");
 }
 
@@ -76,6 +76,8 @@ Suite *suite_client_monitor_lline(void);
 Suite *suite_client_monitor_status_client_ncurses(void);
 Suite *suite_client_protocol1_backup_phase2(void);
 Suite *suite_client_protocol2_backup_phase2(void);
+Suite *suite_client_protocol2_blk_window(void);
+Suite *suite_client_protocol2_hash_pool(void);
 Suite *suite_client_protocol2_rabin_read(void);
 Suite *suite_client_restore(void);
 Suite *suite_client_xattr(void);
@@ -91,6 +93,7 @@ Suite *suite_protocol1_handy(void);
 Suite *suite_protocol1_rs_buf(void);
 Suite *suite_protocol2_blist(void);
 Suite *suite_protocol2_blk(void);
+Suite *suite_protocol2_rabin_gear(void);
 Suite *suite_protocol2_rabin_rabin(void);
 Suite *suite_protocol2_rabin_rconf(void);
 Suite *suite_protocol2_rabin_win(void);
@@ -123,14 +126,25 @@ Suite *suite_server_protocol1_fdirs(void);
 Suite *suite_server_protocol1_restore(void);
 Suite *suite_server_protocol2_backup_phase2(void);
 Suite *suite_server_protocol2_backup_phase4(void);
+Suite *suite_server_protocol2_bcompact(void);
 Suite *suite_server_protocol2_bsparse(void);
+Suite *suite_server_protocol2_champ_chooser_bloom(void);
+Suite *suite_server_protocol2_champ_chooser_candidate(void);
+Suite *suite_server_protocol2_champ_chooser_champ_cache(void);
 Suite *suite_server_protocol2_champ_chooser_champ_chooser(void);
+Suite *suite_server_protocol2_champ_chooser_champ_fanout(void);
+Suite *suite_server_protocol2_champ_chooser_champ_prefetch(void);
+Suite *suite_server_protocol2_champ_chooser_champ_queue(void);
 Suite *suite_server_protocol2_champ_chooser_champ_server(void);
+Suite *suite_server_protocol2_champ_chooser_champ_stats(void);
 Suite *suite_server_protocol2_champ_chooser_dindex(void);
+Suite *suite_server_protocol2_champ_chooser_gc(void);
 Suite *suite_server_protocol2_champ_chooser_hash(void);
 Suite *suite_server_protocol2_champ_chooser_scores(void);
 Suite *suite_server_protocol2_champ_chooser_sparse(void);
+Suite *suite_server_protocol2_champ_chooser_sparse_map(void);
 Suite *suite_server_protocol2_dpth(void);
+Suite *suite_server_protocol2_rblk(void);
 Suite *suite_slist(void);
 Suite *suite_times(void);
 
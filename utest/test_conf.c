@@ -73,6 +73,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_SEED_SRC:
 		case OPT_SEED_DST:
 		case OPT_RESTORE_LIST:
+		case OPT_CHUNK_SIZE:
 			fail_unless(get_string(c[o])==NULL);
 			break;
 		case OPT_RATELIMIT:
@@ -80,9 +81,15 @@ static void check_default(struct conf **c, enum conf_opt o)
 			break;
 		case OPT_CLIENT_IS_WINDOWS:
 		case OPT_RANDOMISE:
+		case OPT_HASH_THREADS:
+		case OPT_BLK_COMPRESSION:
+		case OPT_CHAMP_CHOOSER_THREAD:
+		case OPT_RBLK_MMAP:
+		case OPT_BINARY_MANIFEST:
 		case OPT_B_SCRIPT_POST_RUN_ON_FAIL:
 		case OPT_R_SCRIPT_POST_RUN_ON_FAIL:
 		case OPT_SEND_CLIENT_CNTR:
+		case OPT_SIG_BATCH:
 		case OPT_READALL:
 		case OPT_BREAKPOINT:
 		case OPT_SYSLOG:
@@ -147,6 +154,7 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_ACL:
 		case OPT_XATTR:
 		case OPT_N_FAILURE_BACKUP_FAILOVERS_LEFT:
+		case OPT_CHAMP_CHOOSER_SHARDS:
 			fail_unless(get_int(c[o])==1);
 			break;
 		case OPT_NETWORK_TIMEOUT:
@@ -198,6 +206,8 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_INCFS:
 		case OPT_EXCOM:
 		case OPT_INCGLOB:
+		case OPT_CHUNK_SIZE_EXT:
+		case OPT_CHUNK_SIZE_PATH:
 		case OPT_FIFOS:
 		case OPT_BLOCKDEVS:
 		case OPT_LABEL:
@@ -218,14 +228,33 @@ static void check_default(struct conf **c, enum conf_opt o)
 		case OPT_MIN_FILE_SIZE:
 		case OPT_MAX_FILE_SIZE:
 		case OPT_LIBRSYNC_MAX_SIZE:
+		case OPT_GC_RATE_MAX:
 			fail_unless(get_uint64_t(c[o])==0);
 			break;
 		case OPT_RBLK_MEMORY_MAX:
 			fail_unless(get_uint64_t(c[o])==256*1024*1024);
 			break;
+		case OPT_RBLK_LOOKAHEAD:
+			fail_unless(get_int(c[o])==8192);
+			break;
+		case OPT_RBLK_THREADS:
+			fail_unless(get_int(c[o])==1);
+			break;
 		case OPT_SPARSE_SIZE_MAX:
 			fail_unless(get_uint64_t(c[o])==256*1024*1024);
 			break;
+		case OPT_BLK_WINDOW_MAX:
+			fail_unless(get_uint64_t(c[o])==128*1024*1024);
+			break;
+		case OPT_CHAMP_CACHE_MAX:
+			fail_unless(get_uint64_t(c[o])==64*1024*1024);
+			break;
+		case OPT_CHUNKING:
+			fail_unless(get_int(c[o])==CHUNKING_RABIN);
+			break;
+		case OPT_STRONG_HASH:
+			fail_unless(get_int(c[o])==STRONG_HASH_MD5);
+			break;
 		case OPT_WORKING_DIR_RECOVERY_METHOD:
 			fail_unless(get_e_recovery_method(c[o])==
 				RECOVERY_METHOD_DELETE);
@@ -320,6 +320,54 @@ START_TEST(test_client_include_failures)
 }
 END_TEST
 
+START_TEST(test_client_chunk_size)
+{
+	const char *buf=MIN_CLIENT_CONF
+		"chunk_size=8192:16384:32000\n"
+		"chunk_size_ext=16384:24000:32000:vmdk\n"
+		"chunk_size_path=4096:5000:8192:/a:b\n"
+	;
+	struct strlist *s;
+	struct conf **confs=NULL;
+	setup(&confs, NULL);
+	build_file(CONFFILE, buf);
+	fail_unless(!conf_load_global_only(CONFFILE, confs));
+	ck_assert_str_eq(get_string(confs[OPT_CHUNK_SIZE]),
+		"8192:16384:32000");
+	s=get_strlist(confs[OPT_CHUNK_SIZE_EXT]);
+	assert_strlist(&s, "16384:24000:32000:vmdk", 0);
+	assert_strlist(&s, NULL, 0);
+	s=get_strlist(confs[OPT_CHUNK_SIZE_PATH]);
+	assert_strlist(&s, "4096:5000:8192:/a:b", 0);
+	assert_strlist(&s, NULL, 0);
+	tear_down(NULL, &confs);
+}
+END_TEST
+
+static const char *chunk_size_failures[] = {
+	MIN_CLIENT_CONF "chunk_size=4096:5000\n",
+	MIN_CLIENT_CONF "chunk_size=4096:5000:8192:vmdk\n",
+	MIN_CLIENT_CONF "chunk_size=8192:5000:4096\n",
+	MIN_CLIENT_CONF "chunk_size=16:32:64\n",
+	MIN_CLIENT_CONF "chunk_size=32768:65536:131072\n",
+	MIN_CLIENT_CONF "chunk_size_ext=4096:5000:8192\n",
+	MIN_CLIENT_CONF "chunk_size_ext=4096:5000:8192:\n",
+	MIN_CLIENT_CONF "chunk_size_path=4096:x:8192:/a\n",
+};
+
+START_TEST(test_client_chunk_size_failures)
+{
+	struct conf **confs=NULL;
+	FOREACH(chunk_size_failures)
+	{
+		setup(&confs, NULL);
+		build_file(CONFFILE, chunk_size_failures[i]);
+		fail_unless(conf_load_global_only(CONFFILE, confs)==-1);
+		tear_down(NULL, &confs);
+	}
+}
+END_TEST
+
 START_TEST(test_client_include_glob)
 {
 	char cwd[1024];
@@ -1095,6 +1143,8 @@ Suite *suite_conffile(void)
 	tcase_add_test(tc_core, test_client_includes_excludes);
 	tcase_add_test(tc_core, test_client_include_failures);
 	tcase_add_test(tc_core, test_client_include_glob);
+	tcase_add_test(tc_core, test_client_chunk_size);
+	tcase_add_test(tc_core, test_client_chunk_size_failures);
 	tcase_add_test(tc_core, test_client_conf_monitor_exe);
 	tcase_add_test(tc_core, test_client_conf_ports_opt_port_only);
 	tcase_add_test(tc_core, test_client_conf_ports_opt_port_and_restore);
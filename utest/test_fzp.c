@@ -185,6 +185,50 @@ START_TEST(test_fzp_gzseek)
 }
 END_TEST
 
+static void do_read_view_tests(
+	struct fzp *(*open_func)(const char *, const char *))
+{
+	char buf[8]="";
+	char *view=NULL;
+	struct fzp *fzp;
+
+	setup_for_read(open_func, content);
+	fail_unless((fzp=open_func(file, "rb"))!=NULL);
+	fail_unless(!fzp_read_view(fzp, &view, 3, __func__));
+	fail_unless(!strncmp(view, "012", 3));
+	fail_unless(fzp_tell(fzp)==3);
+
+	// Ordinary reads carry on from the same place.
+	fail_unless(fzp_read(fzp, buf, 4)==4);
+	ck_assert_str_eq(buf, "3456");
+	fail_unless(fzp_tell(fzp)==7);
+	fail_unless(!fzp_eof(fzp));
+
+	fail_unless(!fzp_seek(fzp, 9, SEEK_SET));
+	fail_unless(!fzp_read_view(fzp, &view, 8, __func__));
+	fail_unless(!strncmp(view, "9abcdefg", 8));
+	fail_unless(fzp_eof(fzp));
+	fail_unless(fzp_read_view(fzp, &view, 1, __func__)==1);
+
+	// Not enough left.
+	fail_unless(!fzp_seek(fzp, 12, SEEK_SET));
+	fail_unless(fzp_read_view(fzp, &view, 6, __func__)==-1);
+	fail_unless(!fzp_close(&fzp));
+	tear_down();
+}
+
+START_TEST(test_fzp_read_view)
+{
+	do_read_view_tests(fzp_open);
+}
+END_TEST
+
+START_TEST(test_fzp_gzread_view)
+{
+	do_read_view_tests(fzp_gzopen);
+}
+END_TEST
+
 #ifndef HAVE_WIN32
 START_TEST(test_fzp_truncate)
 {
@@ -209,6 +253,7 @@ START_TEST(test_fzp_null_pointer)
 	fail_unless(fzp_flush(NULL)==EOF);
 	fail_unless(fzp_seek(NULL, 1, SEEK_SET)==-1);
 	fail_unless(fzp_tell(NULL)==-1);
+	fail_unless(fzp_read_view(NULL, NULL, 1, __func__)==-1);
 	fail_unless(fzp_truncate(NULL, FZP_FILE, 1, 9 /* compression */)==-1);
 	fail_unless(fzp_printf(NULL, "%s", "blah")==-1);
 	fzp_setlinebuf(NULL);
@@ -235,6 +280,8 @@ Suite *suite_fzp(void)
 	tcase_add_test(tc_core, test_fzp_gzread);
 	tcase_add_test(tc_core, test_fzp_seek);
 	tcase_add_test(tc_core, test_fzp_gzseek);
+	tcase_add_test(tc_core, test_fzp_read_view);
+	tcase_add_test(tc_core, test_fzp_gzread_view);
 #ifndef HAVE_WIN32
 	tcase_add_test(tc_core, test_fzp_truncate);
 	tcase_add_test(tc_core, test_fzp_gztruncate);
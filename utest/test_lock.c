@@ -103,6 +103,52 @@ START_TEST(test_lock_left_behind)
 }
 END_TEST
 
+static int child_can_get_lock(void)
+{
+	int stat;
+	pid_t pid;
+	switch((pid=fork()))
+	{
+		case -1: fail_unless(0==1);
+			break;
+		case 0: // Child.
+		{
+			struct lock *lock;
+			lock=lock_alloc_and_init(lockfile);
+			lock_get_quick(lock);
+			exit(lock->status==GET_LOCK_GOT);
+		}
+		default: break;
+	}
+	fail_unless(waitpid(pid, &stat, 0)==pid);
+	return WEXITSTATUS(stat);
+}
+
+START_TEST(test_lock_held_by_this_process)
+{
+	struct lock *lock;
+	struct lock *other;
+	lock=setup();
+	fail_unless((other=lock_alloc_and_init(lockfile))!=NULL);
+	lock_get_quick(lock);
+	fail_unless(lock->status==GET_LOCK_GOT);
+
+	// lockf() on its own would hand the lock out again within the same
+	// process.
+	lock_get_quick(other);
+	fail_unless(other->status==GET_LOCK_NOT_GOT);
+
+	// Testing it does not drop it.
+	fail_unless(lock_test(lockfile)==-1);
+	fail_unless(!child_can_get_lock());
+
+	fail_unless(!lock_release(lock));
+	assert_can_get_lock(other);
+	lock_free(&other);
+	tear_down(&lock, NULL);
+}
+END_TEST
+
 static void init_and_add_to_list(struct lock **locklist, const char *path)
 {
 	struct lock *lock;
@@ -137,6 +183,7 @@ Suite *suite_lock(void)
 	tcase_add_test(tc_core, test_lock_simple_success);
 	tcase_add_test(tc_core, test_lock_simple_failure);
 	tcase_add_test(tc_core, test_lock_left_behind);
+	tcase_add_test(tc_core, test_lock_held_by_this_process);
 	tcase_add_test(tc_core, test_lock_list);
 	suite_add_tcase(s, tc_core);
 